@@ -3,6 +3,7 @@
 #include <dpp/discord.h>
 #include <map>
 #include <mutex>
+#include <unordered_set>
 
 namespace dpp {
 
@@ -18,6 +19,9 @@ namespace dpp {
 		/** Cached items */
 		std::unordered_map<uint64_t, managed*> cache_map;
 
+		/** Ids of items stored by store_fetched() which haven't been stored or removed by anything else since */
+		std::unordered_set<uint64_t> fetched_ids;
+
 	public:
 
 		/** Store an object in the cache.
@@ -25,6 +29,20 @@ namespace dpp {
 		 */
 		void store(managed* object);
 
+		/** Store an object fetched over REST, unless the cache holds a copy which was stored
+		 * by store() (e.g. from the gateway), which events keep more up to date. The check and
+		 * the store are done together, so a copy stored by store() is never overwritten.
+		 * @param object object to store
+		 * @returns True if it was stored; if not, the caller still owns the object
+		 */
+		bool store_fetched(managed* object);
+
+		/** Check whether the object cached for an id was stored by store_fetched(), and hasn't
+		 * been replaced by store() or removed since.
+		 * @param id Object id to check
+		 */
+		bool fetched(snowflake id);
+
 		/** Remove an object from the cache.
 		 * @param object object to remove
 		 */
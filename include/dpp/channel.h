@@ -1,6 +1,7 @@
 #pragma once
 
 #include <dpp/json_fwd.hpp>
+#include <dpp/jsonwriter.h>
 
 namespace dpp {
 
@@ -45,6 +46,13 @@ public:
 	channel& fill_from_json(nlohmann::json* j);
 	std::string build_json(bool with_id = false) const;
 
+	/** Write this object as JSON, without building a json document first.
+	 * @param w Writer to append the object to
+	 * @param with_id True if the ID is to be included in the JSON
+	 * @param with_position False to leave out the position, which discord won't accept when editing a channel
+	 */
+	void write_json(json_writer &w, bool with_id = false, bool with_position = true) const;
+
 	bool is_nsfw() const;
 	bool is_text_channel() const;
 	bool is_dm() const;
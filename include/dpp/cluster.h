@@ -2,13 +2,24 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include <variant>
+#include <future>
+#include <mutex>
+#include <unordered_map>
 #include <dpp/discord.h>
 #include <dpp/dispatcher.h>
 #include <dpp/json_fwd.hpp>
 #include <spdlog/fwd.h>
 #include <dpp/discordclient.h>
 #include <dpp/queues.h>
+#include <dpp/jsonscan.h>
+#include <dpp/ratelimit.h>
+#include <dpp/stats.h>
+#include <dpp/coordinator.h>
+#include <dpp/coro.h>
+#include <dpp/history.h>
+#include <dpp/function.h>
 
 using  json = nlohmann::json;
 
@@ -47,10 +58,30 @@ struct confirmation_callback_t {
 
 	confirmation_callback_t() = default;
 	confirmation_callback_t(const std::string &_type, const confirmable_t& _value, const http_request_completion_t& _http);
+	/** Constructor which moves the value in, for large maps */
+	confirmation_callback_t(const std::string &_type, confirmable_t&& _value, const http_request_completion_t& _http);
 };
 
 typedef std::function<void(const confirmation_callback_t&)> command_completion_event_t;
-typedef std::function<void(json&, const http_request_completion_t&)> json_encode_t;
+/** Called with the parsed reply to a REST request. Every REST call creates one, usually from a
+ * lambda capturing the caller's command_completion_event_t and an id or two, so it is a
+ * small_function: lambdas of that size are held inline instead of being allocated.
+ */
+typedef small_function<void(json&, const http_request_completion_t&)> json_encode_t;
+
+/** One call in a batch: starts a cluster REST method, passing it the callback it is given, e.g.
+ *     [&bot, id](command_completion_event_t cc) { bot.roles_get(id, cc); }
+ * The callback must be called exactly once, whether or not the request succeeds.
+ */
+typedef std::function<void(command_completion_event_t)> batch_call;
+
+/** Called once every call in a batch has completed, with their results in the order the calls were given */
+typedef std::function<void(const std::vector<confirmation_callback_t>&)> batch_completion_event_t;
+
+#ifdef DPP_CORO
+/** Result of co_awaiting one of cluster's co_ REST methods */
+typedef async_result<confirmation_callback_t> awaitable;
+#endif
 
 /** The cluster class represents a group of shards and a command queue for sending and 
  * receiving commands from discord via HTTP. You should usually instantiate a cluster object
@@ -59,6 +90,79 @@ typedef std::function<void(json&, const http_request_completion_t&)> json_encode
 class cluster {
 	/** queue system for commands sent to Discord, and any replies */
 	request_queue* rest;
+
+	/** IDENTIFY rate limits, one bucket per rate limit key (shard id modulo max_concurrency) */
+	std::vector<token_bucket*> identify_buckets;
+
+	/** Coordinator shared with the bot's other cluster processes, or nullptr if coordinate() hasn't been called */
+	cluster_coordinator* coordinator;
+
+	/** Protects shards while start() adds to it, as shards already connected and the
+	 * coordinator's publishing thread may read it meanwhile
+	 */
+	std::mutex shards_mutex;
+
+	/** A REST result stored in the cache by one of the cache-through getters. Whether the
+	 * gateway has since replaced the object is tracked by the cache, see cache::fetched().
+	 */
+	struct cache_through_entry {
+		/** Ids of the roles stored by roles_get_cached() */
+		std::vector<snowflake> ids;
+		/** When it was fetched */
+		time_t fetched = 0;
+	};
+
+	/** Protects the cache-through entries, fetches in flight and counts */
+	std::mutex cache_through_mutex;
+
+	/** Objects stored by the cache-through getters, keyed by e.g. "guild:<id>" */
+	std::unordered_map<std::string, cache_through_entry> cache_through_entries;
+
+	/** Callbacks waiting for each cache-through fetch in flight, by the same keys */
+	std::unordered_map<std::string, std::vector<command_completion_event_t>> cache_through_inflight;
+
+	/** Cache-through hit and miss counts */
+	cache_through_stats cache_through_counts;
+
+	/** When expired cache-through entries were last removed */
+	time_t cache_through_swept = 0;
+
+	/** Remove cache-through entries older than cache_ttl, at most once every cache_ttl seconds.
+	 * cache_through_mutex must be held.
+	 */
+	void cache_through_expire();
+
+	/** Decide whether a cached object can be returned by a cache-through getter, and count the hit or expiry.
+	 * @param key Key of the object
+	 * @param c Cache holding it
+	 * @param id Id of the object
+	 * @returns True if the gateway put it there, or a cache-through getter did less than cache_ttl seconds ago
+	 */
+	bool cache_fresh(const std::string &key, class cache* c, snowflake id);
+
+	/** Store an object fetched by a cache-through getter, unless the gateway has cached the object since.
+	 * @param key Key of the object
+	 * @param c Cache to store it in
+	 * @param object New object to store
+	 * @returns True if it was stored; if not, the caller still owns it
+	 */
+	bool cache_store(const std::string &key, class cache* c, managed* object);
+
+	/** Fetch an object for a cache-through getter which missed, sharing the request with
+	 * any other fetch of the same key in flight.
+	 * @param key Key of the object
+	 * @param callback Caller's callback
+	 * @param fetch Starts the REST request
+	 * @param store Stores a successful result in the cache
+	 */
+	void cache_fetch(const std::string &key, command_completion_event_t callback, std::function<void(command_completion_event_t)> fetch, std::function<void(const confirmation_callback_t&)> store);
+
+	/** Ask discord's /gateway/bot endpoint for the recommended shard count, the gateway
+	 * host and max_concurrency, and fill them in. Blocks until the request completes, or for
+	 * at most GATEWAY_BOT_TIMEOUT seconds. Leaves the defaults in place if the request fails,
+	 * its reply can't be parsed, or it times out.
+	 */
+	void fetch_gateway_bot();
 public:
 	/** Current bot token for all shards on this cluster and all commands sent via HTTP */
 	std::string token;
@@ -66,18 +170,110 @@ public:
 	/** Current bitmask of gateway intents */
 	uint32_t intents;
 
-	/** Total number of shards across all clusters */
+	/** Total number of shards across all clusters. If this is 0 when start() is called,
+	 * the number of shards recommended by discord is used instead.
+	 */
 	uint32_t numshards;
 
 	/** ID of this cluster, between 0 and MAXCLUSTERS-1 inclusive */
 	uint32_t cluster_id;
 
+	/** Number of shards which may IDENTIFY at the same time, from the session_start_limit
+	 * given by discord's /gateway/bot endpoint. Defaults to 1. Shards are started in
+	 * groups of this size, and each shard with the same shard id modulo max_concurrency
+	 * may only IDENTIFY once every five seconds.
+	 */
+	uint32_t max_concurrency;
+
+	/** Host name of the websocket gateway new shard connections are made to. Defaults to
+	 * gateway.discord.gg, and is replaced with the host given by /gateway/bot when the
+	 * shard count is discovered automatically.
+	 */
+	std::string gateway_host;
+
+	/** Port shard connections are made to on gateway_host, and on the resume host discord
+	 * gives each session. Defaults to 443. Set it before start(), e.g. to point shards at a
+	 * local stand-in gateway for testing.
+	 */
+	std::string gateway_port;
+
+	/** Scheme, host and optionally port REST requests are sent to. Defaults to https://discord.com.
+	 * Set it before making any requests, e.g. to point the cluster at a local stand-in server for testing.
+	 */
+	std::string rest_url;
+
+	/** Maximum number of guilds to ask for members of in one gateway request (op 8), when
+	 * the GUILD_MEMBERS intent is enabled. Defaults to 25. Set to 1 to request guilds one by one.
+	 */
+	uint32_t chunk_batch_size;
+
+	/** Seconds to wait for the next member chunk of a guild before giving up on it, and firing
+	 * guild_members_loaded with timed_out set and the members received so far. Defaults to 60.
+	 */
+	uint32_t chunk_timeout;
+
+	/** Maximum number of times a REST request is retried after a 429, a 5xx server error or a
+	 * lost connection, before the failure is passed to its callback. Defaults to 3. Only GET,
+	 * PUT and DELETE requests are retried after a server error or a connection lost mid-request,
+	 * as discord may already have carried out a POST or PATCH.
+	 */
+	uint32_t request_retries;
+
+	/** Maximum number of REST retries per minute across the whole cluster, so that an outage
+	 * doesn't multiply the load on discord. Defaults to 60.
+	 */
+	uint32_t retry_budget;
+
+	/** Number of threads which run REST completion callbacks. Defaults to 1, where every
+	 * callback runs in order on one thread. With more, a slow callback only holds up those
+	 * sharing its ordering key (by default, its rate limit bucket), and callbacks for the
+	 * same key still run in order. Takes effect on the first completion, so set it early.
+	 * Coroutines awaiting REST calls resume on these threads, so with more than one, a
+	 * coroutine may carry on on a different thread after each co_await (see dpp::async_result).
+	 */
+	uint32_t completion_threads;
+
+	/** Number of seconds objects fetched by the cache-through getters, such as guild_get_cached(),
+	 * are trusted for before being fetched again. Defaults to 300. Objects the gateway keeps in
+	 * the cache are updated by its events, and trusted for as long as they are there.
+	 */
+	uint32_t cache_ttl;
+
+	/** If true, the REST request thread keeps its connection to discord open between requests,
+	 * saving a TCP and TLS handshake on each one. The connection is closed after it has been
+	 * idle for a while, and reopened on the next request. Defaults to true.
+	 */
+	bool rest_keep_alive;
+
+	/** If true, REST requests are multiplexed on one HTTP/2 connection to discord, so that
+	 * requests for different rate limit buckets are in flight at once instead of each waiting
+	 * for the reply before it. Each bucket still has one request in flight at a time, so its
+	 * requests complete in order. Uploads with files attached, and all requests if discord
+	 * turns down HTTP/2, go over HTTP/1.1 as before. Has no effect if the library was built
+	 * without nghttp2. Defaults to false.
+	 */
+	bool rest_http2;
+
+	/** If true, REST requests ask discord to compress their replies, with whichever of brotli,
+	 * gzip and deflate the library was built with support for. A compressed reply is read in
+	 * full and then decoded in one pass before it is parsed, so it briefly needs memory for both
+	 * the compressed and decoded bodies, except for one which is streamed (see post_rest_array),
+	 * which is decoded a part at a time as it arrives. JSON compresses well, so this saves bandwidth and time
+	 * on large replies such as message history, at the cost of some CPU. A reply which can't be
+	 * decoded completes with error h_compression. Has no effect if the library was built without
+	 * zlib or brotli. Defaults to false.
+	 */
+	bool rest_compression;
+
 	/** Total number of clusters that are active */
 	uint32_t maxclusters;
 
 	/** Optional spdlog::logger log object */
 	spdlog::logger* log;
 
+	/** JSON parser used for gateway events and REST replies, defaults to dpp::jb_nlohmann */
+	json_backend json_parser;
+
 	/** Routes events from Discord back to user program code via std::functions */
 	dpp::dispatcher dispatch;
 
@@ -89,7 +285,7 @@ public:
 	/** Constructor for creating a cluster. All but the token are optional.
 	 * @param token The bot token to use for all HTTP commands and websocket connections
 	 * @param intents A bitmask of dpd::intents values for all shards on this cluster. This is required to be sent for all bots with over 100 servers.
-	 * @param shards The total number of shards on this bot. If there are multiple clusters, then (shards / clusters) actual shards will run on this cluster.
+	 * @param shards The total number of shards on this bot. If there are multiple clusters, then (shards / clusters) actual shards will run on this cluster. Pass 0 to use the number of shards discord recommends, which also fills in max_concurrency and gateway_host.
 	 * @param cluster_id The ID of this cluster, should be between 0 and MAXCLUSTERS-1
 	 * @param maxclusters The total number of clusters that are active, which may be on seperate processes or even separate machines.
 	 * @param log An optional spdlog::logger object for logging details about the cluster
@@ -100,10 +296,50 @@ public:
 	~cluster();
 
 	/** Start the cluster, connecting all its shards.
-	 * Returns once all shards are connected.
+	 * Shards are connected in groups of max_concurrency, and each group is started as soon
+	 * as the one before it has identified. Returns once all shards have identified.
+	 * @throw std::runtime_error if a shard can't make its first connection to the gateway. No
+	 * further groups are started, and the shards already connected keep running.
 	 */
 	void start();
 
+	/** Called by a shard when it wants to IDENTIFY. Takes a slot from the identify rate limit
+	 * for the shard's rate limit key.
+	 * @param shard_id The shard which wants to identify
+	 * @returns True if the shard may identify now, false if it should try again later
+	 */
+	bool acquire_identify(uint32_t shard_id);
+
+	/** Coordinate with the bot's other clusters running as separate processes on this host.
+	 * Once called, a global rate limit hit by any process holds back REST requests in all of
+	 * them, IDENTIFY rate limits are shared between them, and cluster-wide cache counts are
+	 * available from get_coordinator(). Call this before start().
+	 * @param name Name shared by every cluster of the bot on this host
+	 * @throw std::runtime_error if the shared memory can't be set up
+	 */
+	void coordinate(const std::string &name);
+
+	/** Returns the coordinator created by coordinate(), or nullptr if there isn't one */
+	cluster_coordinator* get_coordinator() const;
+
+	/** Returns heartbeat round trip times and connection statistics for each shard
+	 * on this cluster, keyed by shard id.
+	 */
+	std::map<uint32_t, shard_stats> get_shard_stats();
+
+	/** Returns counts of REST requests sent and retried */
+	rest_stats get_rest_stats();
+
+	/** Returns hit and miss counts for the cache-through getters */
+	cache_through_stats get_cache_through_stats();
+
+	/** Move a guild to the front of its shard's member request queue, if it is still waiting
+	 * there. Use this for guilds where the bot needs the member list soon. Does nothing
+	 * before start() has been called.
+	 * @param guild_id Guild to prioritise
+	 */
+	void prioritise_member_chunks(snowflake guild_id);
+
 	/* Functions for attaching to event handlers */
 
 	/** Called for VOICE_STATE_UPDATE */
@@ -124,6 +360,9 @@ public:
 	void on_typing_start (std::function<void(const typing_start_t& _event)> _typing_start);
 	void on_message_reaction_add (std::function<void(const message_reaction_add_t& _event)> _message_reaction_add);
 	void on_guild_members_chunk (std::function<void(const guild_members_chunk_t& _event)> _guild_members_chunk);
+
+	/** Called when every member chunk for a guild has been received, so its member list is complete */
+	void on_guild_members_loaded (std::function<void(const guild_members_loaded_t& _event)> _guild_members_loaded);
 	void on_message_reaction_remove (std::function<void(const message_reaction_remove_t& _event)> _message_reaction_remove);
 	void on_guild_create (std::function<void(const guild_create_t& _event)> _guild_create);
 	void on_channel_create (std::function<void(const channel_create_t& _event)> _channel_create);
@@ -147,27 +386,143 @@ public:
 	void on_message_update (std::function<void(const message_update_t& _event)> _message_update);
 	void on_user_update (std::function<void(const user_update_t& _event)> _user_update);
 	void on_message_create (std::function<void(const message_create_t& _event)> _message_create);
+
+	/** Called for MESSAGE_CREATE with a dpp::message_view instead of a fully decoded dpp::message.
+	 * Can be used instead of, or as well as, on_message_create. If only this handler is attached,
+	 * messages are never decoded in full unless the handler calls message_view::to_message().
+	 */
+	void on_message_create_view (std::function<void(const message_create_view_t& _event)> _message_create_view);
 	void on_guild_ban_add (std::function<void(const guild_ban_add_t& _event)> _guild_ban_add);
 	void on_integration_create (std::function<void(const integration_create_t& _event)> _integration_create);
 	void on_integration_update (std::function<void(const integration_update_t& _event)> _integration_update);
 	void on_integration_delete (std::function<void(const integration_delete_t& _event)> _integration_delete);
 
-	/** Post a REST request. Where possible use a helper method instead like message_create */
-	void post_rest(const std::string &endpoint, const std::string &parameters, http_method method, const std::string &postdata, json_encode_t callback);
+	/** Post a REST request. Where possible use a helper method instead like message_create
+	 * @param endpoint API endpoint, e.g. /api/channels
+	 * @param parameters Parameters after the endpoint
+	 * @param method HTTP method
+	 * @param postdata Body for POST, PUT and PATCH requests
+	 * @param callback Called with the parsed reply
+	 * @param priority Priority of the request. Use rp_critical for replies a user is waiting on,
+	 * and rp_low for bulk work such as reading message history.
+	 * @param timeout If not 0, the number of seconds after which the request is given up on if it
+	 * still hasn't been sent. The callback then gets status 408 and error h_canceled.
+	 * @param ordering_key With completion_threads above 1, callbacks with the same ordering key
+	 * run in the order their requests completed, and others may run alongside them. If empty,
+	 * the request's rate limit bucket is used, so callbacks for the same route and channel or
+	 * guild run in order.
+	 * @param inline_completion If true, the callback runs on the thread which made the request
+	 * as soon as the reply arrives, skipping the completion threads. Only for callbacks which
+	 * do next to nothing, as no other request can be sent while it runs.
+	 */
+	void post_rest(std::string endpoint, std::string parameters, http_method method, std::string postdata, json_encode_t callback, rate_priority priority = rp_normal, double timeout = 0, std::string ordering_key = "", bool inline_completion = false);
+
+	/** Post a REST request whose reply is a JSON array, such as a page of messages. Each element is
+	 * parsed on its own and passed to element as it is parsed, so the reply is never held as one
+	 * JSON document. A GET reply is parsed as it arrives, on the thread receiving it, so element
+	 * should do little more than store what it is given; done is called as usual, once the whole
+	 * reply has been handled. A GET posted this way isn't shared with an identical GET in flight.
+	 * @param endpoint Endpoint to post to, e.g. /api/channels
+	 * @param parameters Parameters after the endpoint
+	 * @param method Method, usually m_get
+	 * @param postdata Data to send
+	 * @param element Called with each element of a successful reply, in order
+	 * @param done Called once every element has been handled, or with the error. Its body is empty on success.
+	 * @param priority Priority of the request
+	 * @param timeout If not 0, the number of seconds after which the request is given up on, as for post_rest()
+	 */
+	void post_rest_array(std::string endpoint, std::string parameters, http_method method, std::string postdata, std::function<void(json&)> element, http_completion_event done, rate_priority priority = rp_normal, double timeout = 0);
+
+	/** Post a REST request with files, as multipart/form-data. The json is sent as the payload_json
+	 * part and each file as files[n], streamed from disk or memory as the request is sent.
+	 * @param endpoint Endpoint to post to, e.g. /api/channels
+	 * @param parameters Parameters after the endpoint
+	 * @param method Method, m_post or m_patch
+	 * @param postdata JSON to send
+	 * @param files Files to upload
+	 * @param callback Function to call when the HTTP call completes
+	 * @throw std::runtime_error if a file can't be opened
+	 */
+	void post_rest_multipart(std::string endpoint, std::string parameters, http_method method, const std::string &postdata, const std::vector<message_file> &files, json_encode_t callback);
+
+	/** Start a set of REST calls together and be called back once when they have all completed.
+	 * All the calls are queued at once, so calls in different rate limit buckets (e.g. for
+	 * different guilds) go out side by side, while calls sharing a bucket wait their turn.
+	 * @param calls Calls to make. Each must call the callback it is given exactly once, on
+	 * failure as well as on success, or the batch never completes.
+	 * @param callback Called once with every result, in the order of calls. It runs on the
+	 * thread which completed the last call, or straight away if calls is empty.
+	 */
+	void batch(std::vector<batch_call> calls, batch_completion_event_t callback);
+
+	/** Start a set of REST calls together, returning a future for all their results.
+	 * @param calls Calls to make
+	 * @returns A future which becomes ready with every result, in the order of calls.
+	 * Don't wait on it from a REST callback, which would block the completion thread.
+	 */
+	std::future<std::vector<confirmation_callback_t>> batch(std::vector<batch_call> calls);
+
+	/** Get many users by id. Users already in the cache are taken from it, and only the
+	 * rest are fetched, as one batch.
+	 * @param user_ids Users to get
+	 * @param callback Called once with type "user_map", holding every user found. Its http_info
+	 * is from the first failed request if any failed, including one which got no reply
+	 * (error set, status 0), otherwise from the last request made. If every user was
+	 * cached, it is called before this returns, with an http_info of status 200.
+	 */
+	void users_get(const std::vector<snowflake> &user_ids, command_completion_event_t callback);
+
+	/** Get a guild, from the cache where possible. If the cache holds a fresh copy (see
+	 * cache_ttl), the callback is called before this returns, with an http_info of status 200
+	 * and no body. Otherwise the guild is fetched as by guild_get() and stored in the cache,
+	 * and lookups of the same guild made while the request is in flight share it.
+	 * @param guild_id Guild to get
+	 * @param callback Called with type "guild"
+	 */
+	void guild_get_cached(snowflake guild_id, command_completion_event_t callback);
+
+	/** Get a channel, from the cache where possible, as guild_get_cached() does for guilds
+	 * @param channel_id Channel to get
+	 * @param callback Called with type "channel"
+	 */
+	void channel_get_cached(snowflake channel_id, command_completion_event_t callback);
+
+	/** Get a user, from the cache where possible, as guild_get_cached() does for guilds
+	 * @param user_id User to get
+	 * @param callback Called with type "user"
+	 */
+	void user_get_cached(snowflake user_id, command_completion_event_t callback);
+
+	/** Get a guild's roles, from the cache where possible, as guild_get_cached() does for guilds.
+	 * Every role of the guild has to be cached for the cache to be used.
+	 * @param guild_id Guild to get the roles of
+	 * @param callback Called with type "role_map"
+	 */
+	void roles_get_cached(snowflake guild_id, command_completion_event_t callback);
 
 	/** Get a message */
 	void message_get(snowflake message_id, snowflake channel_id, command_completion_event_t callback);
 
-	/** Get multiple messages */
-	void messages_get(snowflake channel_id, snowflake around, snowflake before, snowflake after, snowflake limit, command_completion_event_t callback);
+	/** Get multiple messages
+	 * @param priority Priority of the request, as for post_rest(). Bulk readers such as
+	 * message_history pass rp_low so they give way to other requests for the channel.
+	 * @param timeout If not 0, the number of seconds after which the request is given up on, as for post_rest()
+	 */
+	void messages_get(snowflake channel_id, snowflake around, snowflake before, snowflake after, snowflake limit, command_completion_event_t callback, rate_priority priority = rp_normal, double timeout = 0);
 
-	/** Send a message to a channel. The callback function is called when the message has been sent */
+	/** Send a message to a channel. The callback function is called when the message has been sent.
+	 * Any message::files are uploaded with it.
+	 * @throw std::runtime_error if a file to upload can't be opened
+	 */
 	void message_create(const struct message &m, command_completion_event_t callback);
 
 	/** Crosspost a message. The callback function is called when the message has been sent */
 	void message_crosspost(snowflake message_id, snowflake channel_id, command_completion_event_t callback);
 
-	/** Edit a message on a channel. The callback function is called when the message has been edited */
+	/** Edit a message on a channel. The callback function is called when the message has been edited.
+	 * Any message::files are uploaded with it.
+	 * @throw std::runtime_error if a file to upload can't be opened
+	 */
 	void message_edit(const struct message &m, command_completion_event_t callback);
 
 	/** Add a reaction to a message. The reaction string must be either an `emojiname:id` or a unicode character. */
@@ -245,6 +600,16 @@ public:
 	/** Pin a message */
 	void message_pin(snowflake channel_id, snowflake message_id, command_completion_event_t callback);
 
+	/** Read a channel's history, newest first, a page at a time. The returned cursor fetches
+	 * pages ahead of the caller, so each page's round trip overlaps with processing the last.
+	 * @param channel_id Channel to read
+	 * @param before Start with the messages before this one, or 0 to start with the newest
+	 * @param page_size Messages per page, up to HISTORY_PAGE_MAX
+	 * @param window Maximum number of pages fetched ahead and held in memory
+	 * @returns A cursor; call next() on it for each page
+	 */
+	std::shared_ptr<message_history> messages_history(snowflake channel_id, snowflake before = 0, uint32_t page_size = HISTORY_PAGE_MAX, uint32_t window = 2);
+
 	/** Unpin a message */
 	void message_unpin(snowflake channel_id, snowflake message_id, command_completion_event_t callback);
 
@@ -309,6 +674,189 @@ public:
 	/** Get current user guilds */
 	void current_user_get_guilds(command_completion_event_t callback);
 
+#ifdef DPP_CORO
+	/* Awaitable versions of the REST methods above, for programs built with C++20 coroutines.
+	 * Each takes the same parameters without the callback, and co_await gives the
+	 * confirmation_callback_t the callback would have been passed, e.g.
+	 *     confirmation_callback_t sent = co_await bot.co_message_create(m);
+	 * The coroutine resumes on the request_queue's completion thread, as a callback would run.
+	 * Parameters are copied, so they needn't outlive the call.
+	 */
+	awaitable co_message_get(snowflake message_id, snowflake channel_id) {
+		return awaitable([this, message_id, channel_id](command_completion_event_t cc) { this->message_get(message_id, channel_id, cc); });
+	}
+	awaitable co_messages_get(snowflake channel_id, snowflake around, snowflake before, snowflake after, snowflake limit, rate_priority priority = rp_normal, double timeout = 0) {
+		return awaitable([this, channel_id, around, before, after, limit, priority, timeout](command_completion_event_t cc) { this->messages_get(channel_id, around, before, after, limit, cc, priority, timeout); });
+	}
+	awaitable co_message_create(const struct message &m) {
+		return awaitable([this, m](command_completion_event_t cc) { this->message_create(m, cc); });
+	}
+	awaitable co_message_crosspost(snowflake message_id, snowflake channel_id) {
+		return awaitable([this, message_id, channel_id](command_completion_event_t cc) { this->message_crosspost(message_id, channel_id, cc); });
+	}
+	awaitable co_message_edit(const struct message &m) {
+		return awaitable([this, m](command_completion_event_t cc) { this->message_edit(m, cc); });
+	}
+	awaitable co_message_add_reaction(const struct message &m, const std::string &reaction) {
+		return awaitable([this, m, reaction](command_completion_event_t cc) { this->message_add_reaction(m, reaction, cc); });
+	}
+	awaitable co_message_delete_own_reaction(const struct message &m, const std::string &reaction) {
+		return awaitable([this, m, reaction](command_completion_event_t cc) { this->message_delete_own_reaction(m, reaction, cc); });
+	}
+	awaitable co_message_delete_reaction(const struct message &m, snowflake user_id, const std::string &reaction) {
+		return awaitable([this, m, user_id, reaction](command_completion_event_t cc) { this->message_delete_reaction(m, user_id, reaction, cc); });
+	}
+	awaitable co_message_get_reactions(const struct message &m, const std::string &reaction, snowflake before, snowflake after, snowflake limit) {
+		return awaitable([this, m, reaction, before, after, limit](command_completion_event_t cc) { this->message_get_reactions(m, reaction, before, after, limit, cc); });
+	}
+	awaitable co_message_delete_all_reactions(const struct message &m) {
+		return awaitable([this, m](command_completion_event_t cc) { this->message_delete_all_reactions(m, cc); });
+	}
+	awaitable co_message_delete_reaction_emoji(const struct message &m, const std::string &reaction) {
+		return awaitable([this, m, reaction](command_completion_event_t cc) { this->message_delete_reaction_emoji(m, reaction, cc); });
+	}
+	awaitable co_message_delete(snowflake message_id, snowflake channel_id) {
+		return awaitable([this, message_id, channel_id](command_completion_event_t cc) { this->message_delete(message_id, channel_id, cc); });
+	}
+	awaitable co_message_delete_bulk(const std::vector<snowflake> &message_ids, snowflake channel_id) {
+		return awaitable([this, message_ids, channel_id](command_completion_event_t cc) { this->message_delete_bulk(message_ids, channel_id, cc); });
+	}
+	awaitable co_channel_get(snowflake c) {
+		return awaitable([this, c](command_completion_event_t cc) { this->channel_get(c, cc); });
+	}
+	awaitable co_channels_get(snowflake guild_id) {
+		return awaitable([this, guild_id](command_completion_event_t cc) { this->channels_get(guild_id, cc); });
+	}
+	awaitable co_channel_create(const class channel &c) {
+		return awaitable([this, c](command_completion_event_t cc) { this->channel_create(c, cc); });
+	}
+	awaitable co_channel_edit(const class channel &c) {
+		return awaitable([this, c](command_completion_event_t cc) { this->channel_edit(c, cc); });
+	}
+	awaitable co_channel_edit_position(const class channel &c) {
+		return awaitable([this, c](command_completion_event_t cc) { this->channel_edit_position(c, cc); });
+	}
+	awaitable co_channel_edit_permissions(const class channel &c, snowflake overwrite_id, uint32_t allow, uint32_t deny, bool member) {
+		return awaitable([this, c, overwrite_id, allow, deny, member](command_completion_event_t cc) { this->channel_edit_permissions(c, overwrite_id, allow, deny, member, cc); });
+	}
+	awaitable co_channel_delete(snowflake channel_id) {
+		return awaitable([this, channel_id](command_completion_event_t cc) { this->channel_delete(channel_id, cc); });
+	}
+	awaitable co_invite_get(const std::string &invite) {
+		return awaitable([this, invite](command_completion_event_t cc) { this->invite_get(invite, cc); });
+	}
+	awaitable co_invite_delete(const std::string &invite) {
+		return awaitable([this, invite](command_completion_event_t cc) { this->invite_delete(invite, cc); });
+	}
+	awaitable co_channel_invites_get(const class channel &c) {
+		return awaitable([this, c](command_completion_event_t cc) { this->channel_invites_get(c, cc); });
+	}
+	awaitable co_channel_invite_create(const class channel &c, const class invite &i) {
+		return awaitable([this, c, i](command_completion_event_t cc) { this->channel_invite_create(c, i, cc); });
+	}
+	awaitable co_pins_get(snowflake channel_id) {
+		return awaitable([this, channel_id](command_completion_event_t cc) { this->pins_get(channel_id, cc); });
+	}
+	awaitable co_gdm_add(snowflake channel_id, snowflake user_id, const std::string &access_token, const std::string &nick) {
+		return awaitable([this, channel_id, user_id, access_token, nick](command_completion_event_t cc) { this->gdm_add(channel_id, user_id, access_token, nick, cc); });
+	}
+	awaitable co_gdm_remove(snowflake channel_id, snowflake user_id) {
+		return awaitable([this, channel_id, user_id](command_completion_event_t cc) { this->gdm_remove(channel_id, user_id, cc); });
+	}
+	awaitable co_channel_delete_permission(const class channel &c, snowflake overwrite_id) {
+		return awaitable([this, c, overwrite_id](command_completion_event_t cc) { this->channel_delete_permission(c, overwrite_id, cc); });
+	}
+	awaitable co_channel_follow_news(const class channel &c, snowflake target_channel_id) {
+		return awaitable([this, c, target_channel_id](command_completion_event_t cc) { this->channel_follow_news(c, target_channel_id, cc); });
+	}
+	awaitable co_channel_typing(const class channel &c) {
+		return awaitable([this, c](command_completion_event_t cc) { this->channel_typing(c, cc); });
+	}
+	awaitable co_message_pin(snowflake channel_id, snowflake message_id) {
+		return awaitable([this, channel_id, message_id](command_completion_event_t cc) { this->message_pin(channel_id, message_id, cc); });
+	}
+	awaitable co_message_unpin(snowflake channel_id, snowflake message_id) {
+		return awaitable([this, channel_id, message_id](command_completion_event_t cc) { this->message_unpin(channel_id, message_id, cc); });
+	}
+	awaitable co_guild_get(snowflake g) {
+		return awaitable([this, g](command_completion_event_t cc) { this->guild_get(g, cc); });
+	}
+	awaitable co_template_get(const std::string &code) {
+		return awaitable([this, code](command_completion_event_t cc) { this->template_get(code, cc); });
+	}
+	awaitable co_guild_create_from_template(const std::string &code, const std::string &name) {
+		return awaitable([this, code, name](command_completion_event_t cc) { this->guild_create_from_template(code, name, cc); });
+	}
+	awaitable co_guild_templates_get(snowflake guild_id) {
+		return awaitable([this, guild_id](command_completion_event_t cc) { this->guild_templates_get(guild_id, cc); });
+	}
+	awaitable co_guild_template_create(snowflake guild_id, const std::string &name, const std::string &description) {
+		return awaitable([this, guild_id, name, description](command_completion_event_t cc) { this->guild_template_create(guild_id, name, description, cc); });
+	}
+	awaitable co_guild_template_sync(snowflake guild_id, const std::string &code) {
+		return awaitable([this, guild_id, code](command_completion_event_t cc) { this->guild_template_sync(guild_id, code, cc); });
+	}
+	awaitable co_guild_template_modify(snowflake guild_id, const std::string &code, const std::string &name, const std::string &description) {
+		return awaitable([this, guild_id, code, name, description](command_completion_event_t cc) { this->guild_template_modify(guild_id, code, name, description, cc); });
+	}
+	awaitable co_guild_template_delete(snowflake guild_id, const std::string &code) {
+		return awaitable([this, guild_id, code](command_completion_event_t cc) { this->guild_template_delete(guild_id, code, cc); });
+	}
+	awaitable co_guild_create(const class guild &g) {
+		return awaitable([this, g](command_completion_event_t cc) { this->guild_create(g, cc); });
+	}
+	awaitable co_guild_edit(const class guild &g) {
+		return awaitable([this, g](command_completion_event_t cc) { this->guild_edit(g, cc); });
+	}
+	awaitable co_guild_delete(snowflake guild_id) {
+		return awaitable([this, guild_id](command_completion_event_t cc) { this->guild_delete(guild_id, cc); });
+	}
+	awaitable co_guild_emojis_get(snowflake guild_id) {
+		return awaitable([this, guild_id](command_completion_event_t cc) { this->guild_emojis_get(guild_id, cc); });
+	}
+	awaitable co_guild_emoji_get(snowflake guild_id, snowflake emoji_id) {
+		return awaitable([this, guild_id, emoji_id](command_completion_event_t cc) { this->guild_emoji_get(guild_id, emoji_id, cc); });
+	}
+	awaitable co_roles_get(snowflake guild_id) {
+		return awaitable([this, guild_id](command_completion_event_t cc) { this->roles_get(guild_id, cc); });
+	}
+	awaitable co_role_create(const class role &r) {
+		return awaitable([this, r](command_completion_event_t cc) { this->role_create(r, cc); });
+	}
+	awaitable co_role_edit(const class role &r) {
+		return awaitable([this, r](command_completion_event_t cc) { this->role_edit(r, cc); });
+	}
+	awaitable co_role_edit_position(const class role &r) {
+		return awaitable([this, r](command_completion_event_t cc) { this->role_edit_position(r, cc); });
+	}
+	awaitable co_role_delete(snowflake guild_id, snowflake role_id) {
+		return awaitable([this, guild_id, role_id](command_completion_event_t cc) { this->role_delete(guild_id, role_id, cc); });
+	}
+	awaitable co_user_get(snowflake user_id) {
+		return awaitable([this, user_id](command_completion_event_t cc) { this->user_get(user_id, cc); });
+	}
+	awaitable co_guild_get_cached(snowflake guild_id) {
+		return awaitable([this, guild_id](command_completion_event_t cc) { this->guild_get_cached(guild_id, cc); });
+	}
+	awaitable co_channel_get_cached(snowflake channel_id) {
+		return awaitable([this, channel_id](command_completion_event_t cc) { this->channel_get_cached(channel_id, cc); });
+	}
+	awaitable co_user_get_cached(snowflake user_id) {
+		return awaitable([this, user_id](command_completion_event_t cc) { this->user_get_cached(user_id, cc); });
+	}
+	awaitable co_users_get(const std::vector<snowflake> &user_ids) {
+		return awaitable([this, user_ids](command_completion_event_t cc) { this->users_get(user_ids, cc); });
+	}
+	awaitable co_roles_get_cached(snowflake guild_id) {
+		return awaitable([this, guild_id](command_completion_event_t cc) { this->roles_get_cached(guild_id, cc); });
+	}
+	awaitable co_current_user_get() {
+		return awaitable([this](command_completion_event_t cc) { this->current_user_get(cc); });
+	}
+	awaitable co_current_user_get_guilds() {
+		return awaitable([this](command_completion_event_t cc) { this->current_user_get_guilds(cc); });
+	}
+#endif
 
 };
 
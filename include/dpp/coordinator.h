@@ -0,0 +1,139 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+namespace dpp {
+
+/** Maximum number of clusters which can share one coordinator */
+#define COORDINATOR_MAX_CLUSTERS 128
+
+/** Maximum number of IDENTIFY rate limit keys (max_concurrency) a coordinator tracks */
+#define COORDINATOR_MAX_IDENTIFY_KEYS 256
+
+/** Seconds after which a cluster which hasn't published its counts is treated as gone */
+#define COORDINATOR_STALE_SECONDS 10
+
+/** Cache sizes published by one cluster */
+struct cache_counts {
+	/** ID of the cluster the counts are from */
+	uint32_t cluster_id = 0;
+	/** Process ID of the cluster */
+	int64_t pid = 0;
+	/** Number of shards running on the cluster */
+	uint64_t shards = 0;
+	/** Cached guilds */
+	uint64_t guilds = 0;
+	/** Cached users */
+	uint64_t users = 0;
+	/** Cached channels */
+	uint64_t channels = 0;
+	/** Cached roles */
+	uint64_t roles = 0;
+	/** Cached emojis */
+	uint64_t emojis = 0;
+};
+
+/** Coordinates several clusters of the same bot running as separate processes on one host.
+ *
+ * Each cluster process creates a coordinator with the same name, and they share a small
+ * block of POSIX shared memory guarded by a process-shared mutex. Through it they share
+ * the REST global rate limit: requests from every process take from one token bucket, so
+ * that together they stay under it, and one process hitting it anyway holds back the others; take
+ * turns to IDENTIFY for each rate limit key; and publish their cache sizes so that any
+ * process can report totals for the whole bot.
+ *
+ * A background thread publishes this cluster's cache counts once a second. Counts from a
+ * cluster which hasn't published for COORDINATOR_STALE_SECONDS are left out of the totals,
+ * so a crashed process drops out on its own. The shared memory is left in place when the
+ * last process exits, so clusters can be restarted one at a time; call remove() to delete it.
+ *
+ * Not available on Windows, where the constructor throws std::runtime_error.
+ */
+class cluster_coordinator {
+	/** Mapped shared memory */
+	struct shared_state* state;
+
+	/** Name of the shared memory object */
+	std::string shm_name;
+
+	/** ID of the cluster this process runs */
+	uint32_t cluster_id;
+
+	/** Returns this cluster's current cache counts, called by the publishing thread */
+	std::function<cache_counts()> counter;
+
+	/** Publishing thread */
+	std::thread* publisher;
+
+	/** Set to stop the publishing thread */
+	std::atomic<bool> terminating;
+
+	/** Lock the shared mutex, recovering it if the process holding it died */
+	void lock();
+
+	/** Unlock the shared mutex */
+	void unlock();
+
+	/** Publishing thread loop */
+	void publish_loop();
+public:
+	/** Constructor. Opens the shared memory for the name, creating and initialising it if this
+	 * is the first process to use it.
+	 * @param name A name shared by every cluster of the bot on this host, e.g. the bot's name
+	 * @param _cluster_id ID of this cluster, less than COORDINATOR_MAX_CLUSTERS
+	 * @throw std::runtime_error if the shared memory can't be opened or mapped
+	 */
+	cluster_coordinator(const std::string &name, uint32_t _cluster_id);
+
+	/** Destructor. Marks this cluster as gone and unmaps the shared memory */
+	~cluster_coordinator();
+
+	/** Start publishing this cluster's cache counts once a second.
+	 * @param _counter Function returning the counts to publish
+	 */
+	void publish(std::function<cache_counts()> _counter);
+
+	/** Record that discord has globally rate limited us, holding back REST requests in every process.
+	 * @param seconds Number of seconds the limit lasts for
+	 */
+	void set_global_ratelimit(uint64_t seconds);
+
+	/** Take a token from the REST global rate limit bucket shared by every process. The bucket
+	 * holds one second's worth of tokens.
+	 * @param per_second Requests allowed per second
+	 * @param leave Only take a token if at least this many would be left afterwards, to keep
+	 * some back for higher priorities as dpp::rate_limiter does
+	 * @returns 0 if a token was taken, otherwise the number of seconds until one could be
+	 */
+	double acquire_global(double per_second, double leave);
+
+	/** Returns the number of milliseconds until the global rate limit ends, or 0 if there is none */
+	uint64_t global_ratelimit_wait();
+
+	/** Take the IDENTIFY slot for a rate limit key if it is free.
+	 * @param key Rate limit key, the shard id modulo max_concurrency
+	 * @param interval Seconds the slot is then held for
+	 * @returns True if the caller may IDENTIFY now, false if another shard on any process has
+	 * identified with the same key too recently
+	 */
+	bool acquire_identify(uint32_t key, double interval);
+
+	/** Returns the counts last published by each live cluster, including this one */
+	std::vector<cache_counts> get_counts();
+
+	/** Returns the sum of the counts of every live cluster. The cluster_id and pid fields are 0. */
+	cache_counts get_totals();
+
+	/** Delete the shared memory for a name. Processes which still have it open keep using
+	 * their copy; new coordinators with the name will create a fresh one.
+	 * @param name Name passed to the constructor
+	 */
+	static void remove(const std::string &name);
+};
+
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+/* Coroutine support needs C++20. The library itself builds as C++17, so none of this is
+ * compiled into it; it is all header-only and becomes available to programs which are
+ * compiled with coroutines enabled. DPP_CORO is defined when it is.
+ */
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <utility>
+
+#define DPP_CORO
+
+namespace dpp {
+
+/** An awaitable wrapping a call which reports its result to a callback, such as any of
+ * dpp::cluster's REST methods. The call is started when the awaitable is co_awaited, and
+ * the coroutine resumes directly from the callback, on whichever thread runs it, with no
+ * further hop through an executor.
+ *
+ * For REST methods that is a request_queue completion thread. With the default of one
+ * (cluster::completion_threads), every await in a coroutine resumes on that same thread. With
+ * more, each call completes on the worker for its rate limit bucket, so one coroutine may
+ * resume on a different thread after each co_await. It never runs on two threads at once, but
+ * it must not rely on thread-local state or thread affinity across an await.
+ * @tparam R Type of the result passed to the callback
+ */
+template <typename R> class async_result {
+	/** Starts the call, passing it the callback to report to */
+	std::function<void(std::function<void(const R&)>)> start;
+
+	/** Result given to the callback */
+	R result;
+public:
+	/** Constructor
+	 * @param _start Function which starts the call, passing it the callback it is given
+	 */
+	async_result(std::function<void(std::function<void(const R&)>)> _start) : start(std::move(_start)) {
+	}
+
+	/** The call always completes asynchronously */
+	bool await_ready() const noexcept {
+		return false;
+	}
+
+	/** Start the call, resuming the coroutine from its callback */
+	void await_suspend(std::coroutine_handle<> handle) {
+		/* The callback may resume the coroutine, and destroy this object, before start()
+		 * returns, so it must not be called through a member.
+		 */
+		auto s = std::move(start);
+		s([this, handle](const R &r) {
+			result = r;
+			handle.resume();
+		});
+	}
+
+	/** Returns the result given to the callback */
+	R await_resume() {
+		return std::move(result);
+	}
+};
+
+/** Return type for a coroutine which is started and left to run on its own, e.g. an event
+ * handler which awaits REST calls:
+ *
+ *     dpp::job reply(dpp::cluster& bot, dpp::message m) {
+ *         auto sent = co_await bot.co_message_create(m);
+ *         ...
+ *     }
+ *
+ * The coroutine runs straight away until its first co_await, and its frame is freed when it
+ * finishes. Arguments are copied into the frame, so pass them by value.
+ */
+struct job {
+	struct promise_type {
+		job get_return_object() noexcept {
+			return {};
+		}
+		std::suspend_never initial_suspend() noexcept {
+			return {};
+		}
+		std::suspend_never final_suspend() noexcept {
+			return {};
+		}
+		void return_void() noexcept {
+		}
+		void unhandled_exception() {
+			std::terminate();
+		}
+	};
+};
+
+};
+
+#endif
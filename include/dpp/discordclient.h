@@ -8,7 +8,14 @@
 #include <dpp/dispatcher.h>
 #include <dpp/cluster.h>
 #include <queue>
+#include <deque>
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <mutex>
+#include <dpp/stats.h>
+#include <dpp/ratelimit.h>
 
 using json = nlohmann::json;
 
@@ -20,14 +27,121 @@ namespace dpp {
 /** Implements a discord client. Each DiscordClient connects to one shard and derives from a websocket client. */
 class DiscordClient : public WSClient
 {
-	/** Queue of guild ids we are requesting member chunks for */
-	std::queue<uint64_t> chunk_queue;
+	/** Guild ids waiting for their member chunks to be requested, in the order they will be requested */
+	std::deque<uint64_t> chunk_queue;
+
+	/** Progress of a guild whose members have been requested */
+	struct chunk_progress {
+		/** Nonce sent with the request */
+		std::string nonce;
+		/** Chunks received so far */
+		uint32_t chunks_received;
+		/** Members received so far */
+		uint64_t members;
+		/** When the request was sent, or the last chunk arrived */
+		std::chrono::steady_clock::time_point last_activity;
+	};
+
+	/** Guilds whose member requests have been sent, which haven't received all their chunks yet */
+	std::map<uint64_t, chunk_progress> chunks_loading;
+
+	/** Counter used to give each member request a unique nonce */
+	uint64_t chunk_nonce;
+
+	/** Members received in chunks during the current second */
+	uint64_t chunk_members_this_second;
+
+	/** Mutex for chunk_queue and chunks_loading, as guilds may be prioritised from other threads */
+	std::mutex chunk_mutex;
+
+	/** Send one member request (op 8) for the next batch of guilds in chunk_queue.
+	 * Must be called with chunk_mutex held.
+	 */
+	void SendChunkRequest();
+
+	/** Give up on member requests which have had no reply for too long, so that they
+	 * don't hold up guilds_pending forever. Must be called without chunk_mutex held.
+	 */
+	void ExpireChunkRequests();
 
 	/** Thread this shard is executing on */
 	std::thread* runner;
 
+	/** True if an IDENTIFY is waiting for a slot from the cluster's identify rate limit */
+	bool identify_pending;
+
+	/** When to resume or identify again after discord said the session is invalid (op 9),
+	 * or the epoch if not waiting to. Tick() starts the session once it has passed.
+	 */
+	std::chrono::steady_clock::time_point reidentify_at;
+
+	/** Number of reconnection attempts since the connection was last known to be healthy.
+	 * Reset when a heartbeat is acknowledged.
+	 */
+	uint32_t reconnect_attempts;
+
+	/** True if discord asked us to reconnect (op 7), so the next reconnect doesn't wait */
+	bool reconnect_now;
+
+	/** Websocket close code received from discord, or 0 */
+	uint32_t close_code;
+
+	/** True if the last heartbeat we sent has been acknowledged (op 11) */
+	bool heartbeat_acked;
+
+	/** When the next heartbeat is due */
+	std::chrono::steady_clock::time_point next_heartbeat;
+
+	/** Mutex for stats, which are read from other threads by get_stats() */
+	std::mutex stats_mutex;
+
+	/** Heartbeat and connection statistics for this shard */
+	dpp::shard_stats stats;
+
+	/** Send a heartbeat now, and schedule the next one */
+	void Heartbeat();
+
+	/** Gateway commands allowed per connection, and the period in seconds they are counted over */
+	static constexpr double send_limit = 120;
+	static constexpr double send_period = 60;
+
+	/** Outbound gateway command rate limit. The reserve keeps room for heartbeats however many
+	 * other commands are queued.
+	 */
+	dpp::rate_limiter send_limiter;
+
+	/** Gateway commands waiting for the rate limit, one queue per dpp::rate_priority */
+	std::array<std::deque<std::string>, RATE_PRIORITIES> send_queue;
+
+	/** Mutex for send_queue, which user code may add to from any thread */
+	std::mutex send_mutex;
+
+	/** Queue a gateway command and send whatever the rate limit allows straight away.
+	 * Only call this on the shard's own thread.
+	 * @param data JSON to send
+	 * @param priority Priority of the command
+	 */
+	void Send(const std::string &data, dpp::rate_priority priority);
+
+	/** Send queued gateway commands, highest priority first, as far as the rate limit allows.
+	 * Commands other than rp_critical are held until the session has been identified or resumed.
+	 * Runs on the shard's own thread.
+	 */
+	void FlushSendQueue();
+
+	/** Random number source for reconnect jitter */
+	std::mt19937 jitter;
+
 	/** Run shard loop under a thread */
 	void ThreadRun();
+
+	/** Send an IDENTIFY if the identify rate limit allows it, otherwise mark it pending
+	 * so that OneSecondTimer tries again.
+	 */
+	void Identify();
+
+	/** Resume the session if there is one to resume, otherwise identify */
+	void StartSession();
 public:
 	/** Owning cluster */
 	class dpp::cluster* creator;
@@ -35,8 +149,8 @@ public:
 	/** Heartbeat interval for sending heartbeat keepalive */
 	uint32_t heartbeat_interval;
 
-	/** Last heartbeat */
-	time_t last_heartbeat;
+	/** When the last heartbeat was sent */
+	std::chrono::steady_clock::time_point last_heartbeat;
 
 	/** Shard ID of this client */
 	uint32_t shard_id;
@@ -56,15 +170,53 @@ public:
 	/** Discord session id */
 	std::string sessionid;
 
+	/** Host name given as resume_gateway_url in READY. Reconnects which resume the
+	 * session go here rather than the cluster's gateway_host.
+	 */
+	std::string resume_host;
+
+	/** True once this shard has sent its first IDENTIFY */
+	std::atomic<bool> identified;
+
+	/** When the connection for this shard was started, for measuring time to ready */
+	std::chrono::steady_clock::time_point connect_started;
+
+	/** Milliseconds from connect_started until READY was received, or 0 if not ready yet */
+	uint64_t time_to_ready;
+
 	/** Handle an event (opcode 0)
 	 * @param event Event name, e.g. MESSAGE_CREATE
 	 * @pram j JSON object for the event content
 	 */
 	virtual void HandleEvent(const std::string &event, json &j);
 
-	/** Fires every second from the underlying socket I/O loop, used for sending heartbeats */
+	/** Fires every second from the underlying socket I/O loop, used for sending chunk requests */
 	virtual void OneSecondTimer();
 
+	/** Fires on every pass of the socket I/O loop, used for sending heartbeats on time */
+	virtual void Tick();
+
+	/** Returns how long to wait, in seconds, before a reconnection attempt. This grows
+	 * exponentially with the attempts made since the connection was last known to be healthy,
+	 * up to a minute, and is randomised, so that shards which lost their connections at the
+	 * same time don't all reconnect at the same time.
+	 * @param attempts Reconnection attempts already made
+	 * @param immediate True if discord asked us to reconnect (op 7), so the first attempt needn't wait
+	 * @param rng Random number source for the jitter
+	 */
+	static double ReconnectDelay(uint32_t attempts, bool immediate, std::mt19937 &rng);
+
+	/** Returns a copy of this shard's heartbeat and connection statistics. Thread safe. */
+	dpp::shard_stats get_stats();
+
+	/** Queue a gateway command to be sent by the shard, subject to discord's limit of 120
+	 * commands per minute per connection. Thread safe. Commands still queued when the
+	 * connection drops are discarded.
+	 * @param data JSON to send
+	 * @param priority Priority of the command; lower priorities wait while higher ones are queued
+	 */
+	void QueueMessage(const std::string &data, dpp::rate_priority priority = dpp::rp_normal);
+
 	/** Optional spdlog::logger */
 	class spdlog::logger* logger;
 
@@ -97,9 +249,25 @@ public:
 
 	/** Add a guild to the chunk queue, to request its guild member chunks on a timer
 	 * (must be on a timer because the guild member chunk requests are rate limited).
+	 * Guilds already queued or being loaded are not added again. Thread safe.
 	 * @param id Guild to add to the chunk queue
+	 * @param priority True to put the guild at the front of the queue rather than the back
+	 */
+	void add_chunk_queue(uint64_t id, bool priority = false);
+
+	/** Move a guild to the front of the chunk queue, if it is waiting in it. Thread safe.
+	 * @param id Guild to prioritise
+	 */
+	void prioritise_chunk(uint64_t id);
+
+	/** Record a member chunk received for a guild. Once every chunk of a request we made
+	 * has arrived, the guild_members_loaded event fires.
+	 * @param guild_id Guild the chunk is for
+	 * @param nonce Nonce from the chunk
+	 * @param chunk_count Total number of chunks for the guild
+	 * @param member_count Number of members in this chunk
 	 */
-	void add_chunk_queue(uint64_t id);
+	void chunk_received(uint64_t guild_id, const std::string &nonce, uint32_t chunk_count, uint32_t member_count);
 
 };
 
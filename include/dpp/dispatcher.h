@@ -33,6 +33,8 @@ struct channel_update_t {
 struct ready_t {
 	std::string session_id;
 	uint32_t shard_id;
+	/** Milliseconds from starting the shard's connection until READY */
+	uint64_t time_to_ready;
 };
 
 struct message_delete_t {
@@ -65,7 +67,36 @@ struct typing_start_t {
 struct message_reaction_add_t {
 };
 
+/** A chunk of guild members, in reply to a member request */
 struct guild_members_chunk_t {
+	/** Guild the members were added to, or nullptr if the guild isn't cached */
+	guild* adding;
+	/** ID of the guild */
+	snowflake guild_id;
+	/** Index of this chunk, from 0 to chunk_count - 1 */
+	uint32_t chunk_index;
+	/** Total number of chunks for this guild */
+	uint32_t chunk_count;
+	/** Number of members in this chunk */
+	uint32_t member_count;
+	/** Nonce sent with the member request */
+	std::string nonce;
+};
+
+/** All member chunks for a guild have been received */
+struct guild_members_loaded_t {
+	/** Guild whose members were loaded, or nullptr if the guild isn't cached */
+	guild* loaded;
+	/** ID of the guild */
+	snowflake guild_id;
+	/** ID of the shard which loaded the members */
+	uint32_t shard_id;
+	/** Number of members received for the guild */
+	uint64_t member_count;
+	/** Guilds on the shard still waiting for their members. When this is 0 the shard has loaded every guild queued so far */
+	size_t guilds_pending;
+	/** True if discord stopped sending chunks for the guild before they were all received */
+	bool timed_out;
 };
 
 struct message_reaction_remove_t {
@@ -154,6 +185,12 @@ struct message_create_t {
 	message* msg;
 };
 
+/** Create message, as a lazily decoded view */
+struct message_create_view_t {
+	/** Only valid until the handler returns, see dpp::message_view */
+	const message_view* view;
+};
+
 struct guild_ban_add_t {
 	guild* banning_guild;
 };
@@ -187,6 +224,7 @@ public:
 	std::function<void(const typing_start_t& event)> typing_start;
 	std::function<void(const message_reaction_add_t& event)> message_reaction_add;
 	std::function<void(const guild_members_chunk_t& event)> guild_members_chunk;
+	std::function<void(const guild_members_loaded_t& event)> guild_members_loaded;
 	std::function<void(const message_reaction_remove_t& event)> message_reaction_remove;
 	std::function<void(const guild_create_t& event)> guild_create;
 	std::function<void(const channel_create_t& event)> channel_create;
@@ -210,6 +248,7 @@ public:
 	std::function<void(const message_update_t& event)> message_update;
 	std::function<void(const user_update_t& event)> user_update;
 	std::function<void(const message_create_t& event)> message_create;
+	std::function<void(const message_create_view_t& event)> message_create_view;
 	std::function<void(const guild_ban_add_t& event)> guild_ban_add;
 	std::function<void(const integration_create_t& event)> integration_create;
 	std::function<void(const integration_update_t& event)> integration_update;
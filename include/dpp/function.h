@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <functional>
+
+namespace dpp {
+
+template <class Signature, size_t Capacity = 64> class small_function;
+
+/** True for any std::function, which small_function treats as empty if it is */
+template <class T> struct is_std_function : std::false_type {};
+template <class Signature> struct is_std_function<std::function<Signature>> : std::true_type {};
+
+/** A copyable function wrapper like std::function, which keeps callables of up to Capacity
+ * bytes inside itself instead of on the heap. std::function only does this for callables of
+ * about two pointers (16 bytes with libstdc++), so a lambda capturing another std::function
+ * and an id, as most REST callbacks do, costs an allocation every time it is wrapped.
+ * Larger callables, or ones which may throw when moved, are still allocated.
+ */
+template <class R, class... Args, size_t Capacity> class small_function<R(Args...), Capacity> {
+	/** Operations on the stored callable, one table per callable type */
+	struct operations {
+		/** Call the callable */
+		R (*invoke)(void* target, Args&&... args);
+		/** Copy construct the callable in src into dest */
+		void (*copy)(void* dest, const void* src);
+		/** Move construct the callable in src into dest, and destroy src */
+		void (*move)(void* dest, void* src);
+		/** Destroy the callable */
+		void (*destroy)(void* target);
+	};
+
+	/** Callables stored inline */
+	template <class F> struct inline_ops {
+		static R invoke(void* target, Args&&... args) {
+			return (*static_cast<F*>(target))(std::forward<Args>(args)...);
+		}
+		static void copy(void* dest, const void* src) {
+			new (dest) F(*static_cast<const F*>(src));
+		}
+		static void move(void* dest, void* src) {
+			new (dest) F(std::move(*static_cast<F*>(src)));
+			static_cast<F*>(src)->~F();
+		}
+		static void destroy(void* target) {
+			static_cast<F*>(target)->~F();
+		}
+		static constexpr operations table = { invoke, copy, move, destroy };
+	};
+
+	/** Callables too large to store inline. The storage holds a pointer to them. */
+	template <class F> struct heap_ops {
+		static R invoke(void* target, Args&&... args) {
+			return (**static_cast<F**>(target))(std::forward<Args>(args)...);
+		}
+		static void copy(void* dest, const void* src) {
+			*static_cast<F**>(dest) = new F(**static_cast<F* const*>(src));
+		}
+		static void move(void* dest, void* src) {
+			*static_cast<F**>(dest) = *static_cast<F**>(src);
+		}
+		static void destroy(void* target) {
+			delete *static_cast<F**>(target);
+		}
+		static constexpr operations table = { invoke, copy, move, destroy };
+	};
+
+	/** True if a callable of type F is stored inline */
+	template <class F> static constexpr bool fits_inline = sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible<F>::value;
+
+	/** Storage for the callable, or for a pointer to it */
+	alignas(std::max_align_t) unsigned char storage[Capacity];
+
+	/** Operations on the stored callable, or nullptr if empty */
+	const operations* ops;
+
+	/** Returns true if f is a null function pointer or an empty std::function */
+	template <class F> static bool is_null(const F& f) {
+		if constexpr (std::is_pointer<F>::value || std::is_member_pointer<F>::value || is_std_function<F>::value) {
+			return !f;
+		} else {
+			return false;
+		}
+	}
+
+public:
+	static_assert(Capacity >= sizeof(void*), "small_function must have room for a pointer");
+
+	/** Constructs an empty function */
+	small_function() noexcept : ops(nullptr) {
+	}
+
+	/** Constructs an empty function */
+	small_function(std::nullptr_t) noexcept : ops(nullptr) {
+	}
+
+	/** Wrap a callable, such as a lambda, a function pointer or a std::function.
+	 * Null function pointers and empty std::functions give an empty small_function.
+	 */
+	template <class F, class D = typename std::decay<F>::type, typename = typename std::enable_if<!std::is_same<D, small_function>::value && std::is_invocable_r<R, D&, Args...>::value>::type>
+	small_function(F&& f) : ops(nullptr) {
+		if (is_null<D>(f)) {
+			return;
+		}
+		if constexpr (fits_inline<D>) {
+			new (storage) D(std::forward<F>(f));
+			ops = &inline_ops<D>::table;
+		} else {
+			*reinterpret_cast<D**>(storage) = new D(std::forward<F>(f));
+			ops = &heap_ops<D>::table;
+		}
+	}
+
+	small_function(const small_function& other) : ops(nullptr) {
+		if (other.ops) {
+			other.ops->copy(storage, other.storage);
+			ops = other.ops;
+		}
+	}
+
+	small_function(small_function&& other) noexcept : ops(nullptr) {
+		if (other.ops) {
+			other.ops->move(storage, other.storage);
+			ops = other.ops;
+			other.ops = nullptr;
+		}
+	}
+
+	small_function& operator=(const small_function& other) {
+		if (this != &other) {
+			small_function copy(other);
+			*this = std::move(copy);
+		}
+		return *this;
+	}
+
+	small_function& operator=(small_function&& other) noexcept {
+		if (this != &other) {
+			reset();
+			if (other.ops) {
+				other.ops->move(storage, other.storage);
+				ops = other.ops;
+				other.ops = nullptr;
+			}
+		}
+		return *this;
+	}
+
+	small_function& operator=(std::nullptr_t) noexcept {
+		reset();
+		return *this;
+	}
+
+	~small_function() {
+		reset();
+	}
+
+	/** Make the function empty */
+	void reset() noexcept {
+		if (ops) {
+			ops->destroy(storage);
+			ops = nullptr;
+		}
+	}
+
+	/** Returns true if the function holds a callable */
+	explicit operator bool() const noexcept {
+		return ops != nullptr;
+	}
+
+	/** Call the callable. It must not be empty. */
+	R operator()(Args... args) const {
+		return ops->invoke(const_cast<unsigned char*>(storage), std::forward<Args>(args)...);
+	}
+};
+
+};
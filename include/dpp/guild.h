@@ -1,5 +1,7 @@
 #pragma once
 
+#include <dpp/jsonwriter.h>
+
 namespace dpp {
 
 /** Represents voice regions for guilds and channels */
@@ -131,6 +133,12 @@ public:
 	 */
 	std::string build_json(bool with_id = false) const;
 
+	/** Write this object as JSON, without building a json document first.
+	 * @param w Writer to append the object to
+	 * @param with_id True if an ID is to be included in the JSON
+	 */
+	void write_json(json_writer &w, bool with_id = false) const;
+
 	/** Is a large server (>250 users) */
 	bool is_large() const;
 
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include <dpp/discord.h>
+#include <dpp/message.h>
+#include <dpp/queues.h>
+#include <dpp/coro.h>
+
+namespace dpp {
+
+/** Maximum number of messages discord returns in one page of history */
+#define HISTORY_PAGE_MAX 100
+
+/** One page of a channel's message history, from dpp::message_history::next() */
+struct history_page {
+	/** Messages on the page, newest first */
+	std::vector<message> messages;
+
+	/** True if there are no more pages after this one, either because the start of the
+	 * channel was reached or because fetching a page failed
+	 */
+	bool end = false;
+
+	/** Result of the request for the page. On a failure, status is 400 or above or error is set, and messages is empty. */
+	http_request_completion_t http_info;
+};
+
+/** Called with each page of history */
+typedef std::function<void(const history_page&)> history_page_event_t;
+
+/** A cursor over a channel's message history, from dpp::cluster::messages_history(), which
+ * walks backwards from the newest message (or a given message) one page at a time.
+ *
+ * Each page's request can only be made once the page before it has arrived, as it asks for
+ * messages before the oldest one on that page. To keep this chain of round trips off the
+ * caller's critical path, the cursor fetches ahead: as soon as a page arrives the next is
+ * requested, until window pages are waiting to be taken with next(). Processing a page then
+ * overlaps with fetching the following ones, and memory stays bounded at window pages.
+ *
+ * Pages are requested at rp_low priority through the cluster's request queue, so they share
+ * the channel's rate limit bucket with, and give way to, other requests for the channel.
+ * Thread safe. The cursor is kept alive by its requests in flight, so it may be released
+ * at any time.
+ */
+class message_history : public std::enable_shared_from_this<message_history> {
+	/** Cluster the pages are fetched through */
+	class cluster* owner;
+
+	/** Channel whose history is read */
+	snowflake channel_id;
+
+	/** The next page to fetch has messages before this id, or is the newest page if 0 */
+	snowflake before;
+
+	/** Messages asked for per page */
+	uint32_t page_size;
+
+	/** Maximum number of pages fetched and not yet taken */
+	uint32_t window;
+
+	/** Protects everything below */
+	std::mutex mutex;
+
+	/** Pages fetched and not yet taken, oldest last */
+	std::deque<history_page> pages;
+
+	/** Callers of next() waiting for a page, in order */
+	std::deque<history_page_event_t> waiting;
+
+	/** True while a page is being fetched */
+	bool fetching;
+
+	/** True once the last page has been fetched */
+	bool finished;
+
+	/** Decide whether to fetch the next page, which is done if the window has room and no page
+	 * is being fetched, and if so mark it as being fetched. Called with the mutex held.
+	 * @param cursor Set to the id to fetch the messages before
+	 * @returns True if the caller should call fetch() once it has released the mutex
+	 */
+	bool start_fetch(snowflake &cursor);
+
+	/** Request the next page. Called without the mutex held, as the request can complete, and
+	 * call received(), before messages_get() returns.
+	 * @param cursor Id to fetch the messages before, from start_fetch()
+	 */
+	void fetch(snowflake cursor);
+
+	/** Handle an arriving page
+	 * @param page The page
+	 */
+	void received(history_page &&page);
+public:
+	/** Constructor. Use dpp::cluster::messages_history() rather than constructing one directly, as
+	 * the cursor must be owned by a std::shared_ptr.
+	 * @param _owner Cluster to fetch pages through
+	 * @param _channel_id Channel to read
+	 * @param _before Start with the messages before this one, or 0 to start with the newest
+	 * @param _page_size Messages per page, up to HISTORY_PAGE_MAX
+	 * @param _window Maximum number of pages to fetch ahead, at least 1
+	 */
+	message_history(class cluster* _owner, snowflake _channel_id, snowflake _before, uint32_t _page_size, uint32_t _window);
+
+	/** Take the next page. If one has been fetched already the callback is called before this
+	 * returns; otherwise it is called from the REST completion thread once the page arrives.
+	 * Calls made while earlier ones are waiting get the pages that follow, in order. Once the
+	 * end has been reached, further calls get an empty page with end set.
+	 * @param callback Called with the page
+	 */
+	void next(history_page_event_t callback);
+
+	/** Returns true if the last page has been fetched, and there are no pages left to take */
+	bool done();
+
+#ifdef DPP_CORO
+	/** Take the next page, for use with co_await */
+	async_result<history_page> co_next() {
+		auto self = shared_from_this();
+		return async_result<history_page>([self](std::function<void(const history_page&)> cc) { self->next(cc); });
+	}
+#endif
+};
+
+};
@@ -0,0 +1,154 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_set>
+#include <dpp/queues.h>
+
+struct ssl_st;
+struct ssl_ctx_st;
+struct nghttp2_session;
+
+namespace dpp {
+
+/** A request sent on a dpp::http2_connection, and the callbacks which receive its reply.
+ * The callbacks run on the connection's thread: on_headers once the reply's headers arrive,
+ * on_data with each part of its body, and on_close last. on_close is always called once,
+ * unless the connection is destroyed first.
+ */
+struct http2_stream {
+	/** HTTP method, e.g. GET */
+	std::string method;
+	/** Path and query string */
+	std::string path;
+	/** Request headers other than the pseudo headers, with lower case names */
+	std::vector<std::pair<std::string, std::string>> headers;
+	/** Request body, sent if not empty */
+	std::string body;
+	/** Called with the reply's status and headers. Returns false to abandon the reply. */
+	std::function<bool(int status, const std::vector<std::pair<std::string, std::string>> &headers)> on_headers;
+	/** Called with each part of the reply's body as it arrives. Returns false to abandon the reply. */
+	std::function<bool(const char* data, size_t length)> on_data;
+	/** Called when the stream ends: h_success if the reply arrived in full, h_canceled if a
+	 * callback abandoned it, h_connection if the request was never sent or the server refused it
+	 * unprocessed, or h_read if the connection was lost after it was sent.
+	 */
+	std::function<void(http_error error)> on_close;
+
+	/** Used by the connection: bytes of body sent so far */
+	size_t body_sent = 0;
+	/** Used by the connection: status of the reply */
+	int status = 0;
+	/** Used by the connection: headers of the reply */
+	std::vector<std::pair<std::string, std::string>> reply_headers;
+	/** Used by the connection: true once the request's headers have been written */
+	bool sent = false;
+	/** Used by the connection: true if a callback abandoned the reply */
+	bool canceled = false;
+};
+
+/** One HTTP/2 connection to discord's REST API, on which any number of requests are in flight
+ * at once, each on a stream of its own. Headers are compressed with HPACK, so the headers which
+ * every request repeats, such as the token, cost a few bytes each after the first.
+ *
+ * The connection is made by connect() on the caller's thread. It then runs on a thread of its
+ * own, which writes the requests given to submit() and reads their replies, until the server
+ * closes it, sends GOAWAY, or close() is called and the last stream finishes. An https url is
+ * connected with TLS, and HTTP/2 is asked for with ALPN; an http url is spoken to with prior
+ * knowledge (h2c), so the server must support that.
+ *
+ * Only built if the library is built with nghttp2 (the DPP_HTTP2 CMake option).
+ */
+class http2_connection {
+	/** True for https */
+	bool tls;
+	/** Host name */
+	std::string host;
+	/** Port */
+	std::string port;
+	/** Value of :authority */
+	std::string authority;
+	/** Socket, or -1 */
+	int fd;
+	/** Pipe which wakes the connection's thread when a stream is submitted */
+	int wake[2];
+	/** OpenSSL context and session, if tls */
+	ssl_ctx_st* ctx;
+	ssl_st* ssl;
+	/** nghttp2 session */
+	nghttp2_session* session;
+	/** The connection's thread */
+	std::thread* runner;
+	/** Streams submitted, not yet handed to the session. Protected by mutex. */
+	std::vector<http2_stream*> pending;
+	/** Streams handed to the session and not yet closed. Only used by the connection's thread. */
+	std::unordered_set<http2_stream*> live;
+	/** Bytes nghttp2 has given us to write which the socket hasn't taken yet */
+	std::string outbuf;
+	/** Protects pending and open */
+	std::mutex mutex;
+	/** True while new streams may be submitted */
+	bool open;
+	/** True once the server has sent GOAWAY */
+	std::atomic<bool> going_away;
+	/** True once close() has been called */
+	std::atomic<bool> closing;
+	/** True once the destructor wants the thread to stop */
+	std::atomic<bool> stopping;
+	/** True once the thread has stopped */
+	std::atomic<bool> done;
+
+	/** Read from the socket. Returns the bytes read, 0 at end of file, -1 if it would block, or -2 on error. */
+	long io_read(char* data, size_t length);
+
+	/** Write to the socket. Returns the bytes written, -1 if it would block, or -2 on error. */
+	long io_write(const char* data, size_t length);
+
+	/** Write what the session has to send, as far as the socket will take it. Returns false if the connection failed. */
+	bool flush();
+
+	/** Hand a submitted stream to the session */
+	void start_stream(http2_stream* s);
+
+	/** The connection's thread */
+	void run();
+
+	/** nghttp2's callbacks, which are defined with nghttp2's types in http2.cpp */
+	friend struct http2_callbacks;
+public:
+	/** Constructor. Doesn't connect.
+	 * @param url Base url of the API, e.g. https://discord.com
+	 */
+	http2_connection(const std::string &url);
+
+	/** Destructor. Stops the connection's thread and closes the connection. Streams still open
+	 * are dropped without their on_close being called.
+	 */
+	~http2_connection();
+
+	/** Connect, and start the connection's thread.
+	 * @param refused Set to true if the server doesn't speak HTTP/2, i.e. ALPN chose something else
+	 * @returns True if connected
+	 */
+	bool connect(bool &refused);
+
+	/** Send a request. If the connection has closed, on_close is called with h_connection
+	 * straight away, on the caller's thread.
+	 * @param s Request, which the connection owns from here on
+	 */
+	void submit(http2_stream* s);
+
+	/** Returns true if the connection is up and taking new streams */
+	bool is_open();
+
+	/** Stop taking new streams, and close the connection once the open ones finish */
+	void close();
+
+	/** Returns true once the connection's thread has stopped, or if it never started */
+	bool finished() const;
+};
+
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <dpp/json_fwd.hpp>
+
+namespace dpp {
+
+/** Selects which JSON parser is used for data received from the gateway and the REST API.
+ * Both backends produce an identical nlohmann::json document, so anything that operates
+ * on a json object (such as SnowflakeNotNull and friends) works the same over either.
+ */
+enum json_backend {
+	/** nlohmann::json's own scalar parser */
+	jb_nlohmann,
+	/** SIMD structural scanner with a fast tree builder, falling back to jb_nlohmann on malformed input */
+	jb_simd
+};
+
+/** Returns the name of the structural scanner picked for this CPU at runtime,
+ * one of "avx2", "sse4.2" or "scalar".
+ */
+const char* json_scanner_name();
+
+/** Build an index of the structural characters in a JSON document. This is the first
+ * stage of the jb_simd backend, and finds every brace, bracket, colon and comma which is
+ * not inside a string, plus the opening and closing quote of every string.
+ * @param buffer Start of the JSON text
+ * @param length Length of the JSON text
+ * @param index Receives the byte offset of each structural character, in order
+ * @returns False if the document ends inside an unterminated string
+ */
+bool json_structural_index(const char* buffer, size_t length, std::vector<uint32_t> &index);
+
+/** Parse a JSON document using the chosen backend.
+ * Throws nlohmann::json::parse_error if the document is malformed, regardless of backend.
+ * @param buffer The JSON text
+ * @param backend The parser backend to use
+ */
+nlohmann::json json_parse(const std::string &buffer, json_backend backend = jb_nlohmann);
+
+/** Parse a JSON document in place, without copying it, using the chosen backend.
+ * Throws nlohmann::json::parse_error if the document is malformed, regardless of backend.
+ * @param buffer Start of the JSON text
+ * @param length Length of the JSON text
+ * @param backend The parser backend to use
+ */
+nlohmann::json json_parse(const char* buffer, size_t length, json_backend backend = jb_nlohmann);
+
+/** Parses a JSON array which arrives in parts, such as a REST reply being received, handing
+ * over each element as soon as its last byte arrives. The array never exists as one document
+ * or one piece of text: an element which lies within one part is parsed where it is, and only
+ * the bytes of an element split across parts are kept until the rest of it arrives.
+ *
+ * Elements are found by tracking brackets and strings a byte at a time, as the structural
+ * index can only be built over a whole document, and each is parsed with the chosen backend.
+ * Throws nlohmann::json::parse_error if the array or an element is malformed. Elements before
+ * the fault have already been handed over by then.
+ */
+class json_array_parser {
+	/** Called with each element */
+	std::function<void(nlohmann::json&)> element;
+	/** Backend each element is parsed with */
+	json_backend backend;
+	/** Bytes of the current element received in earlier parts */
+	std::string pending;
+	/** Where the parser is in the text */
+	enum { ap_start, ap_array, ap_end, ap_not_array } state;
+	/** Depth of brackets and braces, the array's own being 1 */
+	uint32_t depth;
+	/** Elements handed over so far */
+	size_t elements;
+	/** True inside a string */
+	bool in_string;
+	/** True after a backslash in a string */
+	bool escaped;
+	/** True once the current element has anything but whitespace in it */
+	bool content;
+
+	/** Parse the current element, whose last part ends at end, and hand it over */
+	void emit(const char* start, const char* end);
+public:
+	/** Constructor
+	 * @param _element Called with each element in turn, which it may move from
+	 * @param _backend The parser backend to use for each element
+	 */
+	json_array_parser(std::function<void(nlohmann::json&)> _element, json_backend _backend = jb_nlohmann);
+
+	/** Parse the next part of the text. Once the text is known not to be an array, nothing
+	 * more is looked at.
+	 * @param data Start of the part
+	 * @param length Length of the part
+	 */
+	void feed(const char* data, size_t length);
+
+	/** Call at the end of the text. Throws nlohmann::json::parse_error if the array was never closed.
+	 * @returns False if the text isn't an array, in which case no element was handed over
+	 */
+	bool finish();
+};
+
+/** Parse a JSON array one element at a time, handing each element over as it is parsed, so that
+ * the array never exists as one document. This is json_array_parser given the whole text at once.
+ * Throws nlohmann::json::parse_error if the array or an element is malformed.
+ * @param buffer The JSON text
+ * @param element Called with each element in turn, which it may move from
+ * @param backend The parser backend to use for each element
+ * @returns False if the text isn't an array, in which case element is never called
+ */
+bool json_parse_array(const std::string &buffer, const std::function<void(nlohmann::json&)> &element, json_backend backend = jb_nlohmann);
+
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <type_traits>
+#include <cstdint>
+
+namespace dpp {
+
+/** Writes JSON text straight into a string buffer, without building an nlohmann::json
+ * document and then dumping it. Values are written in the order they are given and
+ * commas are inserted automatically, so an object is written as e.g.
+ *
+ *     w.begin_object().field("content", text).field("tts", false).end_object();
+ *
+ * The writer does not check that what is written is well formed; begin and end calls
+ * must be balanced by the caller.
+ */
+class json_writer {
+	/** Output buffer */
+	std::string out;
+
+	/** True if the next key or value in the current object or array must be preceded by a comma */
+	bool need_comma;
+
+	/** Add a comma if one is needed before the next key or value */
+	void separator();
+
+	/** Append a string as a quoted, escaped JSON string. Throws nlohmann::json::type_error,
+	 * as dumping an nlohmann::json would, if the string isn't valid UTF-8.
+	 */
+	void quote(std::string_view s);
+public:
+	/** Constructor
+	 * @param reserve Initial buffer capacity in bytes
+	 */
+	json_writer(size_t reserve = 256);
+
+	/** A writer for the calling thread, cleared and ready for use. Its buffer keeps its
+	 * capacity between uses, so steady state serialisation doesn't reallocate it.
+	 * Don't hold on to the reference across another call to reusable() on the same thread.
+	 */
+	static json_writer& reusable();
+
+	/** Start a JSON object */
+	json_writer& begin_object();
+	/** End the current JSON object */
+	json_writer& end_object();
+	/** Start a JSON array */
+	json_writer& begin_array();
+	/** End the current JSON array */
+	json_writer& end_array();
+
+	/** Write an object key. Must be followed by a value, object or array.
+	 * @param k Key name
+	 */
+	json_writer& key(std::string_view k);
+
+	/** Write a string value. Throws nlohmann::json::type_error if it isn't valid UTF-8. */
+	json_writer& value(std::string_view s);
+	/** Write a string value (this overload stops string literals being written as a bool) */
+	json_writer& value(const char* s);
+	/** Write a boolean value */
+	json_writer& value(bool b);
+	/** Write an integer value */
+	template <typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, int>::type = 0>
+	json_writer& value(T v) {
+		char buf[24];
+		separator();
+		auto r = std::to_chars(buf, buf + sizeof(buf), v);
+		out.append(buf, r.ptr - buf);
+		need_comma = true;
+		return *this;
+	}
+	/** Write a null value */
+	json_writer& null();
+	/** Write a snowflake id, which discord expects as a quoted string */
+	json_writer& snowflake(uint64_t id);
+
+	/** Write a key and its value.
+	 * @param k Key name
+	 * @param v Value to write, of any type accepted by value()
+	 */
+	template <typename T> json_writer& field(std::string_view k, const T &v) {
+		key(k);
+		return value(v);
+	}
+
+	/** Empty the buffer, keeping its capacity */
+	void clear();
+
+	/** The JSON text written so far */
+	const std::string& str() const;
+
+	/** Move the JSON text out of the writer, leaving it empty */
+	std::string release();
+};
+
+};
@@ -2,7 +2,9 @@
 
 #include <dpp/discord.h>
 #include <optional>
+#include <string_view>
 #include <dpp/json_fwd.hpp>
+#include <dpp/jsonwriter.h>
 
 namespace dpp {
 
@@ -126,6 +128,11 @@ struct embed {
 
 	/** Set embed thumbnail. Returns the embed itself so these method calls may be "chained" */
 	embed& set_thumbnail(const std::string& url);
+
+	/** Write the sendable parts of this embed as a JSON object.
+	 * @param w Writer to append the object to
+	 */
+	void write_json(json_writer &w) const;
 };
 
 /** Represets a reaction to a dpp::message */
@@ -138,6 +145,22 @@ struct reaction {
 	snowflake emoji_id;
 };
 
+/** A file to upload with a message sent by dpp::cluster::message_create or message_edit.
+ * The contents are streamed from disk or memory as the request is sent, not copied.
+ */
+struct message_file {
+	/** Name the file is given on discord, e.g. log.txt */
+	std::string name;
+	/** Path of the file on disk, if uploading a file */
+	std::string path;
+	/** Contents in memory, if uploading from memory (e.g. a memory mapped file), which must stay valid until the request completes */
+	const char* data = nullptr;
+	/** Size of data */
+	size_t size = 0;
+	/** MIME type, defaults to application/octet-stream */
+	std::string content_type;
+};
+
 /** Represents messages sent and received on Discord */
 struct message {
 	/** id of the message */
@@ -168,6 +191,8 @@ struct message {
 	std::vector<snowflake> mention_channels;
 	/** any attached files */
 	std::vector<const unsigned char*> attachments;
+	/** Files to upload when sending or editing the message */
+	std::vector<message_file> files;
 	/** zero or more dpp::embed objects */
 	std::vector<embed> embeds;
 	/** Optional: reactions to the message */
@@ -188,6 +213,85 @@ struct message {
 	 */
 	std::string	build_json(bool with_id = false) const;
 
+	/** Write this object as JSON, without building a json document first.
+	 * @param w Writer to append the object to
+	 * @param with_id True if the ID is to be included in the JSON
+	 */
+	void		write_json(json_writer &w, bool with_id = false) const;
+
+};
+
+/** A read only view of a message received from discord. Fields are read from the
+ * received json when they are asked for, rather than all being decoded into a
+ * dpp::message up front, so embeds and other parts of the message which are never
+ * looked at cost nothing.
+ *
+ * The view is over the event's parsed nlohmann::json document, not over the raw frame
+ * buffer. The shard parses every frame into a document before it knows the event type,
+ * and the other handlers read that document, so the frame is still parsed in full; what
+ * the view saves is copying the message out of it and decoding it into a dpp::message.
+ *
+ * A message_view refers directly to the event's json and is only valid for the
+ * duration of the event handler it was passed to. To keep the message beyond that,
+ * call to_message() to get a copy.
+ */
+class message_view {
+	/** The message json within the received event */
+	nlohmann::json* d;
+public:
+	/** Constructor
+	 * @param j The message json, which must outlive this view
+	 */
+	message_view(nlohmann::json* j);
+
+	/** id of the message */
+	snowflake id() const;
+	/** id of the channel the message was sent in */
+	snowflake channel_id() const;
+	/** id of the guild the message was sent in, or 0 */
+	snowflake guild_id() const;
+	/** id of the message author */
+	snowflake author_id() const;
+	/** If the message is generated by a webhook, its id, otherwise 0 */
+	snowflake webhook_id() const;
+	/** contents of the message. Refers to the event json, so has the same lifetime as the view */
+	std::string_view content() const;
+	/** when this message was sent */
+	time_t sent() const;
+	/** when this message was edited, or 0 if never edited */
+	time_t edited() const;
+	/** whether this was a TTS message */
+	bool tts() const;
+	/** whether this message mentions everyone */
+	bool mention_everyone() const;
+	/** whether this message is pinned */
+	bool pinned() const;
+	/** Number of embeds on the message */
+	size_t embed_count() const;
+	/** Decode a single embed.
+	 * Throws nlohmann::json::out_of_range if there is no such embed.
+	 * @param index Index of the embed, between 0 and embed_count() - 1
+	 */
+	embed get_embed(size_t index) const;
+	/** Number of files attached to the message */
+	size_t attachment_count() const;
+	/** ids of users specifically mentioned in the message */
+	std::vector<snowflake> mention_ids() const;
+
+	/** The author of the message, from the cache. If the author is not yet cached,
+	 * the partial user on the message is decoded and cached.
+	 */
+	user* author() const;
+	/** Member properties for the author, from the guild's member list. If the member
+	 * isn't known, it is decoded from the message and stored on the guild.
+	 * Returns nullptr for messages not sent in a cached guild.
+	 */
+	guild_member* member() const;
+
+	/** Decode the whole message into a dpp::message which can be kept after the
+	 * event handler returns.
+	 */
+	message to_message() const;
 };
 
 /** A group of messages */
@@ -7,9 +7,20 @@
 #include <mutex>
 #include <vector>
 #include <functional>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <dpp/ratelimit.h>
+#include <dpp/stats.h>
+
+namespace httplib {
+	class Client;
+};
 
 namespace dpp {
 
+class http2_connection;
+
 /** Encodes a url parameter similar to php urlencode() */
 std::string url_encode(const std::string &value);
 
@@ -48,14 +59,18 @@ struct http_request_completion_t {
 	uint64_t ratelimit_limit = 0;
 	/** Ratelimit remaining requests */
 	uint64_t ratelimit_remaining = 0;
-	/** Ratelimit reset after (seconds) */
-	uint64_t ratelimit_reset_after = 0;
-	/** Ratelimit retry after (seconds) */
-	uint64_t ratelimit_retry_after = 0;
+	/** Ratelimit reset after (seconds, with a fractional part) */
+	double ratelimit_reset_after = 0;
+	/** Ratelimit retry after (seconds, with a fractional part) */
+	double ratelimit_retry_after = 0;
 	/** True if this request has caused us to be globally rate limited */
 	bool ratelimit_global = false;
-	/** Reply body */
+	/** Reply body, with any Content-Encoding decoded */
 	std::string body;
+	/** Size of the reply body as it came over the wire, before any Content-Encoding was decoded */
+	uint64_t wire_size = 0;
+	/** Size of the reply body once decoded. This stays set if the body is moved out to be parsed. */
+	uint64_t body_size = 0;
 };
 
 /** Results of HTTP requests are called back to these std::function types.
@@ -71,18 +86,113 @@ enum http_method {
 	m_get, m_post, m_put, m_patch, m_delete
 };
 
+/** Size of the chunks file contents are read and sent in by dpp::multipart_body */
+#define MULTIPART_CHUNK_SIZE 65536
+
+/** A multipart/form-data request body, e.g. a message with files attached. File contents are
+ * not copied into it; they are read in chunks of MULTIPART_CHUNK_SIZE as the request is written
+ * to the socket, so the memory used doesn't grow with the size of the files.
+ */
+class multipart_body {
+	/** One part of the body */
+	struct part {
+		/** Boundary and headers, written before the contents */
+		std::string head;
+		/** Contents, if they are held here rather than in a file or the caller's memory */
+		std::string content;
+		/** File to read the contents from, if set */
+		std::string path;
+		/** Caller's memory to read the contents from, if set */
+		const char* data = nullptr;
+		/** Size of the contents */
+		uint64_t size = 0;
+	};
+
+	/** Boundary between parts */
+	std::string boundary;
+
+	/** Parts in order */
+	std::vector<part> parts;
+
+	/** Start a part, filling in its head.
+	 * @param name Form field name
+	 * @param filename File name, or empty for a part which isn't a file
+	 * @param content_type MIME type of the contents
+	 */
+	part& add_part(const std::string &name, const std::string &filename, const std::string &content_type);
+
+	/** Returns what is written after the last part */
+	std::string tail() const;
+public:
+	/** Constructor. Picks a random boundary. */
+	multipart_body();
+
+	/** Add a part whose contents are copied into the body, e.g. payload_json.
+	 * @param name Form field name
+	 * @param content Contents
+	 * @param content_type MIME type of the contents
+	 */
+	void add(const std::string &name, const std::string &content, const std::string &content_type);
+
+	/** Add a file which is read from disk as the request is sent.
+	 * @param name Form field name, e.g. files[0]
+	 * @param filename Name the file is given, e.g. log.txt
+	 * @param path Path of the file, which must not change size until the request completes
+	 * @param content_type MIME type of the file
+	 * @throw std::runtime_error if the file can't be opened
+	 */
+	void add_file(const std::string &name, const std::string &filename, const std::string &path, const std::string &content_type);
+
+	/** Add a file from the caller's memory, e.g. a memory mapped file, which is not copied.
+	 * @param name Form field name, e.g. files[0]
+	 * @param filename Name the file is given, e.g. image.png
+	 * @param data Contents, which must stay valid until the request completes
+	 * @param size Size of the contents
+	 * @param content_type MIME type of the file
+	 */
+	void add_data(const std::string &name, const std::string &filename, const char* data, size_t size, const std::string &content_type);
+
+	/** Returns the total size of the body in bytes */
+	uint64_t size() const;
+
+	/** Returns the Content-Type header value for the body, including the boundary */
+	std::string content_type() const;
+
+	/** Write the body out in pieces of at most MULTIPART_CHUNK_SIZE bytes.
+	 * @param out Called with each piece, returns false to stop
+	 * @returns True if the whole body was written, false if out stopped it or a file couldn't be read in full
+	 */
+	bool write(const std::function<bool(const char*, size_t)> &out) const;
+};
+
+/** Size of the blocks http_request is allocated from. Large enough for the request types
+ * dpp::cluster derives from http_request, which check this with a static_assert.
+ */
+#define HTTP_REQUEST_BLOCK_SIZE 384
+
 /** A HTTP request. You should instantiate one of these objects via its constructor,
  * and pass a pointer to it into an instance of request_queue. Although you can
  * directly call hthe Run() method of the object and it will make a HTTP call, be
  * aware that if you do this, it will be a BLOCKING call (not asynchronous) and
  * will not respect rate limits, as both of these functions are managed by the
  * request_queue class.
+ *
+ * Requests are allocated from a small pool of recycled blocks rather than the heap,
+ * as one is created and freed for every REST call. A class derived from http_request
+ * which overrides complete() is also pooled, as long as it fits in a block.
  */
 class http_request {
+protected:
 	/** Completion callback */
 	http_completion_event complete_handler;
 	/** True if request has been made */
 	bool completed;
+
+	/** Send a GET whose reply body is passed to receive(), for Run() */
+	void run_streamed(httplib::Client &cli, const std::string &url, http_request_completion_t &rv);
+
+	/** The request_queue clears completed when it retries a request */
+	friend class request_queue;
 public:
 	/** Endpoint name e.g. /api/users */
 	std::string endpoint;
@@ -90,8 +200,33 @@ public:
 	std::string parameters;
 	/** Postdata for POST and PUT */
 	std::string postdata;
+	/** If set, a multipart/form-data body sent instead of postdata, for POST and PATCH */
+	std::shared_ptr<multipart_body> multipart;
 	/** HTTP method for request */
 	http_method method;
+	/** Number of times the request has been retried */
+	uint32_t retries;
+	/** Priority of the request. Within a rate limit bucket higher priority requests are sent
+	 * first, and rp_critical and rp_normal requests have part of the global rate limit kept
+	 * back for them.
+	 */
+	rate_priority priority;
+	/** If set, the request is not sent after this time, and completes with status 408 and
+	 * error h_canceled instead. Requests of the same priority are sent earliest deadline first.
+	 */
+	std::chrono::steady_clock::time_point deadline;
+	/** When the request was given to the request_queue */
+	std::chrono::steady_clock::time_point queued;
+	/** Completions with the same ordering key run in the order their requests completed. If
+	 * empty, the request's rate limit bucket is used, so requests for the same route and
+	 * channel or guild complete in order.
+	 */
+	std::string ordering_key;
+	/** If true, the completion runs straight away on the thread which made the request,
+	 * skipping the completion queue. Only for completions which do next to nothing, as the
+	 * request thread can send nothing else while it runs.
+	 */
+	bool inline_completion;
 
 	/** Constructor. When constructing one of these objects it should be passed to request_queue::post_request().
 	 * @param _endpoint The API endpoint, e.g. /api/guilds
@@ -100,27 +235,56 @@ public:
 	 * @param _postdata Data to send in POST and PUT requests
 	 * @param method The HTTP method to use from dpp::http_method
 	 */
-	http_request(const std::string &_endpoint, const std::string &_parameters, http_completion_event completion, const std::string &_postdata = "", http_method method = m_get);
+	http_request(std::string _endpoint, std::string _parameters, http_completion_event completion, std::string _postdata = "", http_method method = m_get);
 
 	/** Destructor */
-	~http_request();
+	virtual ~http_request();
+
+	/** Allocate a request from the pool. Requests larger than HTTP_REQUEST_BLOCK_SIZE come from
+	 * the heap instead, so a class derived from http_request should static_assert that it fits.
+	 */
+	static void* operator new(size_t size);
+
+	/** Return a request to the pool */
+	static void operator delete(void* p, size_t size);
 
 	/** Call the completion callback, if the request is complete.
 	 * @param c callback to call
 	 */
-	void complete(const http_request_completion_t &c);
+	virtual void complete(const http_request_completion_t &c);
+
+	/** Returns true if the request takes the body of a successful GET reply as it arrives,
+	 * through receive(), rather than in the result passed to complete(). Such a request is
+	 * never shared with an identical GET. The default is false.
+	 */
+	virtual bool streams_body() const;
+
+	/** Called with each part of the body of a successful reply as it arrives, decoded if it was
+	 * compressed, if streams_body() is true. The result passed to complete() then has no body.
+	 * @param data Start of the part
+	 * @param length Length of the part
+	 * @returns False to abandon the reply, which then completes with error h_canceled
+	 */
+	virtual bool receive(const char* data, size_t length);
 
-	/** Execute the HTTP request and mark the request complete.
+	/** Execute the HTTP request on a new connection and mark the request complete.
 	 * @param owner creating cluster
 	 */
 	http_request_completion_t Run(const class cluster* owner);
 
+	/** Execute the HTTP request with an existing client and mark the request complete.
+	 * A client with keep-alive enabled reuses its connection to discord from the last request.
+	 * @param owner creating cluster
+	 * @param cli client to send the request with, connected to https://discord.com
+	 */
+	http_request_completion_t Run(const class cluster* owner, httplib::Client &cli);
+
 	/** Returns true if the request is complete */
 	bool is_completed();
 };
 
 /** A rate limit bucket. The library builds one of these for
- * each endpoint.
+ * each bucket key (see dpp::bucket_map).
  */
 struct bucket_t {
 	/** Request limit */
@@ -128,11 +292,97 @@ struct bucket_t {
 	/** Requests remaining */
 	uint64_t remaining;
 	/** Ratelimit of this bucket resets after this many seconds */
-	uint64_t reset_after;
+	double reset_after;
 	/** Ratelimit of this bucket can be retried after this many seconds */
-	uint64_t retry_after;
-	/** Timestamp this buckets counters were updated */
-	time_t timestamp;
+	double retry_after;
+	/** When this bucket's counters were updated */
+	std::chrono::steady_clock::time_point timestamp;
+};
+
+/** Seconds a REST rate limit bucket may sit unused after its reset before it is forgotten */
+#define BUCKET_IDLE_TIMEOUT 60
+
+/** Tracks discord's REST rate limit buckets.
+ *
+ * Discord rate limits each route separately for each of its major parameters (the channel,
+ * guild or webhook id), and several routes may share one bucket, which it identifies by the
+ * hash in X-RateLimit-Bucket. Requests are keyed by their route and major parameter until a
+ * reply tells us the route's hash, after which they are keyed by the hash and major parameter.
+ * Requests for different channels or guilds are therefore limited independently, and requests
+ * for routes which share a bucket are counted together.
+ *
+ * Each request taken from a bucket counts against its remaining allowance before the reply
+ * arrives, so a bucket which is used up waits for its reset rather than being sent a request
+ * that would get a 429.
+ *
+ * Buckets are made per channel and guild, so those which have been idle for BUCKET_IDLE_TIMEOUT
+ * seconds past their reset are forgotten, along with the aliases and route hashes which lead
+ * only to them. A forgotten bucket is learned again from the next reply. Thread safe.
+ */
+class bucket_map {
+	/** Mutex for thread safety */
+	std::mutex mutex;
+	/** When idle buckets were last looked for */
+	std::chrono::steady_clock::time_point last_expiry;
+	/** Bucket hash discord reported for each route */
+	std::unordered_map<std::string, std::string> route_hashes;
+	/** Bucket state, by bucket key */
+	std::unordered_map<std::string, bucket_t> buckets;
+	/** Bucket keys made before a route's hash was known, and the hashed keys they now refer to */
+	std::unordered_map<std::string, std::string> aliases;
+
+	/** Returns the key a bucket is stored under. Must be called with the mutex held.
+	 * @param key Bucket key, which may be an alias
+	 */
+	const std::string& resolve(const std::string &key);
+
+	/** Forget idle buckets, at most once every BUCKET_IDLE_TIMEOUT seconds. Must be called with the mutex held. */
+	void expire();
+public:
+	/** Split a request into its route and major parameter. Ids other than the major
+	 * parameter, and reaction emojis, are replaced with placeholders in the route, e.g.
+	 * a DELETE of /api/channels/1234/messages/5678 has route
+	 * "DELETE /api/channels/:major/messages/:id" and major parameter 1234.
+	 * @param method HTTP method
+	 * @param endpoint API endpoint, e.g. /api/channels
+	 * @param parameters Parameters after the endpoint
+	 * @param major Receives the major parameter, or an empty string if there isn't one
+	 * @returns The route
+	 */
+	static std::string route(http_method method, const std::string &endpoint, const std::string &parameters, std::string &major);
+
+	/** Returns the bucket key for a request */
+	std::string key(const http_request* req);
+
+	/** Take one request's worth of a bucket's allowance, if there is any left.
+	 * @param key Bucket key from key()
+	 * @returns True if a request may be sent now
+	 */
+	bool try_acquire(const std::string &key);
+
+	/** Returns the number of seconds until a bucket will have allowance again, or 0 if it has some now.
+	 * @param key Bucket key from key()
+	 */
+	double wait_time(const std::string &key);
+
+	/** Update a bucket from the rate limit headers of a reply, and learn the bucket hash of the request's route.
+	 * @param req Request the reply is for
+	 * @param key Bucket key the request was sent under
+	 * @param rv Reply
+	 */
+	void update(const http_request* req, const std::string &key, const http_request_completion_t &rv);
+
+	/** Hold back a bucket for a while, e.g. before retrying a request which failed with a server error.
+	 * @param key Bucket key
+	 * @param seconds Seconds to wait before the bucket's next request
+	 */
+	void defer(const std::string &key, double seconds);
+
+	/** Returns the number of bucket hashes learned */
+	size_t learned_routes();
+
+	/** Returns the number of buckets being tracked */
+	size_t size();
 };
 
 /** The request_queue class manages rate limits and marshalls HTTP requests that have
@@ -145,6 +395,15 @@ struct bucket_t {
  * in their callback it won't affect when other requests are sent, and if a HTTP request
  * takes a long time due to latency, it won't hold up user processing.
  *
+ * With cluster::rest_http2 set, requests are multiplexed on one HTTP/2 connection. Each rate
+ * limit bucket has at most one request in flight at a time, so its requests are still sent and
+ * completed in order, but requests for different buckets overlap rather than waiting for each
+ * other's replies.
+ *
+ * A GET identical to one already queued or in flight is not sent again. It waits for the
+ * earlier request's reply and gets a copy of it, so that many handlers fetching the same
+ * user or message at once cost one request.
+ *
  * There is usually only one request_queue object in each dpp::cluster, which is used
  * internally for the various REST methods such as sending messages.
  */
@@ -159,17 +418,91 @@ private:
 	std::thread* in_thread;
 	std::thread* out_thread;
 	/** Ratelimit bucket counters */
-	std::map<std::string, bucket_t> buckets;
+	bucket_map buckets;
 	/** Queue of requests to be made */
 	std::map<std::string, std::vector<http_request*>> requests_in;
+	/** A GET request queued or in flight, and identical GETs waiting for its reply */
+	struct coalesced_get {
+		/** The request which is sent */
+		http_request* leader;
+		/** Requests which get a copy of its reply */
+		std::vector<http_request*> followers;
+	};
+	/** GET requests queued or in flight, by endpoint and parameters. Protected by in_mutex. */
+	std::unordered_map<std::string, coalesced_get> gets_in_flight;
+	/** A completed request waiting for its completion to run */
+	struct pending_completion {
+		/** Result of the request */
+		http_request_completion_t rv;
+		/** The request */
+		http_request* req;
+		/** When the result arrived */
+		std::chrono::steady_clock::time_point ready;
+	};
+	/** A completion thread and the completions queued for it */
+	struct completion_worker {
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::queue<pending_completion> queue;
+		std::thread* thread;
+	};
 	/** Completed requests queue */
-	std::queue<std::pair<http_request_completion_t*, http_request*>> responses_out;
+	std::queue<pending_completion> responses_out;
+	/** Completion threads, if cluster::completion_threads is more than 1 */
+	std::vector<completion_worker*> workers;
 	/** Set to true if the threads should terminate */
 	bool terminating;
 	/** True if globally rate limited - makes the entire request thread wait */
 	bool globally_ratelimited;
 	/** How many seconds we are globally rate limited for, if globally_ratelimited is true */
 	uint64_t globally_limited_for;
+	/** Keeps requests under discord's global REST limit, rather than waiting to be told we hit it */
+	rate_limiter global_limiter;
+	/** Limits retries across all requests to cluster::retry_budget a minute. Created on first use,
+	 * as the cluster's settings may be changed after the queue is constructed.
+	 */
+	token_bucket* retry_bucket;
+	/** Mutex for stats */
+	std::mutex stats_mutex;
+	/** Request and retry counters */
+	rest_stats stats;
+	/** Client kept connected to discord between requests, if cluster::rest_keep_alive is set.
+	 * Only used by the request thread.
+	 */
+	httplib::Client* rest_client;
+	/** When rest_client last finished a request */
+	std::chrono::steady_clock::time_point rest_client_used;
+	/** Connection requests are multiplexed on, if cluster::rest_http2 is set. Only used by the request thread. */
+	http2_connection* rest_h2;
+	/** When rest_h2 last sent a request or had a reply */
+	std::chrono::steady_clock::time_point rest_h2_used;
+	/** HTTP/2 connections which have been replaced, and close once their last streams finish */
+	std::vector<http2_connection*> h2_retired;
+	/** True once the server has turned down HTTP/2, after which HTTP/1.1 is used */
+	bool http2_refused;
+	/** The request in flight on the HTTP/2 connection for each bucket, by bucket key. Only used by the request thread. */
+	std::unordered_map<std::string, http_request*> streams_in_flight;
+	/** A reply which arrived on the HTTP/2 connection, for the request thread to deal with */
+	struct http2_reply {
+		/** Bucket key the request was sent under */
+		std::string key;
+		/** The request */
+		http_request* req;
+		/** Its result */
+		http_request_completion_t rv;
+	};
+	/** Replies from the HTTP/2 connection's thread. Protected by h2_mutex. */
+	std::vector<http2_reply> h2_replies;
+	std::mutex h2_mutex;
+
+	/** Decide whether a failed request should be retried, and if so hold back its bucket
+	 * for the delay discord advised or a backoff. Updates the retry counters.
+	 * @param req Request which was sent
+	 * @param key Bucket key the request was sent under
+	 * @param rv Its result
+	 * @returns True if the request should be sent again, false to deliver the result to the caller
+	 */
+	bool should_retry(http_request* req, const std::string &key, const http_request_completion_t &rv);
 
 	/** Ports for notifications of request completion.
 	 * Why are we using sockets here instead of std::condition_variable? Because
@@ -183,9 +516,68 @@ private:
 	int out_queue_listen_sock;
 	int out_queue_connect_sock;
 
+	/** Wait until the global rate limit allows a request to be sent */
+	void wait_global(http_request* req);
+
+	/** Count a request as sent
+	 * @param req The request
+	 * @param new_connection True if a connection was made for it
+	 */
+	void record_sent(http_request* req, bool new_connection);
+
+	/** Wait until the global rate limit allows a request, then run it.
+	 * @param req Request to run
+	 * @returns The result of the request
+	 */
+	http_request_completion_t run_request(http_request* req);
+
+	/** Returns the HTTP/2 connection to send a request on, connecting if need be, or nullptr if
+	 * it is to be sent over HTTP/1.1 instead.
+	 * @param req The request
+	 * @param new_connection Set to true if a connection was made
+	 */
+	http2_connection* multiplex(http_request* req, bool &new_connection);
+
+	/** Wait until the global rate limit allows a request, then send it on the HTTP/2 connection.
+	 * Its reply is added to h2_replies when it arrives.
+	 * @param conn Connection from multiplex()
+	 * @param new_connection True if the connection was made for this request
+	 * @param key Bucket key the request is sent under
+	 * @param req The request
+	 */
+	void send_http2(http2_connection* conn, bool new_connection, const std::string &key, http_request* req);
+
+	/** Deal with a request's reply: update its bucket, note a global rate limit, and either
+	 * leave it queued to be retried or finish it.
+	 * @param key Bucket key the request was sent under
+	 * @param req The request
+	 * @param rv Its result
+	 * @returns False if the request is to be retried
+	 */
+	bool handle_reply(const std::string &key, http_request* req, http_request_completion_t &&rv);
+
+	/** Queue a request's completion, or run it straight away if it is an inline completion.
+	 * @param key Bucket key the request was queued under
+	 * @param req The request
+	 * @param rv Its result
+	 */
+	void queue_completion(const std::string &key, http_request* req, http_request_completion_t &&rv);
+
+	/** Take a finished request out of its bucket and queue its completion, and those of
+	 * any identical GETs which were waiting for it.
+	 * @param key Bucket key the request was queued under
+	 * @param req The request
+	 * @param rv Its result
+	 */
+	void finish(const std::string &key, http_request* req, http_request_completion_t &&rv);
+
+	/** Run a completion, free its request and record how long it waited and ran */
+	void run_completion(pending_completion &p);
+
 	/** Thread loop functions */
 	void in_loop();
 	void out_loop();
+	void worker_loop(completion_worker* w);
 
 	/** Notify request thread of a new request */
 	void emit_in_queue_signal();
@@ -206,6 +598,9 @@ public:
 	 * @param req request to add
 	 */
 	void post_request(http_request *req);
+
+	/** Returns a copy of the request and retry counters. Thread safe. */
+	rest_stats get_stats();
 };
 
 };
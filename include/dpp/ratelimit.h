@@ -0,0 +1,116 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <array>
+#include <cstdint>
+
+namespace dpp {
+
+/** A thread safe token bucket. The bucket holds up to a set number of tokens, and
+ * refills continuously at a fixed rate. Each rate limited action takes one token,
+ * and may not go ahead if there isn't one available.
+ */
+class token_bucket {
+	/** Mutex for thread safety */
+	std::mutex mutex;
+
+	/** Maximum number of tokens the bucket can hold */
+	double capacity;
+
+	/** Tokens currently in the bucket */
+	double tokens;
+
+	/** Tokens added per second */
+	double rate;
+
+	/** When tokens were last added */
+	std::chrono::steady_clock::time_point last_refill;
+
+	/** Add the tokens accumulated since the last refill. Must be called with the mutex held. */
+	void refill();
+public:
+	/** Constructor. The bucket starts full.
+	 * @param _capacity Maximum number of tokens, which is also the largest burst allowed
+	 * @param per_seconds The number of seconds it takes to refill the bucket from empty
+	 */
+	token_bucket(double _capacity, double per_seconds);
+
+	/** Take a token if one is available.
+	 * @param count Number of tokens to take
+	 * @param leave Only take the tokens if at least this many would be left afterwards
+	 * @returns True if the tokens were taken, false if there aren't enough yet
+	 */
+	bool try_acquire(double count = 1, double leave = 0);
+
+	/** Returns the number of seconds until a token will be available, or 0 if there is one now.
+	 * @param count Number of tokens wanted
+	 */
+	double wait_time(double count = 1);
+
+	/** Refill the bucket to capacity, e.g. when the limit it models starts afresh on a new connection */
+	void reset();
+};
+
+/** Priority classes for a dpp::rate_limiter, highest first */
+enum rate_priority {
+	/** Must never be held back by other traffic: heartbeats, IDENTIFY, RESUME */
+	rp_critical = 0,
+	/** Sent on behalf of user code: presence and voice state updates, REST calls */
+	rp_normal = 1,
+	/** Bulk background work which can wait: member chunk requests */
+	rp_low = 2
+};
+
+/** Number of rate_priority values */
+#define RATE_PRIORITIES 3
+
+/** A rate limiter shared by several kinds of traffic. It is a token bucket where part of
+ * the bucket is kept back for higher priorities: rp_normal may not take the last `reserved`
+ * tokens, and rp_low may not take the last 2 * `reserved`. However busy the lower classes
+ * are, rp_critical always has at least `reserved` tokens left for it. Thread safe.
+ */
+class rate_limiter {
+	/** Tokens shared by every priority */
+	token_bucket bucket;
+
+	/** Tokens kept back from each priority below rp_critical */
+	double reserved;
+
+	/** Acquisitions which succeeded, per priority */
+	std::array<std::atomic<uint64_t>, RATE_PRIORITIES> acquired;
+
+	/** Acquisitions which were refused, per priority */
+	std::array<std::atomic<uint64_t>, RATE_PRIORITIES> refused;
+public:
+	/** Constructor. The limiter starts full.
+	 * @param capacity Number of actions allowed per period
+	 * @param per_seconds Length of the period in seconds
+	 * @param _reserved Tokens kept back from each lower priority, see above
+	 */
+	rate_limiter(double capacity, double per_seconds, double _reserved);
+
+	/** Take a token for an action of the given priority, if the priority may have one now.
+	 * @param priority Priority of the action
+	 * @returns True if the action may go ahead
+	 */
+	bool try_acquire(rate_priority priority);
+
+	/** Returns the number of seconds until an action of the given priority could go ahead,
+	 * or 0 if it can now.
+	 * @param priority Priority of the action
+	 */
+	double wait_time(rate_priority priority);
+
+	/** Refill the limiter to capacity */
+	void reset();
+
+	/** Returns the number of successful acquisitions for a priority */
+	uint64_t get_acquired(rate_priority priority) const;
+
+	/** Returns the number of refused acquisitions for a priority */
+	uint64_t get_refused(rate_priority priority) const;
+};
+
+};
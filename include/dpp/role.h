@@ -1,6 +1,7 @@
 #pragma once
 
 #include <dpp/json_fwd.hpp>
+#include <dpp/jsonwriter.h>
 
 namespace dpp {
 
@@ -84,6 +85,13 @@ public:
 	 */
 	std::string build_json(bool with_id = false) const;
 
+	/** Write this object as JSON, without building a json document first.
+	 * @param w Writer to append the object to
+	 * @param with_id true if the ID is to be included in the json text
+	 * @param with_position false to leave out the position, which discord won't accept when editing a role
+	 */
+	void write_json(json_writer &w, bool with_id = false, bool with_position = true) const;
+
 	bool is_hoisted() const;
 	bool is_mentionable() const;
 	bool is_managed() const;
@@ -42,8 +42,16 @@ protected:
 	/** Called every second */
 	virtual void OneSecondTimer();
 
-	/** Start connection */
+	/** Called on every pass of the I/O loop, which is at least every 50 milliseconds.
+	 * For timers which need better than one second resolution.
+	 */
+	virtual void Tick();
+
+	/** Start connection. Throws std::runtime_error if the host can't be resolved or connected to */
 	virtual void Connect();
+
+	/** Shut down the connection, so that ReadLoop returns. The socket itself is closed by close() */
+	void Shutdown();
 public:
 	/** Connect to a specified host and port. Throws std::runtime_error on fatal error.
 	 * @param _hostname The hostname to connect to
@@ -67,7 +75,13 @@ public:
 	 */
 	virtual void write(const std::string &data);
 
-	/** Close SSL connection */
+	/** Close SSL connection. Safe to call on a connection which failed part way through Connect() */
 	virtual void close();
+
+	/** Returns the number of host name lookups made so far by every connection in the process.
+	 * Lookups are cached for five minutes, and dropped when no address for the host could be
+	 * connected to, so this only grows on a cache miss.
+	 */
+	static uint64_t DNSLookups();
 };
 
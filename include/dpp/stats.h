@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <dpp/ratelimit.h>
+
+namespace dpp {
+
+/** A histogram of latencies in milliseconds. Bucket i counts values below 2^i ms,
+ * which were not counted by a lower bucket; the last bucket counts everything else.
+ * This is not thread safe; the owner is expected to hold a lock while recording or
+ * copying it.
+ */
+struct latency_histogram {
+	/** Number of buckets */
+	static constexpr size_t bucket_count = 16;
+
+	/** Count of values in each bucket */
+	std::array<uint64_t, bucket_count> buckets = {};
+
+	/** Number of values recorded */
+	uint64_t count = 0;
+
+	/** Sum of all values recorded, in milliseconds */
+	double total = 0;
+
+	/** Smallest value recorded, in milliseconds */
+	double min = 0;
+
+	/** Largest value recorded, in milliseconds */
+	double max = 0;
+
+	/** Record a value.
+	 * @param ms Latency in milliseconds
+	 */
+	void record(double ms);
+
+	/** Add the contents of another histogram to this one.
+	 * @param other Histogram to add
+	 */
+	void merge(const latency_histogram &other);
+
+	/** Returns the mean of all values recorded, or 0 if none have been */
+	double mean() const;
+
+	/** Returns an estimate of a percentile, as the upper bound of the bucket it falls in.
+	 * @param p Percentile to find, between 0 and 100
+	 */
+	double percentile(double p) const;
+
+	/** Returns the upper bound of a bucket in milliseconds.
+	 * @param bucket Bucket index
+	 */
+	static double bucket_limit(size_t bucket);
+};
+
+/** Statistics for REST requests, from dpp::cluster::get_rest_stats() */
+struct rest_stats {
+	/** Requests sent to discord, including retries */
+	uint64_t requests_sent = 0;
+
+	/** Connections made to discord. With cluster::rest_keep_alive set, requests_sent less this is the number of requests which reused a connection. */
+	uint64_t connections_opened = 0;
+
+	/** Requests sent on an HTTP/2 connection, with cluster::rest_http2 set */
+	uint64_t http2_requests = 0;
+
+	/** Most requests in flight on the HTTP/2 connection at once */
+	uint64_t http2_peak_streams = 0;
+
+	/** Bytes of reply bodies received, as they came over the wire */
+	uint64_t bytes_received = 0;
+
+	/** Bytes of reply bodies once decoded. With cluster::rest_compression set, this less bytes_received is the bandwidth saved. */
+	uint64_t bytes_decoded = 0;
+
+	/** GET requests which weren't sent, because an identical one was already queued or in flight, and got a copy of its reply */
+	uint64_t coalesced = 0;
+
+	/** Requests retried after a 429 */
+	uint64_t retries_ratelimited = 0;
+
+	/** Requests retried after a 5xx server error */
+	uint64_t retries_server_error = 0;
+
+	/** Requests retried after failing to connect or losing the connection */
+	uint64_t retries_connection = 0;
+
+	/** Failures delivered to the caller because the request had used up cluster::request_retries */
+	uint64_t retries_exhausted = 0;
+
+	/** Failures delivered to the caller because the cluster's retry budget was used up */
+	uint64_t retry_budget_exhausted = 0;
+
+	/** Requests dropped without being sent because their deadline passed, indexed by dpp::rate_priority */
+	std::array<uint64_t, RATE_PRIORITIES> expired = {};
+
+	/** Time requests spent queued before they were first sent, indexed by dpp::rate_priority */
+	std::array<latency_histogram, RATE_PRIORITIES> queue_wait;
+
+	/** Time from a reply arriving to its completion callback starting */
+	latency_histogram completion_wait;
+
+	/** Time taken by completion callbacks */
+	latency_histogram completion_run;
+};
+
+/** Statistics for the cache-through REST getters, from dpp::cluster::get_cache_through_stats() */
+struct cache_through_stats {
+	/** Lookups answered from the cache */
+	uint64_t hits = 0;
+
+	/** Lookups which weren't in the cache, or only had a copy older than cluster::cache_ttl */
+	uint64_t misses = 0;
+
+	/** Misses which found a copy older than cluster::cache_ttl */
+	uint64_t expired = 0;
+
+	/** Misses which joined a request already in flight for the same object instead of making their own */
+	uint64_t coalesced = 0;
+
+	/** REST requests made */
+	uint64_t requests = 0;
+
+	/** Returns the number of REST requests saved: lookups answered without a request of their own */
+	uint64_t saved() const;
+
+	/** Returns the fraction of lookups answered from the cache, between 0 and 1 */
+	double hit_ratio() const;
+};
+
+/** Statistics for one shard's gateway connection, from dpp::cluster::get_shard_stats() */
+struct shard_stats {
+	/** Shard ID */
+	uint32_t shard_id = 0;
+
+	/** True if the websocket is connected */
+	bool connected = false;
+
+	/** Heartbeats sent */
+	uint64_t heartbeats_sent = 0;
+
+	/** Heartbeat ACKs received in reply */
+	uint64_t heartbeat_acks = 0;
+
+	/** Heartbeats which were never acknowledged, each of which caused a reconnect */
+	uint64_t missed_acks = 0;
+
+	/** Number of times the shard has reconnected */
+	uint64_t reconnects = 0;
+
+	/** Round trip time of the most recent heartbeat, in milliseconds */
+	double last_rtt = 0;
+
+	/** Round trip times of all acknowledged heartbeats */
+	latency_histogram rtt;
+
+	/** Milliseconds from connecting until READY, for the latest session */
+	uint64_t time_to_ready = 0;
+
+	/** Gateway commands sent, indexed by dpp::rate_priority */
+	std::array<uint64_t, RATE_PRIORITIES> gateway_sent = {};
+
+	/** Gateway commands which had to wait for the outbound rate limit, indexed by dpp::rate_priority */
+	std::array<uint64_t, RATE_PRIORITIES> gateway_limited = {};
+
+	/** Gateway commands currently waiting to be sent */
+	uint64_t gateway_queued = 0;
+
+	/** Guilds waiting for their member request to be sent */
+	uint64_t chunk_guilds_queued = 0;
+
+	/** Guilds whose member request has been sent, and which are still receiving chunks */
+	uint64_t chunk_guilds_loading = 0;
+
+	/** Guilds whose members have been loaded in full */
+	uint64_t chunk_guilds_loaded = 0;
+
+	/** Total members received in member chunks */
+	uint64_t chunk_members_loaded = 0;
+
+	/** Members received in member chunks during the last second */
+	uint64_t chunk_members_per_second = 0;
+};
+
+};
@@ -29,6 +29,7 @@
 #include <algorithm>
 #include <sstream>
 #include <iostream>
+#include <charconv>
 
 /**
  * Convert a string to lowercase using tolower()
@@ -76,6 +77,18 @@ inline std::string trim(std::string s)
 	return ltrim(rtrim(s));
 }
 
+/**
+ * Returns the host name part of a URL, e.g. "gateway.discord.gg" from "wss://gateway.discord.gg/?v=6".
+ * A string with no scheme is taken to start with the host name.
+ */
+inline std::string url_host(const std::string &url)
+{
+	size_t start = url.find("://");
+	start = (start == std::string::npos) ? 0 : start + 3;
+	size_t end = url.find_first_of(":/?", start);
+	return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
 /**
  * Add commas to a string (or dots) based on current locale server-side
  */
@@ -100,3 +113,16 @@ template <typename T> T from_string(const std::string &s, std::ios_base & (*f)(s
 	return t;
 }
 
+
+/**
+ * Specialisation of from_string for 64 bit unsigned values, which are used for every
+ * snowflake id. This is parsed with std::from_chars, so it does not allocate or build
+ * a std::istringstream. Returns 0 if the string does not start with a number.
+ */
+template <> inline uint64_t from_string<uint64_t>(const std::string &s, std::ios_base & (*f)(std::ios_base&))
+{
+	uint64_t t = 0;
+	int base = (f == std::hex ? 16 : (f == std::oct ? 8 : 10));
+	std::from_chars(s.data(), s.data() + s.length(), t, base);
+	return t;
+}
@@ -56,6 +56,7 @@ void cache::store(managed* object) {
 		return;
 	}
 	std::lock_guard<std::mutex> lock(this->cache_mutex);
+	fetched_ids.erase(object->id);
 	auto existing = cache_map.find(object->id);
 	if (existing == cache_map.end()) {
 		cache_map[object->id] = object;
@@ -67,12 +68,37 @@ void cache::store(managed* object) {
 	}
 }
 
+bool cache::store_fetched(managed* object) {
+	if (!object) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(this->cache_mutex);
+	auto existing = cache_map.find(object->id);
+	if (existing == cache_map.end()) {
+		cache_map[object->id] = object;
+	} else if (fetched_ids.find(object->id) == fetched_ids.end()) {
+		return false;
+	} else if (object != existing->second) {
+		std::lock_guard<std::mutex> delete_lock(deletion_mutex);
+		deletion_queue[existing->second] = time(NULL);
+		existing->second = object;
+	}
+	fetched_ids.insert(object->id);
+	return true;
+}
+
+bool cache::fetched(snowflake id) {
+	std::lock_guard<std::mutex> lock(this->cache_mutex);
+	return fetched_ids.find(id) != fetched_ids.end();
+}
+
 void cache::remove(managed* object) {
 	if (!object) {
 		return;
 	}
 	std::lock_guard<std::mutex> lock(cache_mutex);
 	std::lock_guard<std::mutex> delete_lock(deletion_mutex);
+	fetched_ids.erase(object->id);
 	auto existing = cache_map.find(object->id);
 	if (existing != cache_map.end()) {
 		cache_map.erase(existing);
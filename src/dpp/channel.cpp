@@ -80,42 +80,49 @@ channel& channel::fill_from_json(json* j) {
 	return *this;
 }
 
-std::string channel::build_json(bool with_id) const {
-	json j;
+void channel::write_json(json_writer &w, bool with_id, bool with_position) const {
+	w.begin_object();
 	if (with_id) {
-		j["id"] = std::to_string(id);
+		w.key("id").snowflake(id);
+	}
+	w.key("guild_id").snowflake(guild_id);
+	if (with_position) {
+		w.field("position", position);
 	}
-	j["guild_id"] = std::to_string(guild_id);
-	j["position"] = position;
-	j["name"] = name;
-	j["topic"] = topic;
+	w.field("name", name);
+	w.field("topic", topic);
 	if (is_voice_channel()) {
-		j["user_limit"] = user_limit; 
-		j["rate_limit_per_user"] = rate_limit_per_user;
+		w.field("user_limit", user_limit);
+		w.field("rate_limit_per_user", rate_limit_per_user);
 	}
 	if (!is_dm()) {
-		j["parent_id"] = parent_id;
+		w.field("parent_id", parent_id);
 		if (is_text_channel()) {
-			j["type"] = GUILD_TEXT;
+			w.field("type", GUILD_TEXT);
 		} else if (is_voice_channel()) {
-			j["type"] = GUILD_VOICE;
+			w.field("type", GUILD_VOICE);
 		} else if (is_category()) {
-			j["type"] = GUILD_CATEGORY;
+			w.field("type", GUILD_CATEGORY);
 		} else if (is_news_channel()) {
-			j["type"] = GUILD_NEWS;
+			w.field("type", GUILD_NEWS);
 		} else if (is_store_channel()) {
-			j["type"] = GUILD_STORE;
+			w.field("type", GUILD_STORE);
 		}
-		j["nsfw"] = is_nsfw();
+		w.field("nsfw", is_nsfw());
 	} else {
 		if (is_group_dm()) {
-			j["type"] = GROUP_DM;
+			w.field("type", GROUP_DM);
 		} else  {
-			j["type"] = DM;
+			w.field("type", DM);
 		}
 	}
+	w.end_object();
+}
 
-	return j.dump();
+std::string channel::build_json(bool with_id) const {
+	json_writer &w = json_writer::reusable();
+	write_json(w, with_id);
+	return w.str();
 }
 
 };
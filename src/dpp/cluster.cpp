@@ -4,13 +4,19 @@
 #include <dpp/discordclient.h>
 #include <dpp/discordevents.h>
 #include <dpp/message.h>
+#include <dpp/cache.h>
 #include <spdlog/spdlog.h>
 #include <chrono>
+#include <future>
+#include <unordered_set>
+#include <stdexcept>
+#include <exception>
+#include <dpp/stringops.h>
 
 namespace dpp {
 
 cluster::cluster(const std::string &_token, uint32_t _intents, uint32_t _shards, uint32_t _cluster_id, uint32_t _maxclusters, spdlog::logger* _log)
-	: token(_token), intents(_intents), numshards(_shards), cluster_id(_cluster_id), maxclusters(_maxclusters), log(_log)
+	: coordinator(nullptr), token(_token), intents(_intents), numshards(_shards), cluster_id(_cluster_id), max_concurrency(1), gateway_host("gateway.discord.gg"), gateway_port("443"), rest_url("https://discord.com"), chunk_batch_size(25), chunk_timeout(60), request_retries(3), retry_budget(60), completion_threads(1), cache_ttl(300), rest_keep_alive(true), rest_http2(false), rest_compression(false), maxclusters(_maxclusters), log(_log), json_parser(jb_nlohmann)
 {
 	rest = new request_queue(this);
 }
@@ -18,9 +24,13 @@ cluster::cluster(const std::string &_token, uint32_t _intents, uint32_t _shards,
 cluster::~cluster()
 {
 	delete rest;
+	for (auto b : identify_buckets) {
+		delete b;
+	}
+	delete coordinator;
 }
 
-confirmation_callback_t::confirmation_callback_t(const std::string &_type, const confirmable_t& _value, const http_request_completion_t& _http) : type(_type), value(_value), http_info(_http)
+confirmation_callback_t::confirmation_callback_t(const std::string &_type, const confirmable_t& _value, const http_request_completion_t& _http) : type(_type), http_info(_http), value(_value)
 {
 	if (type == "confirmation") {
 		confirmation newvalue = std::get<confirmation>(_value);
@@ -29,46 +39,436 @@ confirmation_callback_t::confirmation_callback_t(const std::string &_type, const
 	}
 }
 
+confirmation_callback_t::confirmation_callback_t(const std::string &_type, confirmable_t&& _value, const http_request_completion_t& _http) : type(_type), http_info(_http), value(std::move(_value))
+{
+	if (type == "confirmation") {
+		std::get<confirmation>(value).success = (http_info.status < 400);
+	}
+}
+
+/* Discord allows one IDENTIFY per rate limit key every 5 seconds. We leave a little slack on top of
+ * this, so that network jitter can't make two identifies arrive closer together than that.
+ */
+#define IDENTIFY_INTERVAL 5.5
+
+/* How long start() waits for a group of shards to identify before moving on to the next group */
+#define IDENTIFY_WAIT_TIMEOUT 60
+
+/* How long start() waits for /gateway/bot before starting one shard on the default gateway */
+#define GATEWAY_BOT_TIMEOUT 30
+
+void cluster::fetch_gateway_bot() {
+	/* Only the callback holds the promise, so if the request is dropped without calling it, the
+	 * future sees a broken promise rather than waiting forever. The reply is parsed here rather
+	 * than by post_rest(), so that a malformed one is caught too.
+	 */
+	auto reply = std::make_shared<std::promise<json>>();
+	std::future<json> got = reply->get_future();
+	rest->post_request(new http_request("/api/gateway", "bot", [this, reply](const http_request_completion_t& http) {
+		json j;
+		try {
+			if (http.error == h_success && http.status == 200) {
+				j = json_parse(http.body, json_parser);
+			} else if (log) {
+				log->error("Unable to fetch /gateway/bot (HTTP status {})", http.status);
+			}
+		}
+		catch (const std::exception &e) {
+			if (log) {
+				log->error("Unable to parse /gateway/bot: {}", e.what());
+			}
+		}
+		reply->set_value(std::move(j));
+	}, "", m_get));
+	reply.reset();
+
+	json j;
+	try {
+		if (got.wait_for(std::chrono::seconds(GATEWAY_BOT_TIMEOUT)) == std::future_status::ready) {
+			j = got.get();
+		} else if (log) {
+			log->error("Timed out after {}s fetching /gateway/bot", GATEWAY_BOT_TIMEOUT);
+		}
+	}
+	catch (const std::future_error &) {
+		/* Dropped without a reply */
+	}
+	try {
+		if (j.is_object()) {
+			std::string url = StringNotNull(&j, "url");
+			if (!url.empty()) {
+				gateway_host = url_host(url);
+			}
+			numshards = Int32NotNull(&j, "shards");
+			auto limit = j.find("session_start_limit");
+			if (limit != j.end() && limit->is_object()) {
+				max_concurrency = Int32NotNull(&(*limit), "max_concurrency");
+				uint32_t remaining = Int32NotNull(&(*limit), "remaining");
+				uint32_t total = Int32NotNull(&(*limit), "total");
+				if (log) {
+					log->info("Discord recommends {} shards, max_concurrency={}, gateway={}, {} of {} session starts remaining", numshards, max_concurrency, gateway_host, remaining, total);
+					if (remaining == 0) {
+						log->error("No session starts remaining, shards will not be able to identify for another {}ms", Int32NotNull(&(*limit), "reset_after"));
+					}
+				}
+			}
+		}
+	}
+	catch (const std::exception &e) {
+		if (log) {
+			log->error("Unexpected /gateway/bot reply: {}", e.what());
+		}
+	}
+	if (numshards < 1) {
+		if (log) {
+			log->error("Starting one shard on {}", gateway_host);
+		}
+		numshards = 1;
+	}
+}
+
 void cluster::start() {
-	/* Start up all shards */
+	if (numshards == 0) {
+		fetch_gateway_bot();
+	}
+	if (max_concurrency < 1) {
+		max_concurrency = 1;
+	}
+	for (auto b : identify_buckets) {
+		delete b;
+	}
+	identify_buckets.clear();
+	for (uint32_t k = 0; k < max_concurrency; ++k) {
+		identify_buckets.push_back(new token_bucket(1, IDENTIFY_INTERVAL));
+	}
+
+	/* Filter out shards that arent part of the current cluster, if the bot is clustered */
+	std::vector<uint32_t> ours;
 	for (uint32_t s = 0; s < numshards; ++s) {
-		/* Filter out shards that arent part of the current cluster, if the bot is clustered */
 		if (s % maxclusters == cluster_id) {
-			/* TODO: DiscordClient should spawn a thread in its Run() */
-			this->shards[s] = new DiscordClient(this, s, numshards, token, intents, log);
-			this->shards[s]->Run();
-			std::this_thread::sleep_for(std::chrono::seconds(5));
+			ours.push_back(s);
+		}
+	}
+
+	auto started = std::chrono::steady_clock::now();
+	/* Shards whose first connection failed, with the reason */
+	std::map<uint32_t, std::string> failed;
+
+	/* Shards are started in groups of max_concurrency. Consecutive shard ids have different
+	 * rate limit keys, so every shard in a group can usually identify straight away; any that
+	 * share a key are held back by acquire_identify(). Each shard's connection is made on its
+	 * own thread, as connecting blocks until the TLS handshake is done.
+	 */
+	for (size_t first = 0; first < ours.size(); first += max_concurrency) {
+		size_t last = std::min(ours.size(), first + max_concurrency);
+		std::vector<std::thread> connecting;
+		for (size_t i = first; i < last; ++i) {
+			uint32_t s = ours[i];
+			connecting.emplace_back([this, s, &failed]() {
+				auto connect_started = std::chrono::steady_clock::now();
+				try {
+					DiscordClient* client = new DiscordClient(this, s, numshards, token, intents, log);
+					client->connect_started = connect_started;
+					client->Run();
+					std::lock_guard<std::mutex> lock(shards_mutex);
+					this->shards[s] = client;
+				}
+				catch (const std::exception &e) {
+					if (log) {
+						log->error("Shard {} could not connect: {}", s, e.what());
+					}
+					std::lock_guard<std::mutex> lock(shards_mutex);
+					failed[s] = e.what();
+				}
+			});
+		}
+		for (auto & t : connecting) {
+			t.join();
+		}
+
+		/* A shard that never connected has no thread to reconnect it, so the cluster would run
+		 * without it. Stop here and tell the caller, as start() did before shards were started
+		 * concurrently. Shards already connected keep running.
+		 */
+		if (!failed.empty()) {
+			std::string error = "Shard " + std::to_string(failed.begin()->first) + " could not connect: " + failed.begin()->second;
+			if (failed.size() > 1) {
+				error += " (and " + std::to_string(failed.size() - 1) + " more shards)";
+			}
+			throw std::runtime_error(error);
+		}
+
+		/* Wait for this group to identify before connecting the next, so that no shard sits
+		 * on an open connection waiting for its turn to identify.
+		 */
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(IDENTIFY_WAIT_TIMEOUT);
+		for (size_t i = first; i < last; ++i) {
+			auto shard = shards.find(ours[i]);
+			if (shard != shards.end()) {
+				while (!shard->second->identified && std::chrono::steady_clock::now() < deadline) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				}
+			}
 		}
 	}
+
+	if (log) {
+		log->info("{} of {} shards identified in {:.1f}s with max_concurrency={}", shards.size(), ours.size(),
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count(), max_concurrency);
+	}
 }
 
-void cluster::post_rest(const std::string &endpoint, const std::string &parameters, http_method method, const std::string &postdata, json_encode_t callback) {
-	/* NOTE: This is not a memory leak! The request_queue will free the http_request once it reaches the end of its lifecycle */
-	rest->post_request(new http_request(endpoint, parameters, [callback](const http_request_completion_t& rv) {
+std::map<uint32_t, shard_stats> cluster::get_shard_stats() {
+	std::map<uint32_t, shard_stats> s;
+	std::lock_guard<std::mutex> lock(shards_mutex);
+	for (auto & shard : shards) {
+		s[shard.first] = shard.second->get_stats();
+	}
+	return s;
+}
+
+rest_stats cluster::get_rest_stats() {
+	return rest->get_stats();
+}
+
+cache_through_stats cluster::get_cache_through_stats() {
+	std::lock_guard<std::mutex> lock(cache_through_mutex);
+	return cache_through_counts;
+}
+
+void cluster::prioritise_member_chunks(snowflake guild_id) {
+	/* Shards which have connected dispatch events while start() is still adding the others */
+	std::lock_guard<std::mutex> lock(shards_mutex);
+	/* Before start() there are no shards, and the shard count may not be known yet */
+	if (numshards == 0 || shards.empty()) {
+		return;
+	}
+	/* Guilds are sharded by the timestamp part of their id */
+	auto shard = shards.find((guild_id >> 22) % numshards);
+	if (shard != shards.end()) {
+		shard->second->prioritise_chunk(guild_id);
+	}
+}
+
+void cluster::coordinate(const std::string &name) {
+	if (coordinator) {
+		return;
+	}
+	coordinator = new cluster_coordinator(name, cluster_id);
+	coordinator->publish([this]() {
+		cache_counts c;
+		{
+			std::lock_guard<std::mutex> lock(shards_mutex);
+			c.shards = shards.size();
+		}
+		c.guilds = get_guild_count();
+		c.users = get_user_count();
+		c.channels = get_channel_count();
+		c.roles = get_role_count();
+		c.emojis = get_emoji_count();
+		return c;
+	});
+	if (log) {
+		log->info("Cluster {} coordinating with other clusters as '{}'", cluster_id, name);
+	}
+}
+
+cluster_coordinator* cluster::get_coordinator() const {
+	return coordinator;
+}
+
+bool cluster::acquire_identify(uint32_t shard_id) {
+	/* Other processes share our rate limit keys, so when coordinating the shared slots are used instead */
+	if (coordinator) {
+		return coordinator->acquire_identify(shard_id % std::max(max_concurrency, 1U), IDENTIFY_INTERVAL);
+	}
+	/* If start() hasn't set up the buckets, the shard was created by the user and manages its own rate limits */
+	if (identify_buckets.empty()) {
+		return true;
+	}
+	return identify_buckets[shard_id % identify_buckets.size()]->try_acquire();
+}
+
+/* A http_request which parses the reply and passes it to a json_encode_t. Holding the callback
+ * here, rather than wrapping it in another std::function for http_request, saves allocating and
+ * copying the wrapper for every REST call.
+ */
+class json_request : public http_request {
+	json_encode_t json_handler;
+	json_backend backend;
+public:
+	json_request(std::string _endpoint, std::string _parameters, json_encode_t callback, std::string _postdata, http_method _method, json_backend _backend)
+		: http_request(std::move(_endpoint), std::move(_parameters), nullptr, std::move(_postdata), _method), json_handler(std::move(callback)), backend(_backend)
+	{
+	}
+
+	void complete(const http_request_completion_t &rv) {
+		if (!is_completed()) {
+			return;
+		}
 		json j;
-		if (rv.error == h_success && !rv.body.empty()) {
-			j = json::parse(rv.body);
+		/* Error bodies are kept in rv.body, but the handlers expect a successful reply's JSON or nothing */
+		if (rv.error == h_success && rv.status < 400 && !rv.body.empty()) {
+			j = json_parse(rv.body, backend);
+		}
+		if (json_handler) {
+			json_handler(j, rv);
+		}
+	}
+};
+
+/* A REST request whose reply is a JSON array. A successful GET reply is parsed as it arrives, on
+ * the thread receiving it, and each element is handed to the element handler as soon as it has
+ * been received, so neither the reply nor its document is ever held whole. Any other reply (one
+ * in an encoding which can't be decoded as it arrives, or to another method) is parsed the same
+ * way once it has arrived, and its body freed before the completion handler runs. The completion handler gets
+ * the http_info without a body, or if the reply was malformed, with h_unknown as its error and
+ * the parser's message as its body.
+ */
+class json_array_request : public http_request {
+	json_array_parser parser;
+	/* Thrown by the parser or element handler while the reply was arriving, reported by complete() */
+	std::exception_ptr error;
+	/* True once any of the body has been passed to the parser */
+	bool parsing;
+public:
+	json_array_request(std::string _endpoint, std::string _parameters, std::function<void(json&)> element, http_completion_event done, std::string _postdata, http_method _method, json_backend _backend)
+		: http_request(std::move(_endpoint), std::move(_parameters), std::move(done), std::move(_postdata), _method), parser(std::move(element), _backend), parsing(false)
+	{
+	}
+
+	bool streams_body() const {
+		return true;
+	}
+
+	bool receive(const char* data, size_t length) {
+		parsing = true;
+		try {
+			parser.feed(data, length);
+			return true;
+		}
+		catch (...) {
+			error = std::current_exception();
+			return false;
+		}
+	}
+
+	void complete(const http_request_completion_t &rv) {
+		if (!is_completed()) {
+			return;
+		}
+		/* The request_queue owns the result and only hands it to this request, so the body
+		 * can be taken from it, and freed as soon as the elements have been parsed.
+		 */
+		http_request_completion_t &result = const_cast<http_request_completion_t&>(rv);
+		/* Nothing on the completion thread would catch an exception, so a malformed reply is
+		 * reported to the completion handler instead, with the parser's message as the body.
+		 */
+		try {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+			if (result.error == h_success && result.status < 400 && !result.body.empty()) {
+				std::string body;
+				body.swap(result.body);
+				parsing = true;
+				parser.feed(body.data(), body.length());
+			}
+			if (parsing && result.error == h_success) {
+				parser.finish();
+			}
+		}
+		catch (const std::exception &e) {
+			result.error = h_unknown;
+			result.body = e.what();
 		}
+		if (complete_handler) {
+			complete_handler(rv);
+		}
+	}
+};
+
+/* Both are created for every REST call, so they must fit in http_request's pool blocks */
+static_assert(sizeof(json_request) <= HTTP_REQUEST_BLOCK_SIZE, "json_request must fit in a pool block");
+static_assert(sizeof(json_array_request) <= HTTP_REQUEST_BLOCK_SIZE, "json_array_request must fit in a pool block");
+
+void cluster::post_rest(std::string endpoint, std::string parameters, http_method method, std::string postdata, json_encode_t callback, rate_priority priority, double timeout, std::string ordering_key, bool inline_completion) {
+	/* NOTE: This is not a memory leak! The request_queue will free the http_request once it reaches the end of its lifecycle */
+	json_request* req = new json_request(std::move(endpoint), std::move(parameters), std::move(callback), std::move(postdata), method, json_parser);
+	req->priority = priority;
+	req->ordering_key = std::move(ordering_key);
+	req->inline_completion = inline_completion;
+	if (timeout > 0) {
+		req->deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+	}
+	rest->post_request(req);
+}
+
+void cluster::post_rest_multipart(std::string endpoint, std::string parameters, http_method method, const std::string &postdata, const std::vector<message_file> &files, json_encode_t callback) {
+	auto body = std::make_shared<multipart_body>();
+	body->add("payload_json", postdata, "application/json");
+	for (size_t i = 0; i < files.size(); ++i) {
+		const message_file &f = files[i];
+		std::string name = "files[" + std::to_string(i) + "]";
+		std::string content_type = f.content_type.empty() ? "application/octet-stream" : f.content_type;
+		if (f.data) {
+			body->add_data(name, f.name, f.data, f.size, content_type);
+		} else {
+			body->add_file(name, f.name, f.path, content_type);
+		}
+	}
+	json_request* req = new json_request(std::move(endpoint), std::move(parameters), std::move(callback), "", method, json_parser);
+	req->multipart = std::move(body);
+	rest->post_request(req);
+}
+
+void cluster::post_rest_array(std::string endpoint, std::string parameters, http_method method, std::string postdata, std::function<void(json&)> element, http_completion_event done, rate_priority priority, double timeout) {
+	json_array_request* req = new json_array_request(std::move(endpoint), std::move(parameters), std::move(element), std::move(done), std::move(postdata), method, json_parser);
+	req->priority = priority;
+	if (timeout > 0) {
+		req->deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+	}
+	rest->post_request(req);
+}
+
+/* Get a list of objects as a map keyed by id. Each object is built from its element of the reply
+ * as the element is parsed, and the finished map is moved into the callback's result.
+ */
+template <class M> static void get_map(cluster* c, std::string endpoint, std::string parameters, const char* type, std::function<typename M::mapped_type(json&)> build, command_completion_event_t callback, rate_priority priority = rp_normal, double timeout = 0) {
+	auto objects = std::make_shared<M>();
+	c->post_rest_array(std::move(endpoint), std::move(parameters), m_get, "", [objects, build](json &j) {
+		(*objects)[SnowflakeNotNull(&j, "id")] = build(j);
+	}, [objects, type, callback](const http_request_completion_t& http) {
 		if (callback) {
-			callback(j, rv);
+			callback(confirmation_callback_t(type, std::move(*objects), http));
 		}
-	}, postdata, method));
+	}, priority, timeout);
 }
 
 void cluster::message_create(const message &m, command_completion_event_t callback) {
-	this->post_rest("/api/channels", std::to_string(m.channel_id) + "/messages", m_post, m.build_json(), [callback](json &j, const http_request_completion_t& http) {
+	auto handler = [callback](json &j, const http_request_completion_t& http) {
 		if (callback) {
 			callback(confirmation_callback_t("message", message().fill_from_json(&j), http));
 		}
-	});
+	};
+	if (!m.files.empty()) {
+		this->post_rest_multipart("/api/channels", std::to_string(m.channel_id) + "/messages", m_post, m.build_json(), m.files, handler);
+		return;
+	}
+	this->post_rest("/api/channels", std::to_string(m.channel_id) + "/messages", m_post, m.build_json(), handler);
 }
 
 void cluster::message_edit(const message &m, command_completion_event_t callback) {
-	this->post_rest("/api/channels", std::to_string(m.channel_id) + "/messages/" + std::to_string(m.id), m_patch, m.build_json(true), [callback](json &j, const http_request_completion_t& http) {
+	auto handler = [callback](json &j, const http_request_completion_t& http) {
 		if (callback) {
 			callback(confirmation_callback_t("message", message().fill_from_json(&j), http));
 		}
-	});
+	};
+	if (!m.files.empty()) {
+		this->post_rest_multipart("/api/channels", std::to_string(m.channel_id) + "/messages/" + std::to_string(m.id), m_patch, m.build_json(true), m.files, handler);
+		return;
+	}
+	this->post_rest("/api/channels", std::to_string(m.channel_id) + "/messages/" + std::to_string(m.id), m_patch, m.build_json(true), handler);
 }
 
 void cluster::message_crosspost(snowflake message_id, snowflake channel_id, command_completion_event_t callback) {
@@ -134,15 +534,9 @@ void cluster::message_get_reactions(const struct message &m, const std::string &
 	if (!parameters.empty()) {
 		parameters[0] = '?';
 	}
-	this->post_rest("/api/channels", std::to_string(m.channel_id) + "/messages/" + std::to_string(m.id) + "/reactions/" + dpp::url_encode(reaction) + parameters, m_get, "", [callback](json &j, const http_request_completion_t& http) {
-		if (callback) {
-			user_map users;
-			for (auto & curr_user : j) {
-				users[SnowflakeNotNull(&curr_user, "id")] = user().fill_from_json(&curr_user);
-			}
-			callback(confirmation_callback_t("user_map", users, http));
-		}
-	});
+	get_map<user_map>(this, "/api/channels", std::to_string(m.channel_id) + "/messages/" + std::to_string(m.id) + "/reactions/" + dpp::url_encode(reaction) + parameters, "user_map", [](json &j) {
+		return user().fill_from_json(&j);
+	}, callback);
 }
 
 void cluster::message_get(snowflake message_id, snowflake channel_id, command_completion_event_t callback) {
@@ -182,12 +576,9 @@ void cluster::channel_create(const class channel &c, command_completion_event_t
 }
 
 void cluster::channel_edit(const class channel &c, command_completion_event_t callback) {
-	json j = c.build_json(true);
-	auto p = j.find("position");
-	if (p != j.end()) {
-		j.erase(p);
-	}
-	this->post_rest("/api/channels", std::to_string(c.id), m_patch, j.dump(), [callback](json &j, const http_request_completion_t& http) {
+	json_writer &w = json_writer::reusable();
+	c.write_json(w, true, false);
+	this->post_rest("/api/channels", std::to_string(c.id), m_patch, w.str(), [callback](json &j, const http_request_completion_t& http) {
 		if (callback) {
 			callback(confirmation_callback_t("channel", channel().fill_from_json(&j), http));
 		}
@@ -270,15 +661,9 @@ void cluster::invite_get(const std::string &invitecode, command_completion_event
 }
 
 void cluster::channel_invites_get(const class channel &c, command_completion_event_t callback) {
-	this->post_rest("/api/channels", std::to_string(c.id) + "/invites", m_get, "", [callback](json &j, const http_request_completion_t& http) {
-		invite_map invites;
-		for (auto & curr_invite : j) {
-			invites[SnowflakeNotNull(&curr_invite, "id")] = invite().fill_from_json(&curr_invite);
-		}
-		if (callback) {
-			callback(confirmation_callback_t("invite_map", invites, http));
-		}
-	});
+	get_map<invite_map>(this, "/api/channels", std::to_string(c.id) + "/invites", "invite_map", [](json &j) {
+		return invite().fill_from_json(&j);
+	}, callback);
 }
 
 void cluster::channel_invite_create(const class channel &c, const class invite &i, command_completion_event_t callback) {
@@ -290,15 +675,9 @@ void cluster::channel_invite_create(const class channel &c, const class invite &
 }
 
 void cluster::pins_get(snowflake channel_id, command_completion_event_t callback) {
-	this->post_rest("/api/channels", std::to_string(channel_id) + "/pins", m_get, "", [callback](json &j, const http_request_completion_t& http) {
-		message_map pins_messages;
-		for (auto & curr_message : j) {
-			pins_messages[SnowflakeNotNull(&curr_message, "id")] = message().fill_from_json(&curr_message);
-		}
-		if (callback) {
-		callback(confirmation_callback_t("message_map", pins_messages, http));
-		}
-	});
+	get_map<message_map>(this, "/api/channels", std::to_string(channel_id) + "/pins", "message_map", [](json &j) {
+		return message().fill_from_json(&j);
+	}, callback);
 }
 
 void cluster::gdm_add(snowflake channel_id, snowflake user_id, const std::string &access_token, const std::string &nick, command_completion_event_t callback) {
@@ -379,15 +758,9 @@ void cluster::guild_create_from_template(const std::string &code, const std::str
 }
 
 void cluster::guild_templates_get(snowflake guild_id, command_completion_event_t callback) {
-	this->post_rest("/api/guilds", std::to_string(guild_id) + "/templates", m_get, "", [callback](json &j, const http_request_completion_t& http) {
-	dtemplate_map dtemplates;
-		for (auto & curr_dtemplate : j) {
-			dtemplates[SnowflakeNotNull(&curr_dtemplate, "id")] = dtemplate().fill_from_json(&curr_dtemplate);
-		}
-		if (callback) {
-				callback(confirmation_callback_t("dtemplate_map", dtemplates, http));
-		}
-	});
+	get_map<dtemplate_map>(this, "/api/guilds", std::to_string(guild_id) + "/templates", "dtemplate_map", [](json &j) {
+		return dtemplate().fill_from_json(&j);
+	}, callback);
 }
 
 void cluster::guild_template_create(snowflake guild_id, const std::string &name, const std::string &description, command_completion_event_t callback) {
@@ -428,6 +801,284 @@ void cluster::guild_template_delete(snowflake guild_id, const std::string &code,
 	});
 }
 
+/* Results of a batch so far. Shared by the callbacks of every call in it; the last to complete reports. */
+struct batch_state {
+	std::mutex mutex;
+	std::vector<confirmation_callback_t> results;
+	size_t remaining;
+	batch_completion_event_t callback;
+};
+
+void cluster::batch(std::vector<batch_call> calls, batch_completion_event_t callback) {
+	if (calls.empty()) {
+		if (callback) {
+			callback({});
+		}
+		return;
+	}
+	auto state = std::make_shared<batch_state>();
+	state->results.resize(calls.size());
+	state->remaining = calls.size();
+	state->callback = std::move(callback);
+	for (size_t i = 0; i < calls.size(); ++i) {
+		calls[i]([state, i](const confirmation_callback_t &cc) {
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->results[i] = cc;
+				if (--state->remaining > 0) {
+					return;
+				}
+			}
+			if (state->callback) {
+				state->callback(state->results);
+			}
+		});
+	}
+}
+
+std::future<std::vector<confirmation_callback_t>> cluster::batch(std::vector<batch_call> calls) {
+	auto promise = std::make_shared<std::promise<std::vector<confirmation_callback_t>>>();
+	auto future = promise->get_future();
+	this->batch(std::move(calls), [promise](const std::vector<confirmation_callback_t> &results) {
+		promise->set_value(results);
+	});
+	return future;
+}
+
+/* The http_info given to callbacks of cache-through getters answered from the cache */
+static http_request_completion_t cache_hit_http() {
+	http_request_completion_t http;
+	http.status = 200;
+	return http;
+}
+
+void cluster::users_get(const std::vector<snowflake> &user_ids, command_completion_event_t callback) {
+	user_map users;
+	std::vector<batch_call> calls;
+	std::unordered_set<snowflake> requested;
+	for (auto id : user_ids) {
+		user* u = dpp::find_user(id);
+		if (u) {
+			users[id] = *u;
+		} else if (requested.insert(id).second) {
+			calls.push_back([this, id](command_completion_event_t cc) { this->user_get(id, cc); });
+		}
+	}
+	/* Every user was cached: there is nothing to fetch, and nothing failed */
+	if (calls.empty()) {
+		if (callback) {
+			callback(confirmation_callback_t("user_map", users, cache_hit_http()));
+		}
+		return;
+	}
+	this->batch(std::move(calls), [users, callback](const std::vector<confirmation_callback_t> &results) mutable {
+		http_request_completion_t http = cache_hit_http();
+		for (auto & r : results) {
+			if (r.http_info.error == h_success && r.http_info.status == 200 && std::holds_alternative<user>(r.value)) {
+				const user &u = std::get<user>(r.value);
+				users[u.id] = u;
+			}
+			/* Keep the first failure, whether an error status or a request which never got a reply */
+			if (http.error == h_success && http.status < 400) {
+				http = r.http_info;
+			}
+		}
+		if (callback) {
+			callback(confirmation_callback_t("user_map", users, http));
+		}
+	});
+}
+
+void cluster::cache_through_expire() {
+	time_t now = time(NULL);
+	if (now - cache_through_swept < (time_t)cache_ttl) {
+		return;
+	}
+	cache_through_swept = now;
+	for (auto e = cache_through_entries.begin(); e != cache_through_entries.end();) {
+		if (now - e->second.fetched >= (time_t)cache_ttl) {
+			e = cache_through_entries.erase(e);
+		} else {
+			++e;
+		}
+	}
+}
+
+bool cluster::cache_fresh(const std::string &key, cache* c, snowflake id) {
+	bool fetched = c->fetched(id);
+	std::lock_guard<std::mutex> lock(cache_through_mutex);
+	cache_through_expire();
+	auto e = cache_through_entries.find(key);
+	if (!fetched) {
+		/* The gateway put it there, or has replaced the copy we stored */
+		if (e != cache_through_entries.end()) {
+			cache_through_entries.erase(e);
+		}
+		cache_through_counts.hits++;
+		return true;
+	}
+	if (e != cache_through_entries.end() && time(NULL) - e->second.fetched < (time_t)cache_ttl) {
+		cache_through_counts.hits++;
+		return true;
+	}
+	cache_through_counts.expired++;
+	return false;
+}
+
+bool cluster::cache_store(const std::string &key, cache* c, managed* object) {
+	/* If the gateway has cached it while we were fetching it, it will keep it more up to date than we can */
+	if (!c->store_fetched(object)) {
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(cache_through_mutex);
+	cache_through_expire();
+	cache_through_entries[key].fetched = time(NULL);
+	return true;
+}
+
+void cluster::cache_fetch(const std::string &key, command_completion_event_t callback, std::function<void(command_completion_event_t)> fetch, std::function<void(const confirmation_callback_t&)> store) {
+	{
+		std::lock_guard<std::mutex> lock(cache_through_mutex);
+		cache_through_counts.misses++;
+		auto f = cache_through_inflight.find(key);
+		if (f != cache_through_inflight.end()) {
+			f->second.push_back(callback);
+			cache_through_counts.coalesced++;
+			return;
+		}
+		cache_through_inflight[key].push_back(callback);
+		cache_through_counts.requests++;
+	}
+	fetch([this, key, store](const confirmation_callback_t &cc) {
+		if (cc.http_info.status == 200) {
+			store(cc);
+		}
+		std::vector<command_completion_event_t> waiting;
+		{
+			std::lock_guard<std::mutex> lock(cache_through_mutex);
+			auto f = cache_through_inflight.find(key);
+			waiting = std::move(f->second);
+			cache_through_inflight.erase(f);
+		}
+		for (auto & w : waiting) {
+			if (w) {
+				w(cc);
+			}
+		}
+	});
+}
+
+void cluster::guild_get_cached(snowflake guild_id, command_completion_event_t callback) {
+	std::string key = "guild:" + std::to_string(guild_id);
+	guild* g = dpp::find_guild(guild_id);
+	if (g && cache_fresh(key, dpp::get_guild_cache(), g->id)) {
+		if (callback) {
+			callback(confirmation_callback_t("guild", *g, cache_hit_http()));
+		}
+		return;
+	}
+	cache_fetch(key, callback, [this, guild_id](command_completion_event_t cc) { this->guild_get(guild_id, cc); }, [this, key](const confirmation_callback_t &cc) {
+		guild* g = new guild(std::get<guild>(cc.value));
+		if (!cache_store(key, dpp::get_guild_cache(), g)) {
+			delete g;
+		}
+	});
+}
+
+void cluster::channel_get_cached(snowflake channel_id, command_completion_event_t callback) {
+	std::string key = "channel:" + std::to_string(channel_id);
+	channel* c = dpp::find_channel(channel_id);
+	if (c && cache_fresh(key, dpp::get_channel_cache(), c->id)) {
+		if (callback) {
+			callback(confirmation_callback_t("channel", *c, cache_hit_http()));
+		}
+		return;
+	}
+	cache_fetch(key, callback, [this, channel_id](command_completion_event_t cc) { this->channel_get(channel_id, cc); }, [this, key](const confirmation_callback_t &cc) {
+		channel* c = new channel(std::get<channel>(cc.value));
+		if (!cache_store(key, dpp::get_channel_cache(), c)) {
+			delete c;
+		}
+	});
+}
+
+void cluster::user_get_cached(snowflake user_id, command_completion_event_t callback) {
+	std::string key = "user:" + std::to_string(user_id);
+	user* u = dpp::find_user(user_id);
+	if (u && cache_fresh(key, dpp::get_user_cache(), u->id)) {
+		if (callback) {
+			callback(confirmation_callback_t("user", *u, cache_hit_http()));
+		}
+		return;
+	}
+	cache_fetch(key, callback, [this, user_id](command_completion_event_t cc) { this->user_get(user_id, cc); }, [this, key](const confirmation_callback_t &cc) {
+		user* u = new user(std::get<user>(cc.value));
+		if (!cache_store(key, dpp::get_user_cache(), u)) {
+			delete u;
+		}
+	});
+}
+
+void cluster::roles_get_cached(snowflake guild_id, command_completion_event_t callback) {
+	std::string key = "roles:" + std::to_string(guild_id);
+	/* A guild from the gateway lists its roles, and role events keep them up to date. Otherwise,
+	 * use the roles from our last fetch while that is fresh.
+	 */
+	std::vector<snowflake> ids;
+	guild* g = dpp::find_guild(guild_id);
+	bool from_gateway = g && !g->roles.empty() && !dpp::get_guild_cache()->fetched(guild_id);
+	if (from_gateway) {
+		ids = g->roles;
+	} else {
+		std::lock_guard<std::mutex> lock(cache_through_mutex);
+		cache_through_expire();
+		auto re = cache_through_entries.find(key);
+		if (re != cache_through_entries.end()) {
+			if (time(NULL) - re->second.fetched < (time_t)cache_ttl) {
+				ids = re->second.ids;
+			} else {
+				cache_through_counts.expired++;
+			}
+		}
+	}
+	if (!ids.empty()) {
+		role_map roles;
+		for (auto id : ids) {
+			role* r = dpp::find_role(id);
+			if (!r) {
+				roles.clear();
+				break;
+			}
+			roles[id] = *r;
+		}
+		if (!roles.empty()) {
+			{
+				std::lock_guard<std::mutex> lock(cache_through_mutex);
+				cache_through_counts.hits++;
+			}
+			if (callback) {
+				callback(confirmation_callback_t("role_map", roles, cache_hit_http()));
+			}
+			return;
+		}
+	}
+	cache_fetch(key, callback, [this, guild_id](command_completion_event_t cc) { this->roles_get(guild_id, cc); }, [this, key](const confirmation_callback_t &cc) {
+		std::vector<snowflake> stored;
+		for (auto & rp : std::get<role_map>(cc.value)) {
+			/* Roles the gateway already holds are left alone, it keeps them up to date */
+			role* r = new role(rp.second);
+			if (!dpp::get_role_cache()->store_fetched(r)) {
+				delete r;
+			}
+			stored.push_back(rp.first);
+		}
+		std::lock_guard<std::mutex> lock(cache_through_mutex);
+		cache_through_entry &entry = cache_through_entries[key];
+		entry.ids = stored;
+		entry.fetched = time(NULL);
+	});
+}
+
 void cluster::user_get(snowflake user_id, command_completion_event_t callback) {
 	this->post_rest("/api/users", std::to_string(user_id), m_get, "", [callback](json &j, const http_request_completion_t& http) {
 		if (callback) {
@@ -445,15 +1096,9 @@ void cluster::current_user_get(command_completion_event_t callback) {
 }
 
 void cluster::current_user_get_guilds(command_completion_event_t callback) {
-	this->post_rest("/api/users", "@me/guilds", m_get, "", [callback](json &j, const http_request_completion_t& http) {
-		if (callback) {
-			guild_map guilds;
-			for (auto & curr_guild : j) {
-				guilds[SnowflakeNotNull(&curr_guild, "id")] = guild().fill_from_json(&curr_guild);
-			}
-			callback(confirmation_callback_t("guild_map", guilds, http));
-		}
-	});
+	get_map<guild_map>(this, "/api/users", "@me/guilds", "guild_map", [](json &j) {
+		return guild().fill_from_json(&j);
+	}, callback);
 }
 
 void cluster::guild_delete(snowflake guild_id, command_completion_event_t callback) {
@@ -473,12 +1118,9 @@ void cluster::role_create(const class role &r, command_completion_event_t callba
 }
 
 void cluster::role_edit(const class role &r, command_completion_event_t callback) {
-	json j = r.build_json(true);
-	auto p = j.find("position");
-	if (p != j.end()) {
-		j.erase(p);
-	}
-	this->post_rest("/api/guilds", std::to_string(r.guild_id) + "/roles/" + std::to_string(r.id) , m_patch, j.dump(), [r, callback](json &j, const http_request_completion_t& http) {
+	json_writer &w = json_writer::reusable();
+	r.write_json(w, true, false);
+	this->post_rest("/api/guilds", std::to_string(r.guild_id) + "/roles/" + std::to_string(r.id) , m_patch, w.str(), [r, callback](json &j, const http_request_completion_t& http) {
 		if (callback) {
 			callback(confirmation_callback_t("role", role().fill_from_json(r.guild_id, &j), http));
 		}
@@ -486,15 +1128,9 @@ void cluster::role_edit(const class role &r, command_completion_event_t callback
 }
 
 void cluster::guild_emojis_get(snowflake guild_id, command_completion_event_t callback) {
-	this->post_rest("/api/guilds", std::to_string(guild_id) + "/emojis", m_get, "", [guild_id, callback](json &j, const http_request_completion_t& http) {
-		if (callback) {
-			emoji_map emojis;
-			for (auto & curr_emoji : j) {
-				emojis[SnowflakeNotNull(&curr_emoji, "id")] = emoji().fill_from_json(&curr_emoji);
-			}
-			callback(confirmation_callback_t("emoji_map", emojis, http));
-		}
-	});
+	get_map<emoji_map>(this, "/api/guilds", std::to_string(guild_id) + "/emojis", "emoji_map", [](json &j) {
+		return emoji().fill_from_json(&j);
+	}, callback);
 }
 
 void cluster::guild_emoji_get(snowflake guild_id, snowflake emoji_id, command_completion_event_t callback) {
@@ -507,31 +1143,19 @@ void cluster::guild_emoji_get(snowflake guild_id, snowflake emoji_id, command_co
 
 
 void cluster::roles_get(snowflake guild_id, command_completion_event_t callback) {
-	this->post_rest("/api/guilds", std::to_string(guild_id) + "/roles", m_get, "", [guild_id, callback](json &j, const http_request_completion_t& http) {
-		if (callback) {
-			role_map roles;
-			for (auto & curr_role : j) {
-				roles[SnowflakeNotNull(&curr_role, "id")] = role().fill_from_json(guild_id, &curr_role);
-			}
-			callback(confirmation_callback_t("role_map", roles, http));
-		}
-	});
+	get_map<role_map>(this, "/api/guilds", std::to_string(guild_id) + "/roles", "role_map", [guild_id](json &j) {
+		return role().fill_from_json(guild_id, &j);
+	}, callback);
 }
 
 void cluster::channels_get(snowflake guild_id, command_completion_event_t callback) {
-	this->post_rest("/api/guilds", std::to_string(guild_id) + "/channels", m_get, "", [callback](json &j, const http_request_completion_t& http) {
-		if (callback) {
-			channel_map channels;
-			for (auto & curr_channel: j) {
-				channels[SnowflakeNotNull(&curr_channel, "id")] = channel().fill_from_json(&curr_channel);
-			}
-			callback(confirmation_callback_t("channel_map", channels, http));
-		}
-	});
+	get_map<channel_map>(this, "/api/guilds", std::to_string(guild_id) + "/channels", "channel_map", [](json &j) {
+		return channel().fill_from_json(&j);
+	}, callback);
 }
 
 
-void cluster::messages_get(snowflake channel_id, snowflake around, snowflake before, snowflake after, snowflake limit, command_completion_event_t callback) {
+void cluster::messages_get(snowflake channel_id, snowflake around, snowflake before, snowflake after, snowflake limit, command_completion_event_t callback, rate_priority priority, double timeout) {
 	std::string parameters;
 	if (around) {
 		parameters.append("&around=" + std::to_string(around));
@@ -548,15 +1172,13 @@ void cluster::messages_get(snowflake channel_id, snowflake around, snowflake bef
 	if (!parameters.empty()) {
 		parameters[0] = '?';
 	}
-	this->post_rest("/api/channels", std::to_string(channel_id) + "/messages" + parameters, m_get, json(), [channel_id, callback](json &j, const http_request_completion_t& http) {
-		if (callback) {
-			message_map messages;
-			for (auto & curr_message : j) {
-				messages[SnowflakeNotNull(&curr_message, "id")] = message().fill_from_json(&curr_message);
-			}
-			callback(confirmation_callback_t("message_map", messages, http));
-		}
-	});
+	get_map<message_map>(this, "/api/channels", std::to_string(channel_id) + "/messages" + parameters, "message_map", [](json &j) {
+		return message().fill_from_json(&j);
+	}, callback, priority, timeout);
+}
+
+std::shared_ptr<message_history> cluster::messages_history(snowflake channel_id, snowflake before, uint32_t page_size, uint32_t window) {
+	return std::make_shared<message_history>(this, channel_id, before, page_size, window);
 }
 
 void cluster::role_edit_position(const class role &r, command_completion_event_t callback) {
@@ -728,6 +1350,14 @@ void cluster::on_message_create (std::function<void(const message_create_t& _eve
 	this->dispatch.message_create = _message_create; 
 }
 
+void cluster::on_guild_members_loaded (std::function<void(const guild_members_loaded_t& _event)> _guild_members_loaded) {
+	this->dispatch.guild_members_loaded = _guild_members_loaded;
+}
+
+void cluster::on_message_create_view (std::function<void(const message_create_view_t& _event)> _message_create_view) {
+	this->dispatch.message_create_view = _message_create_view;
+}
+
 void cluster::on_guild_ban_add (std::function<void(const guild_ban_add_t& _event)> _guild_ban_add) {
 	this->dispatch.guild_ban_add = _guild_ban_add; 
 }
@@ -0,0 +1,311 @@
+#include <dpp/coordinator.h>
+#include <stdexcept>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace dpp {
+
+/* Written last when the shared memory is created, so that other processes know it is ready */
+#define COORDINATOR_MAGIC 0x44505043
+
+/* Bumped whenever the layout of shared_state changes */
+#define COORDINATOR_VERSION 1
+
+/* How long to wait for another process to finish creating the shared memory */
+#define COORDINATOR_OPEN_TIMEOUT 5
+
+/** One cluster's entry in the shared memory */
+struct shared_cluster {
+	/** When the counts were last published, in steady clock milliseconds, or 0 if the cluster has gone */
+	int64_t last_update;
+	/** Counts last published */
+	cache_counts counts;
+};
+
+/** Layout of the shared memory. Times are steady clock milliseconds, which on the platforms
+ * this is built for count from boot, so they can be compared between processes.
+ */
+struct shared_state {
+	std::atomic<uint32_t> magic;
+	uint32_t version;
+#ifndef _WIN32
+	pthread_mutex_t mutex;
+#endif
+	/** When the REST global rate limit ends */
+	int64_t global_ratelimit_until;
+	/** Tokens in the REST global rate limit bucket every process takes from */
+	double global_tokens;
+	/** When global_tokens was last refilled, or 0 if it never has been */
+	int64_t global_refilled;
+	/** When each IDENTIFY rate limit key may next be used */
+	int64_t identify_next[COORDINATOR_MAX_IDENTIFY_KEYS];
+	/** Published counts, indexed by cluster id */
+	shared_cluster clusters[COORDINATOR_MAX_CLUSTERS];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "The shared memory needs lock free atomics");
+
+static int64_t now_ms() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string make_shm_name(const std::string &name) {
+	/* POSIX shared memory names start with a slash and may contain no others */
+	std::string n = "/dpp-" + name;
+	for (size_t i = 1; i < n.length(); ++i) {
+		if (n[i] == '/') {
+			n[i] = '_';
+		}
+	}
+	return n;
+}
+
+#ifndef _WIN32
+
+static int64_t process_id() {
+	return getpid();
+}
+
+cluster_coordinator::cluster_coordinator(const std::string &name, uint32_t _cluster_id) : state(nullptr), shm_name(make_shm_name(name)), cluster_id(_cluster_id), publisher(nullptr), terminating(false)
+{
+	if (cluster_id >= COORDINATOR_MAX_CLUSTERS) {
+		throw std::runtime_error("Cluster id too large for the coordinator");
+	}
+	bool creator = true;
+	int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd == -1 && errno == EEXIST) {
+		creator = false;
+		fd = shm_open(shm_name.c_str(), O_RDWR, 0600);
+	}
+	if (fd == -1) {
+		throw std::runtime_error(std::string("Can't open coordinator shared memory: ") + strerror(errno));
+	}
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(COORDINATOR_OPEN_TIMEOUT);
+	if (creator) {
+		if (ftruncate(fd, sizeof(shared_state)) == -1) {
+			::close(fd);
+			shm_unlink(shm_name.c_str());
+			throw std::runtime_error(std::string("Can't size coordinator shared memory: ") + strerror(errno));
+		}
+	} else {
+		/* The creator may not have sized it yet */
+		struct stat st;
+		while (fstat(fd, &st) == 0 && (size_t)st.st_size < sizeof(shared_state) && std::chrono::steady_clock::now() < deadline) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		if ((size_t)st.st_size < sizeof(shared_state)) {
+			::close(fd);
+			throw std::runtime_error("Coordinator shared memory is the wrong size, remove it and try again");
+		}
+	}
+	void* mem = mmap(nullptr, sizeof(shared_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mem == MAP_FAILED) {
+		throw std::runtime_error(std::string("Can't map coordinator shared memory: ") + strerror(errno));
+	}
+	state = (shared_state*)mem;
+	if (creator) {
+		/* A new shared memory object is zero filled, so only the mutex needs setting up */
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef __linux__
+		pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+		pthread_mutex_init(&state->mutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+		state->version = COORDINATOR_VERSION;
+		state->magic.store(COORDINATOR_MAGIC, std::memory_order_release);
+	} else {
+		while (state->magic.load(std::memory_order_acquire) != COORDINATOR_MAGIC && std::chrono::steady_clock::now() < deadline) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		if (state->magic.load(std::memory_order_acquire) != COORDINATOR_MAGIC || state->version != COORDINATOR_VERSION) {
+			munmap(state, sizeof(shared_state));
+			state = nullptr;
+			throw std::runtime_error("Coordinator shared memory is from another version, remove it and try again");
+		}
+	}
+}
+
+cluster_coordinator::~cluster_coordinator()
+{
+	terminating = true;
+	if (publisher) {
+		publisher->join();
+		delete publisher;
+	}
+	if (state) {
+		lock();
+		state->clusters[cluster_id].last_update = 0;
+		unlock();
+		munmap(state, sizeof(shared_state));
+	}
+}
+
+void cluster_coordinator::lock()
+{
+	int rc = pthread_mutex_lock(&state->mutex);
+#ifdef __linux__
+	if (rc == EOWNERDEAD) {
+		/* A process died holding the lock. Everything it guards is updated in single stores, so it is still consistent */
+		pthread_mutex_consistent(&state->mutex);
+	}
+#else
+	(void)rc;
+#endif
+}
+
+void cluster_coordinator::unlock()
+{
+	pthread_mutex_unlock(&state->mutex);
+}
+
+void cluster_coordinator::remove(const std::string &name)
+{
+	shm_unlink(make_shm_name(name).c_str());
+}
+
+#else
+
+static int64_t process_id() {
+	return 0;
+}
+
+cluster_coordinator::cluster_coordinator(const std::string &name, uint32_t _cluster_id) : state(nullptr), shm_name(make_shm_name(name)), cluster_id(_cluster_id), publisher(nullptr), terminating(false)
+{
+	throw std::runtime_error("Cluster coordination is not supported on Windows");
+}
+
+cluster_coordinator::~cluster_coordinator()
+{
+}
+
+void cluster_coordinator::lock()
+{
+}
+
+void cluster_coordinator::unlock()
+{
+}
+
+void cluster_coordinator::remove(const std::string &name)
+{
+}
+
+#endif
+
+void cluster_coordinator::publish(std::function<cache_counts()> _counter)
+{
+	if (publisher) {
+		return;
+	}
+	counter = _counter;
+	publisher = new std::thread(&cluster_coordinator::publish_loop, this);
+}
+
+void cluster_coordinator::publish_loop()
+{
+	while (!terminating) {
+		cache_counts c = counter();
+		c.cluster_id = cluster_id;
+		c.pid = process_id();
+		lock();
+		state->clusters[cluster_id].counts = c;
+		state->clusters[cluster_id].last_update = now_ms();
+		unlock();
+		for (int i = 0; i < 10 && !terminating; ++i) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+	}
+}
+
+void cluster_coordinator::set_global_ratelimit(uint64_t seconds)
+{
+	int64_t until = now_ms() + (int64_t)seconds * 1000;
+	lock();
+	if (until > state->global_ratelimit_until) {
+		state->global_ratelimit_until = until;
+	}
+	unlock();
+}
+
+double cluster_coordinator::acquire_global(double per_second, double leave)
+{
+	int64_t now = now_ms();
+	double wait = 0;
+	lock();
+	/* The bucket holds a second's worth of tokens. A new one is zero filled, so it starts full. */
+	double elapsed = state->global_refilled ? (now - state->global_refilled) / 1000.0 : 1;
+	state->global_tokens = std::min(per_second, state->global_tokens + elapsed * per_second);
+	state->global_refilled = now;
+	if (state->global_tokens >= 1 + leave) {
+		state->global_tokens -= 1;
+	} else {
+		wait = (1 + leave - state->global_tokens) / per_second;
+	}
+	unlock();
+	return wait;
+}
+
+uint64_t cluster_coordinator::global_ratelimit_wait()
+{
+	lock();
+	int64_t until = state->global_ratelimit_until;
+	unlock();
+	int64_t now = now_ms();
+	return until > now ? until - now : 0;
+}
+
+bool cluster_coordinator::acquire_identify(uint32_t key, double interval)
+{
+	int64_t now = now_ms();
+	int64_t &next = state->identify_next[key % COORDINATOR_MAX_IDENTIFY_KEYS];
+	bool acquired = false;
+	lock();
+	if (now >= next) {
+		next = now + (int64_t)(interval * 1000);
+		acquired = true;
+	}
+	unlock();
+	return acquired;
+}
+
+std::vector<cache_counts> cluster_coordinator::get_counts()
+{
+	std::vector<cache_counts> counts;
+	int64_t stale = now_ms() - COORDINATOR_STALE_SECONDS * 1000;
+	lock();
+	for (size_t i = 0; i < COORDINATOR_MAX_CLUSTERS; ++i) {
+		if (state->clusters[i].last_update && state->clusters[i].last_update > stale) {
+			counts.push_back(state->clusters[i].counts);
+		}
+	}
+	unlock();
+	return counts;
+}
+
+cache_counts cluster_coordinator::get_totals()
+{
+	cache_counts totals;
+	for (auto & c : get_counts()) {
+		totals.shards += c.shards;
+		totals.guilds += c.guilds;
+		totals.users += c.users;
+		totals.channels += c.channels;
+		totals.roles += c.roles;
+		totals.emojis += c.emojis;
+	}
+	return totals;
+}
+
+};
@@ -5,16 +5,33 @@
 #include <dpp/cache.h>
 #include <spdlog/spdlog.h>
 #include <dpp/cluster.h>
+#include <dpp/jsonscan.h>
 #include <thread>
+#include <algorithm>
+#ifndef _WIN32
+#include <signal.h>
+#include <pthread.h>
+#endif
 
-DiscordClient::DiscordClient(dpp::cluster* _cluster, uint32_t _shard_id, uint32_t _max_shards, const std::string &_token, uint32_t _intents, spdlog::logger* _logger) : WSClient("gateway.discord.gg", "443"), creator(_cluster), shard_id(_shard_id), max_shards(_max_shards), token(_token), last_heartbeat(time(NULL)), heartbeat_interval(0), last_seq(0), sessionid(""), logger(_logger), intents(_intents), runner(nullptr)
+/* Gateway commands kept back from each lower priority for the ones above it. Heartbeats need
+ * around two a minute, so this leaves rp_critical ample room even with rp_low saturated.
+ */
+#define GATEWAY_RESERVED_SENDS 5
+
+DiscordClient::DiscordClient(dpp::cluster* _cluster, uint32_t _shard_id, uint32_t _max_shards, const std::string &_token, uint32_t _intents, spdlog::logger* _logger) : WSClient(_cluster->gateway_host, _cluster->gateway_port), chunk_nonce(0), chunk_members_this_second(0), runner(nullptr), identify_pending(false), reconnect_attempts(0), reconnect_now(false), close_code(0), heartbeat_acked(true), send_limiter(send_limit, send_period, GATEWAY_RESERVED_SENDS), jitter(std::random_device{}()), creator(_cluster), heartbeat_interval(0), last_heartbeat(std::chrono::steady_clock::now()), shard_id(_shard_id), max_shards(_max_shards), last_seq(0), token(_token), intents(_intents), sessionid(""), identified(false), connect_started(std::chrono::steady_clock::now()), time_to_ready(0), logger(_logger)
 {
+	stats.shard_id = shard_id;
 	if (logger == nullptr) {
+		/* Shards may be constructed on several threads at once, and all share the one null logger */
+		static std::mutex nullsink_mutex;
+		std::lock_guard<std::mutex> lock(nullsink_mutex);
 		try {
-			std::shared_ptr<spdlog::logger> log;
-			std::vector<spdlog::sink_ptr> sinks;
-			log = std::make_shared<spdlog::logger>("nullsink", begin(sinks), end(sinks));
-			spdlog::register_logger(log);
+			std::shared_ptr<spdlog::logger> log = spdlog::get("nullsink");
+			if (!log) {
+				std::vector<spdlog::sink_ptr> sinks;
+				log = std::make_shared<spdlog::logger>("nullsink", begin(sinks), end(sinks));
+				spdlog::register_logger(log);
+			}
 			logger = log.get();
 		}
 		catch (const spdlog::spdlog_ex& ex) {
@@ -31,13 +48,101 @@ DiscordClient::~DiscordClient()
 	}
 }
 
+/* Reconnect backoff, in seconds. The delay doubles with each failed attempt up to the maximum */
+#define RECONNECT_BASE_DELAY 1.0
+#define RECONNECT_MAX_DELAY 60.0
+
+/* Close codes after which reconnecting would only fail again: authentication failed, invalid shard,
+ * sharding required, invalid API version, invalid intents and disallowed intents.
+ */
+static bool fatal_close_code(uint32_t code)
+{
+	return code == 4004 || (code >= 4010 && code <= 4014);
+}
+
+double DiscordClient::ReconnectDelay(uint32_t attempts, bool immediate, std::mt19937 &rng)
+{
+	if (attempts == 0) {
+		/* First attempt: straight away if asked to by discord, otherwise spread over a second */
+		return immediate ? 0 : std::uniform_real_distribution<double>(0, 1)(rng);
+	}
+	double cap = std::min(RECONNECT_MAX_DELAY, RECONNECT_BASE_DELAY * (double)(1ULL << std::min(attempts, 16U)));
+	return std::uniform_real_distribution<double>(cap / 2, cap)(rng);
+}
+
 void DiscordClient::ThreadRun()
 {
+#ifndef _WIN32
+	/* A dropped connection is noticed by a write failing with EPIPE, rather than SIGPIPE killing
+	 * the process. OpenSSL may write an alert even from SSL_read, e.g. after Shutdown().
+	 */
+	sigset_t sigpipe;
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+#endif
 	do {
+		/* ReadLoop returns when the connection is lost, or has been shut down so that we reconnect */
 		SSLClient::ReadLoop();
 		SSLClient::close();
-		SSLClient::Connect();
-		WSClient::Connect();
+
+		if (fatal_close_code(close_code)) {
+			logger->error("Shard {} was disconnected with close code {} and will not reconnect", shard_id, close_code);
+			return;
+		}
+		if (close_code == 4007 || close_code == 4009) {
+			/* Invalid sequence number or session timed out: the session can't be resumed */
+			sessionid = "";
+			resume_host = "";
+			last_seq = 0;
+		}
+		close_code = 0;
+
+		/* Keep trying until we have a connection. The session id and sequence number are kept, so
+		 * that once reconnected the session is resumed rather than identifying again.
+		 */
+		bool connected = false;
+		while (!connected) {
+			double delay = ReconnectDelay(reconnect_attempts, reconnect_now, jitter);
+			reconnect_now = false;
+			reconnect_attempts++;
+			{
+				std::lock_guard<std::mutex> lock(stats_mutex);
+				stats.reconnects++;
+			}
+			if (delay > 0) {
+				logger->debug("Shard {} reconnecting in {:.2f}s (attempt {})", shard_id, delay, reconnect_attempts);
+				std::this_thread::sleep_for(std::chrono::duration<double>(delay));
+			}
+			/* Resume on the host discord gave us for this session, otherwise go back to the main gateway */
+			hostname = (!sessionid.empty() && !resume_host.empty()) ? resume_host : creator->gateway_host;
+			identify_pending = false;
+			reidentify_at = std::chrono::steady_clock::time_point();
+			heartbeat_acked = true;
+			/* No heartbeats until op 10 on the new connection gives us the interval */
+			heartbeat_interval = 0;
+			/* The gateway rate limit is per connection, and anything queued was meant for the old one */
+			{
+				std::lock_guard<std::mutex> lock(send_mutex);
+				for (auto & q : send_queue) {
+					q.clear();
+				}
+			}
+			send_limiter.reset();
+			connect_started = std::chrono::steady_clock::now();
+			time_to_ready = 0;
+			try {
+				SSLClient::Connect();
+				WSClient::Connect();
+				connected = true;
+			}
+			catch (const std::exception &e) {
+				logger->error("Shard {} could not connect to {}: {}", shard_id, hostname, e.what());
+				SSLClient::close();
+				/* If the resume host is unreachable, the main gateway can still resume the session */
+				resume_host = "";
+			}
+		}
 	} while(true);
 }
 
@@ -49,7 +154,7 @@ void DiscordClient::Run()
 bool DiscordClient::HandleFrame(const std::string &buffer)
 {
 	logger->trace("R: {}", buffer);
-	json j = json::parse(buffer);
+	json j = dpp::json_parse(buffer, creator->json_parser);
 
 	if (j.find("s") != j.end() && !j["s"].is_null()) {
 		last_seq = j["s"].get<uint64_t>();
@@ -59,58 +164,38 @@ bool DiscordClient::HandleFrame(const std::string &buffer)
 		uint32_t op = j["op"];
 
 		switch (op) {
-			case 9:
-				/* Reset session state and fall through to 9 */
-				op = 10;
-				logger->debug("Failed to resume session {}, will reidentify", sessionid);
-				this->sessionid = "";
-				this->last_seq = 0;
-				/* No break here, falls through to state 10 to cause a reidentify */
+			case 9: {
+				/* Invalid session. If d is true the session can still be resumed, otherwise reset
+				 * session state so that falling through to op 10 causes a reidentify.
+				 */
+				bool resumable = j.find("d") != j.end() && j["d"].is_boolean() && j["d"].get<bool>();
+				if (!resumable) {
+					logger->debug("Failed to resume session {}, will reidentify", sessionid);
+					this->sessionid = "";
+					this->resume_host = "";
+					this->last_seq = 0;
+				}
+				/* Discord asks for a random wait of between 1 and 5 seconds before trying again.
+				 * Tick() starts the session when it is over, so that this thread isn't held up.
+				 */
+				reidentify_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::uniform_int_distribution<int>(1000, 5000)(jitter));
+				[[fallthrough]];
+			}
 			case 10:
 				/* Need to check carefully for the existence of this before we try to access it! */
 				if (j.find("d") != j.end() && j["d"].find("heartbeat_interval") != j["d"].end() && !j["d"]["heartbeat_interval"].is_null()) {
 					this->heartbeat_interval = j["d"]["heartbeat_interval"].get<uint32_t>();
 				}
 
-				if (last_seq && !sessionid.empty()) {
-					/* Resume */
-					logger->debug("Resuming session {} with seq={}", sessionid, last_seq);
-					json obj = {
-						{ "op", 6 },
-						{ "d", {
-								{"token", this->token },
-								{"session_id", this->sessionid },
-								{"seq", this->last_seq }
-							}
-						}
-					};
-					this->write(obj.dump());
-				} else {
-					/* Full connect */
-					logger->debug("Connecting new session...");
-						json obj = {
-						{ "op", 2 },
-						{
-							"d",
-							{
-								{ "token", this->token },
-								{ "properties",
-									{
-										{ "$os", "Linux" },
-										{ "$browser", "D++" },
-										{ "$device", "D++" }
-									}
-								},
-								{ "shard", json::array({ shard_id, max_shards }) },
-								{ "compress", false },
-								{ "large_threshold", 250 }
-							}
-						}
-					};
-					if (this->intents) {
-						obj["d"]["intents"] = this->intents;
-					}
-					this->write(obj.dump());
+				/* A new connection starts with nothing waiting to be acknowledged. Discord asks for the
+				 * first heartbeat to be sent after a random fraction of the interval, so that shards
+				 * which connected together don't all heartbeat together.
+				 */
+				heartbeat_acked = true;
+				next_heartbeat = std::chrono::steady_clock::now() + std::chrono::milliseconds((uint64_t)(heartbeat_interval * std::uniform_real_distribution<double>(0, 1)(jitter)));
+
+				if (reidentify_at == std::chrono::steady_clock::time_point()) {
+					StartSession();
 				}
 			break;
 			case 0: {
@@ -120,42 +205,337 @@ bool DiscordClient::HandleFrame(const std::string &buffer)
 			}
 			break;
 			case 7:
+				/* The session stays valid, so we reconnect straight away and resume it */
 				logger->debug("Reconnection requested, closing socket {}", sessionid);
-				::close(sfd);
+				reconnect_now = true;
+				reconnect_attempts = 0;
+				Shutdown();
+			break;
+			case 1:
+				/* Discord wants a heartbeat straight away */
+				Heartbeat();
+			break;
+			case 11:
+				/* Heartbeat ACK. The connection is alive, so any earlier reconnect backoff is over */
+				if (!heartbeat_acked) {
+					double rtt = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - last_heartbeat).count();
+					std::lock_guard<std::mutex> lock(stats_mutex);
+					stats.heartbeat_acks++;
+					stats.last_rtt = rtt;
+					stats.rtt.record(rtt);
+				}
+				heartbeat_acked = true;
+				reconnect_attempts = 0;
 			break;
 		}
 	}
 	return true;
 }
 
+void DiscordClient::StartSession()
+{
+	if (last_seq && !sessionid.empty()) {
+		/* Resume */
+		logger->debug("Resuming session {} with seq={}", sessionid, last_seq);
+		json obj = {
+			{ "op", 6 },
+			{ "d", {
+					{"token", this->token },
+					{"session_id", this->sessionid },
+					{"seq", this->last_seq }
+				}
+			}
+		};
+		Send(obj.dump(), dpp::rp_critical);
+	} else {
+		/* Full connect */
+		Identify();
+	}
+}
+
+void DiscordClient::Identify()
+{
+	if (!creator->acquire_identify(shard_id)) {
+		if (!identify_pending) {
+			logger->debug("Shard {} waiting for an identify slot", shard_id);
+		}
+		identify_pending = true;
+		return;
+	}
+	identify_pending = false;
+	logger->debug("Connecting new session...");
+	json obj = {
+		{ "op", 2 },
+		{
+			"d",
+			{
+				{ "token", this->token },
+				{ "properties",
+					{
+						{ "$os", "Linux" },
+						{ "$browser", "D++" },
+						{ "$device", "D++" }
+					}
+				},
+				{ "shard", json::array({ shard_id, max_shards }) },
+				{ "compress", false },
+				{ "large_threshold", 250 }
+			}
+		}
+	};
+	if (this->intents) {
+		obj["d"]["intents"] = this->intents;
+	}
+	Send(obj.dump(), dpp::rp_critical);
+	identified = true;
+}
+
 void DiscordClient::Error(uint32_t errorcode)
 {
 	logger->debug("OOF! Error from underlying websocket: {}", errorcode);
+	close_code = errorcode;
+}
+
+void DiscordClient::Heartbeat()
+{
+	logger->debug("Emit heartbeat, seq={}", last_seq);
+	Send(json({{"op", 1}, {"d", last_seq}}).dump(), dpp::rp_critical);
+	heartbeat_acked = false;
+	last_heartbeat = std::chrono::steady_clock::now();
+	next_heartbeat = last_heartbeat + std::chrono::milliseconds(heartbeat_interval);
+	{
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		stats.heartbeats_sent++;
+	}
+	dpp::garbage_collection();
+}
+
+void DiscordClient::QueueMessage(const std::string &data, dpp::rate_priority priority)
+{
+	std::lock_guard<std::mutex> lock(send_mutex);
+	if (!send_queue[priority].empty() || send_limiter.wait_time(priority) > 0) {
+		std::lock_guard<std::mutex> slock(stats_mutex);
+		stats.gateway_limited[priority]++;
+	}
+	send_queue[priority].push_back(data);
+}
+
+void DiscordClient::Send(const std::string &data, dpp::rate_priority priority)
+{
+	QueueMessage(data, priority);
+	FlushSendQueue();
+}
+
+void DiscordClient::FlushSendQueue()
+{
+	/* Until IDENTIFY or RESUME has gone out, only those and heartbeats may be sent */
+	bool session_started = this->GetState() == CONNECTED && heartbeat_interval && !identify_pending && reidentify_at == std::chrono::steady_clock::time_point();
+	std::lock_guard<std::mutex> lock(send_mutex);
+	for (size_t p = 0; p < RATE_PRIORITIES; ++p) {
+		dpp::rate_priority priority = (dpp::rate_priority)p;
+		if (priority != dpp::rp_critical && !session_started) {
+			return;
+		}
+		while (!send_queue[p].empty()) {
+			/* Lower priorities wait until everything above them is sent */
+			if (!send_limiter.try_acquire(priority)) {
+				return;
+			}
+			this->write(send_queue[p].front());
+			send_queue[p].pop_front();
+			std::lock_guard<std::mutex> slock(stats_mutex);
+			stats.gateway_sent[p]++;
+		}
+	}
+}
+
+void DiscordClient::Tick()
+{
+	if (reidentify_at != std::chrono::steady_clock::time_point() && std::chrono::steady_clock::now() >= reidentify_at) {
+		reidentify_at = std::chrono::steady_clock::time_point();
+		if (this->GetState() == CONNECTED) {
+			StartSession();
+		}
+	}
+	FlushSendQueue();
+	if (this->GetState() == CONNECTED && this->heartbeat_interval && std::chrono::steady_clock::now() >= next_heartbeat) {
+		if (!heartbeat_acked) {
+			/* No ACK since the last heartbeat: the connection is a zombie. Drop it and resume. */
+			logger->warn("Shard {} missed a heartbeat ACK, reconnecting", shard_id);
+			{
+				std::lock_guard<std::mutex> lock(stats_mutex);
+				stats.missed_acks++;
+			}
+			heartbeat_interval = 0;
+			Shutdown();
+			return;
+		}
+		Heartbeat();
+	}
+}
+
+dpp::shard_stats DiscordClient::get_stats()
+{
+	dpp::shard_stats s;
+	{
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		s = stats;
+	}
+	s.connected = (this->GetState() == CONNECTED);
+	s.time_to_ready = time_to_ready;
+	{
+		std::lock_guard<std::mutex> lock(send_mutex);
+		for (auto & q : send_queue) {
+			s.gateway_queued += q.size();
+		}
+	}
+	std::lock_guard<std::mutex> lock(chunk_mutex);
+	s.chunk_guilds_queued = chunk_queue.size();
+	s.chunk_guilds_loading = chunks_loading.size();
+	return s;
 }
 
 void DiscordClient::OneSecondTimer()
 {
 	if (this->GetState() == CONNECTED) {
-		if (this->heartbeat_interval) {
-			/* Check if we're due to emit a heartbeat */
-			if (time(NULL) > last_heartbeat + ((heartbeat_interval / 1000.0) * 0.75)) {
-				logger->debug("Emit heartbeat, seq={}", last_seq);
-				this->write(json({{"op", 1}, {"d", last_seq}}).dump());
-				last_heartbeat = time(NULL);
-				dpp::garbage_collection();
+		if (identify_pending) {
+			Identify();
+		}
+		/* Rate limited chunk requests, 1 every odd second, 2 every even second, each for a batch of guilds */
+		{
+			std::lock_guard<std::mutex> lock(chunk_mutex);
+			for (int x = 0; x < (time(NULL) % 2) + 1 && chunk_queue.size(); ++x) {
+				SendChunkRequest();
 			}
 		}
-		/* Rate limited chunk requests, 1 every odd second, 2 every even second */
-		for (int x = 0; x < (time(NULL) % 2) + 1; ++x) {
-			if (chunk_queue.size()) {
-				uint64_t next_guild_chunk = chunk_queue.front();
-				chunk_queue.pop();
-				json chunk_req = json({{"op", 8}, {"d", {{"guild_id",std::to_string(next_guild_chunk)},{"query",""},{"limit",0}}}});
-				if (this->intents & dpp::GUILD_PRESENCES) {
-					chunk_req["d"]["presences"] = true;
-				}
-				this->write(chunk_req.dump());
+		ExpireChunkRequests();
+	}
+	uint64_t members_per_second;
+	{
+		std::lock_guard<std::mutex> lock(chunk_mutex);
+		members_per_second = chunk_members_this_second;
+		chunk_members_this_second = 0;
+	}
+	std::lock_guard<std::mutex> lock(stats_mutex);
+	stats.chunk_members_per_second = members_per_second;
+}
+
+void DiscordClient::SendChunkRequest()
+{
+	/* The nonce identifies our requests' chunks, and must be at most 32 characters */
+	std::string nonce = std::to_string(shard_id) + "-" + std::to_string(++chunk_nonce);
+	uint32_t batch = std::max(creator->chunk_batch_size, 1U);
+	auto now = std::chrono::steady_clock::now();
+	json guild_ids = json::array();
+	while (guild_ids.size() < batch && chunk_queue.size()) {
+		uint64_t id = chunk_queue.front();
+		chunk_queue.pop_front();
+		guild_ids.push_back(std::to_string(id));
+		chunks_loading[id] = { nonce, 0, 0, now };
+	}
+	/* A single guild is sent as a plain id, as it always was; more than one are sent as an array */
+	json chunk_req = json({{"op", 8}, {"d", {{"guild_id", guild_ids.size() == 1 ? guild_ids[0] : guild_ids},{"query",""},{"limit",0},{"nonce",nonce}}}});
+	if (this->intents & dpp::GUILD_PRESENCES) {
+		chunk_req["d"]["presences"] = true;
+	}
+	QueueMessage(chunk_req.dump(), dpp::rp_low);
+}
+
+void DiscordClient::ExpireChunkRequests()
+{
+	std::vector<dpp::guild_members_loaded_t> expired;
+	{
+		std::lock_guard<std::mutex> lock(chunk_mutex);
+		auto cutoff = std::chrono::steady_clock::now() - std::chrono::seconds(creator->chunk_timeout);
+		for (auto i = chunks_loading.begin(); i != chunks_loading.end();) {
+			if (i->second.last_activity < cutoff) {
+				logger->warn("Shard {} gave up waiting for member chunks of guild {}", shard_id, i->first);
+				dpp::guild_members_loaded_t l = {};
+				l.guild_id = i->first;
+				l.shard_id = shard_id;
+				l.member_count = i->second.members;
+				l.timed_out = true;
+				expired.push_back(l);
+				i = chunks_loading.erase(i);
+			} else {
+				++i;
 			}
 		}
+		for (auto & l : expired) {
+			l.guilds_pending = chunk_queue.size() + chunks_loading.size();
+		}
+	}
+	for (auto & l : expired) {
+		l.loaded = dpp::find_guild(l.guild_id);
+		if (creator->dispatch.guild_members_loaded) {
+			creator->dispatch.guild_members_loaded(l);
+		}
+	}
+}
+
+void DiscordClient::add_chunk_queue(uint64_t id, bool priority)
+{
+	std::lock_guard<std::mutex> lock(chunk_mutex);
+	if (chunks_loading.find(id) != chunks_loading.end()) {
+		return;
+	}
+	auto queued = std::find(chunk_queue.begin(), chunk_queue.end(), id);
+	if (queued != chunk_queue.end()) {
+		if (!priority) {
+			return;
+		}
+		chunk_queue.erase(queued);
+	}
+	if (priority) {
+		chunk_queue.push_front(id);
+	} else {
+		chunk_queue.push_back(id);
+	}
+}
+
+void DiscordClient::prioritise_chunk(uint64_t id)
+{
+	std::lock_guard<std::mutex> lock(chunk_mutex);
+	if (chunk_queue.empty() || chunk_queue.front() == id) {
+		return;
+	}
+	auto queued = std::find(chunk_queue.begin(), chunk_queue.end(), id);
+	if (queued != chunk_queue.end()) {
+		chunk_queue.erase(queued);
+		chunk_queue.push_front(id);
+	}
+}
+
+void DiscordClient::chunk_received(uint64_t guild_id, const std::string &nonce, uint32_t chunk_count, uint32_t member_count)
+{
+	dpp::guild_members_loaded_t l = {};
+	{
+		std::lock_guard<std::mutex> lock(chunk_mutex);
+		chunk_members_this_second += member_count;
+		auto progress = chunks_loading.find(guild_id);
+		/* Chunks for requests we didn't make (or gave up on) aren't tracked */
+		if (progress == chunks_loading.end() || progress->second.nonce != nonce) {
+			return;
+		}
+		progress->second.chunks_received++;
+		progress->second.members += member_count;
+		progress->second.last_activity = std::chrono::steady_clock::now();
+		if (progress->second.chunks_received < chunk_count) {
+			return;
+		}
+		l.guild_id = guild_id;
+		l.shard_id = shard_id;
+		l.member_count = progress->second.members;
+		chunks_loading.erase(progress);
+		l.guilds_pending = chunk_queue.size() + chunks_loading.size();
+	}
+	{
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		stats.chunk_guilds_loaded++;
+		stats.chunk_members_loaded += l.member_count;
+	}
+	l.loaded = dpp::find_guild(guild_id);
+	if (creator->dispatch.guild_members_loaded) {
+		creator->dispatch.guild_members_loaded(l);
 	}
 }
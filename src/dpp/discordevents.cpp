@@ -1,4 +1,3 @@
-#define _XOPEN_SOURCE
 #include <string>
 #include <iostream>
 #include <fstream>
@@ -10,69 +9,106 @@
 #include <dpp/stringops.h>
 #include <spdlog/spdlog.h>
 
-#ifdef _WIN32
-#include <time.h>
-#include <iomanip>
-#include <sstream>
-
-char* strptime(const char* s, const char* f, struct tm* tm) {
-	std::istringstream input(s);
-	input.imbue(std::locale(setlocale(LC_ALL, nullptr)));
-	input >> std::get_time(tm, f);
-	if (input.fail()) {
-		return nullptr;
-	}
-	return (char*)(s + input.tellg());
-}
-#endif
-
 uint64_t SnowflakeNotNull(json* j, const char *keyname)
 {
-	return j->find(keyname) != j->end() && !(*j)[keyname].is_null() && (*j)[keyname].is_string() ? from_string<uint64_t>((*j)[keyname].get<std::string>(), std::dec) : 0;
+	auto k = j->find(keyname);
+	/* get_ref avoids copying the string out of the json object */
+	return k != j->end() && k->is_string() ? from_string<uint64_t>(k->get_ref<const std::string&>(), std::dec) : 0;
 }
 
 std::string StringNotNull(json* j, const char *keyname)
 {
-	return j->find(keyname) != j->end() && !(*j)[keyname].is_null() && (*j)[keyname].is_string() ? (*j)[keyname].get<std::string>() : "";
+	auto k = j->find(keyname);
+	return k != j->end() && k->is_string() ? k->get<std::string>() : "";
 }
 
 uint32_t Int32NotNull(json* j, const char *keyname)
 {
-	return j->find(keyname) != j->end() && !(*j)[keyname].is_null() && !(*j)[keyname].is_string() ? (*j)[keyname].get<uint32_t>() : 0;
+	auto k = j->find(keyname);
+	return k != j->end() && !k->is_null() && !k->is_string() ? k->get<uint32_t>() : 0;
 }
 
 uint16_t Int16NotNull(json* j, const char *keyname)
 {
-	return j->find(keyname) != j->end() && !(*j)[keyname].is_null() && !(*j)[keyname].is_string() ? (*j)[keyname].get<uint16_t>() : 0;
+	auto k = j->find(keyname);
+	return k != j->end() && !k->is_null() && !k->is_string() ? k->get<uint16_t>() : 0;
 }
 
 uint8_t Int8NotNull(json* j, const char *keyname)
 {
-	return j->find(keyname) != j->end() && !(*j)[keyname].is_null() && !(*j)[keyname].is_string() ? (*j)[keyname].get<uint8_t>() : 0;
+	auto k = j->find(keyname);
+	return k != j->end() && !k->is_null() && !k->is_string() ? k->get<uint8_t>() : 0;
 }
 
 bool BoolNotNull(json* j, const char *keyname)
 {
-	return (j->find(keyname) != j->end() && !(*j)[keyname].is_null() && (*j)[keyname].get<bool>() == true);
+	auto k = j->find(keyname);
+	return (k != j->end() && !k->is_null() && k->get<bool>() == true);
+}
+
+/* Read exactly n decimal digits at p, returning -1 if any of them isn't a digit */
+static inline int fixed_digits(const char* p, int n)
+{
+	int v = 0;
+	for (int i = 0; i < n; ++i) {
+		if (p[i] < '0' || p[i] > '9') {
+			return -1;
+		}
+		v = v * 10 + (p[i] - '0');
+	}
+	return v;
+}
+
+/* Days since 1970-01-01 for a date in the proleptic gregorian calendar.
+ * See http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+ */
+static inline int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+	y -= m <= 2;
+	const int64_t era = (y >= 0 ? y : y - 399) / 400;
+	const unsigned yoe = (unsigned)(y - era * 400);
+	const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (int64_t)doe - 719468;
 }
 
 time_t TimestampNotNull(json* j, const char* keyname)
 {
-	/* Parses discord ISO 8061 timestamps to time_t, accounting for local time adjustment.
-	 * Note that discord timestamps contain a decimal seconds part, which time_t and struct tm
-	 * can't handle. We strip these out.
+	/* Parses discord ISO 8601 timestamps such as 2021-04-16T14:21:07.123000+00:00 directly to a UTC time_t.
+	 * Note that discord timestamps contain a decimal seconds part, which time_t can't hold. We skip over it.
+	 * The calendar maths is done here rather than with mktime(), which would apply the local timezone.
 	 */
-	time_t retval = 0;
-	if (j->find(keyname) != j->end() && !(*j)[keyname].is_null() && (*j)[keyname].is_string()) {
-		tm timestamp;
-		std::string timedate = (*j)[keyname].get<std::string>();
-		std::string tzpart = timedate.substr(timedate.find('+'), timedate.length());
-		timedate = timedate.substr(0, timedate.find('.')) + tzpart ;
-		strptime(timedate.substr(0, 19).c_str(), "%FT%TZ%z", &timestamp);
-		timestamp.tm_isdst = 0;
-		retval = mktime(&timestamp);
+	auto k = j->find(keyname);
+	if (k == j->end() || !k->is_string()) {
+		return 0;
+	}
+	const std::string &ts = k->get_ref<const std::string&>();
+	const char* p = ts.c_str();
+	const char* e = p + ts.length();
+	if (ts.length() < 19 || p[4] != '-' || p[7] != '-' || (p[10] != 'T' && p[10] != ' ') || p[13] != ':' || p[16] != ':') {
+		return 0;
+	}
+	int year = fixed_digits(p, 4), month = fixed_digits(p + 5, 2), day = fixed_digits(p + 8, 2);
+	int hour = fixed_digits(p + 11, 2), minute = fixed_digits(p + 14, 2), second = fixed_digits(p + 17, 2);
+	if (year < 0 || month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || minute < 0 || second < 0) {
+		return 0;
 	}
-	return retval;
+	int64_t retval = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+	p += 19;
+	if (p < e && *p == '.') {
+		do {
+			++p;
+		} while (p < e && *p >= '0' && *p <= '9');
+	}
+	/* Timezone offset, +HH:MM or -HH:MM, or 'Z' for UTC */
+	if (e - p >= 6 && (*p == '+' || *p == '-') && p[3] == ':') {
+		int tzh = fixed_digits(p + 1, 2), tzm = fixed_digits(p + 4, 2);
+		if (tzh >= 0 && tzm >= 0) {
+			int64_t offset = tzh * 3600 + tzm * 60;
+			retval += (*p == '+' ? -offset : offset);
+		}
+	}
+	return (time_t)retval;
 }
 
 std::map<std::string, event*> events = {
@@ -129,8 +165,4 @@ void DiscordClient::HandleEvent(const std::string &event, json &j)
 	}
 }
 
-void DiscordClient::add_chunk_queue(uint64_t id)
-{
-	chunk_queue.push(id);
-}
 
@@ -14,7 +14,14 @@ using json = nlohmann::json;
 
 void guild_members_chunk::handle(class DiscordClient* client, json &j) {
 	json &d = j["d"];
-	dpp::guild* g = dpp::find_guild(SnowflakeNotNull(&d, "guild_id"));
+	dpp::guild_members_chunk_t gmc = {};
+	gmc.guild_id = SnowflakeNotNull(&d, "guild_id");
+	gmc.chunk_index = Int32NotNull(&d, "chunk_index");
+	gmc.chunk_count = Int32NotNull(&d, "chunk_count");
+	gmc.member_count = d["members"].size();
+	gmc.nonce = StringNotNull(&d, "nonce");
+	dpp::guild* g = dpp::find_guild(gmc.guild_id);
+	gmc.adding = g;
 	if (g) {
 		/* Store guild members */
 		for (auto & userrec : d["members"]) {
@@ -30,5 +37,11 @@ void guild_members_chunk::handle(class DiscordClient* client, json &j) {
 			g->members[u->id] = gm;
 		}
 	}
+	/* The members are cached now, so the parsed chunk can go before the next one arrives */
+	d["members"] = json();
+	if (client->creator->dispatch.guild_members_chunk) {
+		client->creator->dispatch.guild_members_chunk(gmc);
+	}
+	client->chunk_received(gmc.guild_id, gmc.nonce, gmc.chunk_count, gmc.member_count);
 }
 
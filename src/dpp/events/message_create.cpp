@@ -15,13 +15,28 @@ using json = nlohmann::json;
 
 void message_create::handle(class DiscordClient* client, json &j) {
 
-	json d = j["d"];
-	dpp::message_create_t msg;
-	dpp::message m;
-	m.fill_from_json(&d);	
-	msg.msg = &m;
+	json& d = j["d"];
+	dpp::message_view v(&d);
 
-	if (client->creator->dispatch.message_create)
+	/* A guild with people talking in it is one whose members are likely to be wanted soon */
+	if (client->intents & dpp::GUILD_MEMBERS) {
+		client->prioritise_chunk(SnowflakeNotNull(&d, "guild_id"));
+	}
+
+	if (client->creator->dispatch.message_create_view) {
+		dpp::message_create_view_t mv;
+		mv.view = &v;
+		client->creator->dispatch.message_create_view(mv);
+	}
+
+	if (client->creator->dispatch.message_create) {
+		dpp::message_create_t msg;
+		dpp::message m;
+		m.fill_from_json(&d);
+		msg.msg = &m;
 		client->creator->dispatch.message_create(msg);
+	} else {
+		/* Nothing decoded the message, but keep the author and member caches populated as before */
+		v.member();
+	}
 }
-
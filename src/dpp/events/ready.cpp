@@ -7,17 +7,23 @@
 #include <dpp/discord.h>
 #include <dpp/cache.h>
 #include <dpp/stringops.h>
+#include <dpp/discordevents.h>
 #include <spdlog/spdlog.h>
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
 
 void ready::handle(class DiscordClient* client, json &j) {
-	client->logger->info("Shard {}/{} ready!", client->shard_id, client->max_shards);
+	client->time_to_ready = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - client->connect_started).count();
+	client->logger->info("Shard {}/{} ready in {}ms", client->shard_id, client->max_shards, client->time_to_ready);
 	client->sessionid = j["d"]["session_id"];
+	/* Cached so that a reconnect can resume straight to the right gateway host */
+	std::string resume_url = StringNotNull(&j["d"], "resume_gateway_url");
+	client->resume_host = resume_url.empty() ? "" : url_host(resume_url);
 	dpp::ready_t r;
 	r.session_id = client->sessionid;
 	r.shard_id = client->shard_id;
+	r.time_to_ready = client->time_to_ready;
 	if (client->creator->dispatch.ready)
 		client->creator->dispatch.ready(r);
 
@@ -90,7 +90,7 @@ guild_member& guild_member::fill_from_json(nlohmann::json* j, const guild* g, co
 	this->joined_at = TimestampNotNull(j, "joined_at");
 	this->premium_since = TimestampNotNull(j, "premium_since");
 	for (auto & role : (*j)["roles"]) {
-		this->roles.push_back(from_string<uint64_t>(role.get<std::string>(), std::dec));
+		this->roles.push_back(from_string<uint64_t>(role.get_ref<const std::string&>(), std::dec));
 	}
 	this->flags |= BoolNotNull(j, "deaf") ? dpp::gm_deaf : 0;
 	this->flags |= BoolNotNull(j, "mute") ? dpp::gm_mute : 0;
@@ -170,40 +170,44 @@ bool guild::is_preview_enabled() const {
 	return this->flags & g_preview_enabled;
 }
 
-std::string guild::build_json(bool with_id) const {
-	json j;
+void guild::write_json(json_writer &w, bool with_id) const {
+	w.begin_object();
 	if (with_id) {
-		j["id"] = std::to_string(id);
+		w.key("id").snowflake(id);
 	}
 	if (!name.empty()) {
-		j["name"] = name;
-	}
-	j["widget_enabled"] = widget_enabled();
-	if (afk_channel_id) {
-		j["afk_channel_id"] = afk_channel_id;
+		w.field("name", name);
 	}
+	w.field("widget_enabled", widget_enabled());
 	if (afk_channel_id) {
-		j["afk_timeout"] = afk_timeout;
+		w.field("afk_channel_id", afk_channel_id);
+		w.field("afk_timeout", afk_timeout);
 	}
 	if (widget_enabled()) {
-		j["widget_channel_id"] = widget_channel_id;
+		w.field("widget_channel_id", widget_channel_id);
 	}
-	j["default_message_notifications"] = default_message_notifications;
-	j["explicit_content_filter"] = explicit_content_filter;
-	j["mfa_level"] = mfa_level;
+	w.field("default_message_notifications", default_message_notifications);
+	w.field("explicit_content_filter", explicit_content_filter);
+	w.field("mfa_level", mfa_level);
 	if (system_channel_id) {
-		j["system_channel_id"] = system_channel_id;
+		w.field("system_channel_id", system_channel_id);
 	}
 	if (rules_channel_id) {
-		j["rules_channel_id"] = rules_channel_id;
+		w.field("rules_channel_id", rules_channel_id);
 	}
 	if (!vanity_url_code.empty()) {
-		j["vanity_url_code"] = vanity_url_code;
+		w.field("vanity_url_code", vanity_url_code);
 	}
 	if (!description.empty()) {
-		j["description"] = description;
+		w.field("description", description);
 	}
-	return j.dump();
+	w.end_object();
+}
+
+std::string guild::build_json(bool with_id) const {
+	json_writer &w = json_writer::reusable();
+	write_json(w, with_id);
+	return w.str();
 }
 
 guild& guild::fill_from_json(nlohmann::json* d) {
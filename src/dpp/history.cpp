@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <dpp/history.h>
+#include <dpp/cluster.h>
+
+namespace dpp {
+
+message_history::message_history(cluster* _owner, snowflake _channel_id, snowflake _before, uint32_t _page_size, uint32_t _window)
+	: owner(_owner), channel_id(_channel_id), before(_before), page_size(std::min(std::max(_page_size, 1u), (uint32_t)HISTORY_PAGE_MAX)), window(std::max(_window, 1u)), fetching(false), finished(false)
+{
+}
+
+bool message_history::start_fetch(snowflake &cursor)
+{
+	if (fetching || finished || pages.size() >= window) {
+		return false;
+	}
+	fetching = true;
+	cursor = before;
+	return true;
+}
+
+void message_history::fetch(snowflake cursor)
+{
+	auto self = shared_from_this();
+	/* History is read in bulk, so it gives way to other requests for the channel */
+	owner->messages_get(channel_id, 0, cursor, 0, page_size, [self](const confirmation_callback_t &cc) {
+		history_page page;
+		page.http_info = cc.http_info;
+		if (cc.http_info.error == h_success && cc.http_info.status < 400) {
+			const message_map &messages = std::get<message_map>(cc.value);
+			page.messages.reserve(messages.size());
+			for (auto & m : messages) {
+				page.messages.push_back(m.second);
+			}
+			std::sort(page.messages.begin(), page.messages.end(), [](const message &a, const message &b) {
+				return a.id > b.id;
+			});
+		}
+		self->received(std::move(page));
+	}, rp_low);
+}
+
+void message_history::received(history_page &&page)
+{
+	std::vector<std::pair<history_page_event_t, history_page>> ready;
+	snowflake cursor = 0;
+	bool more;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		fetching = false;
+		/* A short page is the last one, as is a failed one */
+		if (page.messages.size() < page_size) {
+			page.end = true;
+			finished = true;
+		} else {
+			before = page.messages.back().id;
+		}
+		if (!waiting.empty()) {
+			ready.emplace_back(std::move(waiting.front()), std::move(page));
+			waiting.pop_front();
+		} else {
+			pages.push_back(std::move(page));
+		}
+		if (finished) {
+			/* Nothing more is coming for anyone else waiting */
+			while (!waiting.empty()) {
+				history_page last;
+				last.end = true;
+				last.http_info = ready.front().second.http_info;
+				ready.emplace_back(std::move(waiting.front()), std::move(last));
+				waiting.pop_front();
+			}
+		}
+		more = start_fetch(cursor);
+	}
+	if (more) {
+		fetch(cursor);
+	}
+	for (auto & r : ready) {
+		if (r.first) {
+			r.first(r.second);
+		}
+	}
+}
+
+void message_history::next(history_page_event_t callback)
+{
+	history_page page;
+	snowflake cursor = 0;
+	bool more;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!pages.empty()) {
+			page = std::move(pages.front());
+			pages.pop_front();
+		} else if (finished) {
+			page.end = true;
+		} else {
+			waiting.push_back(std::move(callback));
+			callback = nullptr;
+		}
+		/* Taking a page makes room in the window */
+		more = start_fetch(cursor);
+	}
+	if (more) {
+		fetch(cursor);
+	}
+	if (callback) {
+		callback(page);
+	}
+}
+
+bool message_history::done()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return finished && pages.empty();
+}
+
+};
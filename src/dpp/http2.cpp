@@ -0,0 +1,503 @@
+#ifdef DPP_HTTP2
+
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <algorithm>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <nghttp2/nghttp2.h>
+#include <dpp/http2.h>
+
+namespace dpp {
+
+/* Streams the server may have open to us at once. Replies are small, so this only matters for the SETTINGS frame. */
+#define HTTP2_MAX_CONCURRENT_STREAMS 100
+
+/* Size of the blocks the socket is read in */
+#define HTTP2_READ_SIZE 16384
+
+/* Builds a name/value pair for nghttp2 from strings which outlive the call it is passed to */
+static nghttp2_nv make_nv(const std::string &name, const std::string &value)
+{
+	return { (uint8_t*)name.c_str(), (uint8_t*)value.c_str(), name.length(), value.length(), NGHTTP2_NV_FLAG_NONE };
+}
+
+/* Reads a request body out of its stream for nghttp2, as it fits into DATA frames */
+static ssize_t read_body(nghttp2_session*, int32_t, uint8_t* buf, size_t length, uint32_t* data_flags, nghttp2_data_source* source, void*)
+{
+	http2_stream* s = (http2_stream*)source->ptr;
+	size_t n = std::min(length, s->body.length() - s->body_sent);
+	memcpy(buf, s->body.data() + s->body_sent, n);
+	s->body_sent += n;
+	if (s->body_sent == s->body.length()) {
+		*data_flags |= NGHTTP2_DATA_FLAG_EOF;
+	}
+	return (ssize_t)n;
+}
+
+struct http2_callbacks {
+	static int on_header(nghttp2_session* session, const nghttp2_frame* frame, const uint8_t* name, size_t namelen, const uint8_t* value, size_t valuelen, uint8_t, void*)
+	{
+		if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_RESPONSE) {
+			return 0;
+		}
+		http2_stream* s = (http2_stream*)nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+		if (!s) {
+			return 0;
+		}
+		std::string n((const char*)name, namelen), v((const char*)value, valuelen);
+		if (n == ":status") {
+			s->status = atoi(v.c_str());
+			/* An informational reply is followed by the real one, whose headers replace its own */
+			s->reply_headers.clear();
+		} else {
+			s->reply_headers.emplace_back(std::move(n), std::move(v));
+		}
+		return 0;
+	}
+
+	static int on_frame_recv(nghttp2_session* session, const nghttp2_frame* frame, void* user_data)
+	{
+		http2_connection* c = (http2_connection*)user_data;
+		if (frame->hd.type == NGHTTP2_GOAWAY) {
+			/* Streams after the last one the server will process are closed as refused by nghttp2 */
+			c->going_away = true;
+			return 0;
+		}
+		if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_RESPONSE) {
+			return 0;
+		}
+		http2_stream* s = (http2_stream*)nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+		if (s && s->status >= 200 && !s->canceled && s->on_headers && !s->on_headers(s->status, s->reply_headers)) {
+			s->canceled = true;
+			nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, frame->hd.stream_id, NGHTTP2_CANCEL);
+		}
+		return 0;
+	}
+
+	static int on_frame_send(nghttp2_session* session, const nghttp2_frame* frame, void*)
+	{
+		if (frame->hd.type == NGHTTP2_HEADERS) {
+			http2_stream* s = (http2_stream*)nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+			if (s) {
+				s->sent = true;
+			}
+		}
+		return 0;
+	}
+
+	static int on_data_chunk_recv(nghttp2_session* session, uint8_t, int32_t stream_id, const uint8_t* data, size_t len, void*)
+	{
+		http2_stream* s = (http2_stream*)nghttp2_session_get_stream_user_data(session, stream_id);
+		if (s && !s->canceled && s->on_data && !s->on_data((const char*)data, len)) {
+			s->canceled = true;
+			nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CANCEL);
+		}
+		return 0;
+	}
+
+	static int on_stream_close(nghttp2_session* session, int32_t stream_id, uint32_t error_code, void* user_data)
+	{
+		http2_connection* c = (http2_connection*)user_data;
+		http2_stream* s = (http2_stream*)nghttp2_session_get_stream_user_data(session, stream_id);
+		if (!s) {
+			return 0;
+		}
+		c->live.erase(s);
+		http_error error = h_success;
+		if (s->canceled) {
+			error = h_canceled;
+		} else if (error_code == NGHTTP2_REFUSED_STREAM || !s->sent) {
+			/* The server didn't act on it, so it is as if it was never sent */
+			error = h_connection;
+		} else if (error_code != NGHTTP2_NO_ERROR) {
+			error = h_read;
+		}
+		if (s->on_close) {
+			s->on_close(error);
+		}
+		delete s;
+		return 0;
+	}
+};
+
+http2_connection::http2_connection(const std::string &url) : tls(true), fd(-1), wake{-1, -1}, ctx(nullptr), ssl(nullptr), session(nullptr), runner(nullptr), open(false), going_away(false), closing(false), stopping(false), done(false)
+{
+	std::string rest = url;
+	size_t scheme = rest.find("://");
+	if (scheme != std::string::npos) {
+		tls = rest.substr(0, scheme) != "http";
+		rest = rest.substr(scheme + 3);
+	}
+	rest = rest.substr(0, rest.find('/'));
+	authority = rest;
+	size_t colon = rest.rfind(':');
+	if (colon != std::string::npos && rest.find(']', colon) == std::string::npos) {
+		host = rest.substr(0, colon);
+		port = rest.substr(colon + 1);
+	} else {
+		host = rest;
+		port = tls ? "443" : "80";
+	}
+	/* An IPv6 literal is bracketed in the url, but not for getaddrinfo() */
+	if (host.length() > 1 && host[0] == '[') {
+		host = host.substr(1, host.length() - 2);
+	}
+}
+
+http2_connection::~http2_connection()
+{
+	stopping = true;
+	if (runner) {
+		if (write(wake[1], "X", 1) < 0) {
+			/* The thread is woken by the socket closing instead */
+			shutdown(fd, SHUT_RDWR);
+		}
+		runner->join();
+		delete runner;
+	}
+	for (auto s : pending) {
+		delete s;
+	}
+	/* Streams still open belong to the session, which holds them as user data, so are freed from live */
+	for (auto s : live) {
+		delete s;
+	}
+	if (session) {
+		nghttp2_session_del(session);
+	}
+	if (ssl) {
+		SSL_free(ssl);
+	}
+	if (ctx) {
+		SSL_CTX_free(ctx);
+	}
+	if (fd != -1) {
+		::close(fd);
+	}
+	for (int w : wake) {
+		if (w != -1) {
+			::close(w);
+		}
+	}
+}
+
+bool http2_connection::connect(bool &refused)
+{
+	refused = false;
+	struct addrinfo hints = {}, *addrs = nullptr;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs) != 0) {
+		return false;
+	}
+	for (struct addrinfo* a = addrs; a && fd == -1; a = a->ai_next) {
+		fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (fd != -1 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+			::close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(addrs);
+	if (fd == -1) {
+		return false;
+	}
+	/* Frames are written as nghttp2 makes them, and shouldn't wait for earlier ones to be ACKed */
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (tls) {
+		ctx = SSL_CTX_new(TLS_client_method());
+		if (!ctx) {
+			return false;
+		}
+		/* As for the HTTP/1.1 client: some systems have really out of date cert stores */
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+		SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+		static const unsigned char alpn[] = { 2, 'h', '2' };
+		SSL_CTX_set_alpn_protos(ctx, alpn, sizeof(alpn));
+		ssl = SSL_new(ctx);
+		if (!ssl) {
+			return false;
+		}
+		SSL_set_tlsext_host_name(ssl, host.c_str());
+		SSL_set_fd(ssl, fd);
+		if (SSL_connect(ssl) != 1) {
+			return false;
+		}
+		const unsigned char* chosen = nullptr;
+		unsigned int chosen_length = 0;
+		SSL_get0_alpn_selected(ssl, &chosen, &chosen_length);
+		if (chosen_length != 2 || memcmp(chosen, "h2", 2) != 0) {
+			refused = true;
+			return false;
+		}
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	if (pipe(wake) != 0) {
+		return false;
+	}
+	fcntl(wake[0], F_SETFL, fcntl(wake[0], F_GETFL, 0) | O_NONBLOCK);
+
+	nghttp2_session_callbacks* callbacks;
+	if (nghttp2_session_callbacks_new(&callbacks) != 0) {
+		return false;
+	}
+	nghttp2_session_callbacks_set_on_header_callback(callbacks, http2_callbacks::on_header);
+	nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, http2_callbacks::on_frame_recv);
+	nghttp2_session_callbacks_set_on_frame_send_callback(callbacks, http2_callbacks::on_frame_send);
+	nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, http2_callbacks::on_data_chunk_recv);
+	nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, http2_callbacks::on_stream_close);
+	int rv = nghttp2_session_client_new(&session, callbacks, this);
+	nghttp2_session_callbacks_del(callbacks);
+	if (rv != 0) {
+		session = nullptr;
+		return false;
+	}
+	nghttp2_settings_entry settings[] = { { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, HTTP2_MAX_CONCURRENT_STREAMS } };
+	nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, settings, sizeof(settings) / sizeof(settings[0]));
+
+	open = true;
+	runner = new std::thread(&http2_connection::run, this);
+	return true;
+}
+
+long http2_connection::io_read(char* data, size_t length)
+{
+	if (ssl) {
+		int r = SSL_read(ssl, data, (int)length);
+		if (r > 0) {
+			return r;
+		}
+		switch (SSL_get_error(ssl, r)) {
+			case SSL_ERROR_WANT_READ:
+			case SSL_ERROR_WANT_WRITE:
+				return -1;
+			case SSL_ERROR_ZERO_RETURN:
+				return 0;
+			default:
+				return -2;
+		}
+	}
+	ssize_t r = ::recv(fd, data, length, 0);
+	if (r >= 0) {
+		return r;
+	}
+	return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? -1 : -2;
+}
+
+long http2_connection::io_write(const char* data, size_t length)
+{
+	if (ssl) {
+		int r = SSL_write(ssl, data, (int)length);
+		if (r > 0) {
+			return r;
+		}
+		int e = SSL_get_error(ssl, r);
+		return (e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE) ? -1 : -2;
+	}
+	ssize_t r = ::send(fd, data, length, MSG_NOSIGNAL);
+	if (r >= 0) {
+		return r;
+	}
+	return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? -1 : -2;
+}
+
+bool http2_connection::flush()
+{
+	while (true) {
+		if (outbuf.empty()) {
+			const uint8_t* data;
+			ssize_t n = nghttp2_session_mem_send(session, &data);
+			if (n < 0) {
+				return false;
+			}
+			if (n == 0) {
+				return true;
+			}
+			outbuf.assign((const char*)data, n);
+		}
+		long w = io_write(outbuf.data(), outbuf.length());
+		if (w == -1) {
+			/* The rest goes when the socket can take it */
+			return true;
+		}
+		if (w < 0) {
+			return false;
+		}
+		outbuf.erase(0, w);
+	}
+}
+
+void http2_connection::start_stream(http2_stream* s)
+{
+	std::vector<nghttp2_nv> nva;
+	static const std::string method = ":method", scheme = ":scheme", authority_name = ":authority", path = ":path";
+	static const std::string https = "https", http = "http";
+	std::string length = std::to_string(s->body.length());
+	static const std::string content_length = "content-length";
+	nva.push_back(make_nv(method, s->method));
+	nva.push_back(make_nv(scheme, tls ? https : http));
+	nva.push_back(make_nv(authority_name, authority));
+	nva.push_back(make_nv(path, s->path));
+	for (auto & h : s->headers) {
+		nva.push_back(make_nv(h.first, h.second));
+	}
+	nghttp2_data_provider body;
+	body.source.ptr = s;
+	body.read_callback = read_body;
+	if (!s->body.empty()) {
+		nva.push_back(make_nv(content_length, length));
+	}
+	int32_t id = nghttp2_submit_request(session, nullptr, nva.data(), nva.size(), s->body.empty() ? nullptr : &body, s);
+	if (id < 0) {
+		if (s->on_close) {
+			s->on_close(h_connection);
+		}
+		delete s;
+		return;
+	}
+	live.insert(s);
+}
+
+void http2_connection::run()
+{
+	/* A write to a connection the server has dropped then fails with EPIPE, rather than killing the process */
+	sigset_t sigpipe;
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+	char buffer[HTTP2_READ_SIZE];
+	bool failed = false;
+	while (!stopping) {
+		std::vector<http2_stream*> starting;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			starting.swap(pending);
+		}
+		for (auto s : starting) {
+			if (going_away) {
+				/* The server won't take new streams, so these were never sent */
+				if (s->on_close) {
+					s->on_close(h_connection);
+				}
+				delete s;
+			} else {
+				start_stream(s);
+			}
+		}
+		if ((closing || going_away) && live.empty()) {
+			nghttp2_session_terminate_session(session, NGHTTP2_NO_ERROR);
+			flush();
+			break;
+		}
+		if (!flush()) {
+			failed = true;
+			break;
+		}
+		if (!nghttp2_session_want_read(session) && !nghttp2_session_want_write(session) && outbuf.empty()) {
+			break;
+		}
+
+		struct pollfd fds[2] = { { fd, (short)(POLLIN | (outbuf.empty() ? 0 : POLLOUT)), 0 }, { wake[0], POLLIN, 0 } };
+		/* TLS may hold decrypted data the socket no longer shows as readable */
+		if (!(ssl && SSL_pending(ssl)) && poll(fds, 2, -1) < 0 && errno != EINTR) {
+			failed = true;
+			break;
+		}
+		if (fds[1].revents) {
+			while (read(wake[0], buffer, sizeof(buffer)) > 0);
+		}
+		if (fds[0].revents || (ssl && SSL_pending(ssl))) {
+			long r;
+			while ((r = io_read(buffer, sizeof(buffer))) > 0) {
+				if (nghttp2_session_mem_recv(session, (const uint8_t*)buffer, r) < 0) {
+					r = -2;
+					break;
+				}
+			}
+			if (r == 0 || r == -2) {
+				failed = true;
+				break;
+			}
+		}
+	}
+
+	std::vector<http2_stream*> unsent;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		open = false;
+		unsent.swap(pending);
+	}
+	if (stopping) {
+		pending.swap(unsent);
+	} else {
+		/* The connection was lost or closed: nothing more will arrive for any stream still open */
+		for (auto s : unsent) {
+			if (s->on_close) {
+				s->on_close(h_connection);
+			}
+			delete s;
+		}
+		for (auto s : live) {
+			if (s->on_close) {
+				s->on_close(failed && s->sent ? h_read : h_connection);
+			}
+			delete s;
+		}
+		live.clear();
+	}
+	done = true;
+}
+
+void http2_connection::submit(http2_stream* s)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (open) {
+			pending.push_back(s);
+			if (write(wake[1], "X", 1) < 0) {
+				/* The pipe is full, so the thread has wakes waiting already */
+			}
+			return;
+		}
+	}
+	if (s->on_close) {
+		s->on_close(h_connection);
+	}
+	delete s;
+}
+
+bool http2_connection::is_open()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return open && !going_away && !closing;
+}
+
+void http2_connection::close()
+{
+	closing = true;
+	if (runner && write(wake[1], "X", 1) < 0) {
+		/* The pipe is full, so the thread has wakes waiting already */
+	}
+}
+
+bool http2_connection::finished() const
+{
+	return !runner || done;
+}
+
+};
+
+#endif
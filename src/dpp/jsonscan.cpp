@@ -0,0 +1,737 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <charconv>
+#include <nlohmann/json.hpp>
+#include <dpp/jsonscan.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define DPP_JSON_X86
+#include <immintrin.h>
+#endif
+
+using json = nlohmann::json;
+
+namespace dpp {
+
+/* Documents nested deeper than this are handed to nlohmann::json instead */
+const int JSON_MAX_DEPTH = 1024;
+
+/* Bitmasks of the interesting characters within a 64 byte block of input,
+ * one bit per byte, least significant bit first.
+ */
+struct block_masks {
+	uint64_t quote;
+	uint64_t backslash;
+	uint64_t op;
+};
+
+typedef void (*classify_t)(const char* block, block_masks &m);
+
+static void classify_scalar(const char* block, block_masks &m)
+{
+	m.quote = m.backslash = m.op = 0;
+	for (int i = 0; i < 64; ++i) {
+		switch (block[i]) {
+			case '"':
+				m.quote |= 1ULL << i;
+			break;
+			case '\\':
+				m.backslash |= 1ULL << i;
+			break;
+			case '{': case '}': case '[': case ']': case ':': case ',':
+				m.op |= 1ULL << i;
+			break;
+		}
+	}
+}
+
+#ifdef DPP_JSON_X86
+/* SSE4.2 string instructions match the six structural characters in one go, 16 bytes at a time */
+__attribute__((target("sse4.2"))) static void classify_sse42(const char* block, block_masks &m)
+{
+	const __m128i ops = _mm_setr_epi8('{', '}', '[', ']', ':', ',', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	m.quote = m.backslash = m.op = 0;
+	for (int i = 0; i < 4; ++i) {
+		__m128i in = _mm_loadu_si128((const __m128i*)(block + i * 16));
+		__m128i op = _mm_cmpestrm(ops, 6, in, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+		m.op |= (uint64_t)(_mm_cvtsi128_si32(op) & 0xffff) << (i * 16);
+		m.quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(in, quote)) << (i * 16);
+		m.backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(in, backslash)) << (i * 16);
+	}
+}
+
+/* AVX2 compares 32 bytes against each character of interest */
+__attribute__((target("avx2"))) static void classify_avx2(const char* block, block_masks &m)
+{
+	m.quote = m.backslash = m.op = 0;
+	for (int i = 0; i < 2; ++i) {
+		__m256i in = _mm256_loadu_si256((const __m256i*)(block + i * 32));
+		__m256i op = _mm256_or_si256(
+			_mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(in, _mm256_set1_epi8('}'))),
+				_mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('[')), _mm256_cmpeq_epi8(in, _mm256_set1_epi8(']')))
+			),
+			_mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(in, _mm256_set1_epi8(',')))
+		);
+		m.op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << (i * 32);
+		m.quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('"'))) << (i * 32);
+		m.backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('\\'))) << (i * 32);
+	}
+}
+#endif
+
+struct json_scanner {
+	classify_t classify;
+	const char* name;
+};
+
+/* Pick the widest classifier this CPU supports, once, on first use */
+static const json_scanner& get_scanner()
+{
+	static const json_scanner scanner = []() -> json_scanner {
+#ifdef DPP_JSON_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			return { classify_avx2, "avx2" };
+		}
+		if (__builtin_cpu_supports("sse4.2")) {
+			return { classify_sse42, "sse4.2" };
+		}
+#endif
+		return { classify_scalar, "scalar" };
+	}();
+	return scanner;
+}
+
+const char* json_scanner_name()
+{
+	return get_scanner().name;
+}
+
+static inline int trailing_zeroes(uint64_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(v);
+#else
+	int n = 0;
+	while (!(v & 1)) {
+		v >>= 1;
+		++n;
+	}
+	return n;
+#endif
+}
+
+/* Each set bit in the result is the xor of all bits at or below it in the input.
+ * For a mask of unescaped quotes this gives a mask of the bytes inside strings.
+ */
+static inline uint64_t prefix_xor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+/* Returns a mask of the characters escaped by an odd length run of backslashes.
+ * Runs are found with carries: adding the start of a run to the run itself carries
+ * through to the byte after it, and the parity of where it started tells us if it is odd.
+ * prev_odd carries a run that ends at the last byte of a block over into the next block.
+ */
+static inline uint64_t find_escaped(uint64_t backslash, uint64_t &prev_odd)
+{
+	const uint64_t even_bits = 0x5555555555555555ULL;
+	const uint64_t odd_bits = ~even_bits;
+	uint64_t start_edges = backslash & ~(backslash << 1);
+	uint64_t even_start_mask = even_bits ^ prev_odd;
+	uint64_t even_starts = start_edges & even_start_mask;
+	uint64_t odd_starts = start_edges & ~even_start_mask;
+	uint64_t even_carries = backslash + even_starts;
+	uint64_t odd_carries = backslash + odd_starts;
+	bool ends_odd = odd_carries < backslash;
+	odd_carries |= prev_odd;
+	prev_odd = ends_odd ? 1 : 0;
+	uint64_t even_carry_ends = even_carries & ~backslash;
+	uint64_t odd_carry_ends = odd_carries & ~backslash;
+	return (even_carry_ends & odd_bits) | (odd_carry_ends & even_bits);
+}
+
+bool json_structural_index(const char* buffer, size_t length, std::vector<uint32_t> &index)
+{
+	const json_scanner& scanner = get_scanner();
+	uint64_t prev_odd_backslash = 0, prev_in_string = 0;
+	char tail[64];
+
+	index.clear();
+	if (length > UINT32_MAX) {
+		return false;
+	}
+	for (size_t base = 0; base < length; base += 64) {
+		const char* block = buffer + base;
+		if (length - base < 64) {
+			/* Pad the last partial block with whitespace */
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, block, length - base);
+			block = tail;
+		}
+		block_masks m;
+		scanner.classify(block, m);
+		uint64_t quotes = m.quote & ~find_escaped(m.backslash, prev_odd_backslash);
+		uint64_t in_string = prefix_xor(quotes) ^ prev_in_string;
+		prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+		uint64_t structurals = (m.op & ~in_string) | quotes;
+		while (structurals) {
+			index.push_back((uint32_t)(base + trailing_zeroes(structurals)));
+			structurals &= structurals - 1;
+		}
+	}
+	return prev_in_string == 0;
+}
+
+static inline bool is_json_space(char c)
+{
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static bool read_hex4(const char* p, const char* e, uint32_t &out)
+{
+	if (e - p < 4) {
+		return false;
+	}
+	out = 0;
+	for (int i = 0; i < 4; ++i) {
+		char c = p[i];
+		out <<= 4;
+		if (c >= '0' && c <= '9') {
+			out |= c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			out |= c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			out |= c - 'A' + 10;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void append_utf8(std::string &out, uint32_t cp)
+{
+	if (cp < 0x80) {
+		out += (char)cp;
+	} else if (cp < 0x800) {
+		out += (char)(0xC0 | (cp >> 6));
+		out += (char)(0x80 | (cp & 0x3F));
+	} else if (cp < 0x10000) {
+		out += (char)(0xE0 | (cp >> 12));
+		out += (char)(0x80 | ((cp >> 6) & 0x3F));
+		out += (char)(0x80 | (cp & 0x3F));
+	} else {
+		out += (char)(0xF0 | (cp >> 18));
+		out += (char)(0x80 | ((cp >> 12) & 0x3F));
+		out += (char)(0x80 | ((cp >> 6) & 0x3F));
+		out += (char)(0x80 | (cp & 0x3F));
+	}
+}
+
+/* Decode the escape sequences in the string content between p and e */
+static bool unescape(const char* p, const char* e, std::string &out)
+{
+	out.clear();
+	out.reserve(e - p);
+	while (p < e) {
+		const char* bs = (const char*)memchr(p, '\\', e - p);
+		if (!bs) {
+			out.append(p, e - p);
+			break;
+		}
+		out.append(p, bs - p);
+		p = bs + 1;
+		if (p >= e) {
+			return false;
+		}
+		switch (*p++) {
+			case '"': out += '"'; break;
+			case '\\': out += '\\'; break;
+			case '/': out += '/'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u': {
+				uint32_t cp, low;
+				if (!read_hex4(p, e, cp)) {
+					return false;
+				}
+				p += 4;
+				if (cp >= 0xD800 && cp <= 0xDBFF) {
+					/* High surrogate, must be followed by an escaped low surrogate */
+					if (e - p < 6 || p[0] != '\\' || p[1] != 'u' || !read_hex4(p + 2, e, low) || low < 0xDC00 || low > 0xDFFF) {
+						return false;
+					}
+					p += 6;
+					cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+				} else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+					return false;
+				}
+				append_utf8(out, cp);
+			}
+			break;
+			default:
+				return false;
+		}
+	}
+	return true;
+}
+
+/* Checks the raw content of a string for what JSON forbids there: unescaped control characters,
+ * and bytes which aren't well formed UTF-8 (overlong forms, surrogates, and code points past
+ * U+10FFFF included), all of which nlohmann rejects. Escapes are plain ASCII, so they pass.
+ */
+static bool valid_string(const char* p, const char* e)
+{
+	const uint64_t spaces = 0x2020202020202020ULL;
+	const uint64_t high_bits = 0x8080808080808080ULL;
+	while (p < e) {
+		/* Skip eight bytes at a time while they are all printable ASCII. Subtracting 0x20 from
+		 * each byte only sets its high bit, or borrows from the next, if it was below 0x20.
+		 */
+		while (e - p >= 8) {
+			uint64_t v;
+			memcpy(&v, p, 8);
+			if (((v - spaces) | v) & high_bits) {
+				break;
+			}
+			p += 8;
+		}
+		if (p >= e) {
+			break;
+		}
+		unsigned char c = (unsigned char)*p;
+		if (c < 0x20) {
+			return false;
+		}
+		if (c < 0x80) {
+			++p;
+			continue;
+		}
+		/* Well formed sequences per RFC 3629. The first continuation byte has a narrower range after some lead bytes. */
+		int n;
+		unsigned char lo = 0x80, hi = 0xBF;
+		if (c >= 0xC2 && c <= 0xDF) {
+			n = 1;
+		} else if (c >= 0xE0 && c <= 0xEF) {
+			n = 2;
+			if (c == 0xE0) {
+				lo = 0xA0;
+			} else if (c == 0xED) {
+				hi = 0x9F;
+			}
+		} else if (c >= 0xF0 && c <= 0xF4) {
+			n = 3;
+			if (c == 0xF0) {
+				lo = 0x90;
+			} else if (c == 0xF4) {
+				hi = 0x8F;
+			}
+		} else {
+			return false;
+		}
+		if (e - p <= n) {
+			return false;
+		}
+		unsigned char c1 = (unsigned char)p[1];
+		if (c1 < lo || c1 > hi) {
+			return false;
+		}
+		for (int i = 2; i <= n; ++i) {
+			if (((unsigned char)p[i] & 0xC0) != 0x80) {
+				return false;
+			}
+		}
+		p += n + 1;
+	}
+	return true;
+}
+
+/* Checks a literal against the JSON number grammar */
+static bool valid_number(const char* p, const char* e, bool &integer)
+{
+	integer = true;
+	if (p < e && *p == '-') {
+		++p;
+	}
+	if (p >= e) {
+		return false;
+	}
+	if (*p == '0') {
+		++p;
+	} else if (*p >= '1' && *p <= '9') {
+		while (p < e && *p >= '0' && *p <= '9') {
+			++p;
+		}
+	} else {
+		return false;
+	}
+	if (p < e && *p == '.') {
+		integer = false;
+		const char* digits = ++p;
+		while (p < e && *p >= '0' && *p <= '9') {
+			++p;
+		}
+		if (p == digits) {
+			return false;
+		}
+	}
+	if (p < e && (*p == 'e' || *p == 'E')) {
+		integer = false;
+		++p;
+		if (p < e && (*p == '+' || *p == '-')) {
+			++p;
+		}
+		const char* digits = p;
+		while (p < e && *p >= '0' && *p <= '9') {
+			++p;
+		}
+		if (p == digits) {
+			return false;
+		}
+	}
+	return p == e;
+}
+
+static bool parse_double(const char* p, const char* e, double &out)
+{
+#if defined(__cpp_lib_to_chars)
+	return std::from_chars(p, e, out).ec == std::errc();
+#else
+	/* strtod is locale dependent, so only use it on a copy we know has a '.' point */
+	std::string copy(p, e);
+	char* end = nullptr;
+	out = strtod(copy.c_str(), &end);
+	return end == copy.c_str() + copy.length();
+#endif
+}
+
+/* Second stage of the jb_simd backend. Walks the structural index building an
+ * nlohmann::json tree. Strings are validated and then copied straight out of the buffer
+ * between their quotes, and scalars are whatever lies between two structural characters.
+ * Any error returns false, and the caller falls back to nlohmann's parser which
+ * will report it properly.
+ */
+class tree_builder {
+	const char* buf;
+	size_t len;
+	const std::vector<uint32_t> &idx;
+	/* Next entry in idx to consume */
+	size_t pos;
+	/* Offset just past the last value parsed */
+	size_t last;
+	int depth;
+
+	size_t skip_space(size_t p) {
+		while (p < len && is_json_space(buf[p])) {
+			++p;
+		}
+		return p;
+	}
+
+	/* True if the next structural is c, with only whitespace between it and offset 'from' */
+	bool next_is(size_t from, char c) {
+		return pos < idx.size() && buf[idx[pos]] == c && skip_space(from) == idx[pos];
+	}
+
+	bool string(std::string &out) {
+		if (pos + 1 >= idx.size() || buf[idx[pos + 1]] != '"') {
+			return false;
+		}
+		const char* p = buf + idx[pos] + 1;
+		const char* e = buf + idx[pos + 1];
+		last = idx[pos + 1] + 1;
+		pos += 2;
+		if (!valid_string(p, e)) {
+			return false;
+		}
+		if (memchr(p, '\\', e - p) == nullptr) {
+			out.assign(p, e - p);
+			return true;
+		}
+		return unescape(p, e, out);
+	}
+
+	bool scalar(json &out, size_t p) {
+		size_t e = pos < idx.size() ? idx[pos] : len;
+		last = e;
+		while (e > p && is_json_space(buf[e - 1])) {
+			--e;
+		}
+		const char* s = buf + p;
+		size_t n = e - p;
+		if (n == 4 && memcmp(s, "true", 4) == 0) {
+			out = true;
+		} else if (n == 5 && memcmp(s, "false", 5) == 0) {
+			out = false;
+		} else if (n == 4 && memcmp(s, "null", 4) == 0) {
+			out = nullptr;
+		} else {
+			bool integer;
+			if (!valid_number(s, s + n, integer)) {
+				return false;
+			}
+			if (integer) {
+				if (*s == '-') {
+					int64_t v;
+					if (std::from_chars(s, s + n, v).ec == std::errc()) {
+						out = v;
+						return true;
+					}
+				} else {
+					uint64_t v;
+					if (std::from_chars(s, s + n, v).ec == std::errc()) {
+						out = v;
+						return true;
+					}
+				}
+				/* Out of range integers become floating point, as with nlohmann */
+			}
+			double d;
+			if (!parse_double(s, s + n, d)) {
+				return false;
+			}
+			out = d;
+		}
+		return true;
+	}
+
+	bool object(json &out) {
+		out = json::object();
+		size_t p = idx[pos++] + 1;
+		if (next_is(p, '}')) {
+			last = idx[pos++] + 1;
+			return true;
+		}
+		std::string key;
+		while (true) {
+			if (!next_is(p, '"') || !string(key) || !next_is(last, ':')) {
+				return false;
+			}
+			p = idx[pos++] + 1;
+			if (!value(out[std::move(key)], p)) {
+				return false;
+			}
+			if (next_is(last, ',')) {
+				p = idx[pos++] + 1;
+			} else if (next_is(last, '}')) {
+				last = idx[pos++] + 1;
+				return true;
+			} else {
+				return false;
+			}
+		}
+	}
+
+	bool array(json &out) {
+		out = json::array();
+		size_t p = idx[pos++] + 1;
+		if (next_is(p, ']')) {
+			last = idx[pos++] + 1;
+			return true;
+		}
+		while (true) {
+			out.push_back(json());
+			if (!value(out.back(), p)) {
+				return false;
+			}
+			if (next_is(last, ',')) {
+				p = idx[pos++] + 1;
+			} else if (next_is(last, ']')) {
+				last = idx[pos++] + 1;
+				return true;
+			} else {
+				return false;
+			}
+		}
+	}
+
+	bool value(json &out, size_t p) {
+		p = skip_space(p);
+		if (p >= len) {
+			return false;
+		}
+		char c = buf[p];
+		if (c == '{' || c == '[' || c == '"') {
+			if (pos >= idx.size() || idx[pos] != p) {
+				return false;
+			}
+			if (c == '"') {
+				std::string s;
+				if (!string(s)) {
+					return false;
+				}
+				out = std::move(s);
+				return true;
+			}
+			if (++depth > JSON_MAX_DEPTH) {
+				return false;
+			}
+			bool ok = (c == '{' ? object(out) : array(out));
+			--depth;
+			return ok;
+		}
+		return scalar(out, p);
+	}
+
+public:
+	tree_builder(const char* _buf, size_t _len, const std::vector<uint32_t> &_idx) : buf(_buf), len(_len), idx(_idx), pos(0), last(0), depth(0)
+	{
+	}
+
+	bool document(json &out) {
+		return value(out, 0) && pos == idx.size() && skip_space(last) == len;
+	}
+};
+
+json json_parse(const char* buffer, size_t length, json_backend backend)
+{
+	if (backend == jb_simd) {
+		/* Reused per thread so that steady state parsing doesn't allocate an index */
+		thread_local std::vector<uint32_t> index;
+		json j;
+		if (json_structural_index(buffer, length, index)) {
+			tree_builder builder(buffer, length, index);
+			if (builder.document(j)) {
+				return j;
+			}
+		}
+		/* Malformed, or something we don't handle. Let nlohmann::json decide, and throw if it is bad */
+	}
+	return json::parse(buffer, buffer + length);
+}
+
+json json_parse(const std::string &buffer, json_backend backend)
+{
+	return json_parse(buffer.data(), buffer.length(), backend);
+}
+
+/* Called with a fault found by json_array_parser, to throw the parse_error nlohmann gives for
+ * it. The parser doesn't keep the text it has been given, so a short text with the same fault
+ * stands in for it, e.g. "[}" for a brace closing the array.
+ */
+static void report_parse_error(const std::string &malformed)
+{
+	json discarded = json::parse(malformed);
+}
+
+json_array_parser::json_array_parser(std::function<void(json&)> _element, json_backend _backend)
+	: element(std::move(_element)), backend(_backend), state(ap_start), depth(0), elements(0), in_string(false), escaped(false), content(false)
+{
+}
+
+void json_array_parser::emit(const char* start, const char* end)
+{
+	json j;
+	if (pending.empty()) {
+		j = json_parse(start, end - start, backend);
+	} else {
+		pending.append(start, end - start);
+		j = json_parse(pending.data(), pending.length(), backend);
+		/* clear() keeps the capacity, so it is reused for the next split element */
+		pending.clear();
+	}
+	elements++;
+	element(j);
+}
+
+void json_array_parser::feed(const char* data, size_t length)
+{
+	const char* end = data + length;
+	/* Start of the current element within this part */
+	const char* start = data;
+	for (const char* p = data; p < end; ++p) {
+		char c = *p;
+		if (state == ap_array) {
+			if (in_string) {
+				if (escaped) {
+					escaped = false;
+				} else if (c == '\\') {
+					escaped = true;
+				} else if (c == '"') {
+					in_string = false;
+				}
+			} else if (c == '"') {
+				in_string = true;
+				content = true;
+			} else if (c == '[' || c == '{') {
+				depth++;
+				content = true;
+			} else if (c == ']' || c == '}') {
+				if (--depth > 0) {
+					content = true;
+					continue;
+				}
+				if (c != ']') {
+					report_parse_error("[}");
+				}
+				/* Only [] has nothing before its closing bracket. After a comma, emit() reports the error. */
+				if (content || elements) {
+					emit(start, p);
+				}
+				state = ap_end;
+			} else if (c == ',' && depth == 1) {
+				/* Elements are separated by the commas at depth 1 */
+				emit(start, p);
+				start = p + 1;
+				content = false;
+			} else if (!is_json_space(c)) {
+				content = true;
+			}
+		} else if (state == ap_start) {
+			if (is_json_space(c)) {
+				continue;
+			}
+			if (c != '[') {
+				state = ap_not_array;
+				return;
+			}
+			state = ap_array;
+			depth = 1;
+			start = p + 1;
+		} else if (state == ap_end) {
+			if (!is_json_space(c)) {
+				report_parse_error(std::string("[]") + c);
+			}
+		} else {
+			return;
+		}
+	}
+	/* Keep the start of an element which continues in the next part */
+	if (state == ap_array) {
+		pending.append(start, end - start);
+	}
+}
+
+bool json_array_parser::finish()
+{
+	if (state == ap_array) {
+		/* The array was never closed */
+		report_parse_error("[");
+	}
+	return state == ap_end;
+}
+
+bool json_parse_array(const std::string &buffer, const std::function<void(json&)> &element, json_backend backend)
+{
+	json_array_parser parser(element, backend);
+	parser.feed(buffer.data(), buffer.length());
+	return parser.finish();
+}
+
+};
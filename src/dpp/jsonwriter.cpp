@@ -0,0 +1,210 @@
+#include <string>
+#include <algorithm>
+#include <nlohmann/json.hpp>
+#include <dpp/jsonwriter.h>
+
+namespace dpp {
+
+/* Length of the well formed UTF-8 sequence starting at s[i], or 0 if there isn't one there.
+ * Overlong forms, surrogates and code points past U+10FFFF aren't well formed.
+ */
+static size_t utf8_length(std::string_view s, size_t i)
+{
+	unsigned char c = (unsigned char)s[i];
+	size_t n;
+	uint32_t cp;
+	if (c >= 0xc2 && c <= 0xdf) {
+		n = 2;
+		cp = c & 0x1f;
+	} else if (c >= 0xe0 && c <= 0xef) {
+		n = 3;
+		cp = c & 0x0f;
+	} else if (c >= 0xf0 && c <= 0xf4) {
+		n = 4;
+		cp = c & 0x07;
+	} else {
+		return 0;
+	}
+	if (i + n > s.length()) {
+		return 0;
+	}
+	for (size_t k = 1; k < n; ++k) {
+		unsigned char cc = (unsigned char)s[i + k];
+		if ((cc & 0xc0) != 0x80) {
+			return 0;
+		}
+		cp = (cp << 6) | (cc & 0x3f);
+	}
+	if ((n == 3 && (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff))) || (n == 4 && (cp < 0x10000 || cp > 0x10ffff))) {
+		return 0;
+	}
+	return n;
+}
+
+/* Called with a string which isn't valid UTF-8, to throw the type_error nlohmann's dump()
+ * gives for it, so that callers see the same exception either way.
+ */
+static void report_invalid_utf8(std::string_view s)
+{
+	std::string discarded = nlohmann::json(std::string(s)).dump();
+}
+
+json_writer::json_writer(size_t reserve) : need_comma(false)
+{
+	out.reserve(reserve);
+}
+
+json_writer& json_writer::reusable()
+{
+	thread_local json_writer writer(4096);
+	writer.clear();
+	return writer;
+}
+
+void json_writer::separator()
+{
+	if (need_comma) {
+		out += ',';
+	}
+}
+
+void json_writer::quote(std::string_view s)
+{
+	static const char hex[] = "0123456789abcdef";
+	out += '"';
+	size_t start = 0;
+	for (size_t i = 0; i < s.length(); ++i) {
+		unsigned char c = (unsigned char)s[i];
+		if (c >= 0x80) {
+			size_t n = utf8_length(s, i);
+			if (n == 0) {
+				report_invalid_utf8(s);
+			}
+			i += std::max<size_t>(n, 1) - 1;
+			continue;
+		}
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+		/* Copy the run of characters that need no escaping in one go */
+		out.append(s.data() + start, i - start);
+		start = i + 1;
+		switch (c) {
+			case '"': out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\b': out += "\\b"; break;
+			case '\f': out += "\\f"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				out += "\\u00";
+				out += hex[c >> 4];
+				out += hex[c & 0xf];
+			break;
+		}
+	}
+	out.append(s.data() + start, s.length() - start);
+	out += '"';
+}
+
+json_writer& json_writer::begin_object()
+{
+	separator();
+	out += '{';
+	need_comma = false;
+	return *this;
+}
+
+json_writer& json_writer::end_object()
+{
+	out += '}';
+	need_comma = true;
+	return *this;
+}
+
+json_writer& json_writer::begin_array()
+{
+	separator();
+	out += '[';
+	need_comma = false;
+	return *this;
+}
+
+json_writer& json_writer::end_array()
+{
+	out += ']';
+	need_comma = true;
+	return *this;
+}
+
+json_writer& json_writer::key(std::string_view k)
+{
+	separator();
+	quote(k);
+	out += ':';
+	need_comma = false;
+	return *this;
+}
+
+json_writer& json_writer::value(std::string_view s)
+{
+	separator();
+	quote(s);
+	need_comma = true;
+	return *this;
+}
+
+json_writer& json_writer::value(const char* s)
+{
+	return value(std::string_view(s));
+}
+
+json_writer& json_writer::value(bool b)
+{
+	separator();
+	out += (b ? "true" : "false");
+	need_comma = true;
+	return *this;
+}
+
+json_writer& json_writer::null()
+{
+	separator();
+	out += "null";
+	need_comma = true;
+	return *this;
+}
+
+json_writer& json_writer::snowflake(uint64_t id)
+{
+	char buf[24];
+	separator();
+	auto r = std::to_chars(buf, buf + sizeof(buf), id);
+	out += '"';
+	out.append(buf, r.ptr - buf);
+	out += '"';
+	need_comma = true;
+	return *this;
+}
+
+void json_writer::clear()
+{
+	out.clear();
+	need_comma = false;
+}
+
+const std::string& json_writer::str() const
+{
+	return out;
+}
+
+std::string json_writer::release()
+{
+	std::string s = std::move(out);
+	out.clear();
+	need_comma = false;
+	return s;
+}
+
+};
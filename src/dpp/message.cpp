@@ -146,94 +146,103 @@ embed& embed::set_url(const std::string &u) {
 	return *this;
 }
 
-std::string message::build_json(bool with_id) const {
+void embed::write_json(json_writer &w) const {
+	w.begin_object();
+	if (!description.empty()) {
+		w.field("description", description);
+	}
+	if (!title.empty()) {
+		w.field("title", title);
+	}
+	if (!url.empty()) {
+		w.field("url", url);
+	}
+	w.field("color", color);
+	if (footer.has_value()) {
+		w.key("footer").begin_object().field("text", footer->text).field("icon_url", footer->icon_url).end_object();
+	}
+	if (image.has_value()) {
+		w.key("image").begin_object().field("url", image->url).end_object();
+	}
+	if (thumbnail.has_value()) {
+		w.key("thumbnail").begin_object().field("url", thumbnail->url).end_object();
+	}
+	if (author.has_value()) {
+		w.key("author").begin_object().field("name", author->name).field("url", author->url).field("icon_url", author->icon_url).end_object();
+	}
+	if (fields.size()) {
+		w.key("fields").begin_array();
+		for (auto& field : fields) {
+			w.begin_object().field("name", field.name).field("value", field.value).field("inline", field.is_inline).end_object();
+		}
+		w.end_array();
+	}
+	w.end_object();
+}
+
+void message::write_json(json_writer &w, bool with_id) const {
 	/* This is the basics. once it works, expand on it. */
-	json j({
-		{"content", content},
-		{"channel_id", channel_id},
-		{"tts", tts},
-		{"nonce", nonce}
-	});
+	w.begin_object();
+	w.field("content", content);
+	w.field("channel_id", channel_id);
+	w.field("tts", tts);
+	w.field("nonce", nonce);
 	if (with_id) {
-		j["id"] = std::to_string(id);
+		w.key("id").snowflake(id);
 	}
+	/* Sending embeds only accepts the first entry */
 	if (embeds.size()) {
-		for (auto& embed : embeds) {
-			json e;
-			if (!embed.description.empty())
-				e["description"] = embed.description;
-			if (!embed.title.empty())
-				e["title"] = embed.title;
-			if (!embed.url.empty())
-				e["url"] = embed.url;
-			e["color"] = embed.color;
-			if (embed.footer.has_value()) {
-				e["footer"]["text"] = embed.footer->text;
-				e["footer"]["icon_url"] = embed.footer->icon_url;
-			}
-			if (embed.image.has_value()) {
-				e["image"]["url"] = embed.image->url;
-			}
-			if (embed.thumbnail.has_value()) {
-				e["thumbnail"]["url"] = embed.thumbnail->url;
-			}
-			if (embed.author.has_value()) {
-				e["author"]["name"] = embed.author->name;
-				e["author"]["url"] = embed.author->url;
-				e["author"]["icon_url"] = embed.author->icon_url;
-			}
-			if (embed.fields.size()) {
-				e["fields"] = json();
-				for (auto& field : embed.fields) {
-					json f({ {"name", field.name}, {"value", field.value}, {"inline", field.is_inline} });
-					e["fields"].push_back(f);
-				}
-			}
+		w.key("embed");
+		embeds[0].write_json(w);
+	}
+	w.end_object();
+}
 
-			/* Sending embeds only accepts the first entry */
-			j["embed"] = e;
-			break;
-		}
+std::string message::build_json(bool with_id) const {
+	json_writer &w = json_writer::reusable();
+	write_json(w, with_id);
+	return w.str();
+}
+
+/* Find the author of a message in the cache. If they're not there yet, cache the partial user from the message */
+static user* cache_author(json* d) {
+	auto a = d->find("author");
+	if (a == d->end()) {
+		return nullptr;
+	}
+	json &author = *a;
+	user* authoruser = find_user(SnowflakeNotNull(&author, "id"));
+	if (!authoruser) {
+		authoruser = new user();
+		authoruser->fill_from_json(&author);
+		get_user_cache()->store(authoruser);
 	}
-	return j.dump();
+	return authoruser;
+}
+
+/* Find the member record for a message's author, storing it on the guild if it isn't there yet */
+static guild_member* cache_member(json* d, snowflake guild_id, user* authoruser) {
+	guild* g = find_guild(guild_id);
+	auto mi = d->find("member");
+	if (!g || !authoruser || mi == d->end()) {
+		return nullptr;
+	}
+	auto thismember = g->members.find(authoruser->id);
+	if (thismember != g->members.end()) {
+		return thismember->second;
+	}
+	guild_member* gm = new guild_member();
+	gm->fill_from_json(&(*mi), g, authoruser);
+	g->members[authoruser->id] = gm;
+	return gm;
 }
 
 message& message::fill_from_json(json* d) {
 	this->id = SnowflakeNotNull(d, "id");
 	this->channel_id = SnowflakeNotNull(d, "channel_id");
 	this->guild_id = SnowflakeNotNull(d, "guild_id");
-	this->author = nullptr;
-	user* authoruser = nullptr;
-	/* May be null, if its null cache it from the partial */
-	if (d->find("author") != d->end()) {
-		json &author = (*d)["author"];
-		authoruser = find_user(SnowflakeNotNull(&author, "id"));
-		if (!authoruser) {
-			/* User does not exist yet, cache the partial as a user record */
-			authoruser = new user();
-			authoruser->fill_from_json(&author);
-			get_user_cache()->store(authoruser);
-		}
-		this->author = authoruser;
-	}
-	/* Fill in member record, cache uncached ones */
-	guild* g = find_guild(this->guild_id);
-	this->member = nullptr;
-	if (g && d->find("member") != d->end()) {
-		json& mi = (*d)["member"];
-		snowflake uid = SnowflakeNotNull(&mi, "id");
-		auto thismember = g->members.find(uid);
-		if (thismember == g->members.end()) {
-			if (authoruser) {
-				guild_member* gm = new guild_member();
-				gm->fill_from_json(&mi, g, authoruser);
-				g->members[authoruser->id] = gm;
-				this->member = gm;
-			}
-		} else {
-			this->member = thismember->second;
-		}
-	}
+	this->author = cache_author(d);
+	this->member = cache_member(d, this->guild_id, this->author);
 	if (d->find("embeds") != d->end()) {
 		json & el = (*d)["embeds"];
 		for (auto& e : el) {
@@ -260,5 +269,97 @@ message& message::fill_from_json(json* d) {
 	return *this;
 }
 
-};
+message_view::message_view(json* j) : d(j) {
+}
+
+snowflake message_view::id() const {
+	return SnowflakeNotNull(d, "id");
+}
 
+snowflake message_view::channel_id() const {
+	return SnowflakeNotNull(d, "channel_id");
+}
+
+snowflake message_view::guild_id() const {
+	return SnowflakeNotNull(d, "guild_id");
+}
+
+snowflake message_view::author_id() const {
+	auto a = d->find("author");
+	return a != d->end() ? SnowflakeNotNull(&(*a), "id") : 0;
+}
+
+snowflake message_view::webhook_id() const {
+	return SnowflakeNotNull(d, "webhook_id");
+}
+
+std::string_view message_view::content() const {
+	auto c = d->find("content");
+	if (c != d->end() && c->is_string()) {
+		return c->get_ref<const std::string&>();
+	}
+	return std::string_view();
+}
+
+time_t message_view::sent() const {
+	return TimestampNotNull(d, "timestamp");
+}
+
+time_t message_view::edited() const {
+	return TimestampNotNull(d, "edited_timestamp");
+}
+
+bool message_view::tts() const {
+	return BoolNotNull(d, "tts");
+}
+
+bool message_view::mention_everyone() const {
+	return BoolNotNull(d, "mention_everyone");
+}
+
+bool message_view::pinned() const {
+	return BoolNotNull(d, "pinned");
+}
+
+size_t message_view::embed_count() const {
+	auto e = d->find("embeds");
+	return e != d->end() && e->is_array() ? e->size() : 0;
+}
+
+embed message_view::get_embed(size_t index) const {
+	/* at() rather than operator[], which would insert nulls into the event's JSON for a bad index */
+	return embed(&d->at("embeds").at(index));
+}
+
+size_t message_view::attachment_count() const {
+	auto a = d->find("attachments");
+	return a != d->end() && a->is_array() ? a->size() : 0;
+}
+
+std::vector<snowflake> message_view::mention_ids() const {
+	std::vector<snowflake> ids;
+	auto m = d->find("mentions");
+	if (m != d->end() && m->is_array()) {
+		ids.reserve(m->size());
+		for (auto & mention : *m) {
+			ids.push_back(SnowflakeNotNull(&mention, "id"));
+		}
+	}
+	return ids;
+}
+
+user* message_view::author() const {
+	return cache_author(d);
+}
+
+guild_member* message_view::member() const {
+	return cache_member(d, guild_id(), cache_author(d));
+}
+
+message message_view::to_message() const {
+	message m;
+	m.fill_from_json(d);
+	return m;
+}
+
+};
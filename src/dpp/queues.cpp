@@ -9,6 +9,7 @@
 #include <io.h>
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #pragma  comment(lib,"ws2_32")
+#define SHUT_RDWR SD_BOTH
 #else
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -20,42 +21,364 @@
 #include <signal.h>
 #include <string.h>
 #include <random>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <unordered_set>
+#include <stdexcept>
 #include <dpp/queues.h>
 #include <dpp/cluster.h>
+#include <dpp/http2.h>
 #define CPPHTTPLIB_OPENSSL_SUPPORT
 #include <dpp/httplib.h>
 #include <dpp/stringops.h>
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 namespace dpp {
 
-http_request::http_request(const std::string &_endpoint, const std::string &_parameters, http_completion_event completion, const std::string &_postdata, http_method _method) : endpoint(_endpoint), parameters(_parameters), complete_handler(completion), postdata(_postdata), method(_method), completed(false)
+/* Blocks freed by http_request are kept here for reuse instead of going back to the heap.
+ * Requests are created on the caller's thread and freed on the completion thread, so the
+ * list is locked. Blocks are a fixed size so that derived request types can share them.
+ */
+static constexpr size_t request_block_size = HTTP_REQUEST_BLOCK_SIZE;
+static_assert(sizeof(http_request) <= request_block_size, "http_request must fit in a pool block");
+static constexpr size_t request_pool_max = 64;
+static std::mutex request_pool_mutex;
+static std::vector<void*> request_pool;
+
+http_request::http_request(std::string _endpoint, std::string _parameters, http_completion_event completion, std::string _postdata, http_method _method) : complete_handler(std::move(completion)), completed(false), endpoint(std::move(_endpoint)), parameters(std::move(_parameters)), postdata(std::move(_postdata)), method(_method), retries(0), priority(rp_normal), inline_completion(false)
 {
 }
 
 http_request::~http_request() {
 }
 
+void* http_request::operator new(size_t size) {
+	if (size > request_block_size) {
+		return ::operator new(size);
+	}
+	{
+		std::lock_guard<std::mutex> lock(request_pool_mutex);
+		if (!request_pool.empty()) {
+			void* p = request_pool.back();
+			request_pool.pop_back();
+			return p;
+		}
+	}
+	return ::operator new(request_block_size);
+}
+
+void http_request::operator delete(void* p, size_t size) {
+	if (size <= request_block_size) {
+		std::lock_guard<std::mutex> lock(request_pool_mutex);
+		if (request_pool.size() < request_pool_max) {
+			request_pool.push_back(p);
+			return;
+		}
+	}
+	::operator delete(p);
+}
+
 void http_request::complete(const http_request_completion_t &c) {
 	/* Call completion handler only if the request has been completed */
 	if (is_completed() && complete_handler)
 		complete_handler(c);
 }
 
-/* Fill a http_request_completion_t from a HTTP result */
-void populate_result(http_request_completion_t& rv, const httplib::Result &res) {
-	rv.status = res->status;
-	rv.body = (res->status < 400) ? res->body : "";
-	for (auto &v : res->headers) {
-		rv.headers[v.first] = v.second;
+/* Content encodings we can decode, for Accept-Encoding, or empty if built without zlib or brotli */
+static std::string accepted_encodings() {
+	std::string encodings;
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+	encodings += "br, ";
+#endif
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+	encodings += "gzip, deflate, ";
+#endif
+	return encodings.empty() ? encodings : encodings.substr(0, encodings.length() - 2);
+}
+
+/* Decodes a reply body's Content-Encoding as it arrives, a part at a time, passing each block
+ * it decodes on as soon as it has it. A stream is only whole once its end marker has been
+ * decoded, which httplib's own decompressors don't check.
+ */
+class body_decoder {
+	/** Content-Encoding being decoded */
+	std::string encoding;
+	/** True once the end of the stream has been decoded */
+	bool done;
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+	BrotliDecoderState* brotli;
+#endif
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+	z_stream zlib;
+	bool zlib_started;
+#endif
+public:
+	body_decoder(const std::string &_encoding) : encoding(_encoding == "identity" ? "" : _encoding), done(encoding.empty())
+	{
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+		brotli = encoding == "br" ? BrotliDecoderCreateInstance(nullptr, nullptr, nullptr) : nullptr;
+#endif
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+		zlib = {};
+		/* 32 + 15: zlib detects for itself whether the stream is gzip or zlib (i.e. HTTP's deflate) */
+		zlib_started = (encoding == "gzip" || encoding == "deflate") && inflateInit2(&zlib, 32 + 15) == Z_OK;
+#endif
+	}
+
+	~body_decoder()
+	{
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+		if (brotli) {
+			BrotliDecoderDestroyInstance(brotli);
+		}
+#endif
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+		if (zlib_started) {
+			inflateEnd(&zlib);
+		}
+#endif
+	}
+
+	/** False if the body is in an encoding we can't decode */
+	bool ok() const
+	{
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+		if (brotli) {
+			return true;
+		}
+#endif
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+		if (zlib_started) {
+			return true;
+		}
+#endif
+		return encoding.empty();
+	}
+
+	/** True once the whole body has been decoded */
+	bool finished() const
+	{
+		return done;
+	}
+
+	/** Decode the next part of the body, passing what it decodes to out. Anything after the end
+	 * of the stream is ignored. Returns false if the body is corrupt, or out returned false.
+	 */
+	bool feed(const char* data, size_t length, const std::function<bool(const char*, size_t)> &out)
+	{
+		if (encoding.empty()) {
+			return out(data, length);
+		}
+		if (done || !ok()) {
+			return done;
+		}
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+		if (brotli) {
+			char block[16384];
+			size_t available_in = length;
+			const uint8_t* next_in = (const uint8_t*)data;
+			BrotliDecoderResult result;
+			do {
+				size_t available_out = sizeof(block);
+				uint8_t* next_out = (uint8_t*)block;
+				result = BrotliDecoderDecompressStream(brotli, &available_in, &next_in, &available_out, &next_out, nullptr);
+				if (available_out < sizeof(block) && !out(block, sizeof(block) - available_out)) {
+					return false;
+				}
+			} while (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+			done = result == BROTLI_DECODER_RESULT_SUCCESS;
+			return result != BROTLI_DECODER_RESULT_ERROR;
+		}
+#endif
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+		char block[16384];
+		zlib.next_in = (Bytef*)data;
+		zlib.avail_in = (uInt)length;
+		int result;
+		do {
+			zlib.next_out = (Bytef*)block;
+			zlib.avail_out = sizeof(block);
+			result = inflate(&zlib, Z_NO_FLUSH);
+			if (zlib.avail_out < sizeof(block) && !out(block, sizeof(block) - zlib.avail_out)) {
+				return false;
+			}
+		} while (result == Z_OK && (zlib.avail_in || !zlib.avail_out));
+		done = result == Z_STREAM_END;
+		/* Z_BUF_ERROR only means that all of this part has been decoded */
+		return result == Z_OK || result == Z_STREAM_END || result == Z_BUF_ERROR;
+#endif
+		return false;
+	}
+};
+
+/* Decode a reply body's Content-Encoding in place. Each block the decoder inflates is appended
+ * straight to the decoded body, and the compressed copy is freed once it has been decoded.
+ * Returns false if the body is in an encoding we can't decode, or is corrupt or cut short.
+ */
+static bool decode_body(const std::string &encoding, std::string &body) {
+	if (encoding.empty() || encoding == "identity") {
+		return true;
+	}
+	body_decoder decoder(encoding);
+	std::string decoded;
+	if (!decoder.feed(body.data(), body.length(), [&decoded](const char* block, size_t length) {
+		decoded.append(block, length);
+		return true;
+	}) || !decoder.finished()) {
+		return false;
+	}
+	body = std::move(decoded);
+	return true;
+}
+
+/* Fill a http_request_completion_t from a HTTP response. The body and header values are
+ * moved out of the response, which is discarded afterwards.
+ */
+void populate_result(http_request_completion_t& rv, httplib::Response &res) {
+	rv.status = res.status;
+	/* httplib is told not to decode bodies itself, so that we can tell how large they were on the wire */
+	rv.wire_size = res.body.length();
+	if (!decode_body(res.get_header_value("Content-Encoding"), res.body)) {
+		rv.error = h_compression;
+	}
+	/* Error bodies are kept too, as they explain what went wrong (e.g. retry_after on a 429) */
+	rv.body = std::move(res.body);
+	rv.body_size = rv.body.length();
+	rv.ratelimit_limit = from_string<uint64_t>(res.get_header_value("X-RateLimit-Limit"), std::dec);
+	rv.ratelimit_remaining = from_string<uint64_t>(res.get_header_value("X-RateLimit-Remaining"), std::dec);
+	rv.ratelimit_reset_after = strtod(res.get_header_value("X-RateLimit-Reset-After").c_str(), nullptr);
+	rv.ratelimit_bucket = res.get_header_value("X-RateLimit-Bucket");
+	rv.ratelimit_global = (res.get_header_value("X-RateLimit-Global") == "true"); 
+	std::string retry_after = res.get_header_value("X-RateLimit-Retry-After");
+	if (retry_after.empty()) {
+		retry_after = res.get_header_value("Retry-After");
+	}
+	if (!retry_after.empty()) {
+		rv.ratelimit_retry_after = strtod(retry_after.c_str(), nullptr);
+	} else if (rv.status == 429) {
+		/* Fall back on the retry_after in the body, {"message": "...", "retry_after": 1.5, "global": false} */
+		size_t pos = rv.body.find("\"retry_after\"");
+		if (pos != std::string::npos && (pos = rv.body.find(':', pos)) != std::string::npos) {
+			rv.ratelimit_retry_after = strtod(rv.body.c_str() + pos + 1, nullptr);
+		}
+	}
+	for (auto &v : res.headers) {
+		rv.headers[v.first] = std::move(v.second);
+	}
+}
+
+multipart_body::multipart_body()
+{
+	static const char chars[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+	std::random_device rd;
+	std::mt19937 gen(rd());
+	std::uniform_int_distribution<size_t> dist(0, sizeof(chars) - 2);
+	boundary = "dpp-";
+	for (int i = 0; i < 32; ++i) {
+		boundary += chars[dist(gen)];
+	}
+}
+
+multipart_body::part& multipart_body::add_part(const std::string &name, const std::string &filename, const std::string &content_type)
+{
+	/* Quotes and line breaks would end the header early */
+	auto quote = [](std::string s) {
+		std::replace_if(s.begin(), s.end(), [](char c) { return c == '"' || c == '\r' || c == '\n'; }, '_');
+		return "\"" + s + "\"";
+	};
+	part p;
+	p.head = "--" + boundary + "\r\nContent-Disposition: form-data; name=" + quote(name);
+	if (!filename.empty()) {
+		p.head += "; filename=" + quote(filename);
+	}
+	p.head += "\r\nContent-Type: " + content_type + "\r\n\r\n";
+	parts.push_back(std::move(p));
+	return parts.back();
+}
+
+std::string multipart_body::tail() const
+{
+	return "--" + boundary + "--\r\n";
+}
+
+void multipart_body::add(const std::string &name, const std::string &content, const std::string &content_type)
+{
+	part &p = add_part(name, "", content_type);
+	p.content = content;
+	p.size = content.length();
+}
+
+void multipart_body::add_file(const std::string &name, const std::string &filename, const std::string &path, const std::string &content_type)
+{
+	std::ifstream f(path, std::ios::binary | std::ios::ate);
+	if (!f) {
+		throw std::runtime_error("Can't open file to upload: " + path);
 	}
-	rv.ratelimit_limit = from_string<uint64_t>(res->get_header_value("X-RateLimit-Limit"), std::dec);
-	rv.ratelimit_remaining = from_string<uint64_t>(res->get_header_value("X-RateLimit-Remaining"), std::dec);
-	rv.ratelimit_reset_after = from_string<uint64_t>(res->get_header_value("X-RateLimit-Reset-After"), std::dec);
-	rv.ratelimit_bucket = res->get_header_value("X-RateLimit-Bucket");
-	rv.ratelimit_global = (res->get_header_value("X-RateLimit-Global") == "true"); 
-	if (res->get_header_value("X-RateLimit-Retry-After") != "") {
-		rv.ratelimit_retry_after = from_string<uint64_t>(res->get_header_value("X-RateLimit-Retry-After"), std::dec);
+	uint64_t size = (uint64_t)f.tellg();
+	part &p = add_part(name, filename, content_type);
+	p.path = path;
+	p.size = size;
+}
+
+void multipart_body::add_data(const std::string &name, const std::string &filename, const char* data, size_t size, const std::string &content_type)
+{
+	part &p = add_part(name, filename, content_type);
+	p.data = data;
+	p.size = size;
+}
+
+uint64_t multipart_body::size() const
+{
+	uint64_t total = tail().length();
+	for (auto & p : parts) {
+		/* Each part's contents are followed by a line break */
+		total += p.head.length() + p.size + 2;
+	}
+	return total;
+}
+
+std::string multipart_body::content_type() const
+{
+	return "multipart/form-data; boundary=" + boundary;
+}
+
+bool multipart_body::write(const std::function<bool(const char*, size_t)> &out) const
+{
+	std::vector<char> buffer;
+	for (auto & p : parts) {
+		if (!out(p.head.data(), p.head.length())) {
+			return false;
+		}
+		if (!p.path.empty()) {
+			std::ifstream f(p.path, std::ios::binary);
+			buffer.resize(MULTIPART_CHUNK_SIZE);
+			uint64_t left = p.size;
+			while (left) {
+				size_t n = (size_t)std::min<uint64_t>(left, MULTIPART_CHUNK_SIZE);
+				/* The size has already been sent in Content-Length, so a file which shrank fails the request */
+				if (!f.read(buffer.data(), n) || !out(buffer.data(), n)) {
+					return false;
+				}
+				left -= n;
+			}
+		} else {
+			const char* d = p.data ? p.data : p.content.data();
+			for (uint64_t sent = 0; sent < p.size; sent += MULTIPART_CHUNK_SIZE) {
+				if (!out(d + sent, (size_t)std::min<uint64_t>(p.size - sent, MULTIPART_CHUNK_SIZE))) {
+					return false;
+				}
+			}
+		}
+		if (!out("\r\n", 2)) {
+			return false;
+		}
 	}
+	std::string t = tail();
+	return out(t.data(), t.length());
 }
 
 /* Returns true if the request has been made */
@@ -64,20 +387,136 @@ bool http_request::is_completed()
 	return completed;
 }
 
-/* Execute a HTTP request */
-http_request_completion_t http_request::Run(const cluster* owner) {
+bool http_request::streams_body() const
+{
+	return false;
+}
 
-	http_request_completion_t rv;
+bool http_request::receive(const char*, size_t)
+{
+	return false;
+}
+
+/* Collects a reply as it arrives. A successful reply to a request which streams its body is
+ * passed to receive() as it arrives, decoded a part at a time if it is compressed. Anything
+ * else, e.g. an error explaining itself, or a reply in an encoding we can't decode, is collected
+ * into the result as usual. Used for streamed GETs, and for every reply over HTTP/2.
+ */
+class reply_reader {
+	http_request* req;
+	/* The headers are kept as they arrive, as a reply abandoned part way through leaves no result */
+	httplib::Response head;
+	std::unique_ptr<body_decoder> decoder;
+	bool streaming = false, refused = false, corrupt = false;
+	std::string body;
+	size_t received = 0, decoded = 0;
+public:
+	reply_reader(http_request* _req) : req(_req)
+	{
+	}
+
+	/* Called with the reply's status and headers */
+	bool headers(const httplib::Response &r)
+	{
+		head = r;
+		if (req->streams_body() && r.status < 400) {
+			decoder = std::make_unique<body_decoder>(r.get_header_value("Content-Encoding"));
+			streaming = decoder->ok();
+		}
+		return true;
+	}
+
+	/* Called with each part of the body. Returns false to abandon the reply. */
+	bool data(const char* part, size_t length)
+	{
+		received += length;
+		if (streaming) {
+			corrupt = !decoder->feed(part, length, [&](const char* block, size_t n) {
+				decoded += n;
+				refused = !req->receive(block, n);
+				return !refused;
+			}) && !refused;
+			return !corrupt && !refused;
+		}
+		body.append(part, length);
+		return true;
+	}
+
+	/* Fill in the result once the reply has ended.
+	 * error is the transport's error, or h_success if the whole reply arrived.
+	 */
+	void finish(http_request_completion_t &rv, http_error error)
+	{
+		/* With a status, a reply which failed part way through isn't retried, as some of it has been handed over */
+		if (head.status != -1) {
+			head.body = std::move(body);
+			populate_result(rv, head);
+			if (streaming) {
+				/* Its body has already been decoded and handed over, so isn't decoded again here */
+				rv.wire_size = received;
+				rv.body_size = decoded;
+				rv.error = decoder->finished() ? h_success : h_compression;
+			}
+		}
+		/* A reply which couldn't be decoded was ended by us, and is reported as such */
+		if (error != h_success && !corrupt) {
+			rv.error = error;
+		}
+	}
+};
 
-	httplib::Client cli("https://discord.com");
+/* GET a reply whose body is passed to receive() as it arrives, if it is a success */
+void http_request::run_streamed(httplib::Client &cli, const std::string &url, http_request_completion_t &rv) {
+	reply_reader reader(this);
+	auto res = cli.Get(url.c_str(), [&reader](const httplib::Response &r) {
+		return reader.headers(r);
+	}, [&reader](const char* data, size_t length) {
+		return reader.data(data, length);
+	});
+	reader.finish(rv, res ? h_success : (http_error)res.error());
+}
+
+/* Set up a client for talking to discord */
+static void configure_client(httplib::Client &cli) {
 	/* This is for a reason :( - Some systems have really out of date cert stores */
 	cli.enable_server_certificate_verification(false);
 	cli.set_follow_location(true);
+	/* Headers and body are written separately, and with Nagle's algorithm the body then waits on a delayed ACK */
+	cli.set_tcp_nodelay(true);
+	/* Replies are decoded by populate_result() */
+	cli.set_decompress(false);
+}
+
+/* Headers sent with every request. Their names are in lower case, as HTTP/2 requires. */
+static std::vector<std::pair<std::string, std::string>> rest_headers(const cluster* owner) {
 	/* TODO: Once we have a version number header, use it here */
-	httplib::Headers headers = {
-		{"Authorization", std::string("Bot ") + owner->token},
-		{"User-Agent", "DiscordBot (https://github.com/brainboxdotcc/DPP, 0.0.1)"}
+	std::vector<std::pair<std::string, std::string>> headers = {
+		{"authorization", std::string("Bot ") + owner->token},
+		{"user-agent", "DiscordBot (https://github.com/brainboxdotcc/DPP, 0.0.1)"}
 	};
+	static const std::string encodings = accepted_encodings();
+	if (owner->rest_compression && !encodings.empty()) {
+		headers.emplace_back("accept-encoding", encodings);
+	}
+	return headers;
+}
+
+/* Execute a HTTP request on a new connection */
+http_request_completion_t http_request::Run(const cluster* owner) {
+	httplib::Client cli(owner->rest_url.c_str());
+	configure_client(cli);
+	return Run(owner, cli);
+}
+
+/* Execute a HTTP request */
+http_request_completion_t http_request::Run(const cluster* owner, httplib::Client &cli) {
+
+	http_request_completion_t rv;
+
+	httplib::Headers headers;
+	for (auto & h : rest_headers(owner)) {
+		headers.emplace(std::move(h));
+	}
 	cli.set_default_headers(headers);
 
 	rv.ratelimit_limit = rv.ratelimit_remaining = rv.ratelimit_reset_after = rv.ratelimit_retry_after = 0;
@@ -93,10 +532,23 @@ http_request_completion_t http_request::Run(const cluster* owner) {
 	 * shorter. We have to use "auto res = ...". This is because httplib::Result has no default constructor
 	 * and needs to be passed a result and some other blackboxed rammel.
 	 */
+	/* A multipart body is written straight from its files to the socket. httplib calls the provider
+	 * again from the offset reached if it writes less than the whole body, which only happens if
+	 * the body couldn't be written, so that ends the request.
+	 */
+	httplib::ContentProvider provider = [this](size_t offset, size_t, httplib::DataSink &sink) {
+		return offset == 0 && multipart->write([&sink](const char* data, size_t len) {
+			sink.write(data, len);
+			return sink.is_writable();
+		});
+	};
+
 	switch (method) {
 		case m_get: {
-			if (auto res = cli.Get(_url.c_str())) {
-				populate_result(rv, res);
+			if (streams_body()) {
+				run_streamed(cli, _url, rv);
+			} else if (auto res = cli.Get(_url.c_str())) {
+				populate_result(rv, *res);
 			} else {
 				rv.error = (http_error)res.error();
 			}
@@ -104,16 +556,17 @@ http_request_completion_t http_request::Run(const cluster* owner) {
 		break;
 		case m_post: {
 			/* POST supports post data body */
-			if (auto res = cli.Post(_url.c_str(), postdata.c_str(), "application/json")) {
-				populate_result(rv, res);
+			if (auto res = multipart ? cli.Post(_url.c_str(), multipart->size(), provider, multipart->content_type().c_str()) : cli.Post(_url.c_str(), postdata, "application/json")) {
+				populate_result(rv, *res);
 			} else {
 				rv.error = (http_error)res.error();
 			}
 		}
 		break;
 		case m_patch: {
-			if (auto res = cli.Patch(_url.c_str())) {
-				populate_result(rv, res);
+			/* PATCH supports post data body */
+			if (auto res = multipart ? cli.Patch(_url.c_str(), multipart->size(), provider, multipart->content_type().c_str()) : cli.Patch(_url.c_str(), postdata, "application/json")) {
+				populate_result(rv, *res);
 			} else {
 				rv.error = (http_error)res.error();
 			}
@@ -121,8 +574,8 @@ http_request_completion_t http_request::Run(const cluster* owner) {
 		break;
 		case m_put: {
 			/* PUT supports post data body */
-			if (auto res = cli.Put(_url.c_str(), postdata.c_str(), "application/json")) {
-				populate_result(rv, res);
+			if (auto res = cli.Put(_url.c_str(), postdata, "application/json")) {
+				populate_result(rv, *res);
 			} else {
 				rv.error = (http_error)res.error();
 			}
@@ -131,7 +584,7 @@ http_request_completion_t http_request::Run(const cluster* owner) {
 		break;
 		case m_delete: {
 			if (auto res = cli.Delete(_url.c_str())) {
-				populate_result(rv, res);
+				populate_result(rv, *res);
 			} else {
 				rv.error = (http_error)res.error();
 			}
@@ -144,7 +597,19 @@ http_request_completion_t http_request::Run(const cluster* owner) {
 	return rv;
 }
 
-request_queue::request_queue(const class cluster* owner) : creator(owner), terminating(false), globally_ratelimited(false), globally_limited_for(0)
+/* Seconds a kept alive REST connection may sit idle before we close it rather than reuse it.
+ * Discord's edge closes idle connections itself, and a request written to a connection it has
+ * just closed fails, so we stay well under its timeout.
+ */
+#define REST_IDLE_TIMEOUT 30
+
+/* Discord's global REST limit, in requests per second */
+#define REST_GLOBAL_LIMIT 50
+
+/* Requests per second of the global limit kept back from each lower priority for those above it */
+#define REST_RESERVED 2
+
+request_queue::request_queue(const class cluster* owner) : creator(owner), terminating(false), globally_ratelimited(false), globally_limited_for(0), global_limiter(REST_GLOBAL_LIMIT, 1, REST_RESERVED), retry_bucket(nullptr), rest_client(nullptr), rest_h2(nullptr), http2_refused(false)
 {
 	in_queue_listen_sock = socket(AF_INET, SOCK_STREAM, 0);
 	out_queue_listen_sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -196,8 +661,445 @@ request_queue::request_queue(const class cluster* owner) : creator(owner), termi
 request_queue::~request_queue()
 {
 	terminating = true;
+	/* The threads wait in recv() on their notifiers; closing our ends wakes them with end of file */
+	shutdown(in_queue_connect_sock, SHUT_RDWR);
+	shutdown(out_queue_connect_sock, SHUT_RDWR);
 	in_thread->join();
+	/* Streams still in flight are dropped; their requests are never completed, like any still queued */
+	delete rest_h2;
+	for (auto c : h2_retired) {
+		delete c;
+	}
 	out_thread->join();
+	::close(in_queue_connect_sock);
+	::close(out_queue_connect_sock);
+	for (auto w : workers) {
+		{
+			std::lock_guard<std::mutex> lock(w->mutex);
+		}
+		w->cv.notify_all();
+		w->thread->join();
+		delete w->thread;
+		delete w;
+	}
+	delete retry_bucket;
+	delete rest_client;
+}
+
+/* Returns true if a path segment is a snowflake id */
+static bool is_id(const std::string &segment) {
+	return !segment.empty() && std::all_of(segment.begin(), segment.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+std::string bucket_map::route(http_method method, const std::string &endpoint, const std::string &parameters, std::string &major)
+{
+	static const char* method_names[] = { "GET", "POST", "PUT", "PATCH", "DELETE" };
+	std::string path = parameters.empty() ? endpoint : endpoint + "/" + parameters;
+	path = path.substr(0, path.find('?'));
+
+	std::vector<std::string> segments;
+	size_t start = 0, slash;
+	do {
+		slash = path.find('/', start);
+		segments.push_back(path.substr(start, slash == std::string::npos ? std::string::npos : slash - start));
+		start = slash + 1;
+	} while (slash != std::string::npos);
+
+	/* segments[0] is empty (the leading slash) and segments[1] is "api" */
+	major = "";
+	std::string r = method_names[method];
+	r += ' ';
+	for (size_t i = 1; i < segments.size(); ++i) {
+		const std::string &s = segments[i];
+		r += "/";
+		if (i == 3 && is_id(s) && (segments[2] == "channels" || segments[2] == "guilds" || segments[2] == "webhooks")) {
+			major = s;
+			r += ":major";
+		} else if (i == 4 && segments[2] == "webhooks" && !major.empty()) {
+			/* Webhook token */
+			r += ":token";
+		} else if (segments[i - 1] == "reactions") {
+			r += ":emoji";
+		} else if (is_id(s)) {
+			r += ":id";
+		} else {
+			r += s;
+		}
+	}
+	return r;
+}
+
+std::string bucket_map::key(const http_request* req)
+{
+	std::string major;
+	std::string r = route(req->method, req->endpoint, req->parameters, major);
+	std::lock_guard<std::mutex> lock(mutex);
+	auto hash = route_hashes.find(r);
+	return (hash != route_hashes.end() ? hash->second : r) + "@" + major;
+}
+
+const std::string& bucket_map::resolve(const std::string &key)
+{
+	auto alias = aliases.find(key);
+	return alias != aliases.end() ? alias->second : key;
+}
+
+/* When a bucket's allowance comes back */
+static std::chrono::steady_clock::time_point reset_time(const bucket_t &b)
+{
+	double wait = (b.retry_after ? b.retry_after : b.reset_after);
+	return b.timestamp + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(wait));
+}
+
+bool bucket_map::try_acquire(const std::string &key)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto b = buckets.find(resolve(key));
+	if (b == buckets.end()) {
+		/* No bucket yet. Send the request, and make one from its reply */
+		return true;
+	}
+	if (b->second.remaining < 1) {
+		if (std::chrono::steady_clock::now() < reset_time(b->second)) {
+			return false;
+		}
+		/* The bucket has reset. Assume it is full until a reply says otherwise */
+		b->second.remaining = std::max(b->second.limit, (uint64_t)1);
+		b->second.retry_after = 0;
+	}
+	b->second.remaining--;
+	return true;
+}
+
+double bucket_map::wait_time(const std::string &key)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto b = buckets.find(resolve(key));
+	if (b == buckets.end() || b->second.remaining >= 1) {
+		return 0;
+	}
+	return std::max(std::chrono::duration<double>(reset_time(b->second) - std::chrono::steady_clock::now()).count(), 0.0);
+}
+
+void bucket_map::expire()
+{
+	auto now = std::chrono::steady_clock::now();
+	if (now - last_expiry < std::chrono::seconds(BUCKET_IDLE_TIMEOUT)) {
+		return;
+	}
+	last_expiry = now;
+	std::unordered_set<std::string> hashes;
+	for (auto b = buckets.begin(); b != buckets.end();) {
+		if (now > reset_time(b->second) + std::chrono::seconds(BUCKET_IDLE_TIMEOUT)) {
+			b = buckets.erase(b);
+		} else {
+			/* Keys are the route or its hash, then "@" and the major parameter */
+			hashes.insert(b->first.substr(0, b->first.rfind('@')));
+			++b;
+		}
+	}
+	for (auto a = aliases.begin(); a != aliases.end();) {
+		a = buckets.find(a->second) == buckets.end() ? aliases.erase(a) : std::next(a);
+	}
+	for (auto r = route_hashes.begin(); r != route_hashes.end();) {
+		r = hashes.find(r->second) == hashes.end() ? route_hashes.erase(r) : std::next(r);
+	}
+}
+
+void bucket_map::update(const http_request* req, const std::string &key, const http_request_completion_t &rv)
+{
+	/* Replies without rate limit headers (e.g. connection errors) tell us nothing */
+	if (rv.ratelimit_limit == 0 && rv.status != 429) {
+		return;
+	}
+	std::string major;
+	std::string r = route(req->method, req->endpoint, req->parameters, major);
+	bucket_t b;
+	b.limit = rv.ratelimit_limit;
+	b.remaining = (rv.status == 429 ? 0 : rv.ratelimit_remaining);
+	b.reset_after = rv.ratelimit_reset_after;
+	b.retry_after = rv.ratelimit_retry_after;
+	b.timestamp = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(mutex);
+	expire();
+	if (!rv.ratelimit_bucket.empty()) {
+		route_hashes[r] = rv.ratelimit_bucket;
+		std::string hashed = rv.ratelimit_bucket + "@" + major;
+		/* Requests queued before the hash was known keep their route key, which now leads to the same bucket */
+		if (hashed != key) {
+			aliases[key] = hashed;
+		}
+		buckets[hashed] = b;
+	} else {
+		buckets[resolve(key)] = b;
+	}
+}
+
+void bucket_map::defer(const std::string &key, double seconds)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	bucket_t &b = buckets[resolve(key)];
+	b.remaining = 0;
+	b.retry_after = seconds;
+	b.timestamp = std::chrono::steady_clock::now();
+}
+
+size_t bucket_map::learned_routes()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return route_hashes.size();
+}
+
+size_t bucket_map::size()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return buckets.size();
+}
+
+/* Backoff before retrying a request which failed without advice from discord: 1s, 2s, 4s... up to this many seconds */
+#define RETRY_BACKOFF_MAX 16
+
+bool request_queue::should_retry(http_request* req, const std::string &key, const http_request_completion_t &rv)
+{
+	bool ratelimited = (rv.status == 429);
+	bool server_error = (rv.status == 500 || rv.status == 502 || rv.status == 503 || rv.status == 504);
+	/* No reply at all. If we couldn't connect the request never reached discord, but if the
+	 * connection failed later discord may have acted on it.
+	 */
+	bool no_reply = (rv.status == 0 && rv.error != h_success);
+	bool never_sent = (rv.error == h_connection || rv.error == h_bind_ip_address || rv.error == h_ssl_connection);
+
+	/* A 429 was refused without being acted on, so anything may be sent again. Otherwise only
+	 * idempotent methods are, in case discord carried out the first attempt: sending a POST or
+	 * PATCH twice could post a message twice.
+	 */
+	bool idempotent = (req->method == m_get || req->method == m_put || req->method == m_delete);
+	if (!ratelimited && !((server_error || no_reply) && idempotent) && !(no_reply && never_sent)) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(stats_mutex);
+	if (req->retries >= creator->request_retries) {
+		stats.retries_exhausted++;
+		return false;
+	}
+	if (!retry_bucket) {
+		retry_bucket = new token_bucket(std::max(creator->retry_budget, 1U), 60);
+	}
+	if (!retry_bucket->try_acquire()) {
+		stats.retry_budget_exhausted++;
+		return false;
+	}
+
+	req->retries++;
+	req->completed = false;
+	if (ratelimited) {
+		stats.retries_ratelimited++;
+		/* update() has already held back the bucket for retry_after; a global limit holds back the queue */
+	} else {
+		if (server_error) {
+			stats.retries_server_error++;
+		} else {
+			stats.retries_connection++;
+		}
+		buckets.defer(key, std::min(1 << (req->retries - 1), RETRY_BACKOFF_MAX));
+	}
+	return true;
+}
+
+rest_stats request_queue::get_stats()
+{
+	std::lock_guard<std::mutex> lock(stats_mutex);
+	return stats;
+}
+
+void request_queue::wait_global(http_request* req)
+{
+	cluster_coordinator* coordinator = creator->get_coordinator();
+	if (coordinator) {
+		/* The global limit is per bot, so coordinated processes share one bucket for it */
+		double wait;
+		while ((wait = coordinator->acquire_global(REST_GLOBAL_LIMIT, REST_RESERVED * req->priority)) > 0) {
+			std::this_thread::sleep_for(std::chrono::duration<double>(std::max(wait, 0.001)));
+		}
+	} else {
+		while (!global_limiter.try_acquire(req->priority)) {
+			std::this_thread::sleep_for(std::chrono::duration<double>(std::max(global_limiter.wait_time(req->priority), 0.001)));
+		}
+	}
+}
+
+void request_queue::record_sent(http_request* req, bool new_connection)
+{
+	std::lock_guard<std::mutex> lock(stats_mutex);
+	stats.requests_sent++;
+	stats.connections_opened += new_connection ? 1 : 0;
+	if (req->retries == 0) {
+		stats.queue_wait[req->priority].record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - req->queued).count());
+	}
+}
+
+http_request_completion_t request_queue::run_request(http_request* req)
+{
+	wait_global(req);
+	bool new_connection = true;
+	if (creator->rest_keep_alive) {
+		if (!rest_client) {
+			rest_client = new httplib::Client(creator->rest_url.c_str());
+			configure_client(*rest_client);
+			rest_client->set_keep_alive(true);
+		} else if (std::chrono::steady_clock::now() - rest_client_used > std::chrono::seconds(REST_IDLE_TIMEOUT)) {
+			rest_client->stop();
+		}
+		new_connection = !rest_client->is_socket_open();
+	}
+	record_sent(req, new_connection);
+	http_request_completion_t rv;
+	if (creator->rest_keep_alive) {
+		rv = req->Run(creator, *rest_client);
+		rest_client_used = std::chrono::steady_clock::now();
+	} else {
+		rv = req->Run(creator);
+	}
+	{
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		stats.bytes_received += rv.wire_size;
+		stats.bytes_decoded += rv.body_size;
+	}
+	return rv;
+}
+
+#ifdef DPP_HTTP2
+http2_connection* request_queue::multiplex(http_request* req, bool &new_connection)
+{
+	new_connection = false;
+	/* A multipart body is read from its files as it is written, which only the HTTP/1.1 client does */
+	if (!creator->rest_http2 || http2_refused || req->multipart) {
+		return nullptr;
+	}
+	/* A connection which has closed, or been idle long enough that the server may be closing it, is replaced */
+	if (rest_h2 && (!rest_h2->is_open() || (streams_in_flight.empty() && std::chrono::steady_clock::now() - rest_h2_used > std::chrono::seconds(REST_IDLE_TIMEOUT)))) {
+		rest_h2->close();
+		h2_retired.push_back(rest_h2);
+		rest_h2 = nullptr;
+	}
+	if (!rest_h2) {
+		http2_connection* conn = new http2_connection(creator->rest_url);
+		if (!conn->connect(http2_refused)) {
+			/* Sent over HTTP/1.1 instead, which reports the failure if the server can't be reached at all */
+			delete conn;
+			return nullptr;
+		}
+		rest_h2 = conn;
+		new_connection = true;
+	}
+	return rest_h2;
+}
+
+void request_queue::send_http2(http2_connection* conn, bool new_connection, const std::string &key, http_request* req)
+{
+	static const char* methods[] = { "GET", "POST", "PUT", "PATCH", "DELETE" };
+	http2_stream* s = new http2_stream();
+	s->method = methods[req->method];
+	s->path = req->parameters.empty() ? req->endpoint : req->endpoint + "/" + req->parameters;
+	s->headers = rest_headers(creator);
+	/* As over HTTP/1.1, the body goes with POST, PUT and PATCH */
+	if (req->method == m_post || req->method == m_put || req->method == m_patch) {
+		s->headers.emplace_back("content-type", "application/json");
+		s->body = req->postdata;
+	}
+	/* The reply is read as an HTTP/1.1 one is, then handed to the request thread */
+	auto reader = std::make_shared<reply_reader>(req);
+	s->on_headers = [reader](int status, const std::vector<std::pair<std::string, std::string>> &headers) {
+		httplib::Response head;
+		head.status = status;
+		for (auto & h : headers) {
+			head.headers.emplace(h.first, h.second);
+		}
+		return reader->headers(head);
+	};
+	s->on_data = [reader](const char* data, size_t length) {
+		return reader->data(data, length);
+	};
+	s->on_close = [this, reader, key, req](http_error error) {
+		http_request_completion_t rv;
+		reader->finish(rv, error);
+		req->completed = true;
+		{
+			std::lock_guard<std::mutex> lock(stats_mutex);
+			stats.bytes_received += rv.wire_size;
+			stats.bytes_decoded += rv.body_size;
+		}
+		{
+			std::lock_guard<std::mutex> lock(h2_mutex);
+			h2_replies.push_back({ key, req, std::move(rv) });
+		}
+		emit_in_queue_signal();
+	};
+
+	wait_global(req);
+	record_sent(req, new_connection);
+	streams_in_flight[key] = req;
+	rest_h2_used = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		stats.http2_requests++;
+		stats.http2_peak_streams = std::max<uint64_t>(stats.http2_peak_streams, streams_in_flight.size());
+	}
+	conn->submit(s);
+}
+#else
+http2_connection* request_queue::multiplex(http_request*, bool &new_connection)
+{
+	new_connection = false;
+	return nullptr;
+}
+
+void request_queue::send_http2(http2_connection*, bool, const std::string &, http_request*)
+{
+}
+#endif
+
+bool request_queue::handle_reply(const std::string &key, http_request* req, http_request_completion_t &&rv)
+{
+	buckets.update(req, key, rv);
+
+	/* Only the wait in in_loop() clears this, so a later reply can't cut the wait short.
+	 * The signal brings the loop round to that wait, and then back to the requests it
+	 * held back.
+	 */
+	if (rv.ratelimit_global) {
+		globally_ratelimited = true;
+		globally_limited_for = (uint64_t)ceil(rv.ratelimit_retry_after ? rv.ratelimit_retry_after : rv.ratelimit_reset_after);
+		cluster_coordinator* coordinator = creator->get_coordinator();
+		if (coordinator) {
+			coordinator->set_global_ratelimit(globally_limited_for);
+		}
+		emit_in_queue_signal();
+	}
+
+	/* Retries stay at the front of their bucket, so nothing behind them may go first */
+	if (should_retry(req, key, rv)) {
+		emit_in_queue_signal();
+		return false;
+	}
+
+	finish(key, req, std::move(rv));
+	return true;
+}
+
+/* Make recv() on a socket give up after a number of seconds, or wait forever if 0 */
+static void set_recv_timeout(int fd, double seconds)
+{
+#ifdef _WIN32
+	DWORD ms = (DWORD)(seconds * 1000);
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&ms, sizeof(ms));
+#else
+	struct timeval tv;
+	tv.tv_sec = (time_t)seconds;
+	tv.tv_usec = (suseconds_t)((seconds - tv.tv_sec) * 1000000);
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+#endif
 }
 
 void request_queue::in_loop()
@@ -207,103 +1109,223 @@ void request_queue::in_loop()
 	struct sockaddr_in client;
 	int notifier = accept(in_queue_listen_sock, (struct sockaddr *)&client, (socklen_t*)&c);
 	::close(in_queue_listen_sock);
+	/* Seconds until the earliest used up bucket with requests waiting resets, or until the
+	 * earliest deadline of a request waiting on one, or 0 if none is waiting
+	 */
+	double wake_after = 0;
+	auto wake_within = [&wake_after](double seconds) {
+		seconds = std::max(seconds, 0.001);
+		wake_after = wake_after > 0 ? std::min(wake_after, seconds) : seconds;
+	};
+	/* A request past its deadline is dropped without being sent. Its caller gets a timeout. */
+	auto expire = [this](const std::string &key, http_request* req) {
+		if (req->deadline == std::chrono::steady_clock::time_point() || std::chrono::steady_clock::now() <= req->deadline) {
+			return false;
+		}
+		http_request_completion_t rv;
+		rv.status = 408;
+		rv.error = h_canceled;
+		req->completed = true;
+		{
+			std::lock_guard<std::mutex> lock(stats_mutex);
+			stats.expired[req->priority]++;
+		}
+		finish(key, req, std::move(rv));
+		return true;
+	};
+	/* A request held back in its bucket may pass its deadline first, so it is dropped now if it
+	 * has, and otherwise we wake for its deadline.
+	 */
+	auto hold_back = [&](const std::string &key, http_request* req) {
+		if (!expire(key, req) && req->deadline != std::chrono::steady_clock::time_point()) {
+			wake_within(std::chrono::duration<double>(req->deadline - std::chrono::steady_clock::now()).count());
+		}
+	};
 	while (!terminating) {
-		while (recv(notifier, &n, 1, 0) > 0) {
-			/* New request to be sent! */
+		/* Wait for a new request, or for a bucket to reset. Buckets which are used up are passed
+		 * over, so that they don't hold up the others, and looked at again when the first resets.
+		 */
+		set_recv_timeout(notifier, wake_after);
+		if (recv(notifier, &n, 1, 0) == 0) {
+			/* Our end was closed by the destructor */
+			break;
+		}
+		/* New request to be sent, a bucket has reset, or a reply has arrived over HTTP/2 */
+		wake_after = 0;
 
-			if (!globally_ratelimited) {
+		std::vector<http2_reply> replies;
+		{
+			std::lock_guard<std::mutex> lock(h2_mutex);
+			replies.swap(h2_replies);
+		}
+		for (auto & r : replies) {
+			streams_in_flight.erase(r.key);
+			rest_h2_used = std::chrono::steady_clock::now();
+			handle_reply(r.key, r.req, std::move(r.rv));
+		}
+		h2_retired.erase(std::remove_if(h2_retired.begin(), h2_retired.end(), [](http2_connection* c) {
+			if (c->finished()) {
+				delete c;
+				return true;
+			}
+			return false;
+		}), h2_retired.end());
 
-				std::map<std::string, std::vector<http_request*>> requests_in_copy;
-				{
-					/* Make a safe copy within a mutex */
-					std::lock_guard<std::mutex> lock(in_mutex);	
-					requests_in_copy = requests_in;
+		cluster_coordinator* coordinator = creator->get_coordinator();
+		if (coordinator && !globally_ratelimited) {
+			/* Another cluster process may have hit the global rate limit */
+			uint64_t wait = coordinator->global_ratelimit_wait();
+			if (wait) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(wait));
+			}
+		}
+
+		if (!globally_ratelimited) {
+
+			std::map<std::string, std::vector<http_request*>> requests_in_copy;
+			{
+				/* Make a safe copy within a mutex */
+				std::lock_guard<std::mutex> lock(in_mutex);	
+				requests_in_copy = requests_in;
+			}
+
+			/* A global 429 holds back every bucket, not only the one which hit it, so the pass
+			 * ends as soon as one arrives.
+			 */
+			for (auto & bucket : requests_in_copy) {
+				if (globally_ratelimited) {
+					break;
 				}
+				for (size_t i = 0; i < bucket.second.size() && !globally_ratelimited; ++i) {
+					http_request* req = bucket.second[i];
 
-				for (auto & bucket : requests_in_copy) {
-					for (auto req : bucket.second) {
-
-						http_request_completion_t rv;
-						auto currbucket = buckets.find(bucket.first);
-
-						if (currbucket != buckets.end()) {
-							/* Theres a bucket for this request. Check its status. If the bucket says to wait,
-							 * skip all requests in this bucket till its ok.
-							*/
-							if (currbucket->second.remaining < 1) {
-								uint64_t wait = (currbucket->second.retry_after ? currbucket->second.retry_after : currbucket->second.reset_after);
-								if (time(NULL) > currbucket->second.timestamp + wait) {
-									/* Time has passed, we can process this bucket again. send its request. */
-									rv = req->Run(creator);
-								} else {
-									/* Time not up yet, emit signal and wait */
-									std::this_thread::sleep_for(std::chrono::milliseconds(50));
-									emit_in_queue_signal();
-									break;
-								}
-							} else {
-								/* There's limit remaining, we can just run the request */
-								rv = req->Run(creator);
-							}
-						} else {
-							/* No bucket for this endpoint yet. Just send it, and make one from its reply */
-							rv = req->Run(creator);
+					/* While a bucket has a request in flight on the HTTP/2 connection, the rest wait for its reply */
+					auto in_flight = streams_in_flight.find(bucket.first);
+					if (in_flight != streams_in_flight.end()) {
+						if (req != in_flight->second) {
+							hold_back(bucket.first, req);
 						}
+						continue;
+					}
 
-						bucket_t newbucket;
-						newbucket.limit = rv.ratelimit_limit;
-						newbucket.remaining = rv.ratelimit_remaining;
-						newbucket.reset_after = rv.ratelimit_reset_after;
-						newbucket.retry_after = rv.ratelimit_retry_after;
-						newbucket.timestamp = time(NULL);
-						globally_ratelimited = rv.ratelimit_global;
-						if (globally_ratelimited) {
-							globally_limited_for = (newbucket.retry_after ? newbucket.retry_after : newbucket.reset_after);
-						}
-						buckets[req->endpoint] = newbucket;
-
-						/* Make a new entry in the completion list and notify */
-						{
-							std::lock_guard<std::mutex> lock(out_mutex);
-							http_request_completion_t* hrc = new http_request_completion_t();
-							*hrc = rv;
-							responses_out.push(std::make_pair(hrc, req));
-							emit_out_queue_signal();
-						}
+					if (expire(bucket.first, req)) {
+						continue;
 					}
-				}
 
-				{
-					std::lock_guard<std::mutex> lock(in_mutex);
-					bool again = false;
-					do {
-						again = false;
-						for (auto & bucket : requests_in) {
-							for (auto req = bucket.second.begin(); req != bucket.second.end(); ++req) {
-								if ((*req)->is_completed()) {
-									requests_in[bucket.first].erase(req);
-									again = true;
-									goto out;	/* Only clean way out of a nested loop */
-								}
-							}
+					/* If the bucket is used up, skip all requests in this bucket till it resets */
+					if (!buckets.try_acquire(bucket.first)) {
+						wake_within(buckets.wait_time(bucket.first));
+						for (size_t j = i; j < bucket.second.size(); ++j) {
+							hold_back(bucket.first, bucket.second[j]);
 						}
-						out:;
-					} while (again);
-				}
+						break;
+					}
 
-			} else {
-				if (globally_limited_for > 0) {
-					std::this_thread::sleep_for(std::chrono::seconds(globally_limited_for));
-					globally_limited_for = 0;
+					bool new_connection;
+					http2_connection* conn = multiplex(req, new_connection);
+					if (conn) {
+						/* The next bucket's request goes out without waiting for this one's reply */
+						send_http2(conn, new_connection, bucket.first, req);
+						break;
+					}
+
+					/* Retries stay at the front of their bucket, so nothing behind them may go first */
+					if (!handle_reply(bucket.first, req, run_request(req))) {
+						break;
+					}
 				}
-				globally_ratelimited = false;
-				emit_in_queue_signal();
 			}
+
+		} else {
+			if (globally_limited_for > 0) {
+				std::this_thread::sleep_for(std::chrono::seconds(globally_limited_for));
+				globally_limited_for = 0;
+			}
+			globally_ratelimited = false;
+			emit_in_queue_signal();
 		}
 	}
 	::close(notifier);
 }
 
+/* Identical GET requests share this key. Only the endpoint and parameters matter; a GET has no body. */
+static std::string coalesce_key(const http_request* req)
+{
+	return req->endpoint + "/" + req->parameters;
+}
+
+void request_queue::finish(const std::string &key, http_request* req, http_request_completion_t &&rv)
+{
+	/* Take the request out of the queue before anything can free it */
+	std::vector<http_request*> followers;
+	{
+		std::lock_guard<std::mutex> lock(in_mutex);
+		auto bucket = requests_in.find(key);
+		if (bucket != requests_in.end()) {
+			bucket->second.erase(std::remove(bucket->second.begin(), bucket->second.end(), req), bucket->second.end());
+			if (bucket->second.empty()) {
+				requests_in.erase(bucket);
+			}
+		}
+		if (req->method == m_get) {
+			auto g = gets_in_flight.find(coalesce_key(req));
+			if (g != gets_in_flight.end() && g->second.leader == req) {
+				followers = std::move(g->second.followers);
+				gets_in_flight.erase(g);
+			}
+		}
+	}
+	for (auto f : followers) {
+		f->completed = true;
+		queue_completion(key, f, http_request_completion_t(rv));
+	}
+	queue_completion(key, req, std::move(rv));
+}
+
+void request_queue::queue_completion(const std::string &key, http_request* req, http_request_completion_t &&rv)
+{
+	if (req->ordering_key.empty()) {
+		req->ordering_key = key;
+	}
+	pending_completion p = { std::move(rv), req, std::chrono::steady_clock::now() };
+	if (req->inline_completion) {
+		run_completion(p);
+		return;
+	}
+	/* Make a new entry in the completion list and notify */
+	std::lock_guard<std::mutex> lock(out_mutex);
+	responses_out.push(std::move(p));
+	emit_out_queue_signal();
+}
+
+void request_queue::run_completion(pending_completion &p)
+{
+	auto started = std::chrono::steady_clock::now();
+	p.req->complete(p.rv);
+	delete p.req;
+	auto ended = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(stats_mutex);
+	stats.completion_wait.record(std::chrono::duration<double, std::milli>(started - p.ready).count());
+	stats.completion_run.record(std::chrono::duration<double, std::milli>(ended - started).count());
+}
+
+void request_queue::worker_loop(completion_worker* w)
+{
+	while (true) {
+		pending_completion p;
+		{
+			std::unique_lock<std::mutex> lock(w->mutex);
+			w->cv.wait(lock, [this, w]() { return terminating || !w->queue.empty(); });
+			if (w->queue.empty()) {
+				return;
+			}
+			p = std::move(w->queue.front());
+			w->queue.pop();
+		}
+		run_completion(p);
+	}
+}
+
 void request_queue::out_loop()
 {
 	int c = sizeof(struct sockaddr_in);
@@ -315,20 +1337,40 @@ void request_queue::out_loop()
 		while (recv(notifier, &n, 1, 0) > 0) {
 			/* New request to be sent! */
 
-			std::pair<http_request_completion_t*, http_request*> queue_head = {};
+			pending_completion queue_head = {};
 			{
 				std::lock_guard<std::mutex> lock(out_mutex);
 				if (responses_out.size()) {
-					queue_head = responses_out.front();
+					queue_head = std::move(responses_out.front());
 					responses_out.pop();
 				}
 			}
 
-			if (queue_head.first && queue_head.second) {
-				queue_head.second->complete(*queue_head.first);
+			if (!queue_head.req) {
+				continue;
+			}
+
+			/* The workers are started on first use, so that cluster::completion_threads may be set after construction */
+			if (workers.empty() && creator->completion_threads > 1) {
+				for (uint32_t i = 0; i < creator->completion_threads; ++i) {
+					completion_worker* w = new completion_worker();
+					w->thread = new std::thread(&request_queue::worker_loop, this, w);
+					workers.push_back(w);
+				}
+			}
+
+			if (workers.empty()) {
+				/* A single completion thread: run it here, which keeps every completion in order */
+				run_completion(queue_head);
+			} else {
+				/* Completions with the same ordering key always go to the same worker, so they stay in order */
+				completion_worker* w = workers[std::hash<std::string>()(queue_head.req->ordering_key) % workers.size()];
+				{
+					std::lock_guard<std::mutex> lock(w->mutex);
+					w->queue.push(std::move(queue_head));
+				}
+				w->cv.notify_one();
 			}
-			delete queue_head.first;
-			delete queue_head.second;
 		}
 	}
 	::close(notifier);
@@ -339,7 +1381,8 @@ void request_queue::out_loop()
  */
 void request_queue::emit_in_queue_signal()
 {
-	send(in_queue_connect_sock, "X", 1, 0);
+	/* An HTTP/2 reply may arrive as the queue is destroyed, after this socket has been shut down */
+	send(in_queue_connect_sock, "X", 1, MSG_NOSIGNAL);
 }
 
 void request_queue::emit_out_queue_signal()
@@ -350,8 +1393,42 @@ void request_queue::emit_out_queue_signal()
 /* Post a http_request into the queue */
 void request_queue::post_request(http_request* req)
 {
+	req->queued = std::chrono::steady_clock::now();
+	std::string key = buckets.key(req);
 	std::lock_guard<std::mutex> lock(in_mutex);
-	requests_in[req->endpoint].push_back(req);
+	/* A streamed reply's body is handed to its own request as it arrives, so it can't be shared */
+	if (req->method == m_get && !req->streams_body()) {
+		/* Wait on an identical GET already queued or in flight, as long as it will be sent at
+		 * least as soon as this one would have been and won't expire before this one does.
+		 */
+		auto g = gets_in_flight.find(coalesce_key(req));
+		if (g == gets_in_flight.end()) {
+			gets_in_flight[coalesce_key(req)].leader = req;
+		} else {
+			http_request* leader = g->second.leader;
+			bool no_deadline = leader->deadline == std::chrono::steady_clock::time_point();
+			bool has_deadline = req->deadline != std::chrono::steady_clock::time_point();
+			if (leader->priority <= req->priority && (no_deadline || (has_deadline && leader->deadline >= req->deadline))) {
+				g->second.followers.push_back(req);
+				std::lock_guard<std::mutex> stats_lock(stats_mutex);
+				stats.coalesced++;
+				return;
+			}
+		}
+	}
+	/* Keep each bucket in the order its requests should be sent: by priority, then earliest
+	 * deadline (requests without one last), then first come first served.
+	 */
+	auto before = [req](const http_request* other) {
+		if (req->priority != other->priority) {
+			return req->priority < other->priority;
+		}
+		bool has_deadline = req->deadline != std::chrono::steady_clock::time_point();
+		bool other_has_deadline = other->deadline != std::chrono::steady_clock::time_point();
+		return has_deadline && (!other_has_deadline || req->deadline < other->deadline);
+	};
+	auto &bucket = requests_in[key];
+	bucket.insert(std::find_if(bucket.begin(), bucket.end(), before), req);
 	emit_in_queue_signal();
 }
 
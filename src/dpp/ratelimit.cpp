@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <dpp/ratelimit.h>
+
+namespace dpp {
+
+token_bucket::token_bucket(double _capacity, double per_seconds) : capacity(_capacity), tokens(_capacity), rate(_capacity / per_seconds), last_refill(std::chrono::steady_clock::now())
+{
+}
+
+void token_bucket::refill()
+{
+	auto now = std::chrono::steady_clock::now();
+	double elapsed = std::chrono::duration<double>(now - last_refill).count();
+	tokens = std::min(capacity, tokens + elapsed * rate);
+	last_refill = now;
+}
+
+bool token_bucket::try_acquire(double count, double leave)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	refill();
+	if (tokens < count + leave) {
+		return false;
+	}
+	tokens -= count;
+	return true;
+}
+
+double token_bucket::wait_time(double count)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	refill();
+	return tokens >= count ? 0 : (count - tokens) / rate;
+}
+
+void token_bucket::reset()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	tokens = capacity;
+	last_refill = std::chrono::steady_clock::now();
+}
+
+rate_limiter::rate_limiter(double capacity, double per_seconds, double _reserved) : bucket(capacity, per_seconds), reserved(_reserved)
+{
+	for (size_t p = 0; p < RATE_PRIORITIES; ++p) {
+		acquired[p] = 0;
+		refused[p] = 0;
+	}
+}
+
+bool rate_limiter::try_acquire(rate_priority priority)
+{
+	if (bucket.try_acquire(1, reserved * priority)) {
+		acquired[priority]++;
+		return true;
+	}
+	refused[priority]++;
+	return false;
+}
+
+double rate_limiter::wait_time(rate_priority priority)
+{
+	return bucket.wait_time(1 + reserved * priority);
+}
+
+void rate_limiter::reset()
+{
+	bucket.reset();
+}
+
+uint64_t rate_limiter::get_acquired(rate_priority priority) const
+{
+	return acquired[priority];
+}
+
+uint64_t rate_limiter::get_refused(rate_priority priority) const
+{
+	return refused[priority];
+}
+
+};
@@ -42,21 +42,27 @@ role& role::fill_from_json(snowflake _guild_id, nlohmann::json* j)
 	return *this;
 }
 
-std::string role::build_json(bool with_id) const {
-	json j;
-
+void role::write_json(json_writer &w, bool with_id, bool with_position) const {
+	w.begin_object();
 	if (with_id) {
-		j["id"] = std::to_string(id);
+		w.key("id").snowflake(id);
 	}
 	if (colour) {
-		j["color"] = colour;
+		w.field("color", colour);
+	}
+	if (with_position) {
+		w.field("position", position);
 	}
-	j["position"] = position;
-	j["permissions"] = permissions;
-	j["hoist"] = is_hoisted();
-	j["mentionable"] = is_mentionable();
+	w.field("permissions", permissions);
+	w.field("hoist", is_hoisted());
+	w.field("mentionable", is_mentionable());
+	w.end_object();
+}
 
-	return j.dump();
+std::string role::build_json(bool with_id) const {
+	json_writer &w = json_writer::reusable();
+	write_json(w, with_id);
+	return w.str();
 }
 
 bool role::is_hoisted() const {
@@ -26,6 +26,9 @@
 #include <exception>
 #include <string>
 #include <iostream>
+#include <vector>
+#include <map>
+#include <mutex>
 #include <dpp/sslclient.h>
 
 /* You'd think that we would get better performance with a bigger buffer, but SSL frames are 16k each.
@@ -35,7 +38,89 @@
 #define BUFSIZZ 1024 * 16
 const int ERROR_STATUS = -1;
 
-SSLClient::SSLClient(const std::string &_hostname, const std::string &_port) : last_tick(time(NULL)), hostname(_hostname), port(_port)
+/* How long a resolved host name is cached for, in seconds */
+#define DNS_CACHE_TTL 300
+
+/* A resolved address for a host, copied out of getaddrinfo() results */
+struct resolved_address {
+	int family;
+	int socktype;
+	int protocol;
+	sockaddr_storage addr;
+	socklen_t addrlen;
+};
+
+/* Cached addresses for a host and port */
+struct dns_cache_entry {
+	std::vector<resolved_address> addresses;
+	time_t expires;
+};
+
+/* Every shard connects to the same gateway host, so lookups are cached and shared by all
+ * connections. This saves a DNS lookup per shard on startup and on every reconnect, and
+ * means a reconnect can still go ahead while DNS is briefly unavailable.
+ */
+static std::mutex dns_cache_mutex;
+static std::map<std::string, dns_cache_entry> dns_cache;
+static uint64_t dns_lookups = 0;
+
+/* Resolve a host name and port, from the cache if possible. Throws std::runtime_error on failure. */
+static std::vector<resolved_address> resolve(const std::string &hostname, const std::string &port)
+{
+	std::string key = hostname + ":" + port;
+	{
+		std::lock_guard<std::mutex> lock(dns_cache_mutex);
+		auto cached = dns_cache.find(key);
+		if (cached != dns_cache.end() && cached->second.expires > time(NULL)) {
+			return cached->second.addresses;
+		}
+	}
+
+	struct addrinfo hints = {0}, *addrs;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	int status = getaddrinfo(hostname.c_str(), port.c_str(), &hints, &addrs);
+	{
+		std::lock_guard<std::mutex> lock(dns_cache_mutex);
+		dns_lookups++;
+	}
+	if (status != 0)
+		throw std::runtime_error(gai_strerror(status));
+
+	dns_cache_entry entry;
+	for (struct addrinfo *addr = addrs; addr != nullptr; addr = addr->ai_next) {
+		resolved_address a;
+		a.family = addr->ai_family;
+		a.socktype = addr->ai_socktype;
+		a.protocol = addr->ai_protocol;
+		a.addrlen = addr->ai_addrlen;
+		memcpy(&a.addr, addr->ai_addr, addr->ai_addrlen);
+		entry.addresses.push_back(a);
+	}
+	freeaddrinfo(addrs);
+	entry.expires = time(NULL) + DNS_CACHE_TTL;
+
+	std::lock_guard<std::mutex> lock(dns_cache_mutex);
+	dns_cache[key] = entry;
+	return entry.addresses;
+}
+
+/* Drop a host from the cache, so that the next connection attempt looks it up again */
+static void forget_address(const std::string &hostname, const std::string &port)
+{
+	std::lock_guard<std::mutex> lock(dns_cache_mutex);
+	dns_cache.erase(hostname + ":" + port);
+}
+
+uint64_t SSLClient::DNSLookups()
+{
+	std::lock_guard<std::mutex> lock(dns_cache_mutex);
+	return dns_lookups;
+}
+
+SSLClient::SSLClient(const std::string &_hostname, const std::string &_port) : sfd(ERROR_STATUS), ssl(nullptr), ctx(nullptr), last_tick(time(NULL)), hostname(_hostname), port(_port)
 {
 	Connect();
 }
@@ -45,6 +130,9 @@ void SSLClient::Connect()
 {
 	/* Initial connection is done in blocking mode. There is a timeout on it. */
 	nonblocking = false;
+	/* Anything left over from a previous connection is meaningless on this one */
+	buffer.clear();
+	obuffer.clear();
 	const SSL_METHOD *method = TLS_client_method(); /* Create new client-method instance */
 
 	/* Create SSL context */
@@ -58,43 +146,34 @@ void SSLClient::Connect()
 		throw std::runtime_error("SSL_new failed!");
 
 	/* Resolve hostname to IP */
-	struct hostent *host;
-	if ((host = gethostbyname(hostname.c_str())) == nullptr)
-		throw std::runtime_error("Couldn't resolve hostname");
-
-	struct addrinfo hints = {0}, *addrs;
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = IPPROTO_TCP;
-
-	int status = getaddrinfo(hostname.c_str(), port.c_str(), &hints, &addrs);
-	if (status != 0)
-		throw std::runtime_error(gai_strerror(status));
+	std::vector<resolved_address> addresses = resolve(hostname, port);
 
 	/* Attempt each address in turn, if there are multiple IP addresses on the hostname */
-	int err;
-	for (struct addrinfo *addr = addrs; addr != nullptr; addr = addr->ai_next) {
-		sfd = socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol);
-		if (sfd == ERROR_STATUS) {
+	int err = EHOSTUNREACH;
+	sfd = ERROR_STATUS;
+	for (auto & addr : addresses) {
+		int fd = socket(addr.family, addr.socktype, addr.protocol);
+		if (fd == ERROR_STATUS) {
 			err = errno;
 			continue;
-		} else if (connect(sfd, addr->ai_addr, addr->ai_addrlen) == 0) {
+		} else if (connect(fd, (struct sockaddr*)&addr.addr, addr.addrlen) == 0) {
+			sfd = fd;
 			break;
 		}
 		err = errno;
-		sfd = ERROR_STATUS;
-		::close(sfd);
+		::close(fd);
 	}
-	freeaddrinfo(addrs);
 
-	/* Check if none of the IPs yielded a valid connection */
-	if (sfd == ERROR_STATUS)
+	/* Check if none of the IPs yielded a valid connection. The addresses may be stale, so look them up again next time. */
+	if (sfd == ERROR_STATUS) {
+		forget_address(hostname, port);
 		throw std::runtime_error(strerror(err));
+	}
 
 	/* We're good to go - hand the fd over to openssl */
 	SSL_set_fd(ssl, sfd);
 
-	status = SSL_connect(ssl);
+	int status = SSL_connect(ssl);
 	if (status != 1) {
 		throw std::runtime_error("SSL_connect error");
 	}
@@ -121,6 +200,10 @@ void SSLClient::OneSecondTimer()
 {
 }
 
+void SSLClient::Tick()
+{
+}
+
 void SSLClient::ReadLoop()
 {
 	/* The read loop is non-blocking using select(). This method
@@ -162,6 +245,17 @@ void SSLClient::ReadLoop()
 			this->OneSecondTimer();
 			last_tick = time(NULL);
 		}
+		this->Tick();
+
+		/* Check for input on the sendq. This is done before select(), so that anything queued since
+		 * the last pass, e.g. a heartbeat from Tick(), is written now rather than once something is read.
+		 */
+		if (obuffer.length() && ClientToServerLength == 0) {
+			memcpy(&ClientToServerBuffer, obuffer.data(), obuffer.length() > BUFSIZZ ? BUFSIZZ : obuffer.length());
+			ClientToServerLength = obuffer.length() > BUFSIZZ ? BUFSIZZ : obuffer.length();
+			obuffer = obuffer.substr(ClientToServerLength, obuffer.length());
+			ClientToServerOffset = 0;
+		}
 
 		FD_ZERO(&readfds);
 		FD_ZERO(&writefds);
@@ -224,14 +318,6 @@ void SSLClient::ReadLoop()
 			} while (SSL_pending(ssl) && !read_blocked);
 		}
 			
-		/* Check for input on the sendq */
-		if (obuffer.length() && ClientToServerLength == 0) {
-			memcpy(&ClientToServerBuffer, obuffer.data(), obuffer.length() > BUFSIZZ ? BUFSIZZ : obuffer.length());
-			ClientToServerLength = obuffer.length() > BUFSIZZ ? BUFSIZZ : obuffer.length();
-			obuffer = obuffer.substr(ClientToServerLength, obuffer.length());
-			ClientToServerOffset = 0;
-		}
-
 		/* If the socket is writeable... */
 		if ((FD_ISSET(sfd,&writefds) && ClientToServerLength) || (write_blocked_on_read && FD_ISSET(sfd,&readfds))) {
 			write_blocked_on_read = false;
@@ -270,15 +356,30 @@ bool SSLClient::HandleBuffer(std::string &buffer)
 	return true;
 }
 
+void SSLClient::Shutdown()
+{
+	if (sfd != ERROR_STATUS) {
+#ifdef _WIN32
+		::shutdown(sfd, SD_BOTH);
+#else
+		::shutdown(sfd, SHUT_RDWR);
+#endif
+	}
+}
+
 void SSLClient::close()
 {
-	if (ctx && ssl && sfd) {
+	if (ssl) {
 		SSL_free(ssl);
+		ssl = nullptr;
+	}
+	if (sfd != ERROR_STATUS) {
 		::close(sfd);
+		sfd = ERROR_STATUS;
+	}
+	if (ctx) {
 		SSL_CTX_free(ctx);
 		ctx = nullptr;
-		ssl = nullptr;
-		sfd = 0;
 	}
 }
 
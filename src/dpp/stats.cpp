@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <cmath>
+#include <dpp/stats.h>
+
+namespace dpp {
+
+void latency_histogram::record(double ms)
+{
+	size_t bucket = 0;
+	while (bucket < bucket_count - 1 && ms >= bucket_limit(bucket)) {
+		bucket++;
+	}
+	buckets[bucket]++;
+	min = count ? std::min(min, ms) : ms;
+	max = count ? std::max(max, ms) : ms;
+	total += ms;
+	count++;
+}
+
+void latency_histogram::merge(const latency_histogram &other)
+{
+	if (!other.count) {
+		return;
+	}
+	for (size_t i = 0; i < bucket_count; ++i) {
+		buckets[i] += other.buckets[i];
+	}
+	min = count ? std::min(min, other.min) : other.min;
+	max = count ? std::max(max, other.max) : other.max;
+	total += other.total;
+	count += other.count;
+}
+
+double latency_histogram::mean() const
+{
+	return count ? total / count : 0;
+}
+
+double latency_histogram::percentile(double p) const
+{
+	if (!count) {
+		return 0;
+	}
+	uint64_t wanted = (uint64_t)std::ceil(count * std::min(std::max(p, 0.0), 100.0) / 100.0);
+	if (wanted == 0) {
+		return min;
+	}
+	uint64_t seen = 0;
+	for (size_t i = 0; i < bucket_count - 1; ++i) {
+		seen += buckets[i];
+		if (seen >= wanted) {
+			return std::min(bucket_limit(i), max);
+		}
+	}
+	return max;
+}
+
+double latency_histogram::bucket_limit(size_t bucket)
+{
+	return (double)(1ULL << bucket);
+}
+
+uint64_t cache_through_stats::saved() const
+{
+	return hits + coalesced;
+}
+
+double cache_through_stats::hit_ratio() const
+{
+	return hits + misses ? (double)hits / (hits + misses) : 0;
+}
+
+};
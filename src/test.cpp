@@ -33,11 +33,13 @@ int main(int argc, char const *argv[])
 	/* Lets just output some log */
 	log->info("Starting test bot");
 
-	/* Create a D++ cluster. The intents, shard counts, cluster counts and logger are all optional. */
+	/* Create a D++ cluster. The intents, shard counts, cluster counts and logger are all optional.
+	 * If the config doesn't give a shard count, 0 asks discord for its recommended number of shards.
+	 */
 	dpp::cluster bot(configdocument["token"].get<std::string>(),
                 dpp::GUILDS | dpp::GUILD_MEMBERS | dpp::GUILD_BANS | dpp::GUILD_EMOJIS | dpp::GUILD_INTEGRATIONS |
                 dpp::GUILD_WEBHOOKS | dpp::GUILD_INVITES | dpp::GUILD_MESSAGES | dpp::GUILD_MESSAGE_REACTIONS,
-                configdocument["shards"].get<uint32_t>(), 0, 1,
+                configdocument.value("shards", (uint32_t)0), 0, 1,
                 log.get()
         );
 
@@ -0,0 +1,74 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <atomic>
+#include <cstdlib>
+#include <future>
+#include <new>
+
+/* Heap allocations per message_create() round trip against a local server: those made on
+ * the calling thread while the request is queued, and those made by the whole process (the
+ * request and completion threads, and the test server) over the round trip. Once the
+ * global rate limit's burst is used up, round trips are paced at its 50 a second.
+ */
+static std::atomic<size_t> process_allocations(0);
+static thread_local size_t thread_allocations = 0;
+
+void* operator new(size_t size) {
+	process_allocations++;
+	thread_allocations++;
+	void* p = malloc(size ? size : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+int main() {
+	test_server server;
+	server.svr.Post("/api/channels/825411104208977952/messages", [](const httplib::Request &req, httplib::Response &res) {
+		res.set_content(R"({"id":"825411104208977953","channel_id":"825411104208977952","content":"hello","tts":false,"pinned":false,"mention_everyone":false,"timestamp":"2021-04-16T14:21:07.123000+00:00","edited_timestamp":null,"author":{"id":"189759562910400512","username":"brain","discriminator":"0001"}})", "application/json");
+	});
+	server.start();
+
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = server.url();
+	dpp::message m;
+	m.channel_id = 825411104208977952ULL;
+	m.content = "hello";
+
+	auto round_trip = [&bot, &m](size_t &queued) {
+		std::promise<void> done;
+		size_t before = thread_allocations;
+		bot.message_create(m, [&done](const dpp::confirmation_callback_t&) {
+			done.set_value();
+		});
+		queued = thread_allocations - before;
+		done.get_future().wait();
+	};
+
+	/* Warm up the connection, the request pool and the reusable buffers */
+	size_t queued;
+	for (int i = 0; i < 20; ++i) {
+		round_trip(queued);
+	}
+	const int requests = 100;
+	size_t caller = 0;
+	size_t process_before = process_allocations;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < requests; ++i) {
+		round_trip(queued);
+		caller += queued;
+	}
+	double ms = elapsed_ms(start);
+	printf("%d round trips, %.2f ms each\n", requests, ms / requests);
+	printf("allocations per call: %.1f on the calling thread, %.1f in the process\n", (double)caller / requests, (double)(process_allocations - process_before) / requests);
+	return 0;
+}
@@ -0,0 +1,117 @@
+#include <dpp/coro.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/* The cost of co_await over nested callbacks, for chains of four calls which each complete
+ * on a single completion thread, as REST calls do. The calls are a stand-in for the request
+ * queue which completes at once, so that only the chaining is measured.
+ */
+#ifdef DPP_CORO
+struct result {
+	int status;
+	std::string body;
+};
+
+class completion_thread {
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<std::function<void()>> queue;
+	bool stopping = false;
+	std::thread thread;
+public:
+	completion_thread() : thread([this] {
+		for (;;) {
+			std::function<void()> f;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [this] { return stopping || !queue.empty(); });
+				if (queue.empty()) {
+					return;
+				}
+				f = std::move(queue.front());
+				queue.pop_front();
+			}
+			f();
+		}
+	}) {
+	}
+
+	~completion_thread() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		cv.notify_one();
+		thread.join();
+	}
+
+	void call(int x, std::function<void(const result&)> callback) {
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.push_back([x, callback] { callback(result{ 200, std::to_string(x) }); });
+		cv.notify_one();
+	}
+};
+
+static completion_thread completions;
+static std::atomic<int> finished(0);
+static const int steps = 4;
+
+static void nested(int i) {
+	completions.call(i, [i](const result&) {
+		completions.call(i, [i](const result&) {
+			completions.call(i, [i](const result&) {
+				completions.call(i, [](const result&) {
+					finished++;
+				});
+			});
+		});
+	});
+}
+
+static dpp::async_result<result> co_call(int x) {
+	return dpp::async_result<result>([x](std::function<void(const result&)> callback) {
+		completions.call(x, callback);
+	});
+}
+
+static dpp::job chain(int i) {
+	for (int s = 0; s < steps; ++s) {
+		result r = co_await co_call(i);
+		(void)r;
+	}
+	finished++;
+}
+
+template <typename F> static void measure(const char* name, F f) {
+	const int chains = 200000;
+	finished = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < chains; ++i) {
+		f(i);
+	}
+	while (finished < chains) {
+		std::this_thread::yield();
+	}
+	double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%-17s %d chains of %d calls: %.3fs, %.0f chains/s\n", name, chains, steps, s, chains / s);
+}
+#endif
+
+int main() {
+#ifdef DPP_CORO
+	for (int round = 0; round < 3; ++round) {
+		measure("nested callbacks", nested);
+		measure("co_await", chain);
+	}
+#else
+	printf("built without coroutine support\n");
+#endif
+	return 0;
+}
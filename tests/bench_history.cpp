@@ -0,0 +1,63 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <dpp/history.h>
+#include <future>
+
+/* Time to read a channel's history through message_history with and without fetching ahead,
+ * against a local server which takes a while to answer, and a caller which takes a while to
+ * process each page. Without fetching ahead each page costs a round trip plus processing; with
+ * it, the round trips overlap the processing of earlier pages.
+ */
+static const uint64_t total_messages = 450;
+static const int server_ms = 40;
+static const int processing_ms = 40;
+
+static double read_all(const std::string &url, uint32_t window) {
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = url;
+	auto history = bot.messages_history(1, 0, 50, window);
+	auto started = std::chrono::steady_clock::now();
+	while (true) {
+		std::promise<dpp::history_page> p;
+		history->next([&p](const dpp::history_page &page) {
+			p.set_value(page);
+		});
+		auto f = p.get_future();
+		if (f.wait_for(std::chrono::seconds(10)) != std::future_status::ready) {
+			printf("next() never called back\n");
+			break;
+		}
+		dpp::history_page page = f.get();
+		std::this_thread::sleep_for(std::chrono::milliseconds(processing_ms));
+		if (page.end) {
+			break;
+		}
+	}
+	return elapsed_ms(started);
+}
+
+int main() {
+	test_server server;
+	server.svr.Get("/api/channels/1/messages", [](const httplib::Request &req, httplib::Response &res) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(server_ms));
+		uint64_t before = req.has_param("before") ? std::stoull(req.get_param_value("before")) : total_messages + 1;
+		uint64_t limit = std::stoull(req.get_param_value("limit"));
+		std::string body = "[";
+		for (uint64_t id = before - 1; id > 0 && id + limit >= before; --id) {
+			body += (body.size() > 1 ? "," : "") + std::string(R"({"id":")") + std::to_string(id) + R"(","channel_id":"1","content":"message )" + std::to_string(id) + "\"}";
+		}
+		body += "]";
+		res.set_content(body, "application/json");
+	});
+	server.start();
+
+	/* Ten pages, the last one empty */
+	const double serial = 10 * (server_ms + processing_ms);
+	for (int round = 0; round < 3; ++round) {
+		for (uint32_t window : { 1, 4 }) {
+			double ms = read_all(server.url(), window);
+			printf("window %u: %.0fms, %.0f%% of reading one page at a time (%.0fms)\n", window, ms, 100 * ms / serial, serial);
+		}
+	}
+	return 0;
+}
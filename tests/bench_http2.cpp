@@ -0,0 +1,76 @@
+#include "test.h"
+#include "h2_server.h"
+#include <dpp/dpp.h>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <vector>
+
+/* Latency and throughput of a burst of REST requests spread over several channels, over one
+ * keep-alive HTTP/1.1 connection and over one HTTP/2 connection (cluster::rest_http2). Each
+ * server holds every reply back for the same time, standing in for the round trip to discord,
+ * which HTTP/1.1 pays once per request and HTTP/2 once per bucket's turn. Bursts stay within
+ * the global rate limit's burst, so no request waits for it.
+ */
+#ifdef DPP_HTTP2
+static const int requests = 40;
+static const int channels = 10;
+
+static void run(const char* name, const std::string &url, bool http2) {
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = url;
+	bot.rest_http2 = http2;
+	std::mutex latency_mutex;
+	std::vector<double> latency;
+	std::promise<void> all_done;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < requests; ++i) {
+		auto queued = std::chrono::steady_clock::now();
+		/* Each fetches a different message, so that none are coalesced */
+		bot.post_rest("/api/channels", std::to_string(i % channels + 1) + "/messages/" + std::to_string(i + 1000), dpp::m_get, "", [&, queued](json&, const dpp::http_request_completion_t&) {
+			std::lock_guard<std::mutex> lock(latency_mutex);
+			latency.push_back(elapsed_ms(queued));
+			if (latency.size() == requests) {
+				all_done.set_value();
+			}
+		});
+	}
+	all_done.get_future().wait();
+	double total = elapsed_ms(start);
+	std::sort(latency.begin(), latency.end());
+	dpp::rest_stats stats = bot.get_rest_stats();
+	printf("%-8s %6.0f ms total, %7.1f req/s, p50 %7.1f ms, p99 %7.1f ms, %llu connection(s), at most %llu in flight\n", name, total, requests * 1000 / total,
+		latency[requests / 2], latency[requests * 99 / 100], (unsigned long long)stats.connections_opened, (unsigned long long)(http2 ? stats.http2_peak_streams : 1));
+}
+
+int main() {
+	for (int delay : { 0, 20, 100 }) {
+		test_server h1;
+		/* httplib's server closes a connection after 5 requests by default */
+		h1.svr.set_keep_alive_max_count(1000);
+		h1.svr.Get(R"(/api/channels/\d+/messages/(\d+))", [delay](const httplib::Request &req, httplib::Response &res) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+			res.set_content("{\"id\":\"" + std::string(req.matches[1]) + "\"}", "application/json");
+		});
+		h1.start();
+		h2_server h2;
+		h2.handler = [delay](const h2_request &req, h2_response &res) {
+			res.headers.emplace_back("content-type", "application/json");
+			res.body = "{\"id\":\"" + req.path.substr(req.path.rfind('/') + 1) + "\"}";
+			res.delay_ms = delay;
+		};
+		h2.start();
+
+		printf("%d requests over %d channels, replies held back %d ms\n", requests, channels, delay);
+		run("HTTP/1.1", h1.url(), false);
+		run("HTTP/2", h2.url(), true);
+	}
+	return 0;
+}
+#else
+int main() {
+	printf("Built without nghttp2, so there is no HTTP/2 transport to measure\n");
+	return 0;
+}
+#endif
@@ -0,0 +1,50 @@
+#include <dpp/dpp.h>
+#include <dpp/jsonscan.h>
+#include <chrono>
+#include <cstdio>
+
+/* Parse throughput of the two JSON backends, on a MESSAGE_CREATE event and on a large
+ * member list like the ones in GUILD_CREATE and GUILD_MEMBERS_CHUNK, plus the structural
+ * index on its own.
+ */
+static const char* message_create = R"({"t":"MESSAGE_CREATE","s":42,"op":0,"d":{"type":0,"tts":false,"timestamp":"2021-04-16T14:21:07.123000+00:00","referenced_message":null,"pinned":false,"nonce":"832345678901234567","mentions":[],"mention_roles":[],"mention_everyone":false,"member":{"roles":["825407338755653645","828433613343162460"],"mute":false,"joined_at":"2021-03-28T11:22:33.456000+00:00","hoisted_role":null,"deaf":false},"id":"832645678901234567","flags":0,"embeds":[{"type":"rich","title":"This is a test","description":"It is not a drill. THIS is a drill.","color":16711935,"image":{"url":"https://example.com/a.jpg","proxy_url":"https://media.discordapp.net/a.jpg","width":1280,"height":720}}],"edited_timestamp":null,"content":"Hello world, this is a fairly ordinary message with some \"quotes\" and a unicode \u00e9 char","channel_id":"825407338755653648","author":{"username":"brain","public_flags":131072,"id":"189759562910400512","discriminator":"0001","avatar":"a_1234567890abcdef1234567890abcdef"},"attachments":[],"guild_id":"825407338755653642"}})";
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main() {
+	std::string message = message_create;
+	json members = json::object();
+	members["op"] = 0;
+	members["d"]["members"] = json::array();
+	for (int i = 0; i < 2000; ++i) {
+		members["d"]["members"].push_back(json::parse(message)["d"]["author"]);
+	}
+	std::string member_list = members.dump();
+
+	printf("scanner: %s\n", dpp::json_scanner_name());
+	struct { const char* name; const std::string* doc; size_t iterations; } docs[] = {
+		{ "message", &message, 100000 },
+		{ "members", &member_list, 100 },
+	};
+	for (auto & d : docs) {
+		for (auto backend : { dpp::jb_nlohmann, dpp::jb_simd }) {
+			size_t elements = 0;
+			auto start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < d.iterations; ++i) {
+				elements += dpp::json_parse(*d.doc, backend).size();
+			}
+			double s = seconds_since(start);
+			printf("%-8s %-9s %8.1f MB/s %10.2f us/doc\n", d.name, backend == dpp::jb_simd ? "simd" : "nlohmann", d.doc->size() * d.iterations / s / 1e6, s * 1e6 / d.iterations);
+		}
+	}
+
+	std::vector<uint32_t> index;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 1000; ++i) {
+		dpp::json_structural_index(member_list.data(), member_list.size(), index);
+	}
+	printf("structural index only: %.1f MB/s\n", member_list.size() * 1000 / seconds_since(start) / 1e6);
+	return 0;
+}
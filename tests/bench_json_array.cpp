@@ -0,0 +1,79 @@
+#include <dpp/dpp.h>
+#include <dpp/jsonscan.h>
+#include <dpp/discordevents.h>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <unordered_map>
+
+/* Peak heap use while turning a page of messages into dpp::message objects: parsing the
+ * whole reply into one document, against json_parse_array handing over one element at a
+ * time. Each allocation records its size in front of the block, so live and peak bytes can
+ * be tracked without help from the allocator. The per-thread buffers the parsers keep
+ * between calls are sized before measuring.
+ */
+static size_t live = 0, peak = 0;
+
+void* operator new(size_t size) {
+	char* p = (char*)malloc(size + 16);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	*(size_t*)p = size;
+	live += size;
+	peak = std::max(peak, live);
+	return p + 16;
+}
+
+void operator delete(void* p) noexcept {
+	if (p) {
+		char* block = (char*)p - 16;
+		live -= *(size_t*)block;
+		free(block);
+	}
+}
+
+void operator delete(void* p, size_t) noexcept {
+	operator delete(p);
+}
+
+static std::string make_page(int n) {
+	std::string s = "[";
+	for (int i = 0; i < n; ++i) {
+		s += (i ? "," : "") + std::string(R"({"id":")") + std::to_string(800000000000000000ULL + i) + R"(","channel_id":"81384788765712384","author":{"id":"80351110224678912","username":"Nelly","discriminator":"1337","avatar":"8342729096ea3675442027381ff50dfe","public_flags":64},)"
+			R"("content":")" + std::string(200, 'x') + R"(","timestamp":"2017-07-11T17:27:07.299000+00:00","edited_timestamp":null,"tts":false,"mention_everyone":false,"mentions":[],"mention_roles":[],"attachments":[],)"
+			R"("embeds":[{"title":"An embed","description":")" + std::string(300, 'y') + R"(","color":123456,"fields":[{"name":"a","value":"b","inline":true},{"name":"c","value":"d","inline":false}]}],)"
+			R"("reactions":[{"count":1,"me":false,"emoji":{"id":null,"name":"🔥"}}],"pinned":false,"type":0,"flags":0})";
+	}
+	return s + "]";
+}
+
+int main() {
+	for (int n : { 100, 1000 }) {
+		for (auto backend : { dpp::jb_nlohmann, dpp::jb_simd }) {
+			for (bool whole : { true, false }) {
+				std::string body = make_page(n);
+				size_t body_size = body.size();
+				/* Size the per-thread buffers the parsers keep between calls */
+				dpp::json_parse(body, backend);
+				dpp::json_parse_array(body, [](json&) {}, backend);
+				std::unordered_map<uint64_t, dpp::message> messages;
+				size_t base = live;
+				peak = live;
+				if (whole) {
+					json j = dpp::json_parse(body, backend);
+					for (auto & m : j) {
+						messages[SnowflakeNotNull(&m, "id")] = dpp::message().fill_from_json(&m);
+					}
+				} else {
+					dpp::json_parse_array(body, [&messages](json &m) {
+						messages[SnowflakeNotNull(&m, "id")] = dpp::message().fill_from_json(&m);
+					}, backend);
+				}
+				printf("%4d messages, %4zu KB reply, %-8s %-11s peak %5zu KB above the reply, of which %4zu KB is the messages kept\n", n, body_size / 1024, backend == dpp::jb_simd ? "simd" : "nlohmann",
+					whole ? "whole reply" : "per element", (peak - base) / 1024, (live - base) / 1024);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,28 @@
+#include "message_json.h"
+#include <chrono>
+#include <cstdio>
+
+/* message::build_json(), which writes with json_writer, against building an nlohmann::json
+ * document and dumping it, for a message with an embed of ten fields.
+ */
+int main() {
+	dpp::message m = sample_message();
+	const int iterations = 200000;
+	size_t bytes = m.build_json().size();
+	size_t sink = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i) {
+		sink += dom_build_json(m).size();
+	}
+	auto middle = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i) {
+		sink += m.build_json().size();
+	}
+	auto end = std::chrono::steady_clock::now();
+	double dom = std::chrono::duration<double>(middle - start).count();
+	double writer = std::chrono::duration<double>(end - middle).count();
+	printf("payload %zu bytes\n", bytes);
+	printf("json + dump  %6.0f ns %6.0f MB/s\n", dom / iterations * 1e9, bytes * iterations / dom / 1e6);
+	printf("json_writer  %6.0f ns %6.0f MB/s\n", writer / iterations * 1e9, bytes * iterations / writer / 1e6);
+	return sink == 0;
+}
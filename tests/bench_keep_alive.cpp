@@ -0,0 +1,43 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <algorithm>
+#include <future>
+
+/* Round trip latency of REST requests to a local server, with and without
+ * cluster::rest_keep_alive. The server is plain HTTP, so this shows only the TCP handshake
+ * saved; against discord each new connection also costs a TLS handshake. Each run stays
+ * within the global rate limit's burst, so no request waits for it.
+ */
+int main() {
+	test_server server;
+	/* httplib's server closes a connection after 5 requests by default */
+	server.svr.set_keep_alive_max_count(1000);
+	server.svr.Get("/api/users/1", [](const httplib::Request&, httplib::Response &res) {
+		res.set_content(R"({"id":"1","username":"one","discriminator":"0001"})", "application/json");
+	});
+	server.start();
+
+	const int requests = 40;
+	for (int round = 0; round < 3; ++round) {
+		for (bool keep_alive : { false, true }) {
+			dpp::cluster bot("token", 0, 0);
+			bot.rest_url = server.url();
+			bot.rest_keep_alive = keep_alive;
+			std::vector<double> latency;
+			for (int i = 0; i < requests; ++i) {
+				std::promise<void> done;
+				auto start = std::chrono::steady_clock::now();
+				bot.user_get(1, [&done](const dpp::confirmation_callback_t&) {
+					done.set_value();
+				});
+				done.get_future().wait();
+				latency.push_back(elapsed_ms(start));
+			}
+			std::sort(latency.begin(), latency.end());
+			dpp::rest_stats stats = bot.get_rest_stats();
+			printf("%-10s p50 %.3f ms, p99 %.3f ms, %llu connections for %llu requests\n", keep_alive ? "keep-alive" : "fresh", latency[requests / 2], latency[requests * 99 / 100],
+				(unsigned long long)stats.connections_opened, (unsigned long long)stats.requests_sent);
+		}
+	}
+	return 0;
+}
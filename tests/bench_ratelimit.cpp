@@ -0,0 +1,104 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+/* Time taken to send requests to a simulated discord REST API with per-route, per-channel rate
+ * limit buckets, as in the ratelimit test. One busy channel uses its bucket up many times over
+ * and needs busy / LIMIT windows; nine quiet ones each fit in one window, and should be done
+ * within the first two, however long the busy one takes.
+ */
+const int LIMIT = 5;
+const double WINDOW = 0.5;
+
+struct sim_bucket {
+	int remaining = LIMIT;
+	std::chrono::steady_clock::time_point reset;
+};
+
+std::mutex sim_mutex;
+std::map<std::string, sim_bucket> sim_buckets;
+std::atomic<int> served(0), limited(0);
+
+static void serve(const std::string &family, const std::string &channel, httplib::Response &res) {
+	std::lock_guard<std::mutex> lock(sim_mutex);
+	served++;
+	sim_bucket &b = sim_buckets[family + "/" + channel];
+	auto now = std::chrono::steady_clock::now();
+	if (now >= b.reset) {
+		b.remaining = LIMIT;
+		b.reset = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(WINDOW));
+	}
+	double reset_after = std::chrono::duration<double>(b.reset - now).count();
+	res.set_header("X-RateLimit-Bucket", family);
+	res.set_header("X-RateLimit-Limit", std::to_string(LIMIT));
+	res.set_header("X-RateLimit-Reset-After", std::to_string(reset_after));
+	if (b.remaining == 0) {
+		limited++;
+		res.status = 429;
+		res.set_header("X-RateLimit-Remaining", "0");
+		res.set_header("Retry-After", std::to_string(reset_after));
+		res.set_content("{\"message\": \"You are being rate limited.\", \"retry_after\": " + std::to_string(reset_after) + ", \"global\": false}", "application/json");
+		return;
+	}
+	b.remaining--;
+	res.set_header("X-RateLimit-Remaining", std::to_string(b.remaining));
+	res.set_content("{}", "application/json");
+}
+
+int main() {
+	test_server server;
+	server.svr.Post(R"(/api/channels/(\d+)/messages)", [](const httplib::Request &req, httplib::Response &res) {
+		serve("messages", req.matches[1], res);
+	});
+	server.svr.Patch(R"(/api/channels/(\d+)/messages/\d+)", [](const httplib::Request &req, httplib::Response &res) {
+		serve("messages", req.matches[1], res);
+	});
+	server.svr.Put(R"(/api/channels/(\d+)/messages/\d+/reactions/[^/]+/@me)", [](const httplib::Request &req, httplib::Response &res) {
+		serve("reactions", req.matches[1], res);
+	});
+	server.start();
+
+	dpp::cluster bot("token");
+	bot.rest_url = server.url();
+
+	/* One busy channel, which uses its bucket up many times over, and nine quiet ones which
+	 * each fit in one window. The quiet channels must not wait behind the busy one.
+	 */
+	const int busy = 40, quiet = 9, per_quiet = 4;
+	const int total = busy + quiet * per_quiet * 2;
+	std::atomic<int> done(0), failed(0), quiet_done(0);
+	std::atomic<int64_t> quiet_finished(0);
+	auto started = std::chrono::steady_clock::now();
+	auto callback = [&](bool is_quiet) {
+		return [&, is_quiet](json&, const dpp::http_request_completion_t &http) {
+			if (http.status != 200) {
+				failed++;
+			}
+			if (is_quiet && ++quiet_done == quiet * per_quiet * 2) {
+				quiet_finished = (int64_t)elapsed_ms(started);
+			}
+			done++;
+		};
+	};
+	for (int i = 0; i < busy; ++i) {
+		bot.post_rest("/api/channels", i % 2 ? "1000/messages" : "1000/messages/" + std::to_string(5000 + i), i % 2 ? dpp::m_post : dpp::m_patch, "{}", callback(false));
+	}
+	for (int c = 1; c <= quiet; ++c) {
+		std::string channel = std::to_string(1000 + c);
+		for (int i = 0; i < per_quiet; ++i) {
+			bot.post_rest("/api/channels", channel + "/messages", dpp::m_post, "{}", callback(true));
+			bot.post_rest("/api/channels", channel + "/messages/" + std::to_string(6000 + i) + "/reactions/%F0%9F%91%8D/@me", dpp::m_put, "", callback(true));
+		}
+	}
+	while (done < total && elapsed_ms(started) < 30000) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	double secs = elapsed_ms(started) / 1000;
+	printf("requests=%d sent=%d 429s=%d (%.1f%%) time=%.2fs throughput=%.0f req/s, quiet channels done after %.0f ms\n",
+		total, served.load(), limited.load(), 100.0 * limited / served, secs, total / secs, (double)quiet_finished);
+
+	printf("busy channel alone needs %.1fs, quiet channels should be done within %.0fms\n", (busy / LIMIT) * WINDOW, WINDOW * 2 * 1000);
+	return 0;
+}
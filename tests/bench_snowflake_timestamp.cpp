@@ -0,0 +1,55 @@
+#include <dpp/dpp.h>
+#include <dpp/discordevents.h>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <sstream>
+
+/* SnowflakeNotNull and TimestampNotNull against the way they used to parse: copying the
+ * string into a std::istringstream, and strptime() plus mktime().
+ */
+static uint64_t stream_snowflake(json* j, const char* keyname) {
+	if (j->find(keyname) != j->end() && (*j)[keyname].is_string()) {
+		uint64_t t = 0;
+		std::istringstream iss((*j)[keyname].get<std::string>());
+		iss >> std::dec >> t;
+		return t;
+	}
+	return 0;
+}
+
+#ifndef _WIN32
+static time_t strptime_timestamp(json* j, const char* keyname) {
+	if (j->find(keyname) != j->end() && (*j)[keyname].is_string()) {
+		tm timestamp = {};
+		std::string timedate = (*j)[keyname].get<std::string>();
+		std::string tzpart = timedate.substr(timedate.find('+'), timedate.length());
+		timedate = timedate.substr(0, timedate.find('.')) + tzpart;
+		strptime(timedate.substr(0, 19).c_str(), "%FT%TZ%z", &timestamp);
+		timestamp.tm_isdst = 0;
+		return mktime(&timestamp);
+	}
+	return 0;
+}
+#endif
+
+template <typename F> static void measure(const char* name, F f) {
+	const int iterations = 1000000;
+	volatile uint64_t sink = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i) {
+		sink = sink + (uint64_t)f();
+	}
+	printf("%-22s %7.1f ns\n", name, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations);
+}
+
+int main() {
+	json j = { { "id", "832645678901234567" }, { "timestamp", "2021-04-16T14:21:07.123000+00:00" } };
+	measure("snowflake, stream", [&j] { return stream_snowflake(&j, "id"); });
+	measure("snowflake, in place", [&j] { return SnowflakeNotNull(&j, "id"); });
+#ifndef _WIN32
+	measure("timestamp, strptime", [&j] { return strptime_timestamp(&j, "timestamp"); });
+#endif
+	measure("timestamp, in place", [&j] { return TimestampNotNull(&j, "timestamp"); });
+	return 0;
+}
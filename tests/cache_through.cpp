@@ -0,0 +1,86 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <atomic>
+#include <future>
+
+/* The cache-through getters answer from the cache where they can, and never write a REST copy
+ * over one the gateway has cached, even if the gateway stores it while the fetch is in flight.
+ */
+static std::atomic<int> requests(0);
+static std::atomic<int> delay_ms(0);
+
+static std::string get_username(dpp::cluster &bot, dpp::snowflake id) {
+	std::promise<std::string> done;
+	bot.user_get_cached(id, [&done](const dpp::confirmation_callback_t &cc) {
+		done.set_value(cc.http_info.status == 200 ? std::get<dpp::user>(cc.value).username : "");
+	});
+	auto f = done.get_future();
+	if (f.wait_for(std::chrono::seconds(10)) != std::future_status::ready) {
+		CHECK(!"user_get_cached never called back");
+		return "";
+	}
+	return f.get();
+}
+
+static dpp::user* gateway_user(dpp::snowflake id, const std::string &name) {
+	dpp::user* u = new dpp::user();
+	u->id = id;
+	u->username = name;
+	dpp::get_user_cache()->store(u);
+	return u;
+}
+
+int main() {
+	test_server server;
+	server.svr.Get(R"(/api/users/(\d+))", [](const httplib::Request &req, httplib::Response &res) {
+		requests++;
+		std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms.load()));
+		std::string id = req.matches[1];
+		res.set_content(R"({"id":")" + id + R"(","username":"rest)" + id + R"(","discriminator":"0001"})", "application/json");
+	});
+	server.start();
+
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = server.url();
+	bot.request_retries = 0;
+
+	/* A miss is fetched and stored, and the next lookup is a hit */
+	CHECK(get_username(bot, 1) == "rest1");
+	CHECK(get_username(bot, 1) == "rest1");
+	CHECK(requests == 1);
+	CHECK(dpp::get_user_cache()->fetched(1));
+
+	/* The gateway replacing the copy we stored takes ownership of it */
+	gateway_user(1, "gateway1");
+	CHECK(!dpp::get_user_cache()->fetched(1));
+	CHECK(get_username(bot, 1) == "gateway1");
+	CHECK(requests == 1);
+
+	/* The gateway storing a copy while the fetch is in flight wins */
+	delay_ms = 300;
+	std::promise<void> fetched;
+	bot.user_get_cached(2, [&fetched](const dpp::confirmation_callback_t&) {
+		fetched.set_value();
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	dpp::user* gw = gateway_user(2, "gateway2");
+	CHECK(fetched.get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+	CHECK(dpp::find_user(2) == gw);
+	CHECK(dpp::find_user(2)->username == "gateway2");
+	CHECK(requests == 2);
+	delay_ms = 0;
+
+	/* A copy we stored expires after cache_ttl and is fetched again */
+	bot.cache_ttl = 1;
+	CHECK(get_username(bot, 3) == "rest3");
+	std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+	CHECK(get_username(bot, 3) == "rest3");
+	CHECK(requests == 4);
+
+	dpp::cache_through_stats stats = bot.get_cache_through_stats();
+	CHECK(stats.requests == 4);
+	CHECK(stats.hits == 2);
+	CHECK(stats.expired == 1);
+
+	return test_result();
+}
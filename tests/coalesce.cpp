@@ -0,0 +1,105 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <atomic>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
+
+/* Identical GETs queued while one is already queued or in flight wait on it, and each gets a
+ * copy of its reply. A GET which the one in flight would hold up is sent on its own: one with a
+ * higher priority, one with no deadline or a later one when the first has a deadline, and one
+ * whose reply is streamed. The server holds up its replies until everything has been queued, so
+ * that the requests overlap however fast the machine is, and numbers each reply per path.
+ */
+struct reply {
+	uint16_t status = 0;
+	int64_t hit = -1;
+};
+
+int main() {
+	std::mutex hits_mutex;
+	std::map<std::string, int> hits;
+	std::promise<void> all_queued;
+	std::shared_future<void> release = all_queued.get_future().share();
+	test_server server;
+	server.svr.Get(R"(/api/(thing|other))", [&](const httplib::Request &req, httplib::Response &res) {
+		release.wait_for(std::chrono::seconds(10));
+		int hit;
+		{
+			std::lock_guard<std::mutex> lock(hits_mutex);
+			hit = ++hits[req.matches[1]];
+		}
+		res.set_content("[" + std::to_string(hit) + "]", "application/json");
+	});
+	server.start();
+
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = server.url();
+
+	const int total = 10;
+	std::atomic<int> finished(0);
+	std::promise<void> all_finished;
+	std::mutex replies_mutex;
+	std::map<std::string, reply> replies;
+	auto get = [&](const std::string &path, const std::string &name, dpp::rate_priority priority, double timeout) {
+		bot.post_rest(path, "", dpp::m_get, "", [&, name](json &j, const dpp::http_request_completion_t &http) {
+			{
+				std::lock_guard<std::mutex> lock(replies_mutex);
+				replies[name].status = http.status;
+				replies[name].hit = j.is_array() && j.size() == 1 ? j[0].get<int64_t>() : -1;
+			}
+			if (++finished == total) {
+				all_finished.set_value();
+			}
+		}, priority, timeout);
+	};
+
+	/* A leader without a deadline: equal or lower priorities wait on it, deadline or not */
+	get("/api/thing", "leader", dpp::rp_normal, 0);
+	get("/api/thing", "same", dpp::rp_normal, 0);
+	get("/api/thing", "again", dpp::rp_normal, 0);
+	get("/api/thing", "lower", dpp::rp_low, 30);
+	get("/api/thing", "higher", dpp::rp_critical, 0);
+	/* Its reply is handed to the element handler as it arrives */
+	int64_t streamed_hit = -1;
+	bot.post_rest_array("/api/thing", "", dpp::m_get, "", [&streamed_hit](json &j) {
+		streamed_hit = j.get<int64_t>();
+	}, [&](const dpp::http_request_completion_t &) {
+		if (++finished == total) {
+			all_finished.set_value();
+		}
+	});
+
+	/* A leader with a deadline: only a request with an earlier deadline may wait on it */
+	get("/api/other", "deadline_leader", dpp::rp_normal, 30);
+	get("/api/other", "earlier", dpp::rp_normal, 10);
+	get("/api/other", "later", dpp::rp_normal, 60);
+	get("/api/other", "none", dpp::rp_normal, 0);
+
+	all_queued.set_value();
+	CHECK(all_finished.get_future().wait_for(std::chrono::seconds(20)) == std::future_status::ready);
+	CHECK(bot.get_rest_stats().coalesced == 4);
+
+	std::lock_guard<std::mutex> lock(hits_mutex);
+	CHECK(hits["thing"] == 3);
+	CHECK(hits["other"] == 3);
+
+	std::lock_guard<std::mutex> rlock(replies_mutex);
+	for (auto & name : { "leader", "same", "again", "lower", "higher", "deadline_leader", "earlier", "later", "none" }) {
+		CHECK(replies[name].status == 200);
+		CHECK(replies[name].hit > 0);
+	}
+	/* Followers got a copy of their leader's reply, and the others each got their own */
+	for (auto & name : { "same", "again", "lower" }) {
+		CHECK(replies[name].hit == replies["leader"].hit);
+	}
+	CHECK(replies["earlier"].hit == replies["deadline_leader"].hit);
+	CHECK(streamed_hit > 0);
+	std::set<int64_t> thing_hits = { replies["leader"].hit, replies["higher"].hit, streamed_hit };
+	std::set<int64_t> other_hits = { replies["deadline_leader"].hit, replies["later"].hit, replies["none"].hit };
+	CHECK(thing_hits.size() == 3);
+	CHECK(other_hits.size() == 3);
+
+	return test_result();
+}
@@ -0,0 +1,100 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <vector>
+
+/* With completion_threads above 1, REST callbacks with the same ordering key run in the order
+ * their requests completed, while callbacks with other keys run alongside them. A callback
+ * with inline_completion set runs straight away, even while the completion threads are busy.
+ * Callbacks here wait on each other rather than on the clock, so a callback which is wrongly
+ * held up shows as a wait that times out.
+ */
+static bool wait_for(std::shared_future<void> f) {
+	return f.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+}
+
+int main() {
+	test_server server;
+	server.svr.Post(R"(/api/(a|b|c))", [](const httplib::Request &, httplib::Response &res) {
+		res.set_content("{}", "application/json");
+	});
+	server.start();
+
+	{
+		dpp::cluster bot("token", 0, 0);
+		bot.rest_url = server.url();
+		bot.completion_threads = 4;
+
+		/* Keys are spread over the workers by hash. Pick a second key on another worker than the first. */
+		const std::string key_a = "a";
+		std::string key_b = "b";
+		while (std::hash<std::string>()(key_b) % 4 == std::hash<std::string>()(key_a) % 4) {
+			key_b += "b";
+		}
+
+		const int count_a = 20, count_b = 10;
+		std::mutex order_mutex;
+		std::vector<int> order;
+		std::promise<void> b_finished, all_finished;
+		std::shared_future<void> b_done = b_finished.get_future().share();
+		std::atomic<int> b_count(0), finished(0);
+		bool b_ran_alongside = false;
+
+		/* The first completion for key a holds up its worker until every key b completion has run */
+		for (int i = 0; i < count_a; ++i) {
+			bot.post_rest("/api/a", "", dpp::m_post, "{}", [&, i](json&, const dpp::http_request_completion_t&) {
+				if (i == 0) {
+					b_ran_alongside = wait_for(b_done);
+				}
+				{
+					std::lock_guard<std::mutex> lock(order_mutex);
+					order.push_back(i);
+				}
+				if (++finished == count_a + count_b) {
+					all_finished.set_value();
+				}
+			}, dpp::rp_normal, 0, key_a);
+		}
+		for (int i = 0; i < count_b; ++i) {
+			bot.post_rest("/api/b", "", dpp::m_post, "{}", [&](json&, const dpp::http_request_completion_t&) {
+				if (++b_count == count_b) {
+					b_finished.set_value();
+				}
+				if (++finished == count_a + count_b) {
+					all_finished.set_value();
+				}
+			}, dpp::rp_normal, 0, key_b);
+		}
+		CHECK(wait_for(all_finished.get_future().share()));
+		CHECK(b_ran_alongside);
+		std::vector<int> expected;
+		for (int i = 0; i < count_a; ++i) {
+			expected.push_back(i);
+		}
+		std::lock_guard<std::mutex> lock(order_mutex);
+		CHECK(order == expected);
+	}
+
+	{
+		/* One completion thread, held up by a callback until an inline completion has run */
+		dpp::cluster bot("token", 0, 0);
+		bot.rest_url = server.url();
+		std::promise<void> inline_finished, blocked_finished;
+		std::shared_future<void> inline_done = inline_finished.get_future().share();
+		bool inline_ran_alongside = false;
+		bot.post_rest("/api/a", "", dpp::m_post, "{}", [&](json&, const dpp::http_request_completion_t&) {
+			inline_ran_alongside = wait_for(inline_done);
+			blocked_finished.set_value();
+		});
+		bot.post_rest("/api/c", "", dpp::m_post, "{}", [&](json&, const dpp::http_request_completion_t &http) {
+			CHECK(http.status == 200);
+			inline_finished.set_value();
+		}, dpp::rp_normal, 0, "", true);
+		CHECK(wait_for(blocked_finished.get_future().share()));
+		CHECK(inline_ran_alongside);
+	}
+
+	return test_result();
+}
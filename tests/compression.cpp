@@ -0,0 +1,231 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <atomic>
+#include <future>
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+#include <zlib.h>
+#endif
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+#include <brotli/encode.h>
+#endif
+
+/* With cluster::rest_compression set, compressed replies are decoded before they are parsed,
+ * and their sizes on the wire and decoded are reported. The fixtures are sent already encoded,
+ * with a Content-Type the test server won't compress again.
+ */
+static std::string fixture() {
+	std::string s = "[";
+	for (int i = 0; i < 100; ++i) {
+		s += (i ? "," : "") + std::string(R"({"id":")") + std::to_string(900000000000000000ULL + i * 7919) + R"(","type":0,"content":"message number )" + std::to_string(i) + R"( with some text in it","channel_id":"825411707521728511","author":{"id":")" + std::to_string(189759562910400512ULL + i % 5) + R"(","username":"user)" + std::to_string(i % 5) + R"(","discriminator":"0001"},"embeds":[],"mentions":[],"pinned":false,"tts":false,"timestamp":"2021-06-01T12:34:56.789000+00:00","edited_timestamp":null})";
+	}
+	return s + "]";
+}
+
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+/* window_bits 31 gives gzip, 15 gives zlib, which is what HTTP calls deflate */
+static std::string zlib_encode(const std::string &in, int window_bits) {
+	z_stream z{};
+	deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+	std::string out(deflateBound(&z, in.size()), 0);
+	z.next_in = (Bytef*)in.data();
+	z.avail_in = (uInt)in.size();
+	z.next_out = (Bytef*)&out[0];
+	z.avail_out = (uInt)out.size();
+	deflate(&z, Z_FINISH);
+	out.resize(z.total_out);
+	deflateEnd(&z);
+	return out;
+}
+#endif
+
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+static std::string brotli_encode(const std::string &in) {
+	size_t size = BrotliEncoderMaxCompressedSize(in.size());
+	std::string out(size, 0);
+	BrotliEncoderCompress(5, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, in.size(), (const uint8_t*)in.data(), &size, (uint8_t*)&out[0]);
+	out.resize(size);
+	return out;
+}
+#endif
+
+struct reply {
+	dpp::http_request_completion_t http;
+	size_t elements = 0;
+};
+
+static reply get(dpp::cluster &bot, const std::string &name) {
+	std::promise<reply> done;
+	bot.post_rest("/api/fixtures", name, dpp::m_get, "", [&done](json &j, const dpp::http_request_completion_t &http) {
+		reply r;
+		r.http = http;
+		r.elements = j.is_array() ? j.size() : 0;
+		done.set_value(r);
+	});
+	auto f = done.get_future();
+	if (f.wait_for(std::chrono::seconds(10)) != std::future_status::ready) {
+		CHECK(!"request never completed");
+		return reply();
+	}
+	return f.get();
+}
+
+/* Elements handed over so far by the array being fetched */
+static std::atomic<size_t> elements_seen(0);
+
+/* Fetch a fixture as a streamed array. The server sends the second half of the body only once
+ * elements from the first half have been handed over, or after waiting 10 seconds, and reports
+ * which it was: a reply decoded as it arrives gets its elements out before its end.
+ */
+static reply get_array(dpp::cluster &bot, const std::string &name) {
+	elements_seen = 0;
+	std::promise<reply> done;
+	bot.post_rest_array("/api/halves", name, dpp::m_get, "", [](json &) {
+		elements_seen++;
+	}, [&done](const dpp::http_request_completion_t &http) {
+		reply r;
+		r.http = http;
+		r.elements = elements_seen;
+		done.set_value(r);
+	});
+	auto f = done.get_future();
+	if (f.wait_for(std::chrono::seconds(20)) != std::future_status::ready) {
+		CHECK(!"request never completed");
+		return reply();
+	}
+	return f.get();
+}
+
+int main() {
+	const std::string plain = fixture();
+	std::string accepted;
+	test_server server;
+	bool first_half_decoded = false;
+	auto serve = [&server, &first_half_decoded](const std::string &name, const std::string &encoding, const std::string &body) {
+		server.svr.Get(("/api/fixtures/" + name).c_str(), [encoding, body](const httplib::Request&, httplib::Response &res) {
+			res.set_content(body, "application/octet-stream");
+			if (!encoding.empty()) {
+				res.set_header("Content-Encoding", encoding);
+			}
+		});
+		server.svr.Get(("/api/halves/" + name).c_str(), [encoding, body, &first_half_decoded](const httplib::Request&, httplib::Response &res) {
+			if (!encoding.empty()) {
+				res.set_header("Content-Encoding", encoding);
+			}
+			res.set_chunked_content_provider("application/octet-stream", [body, &first_half_decoded](size_t offset, httplib::DataSink &sink) {
+				size_t half = body.size() / 2;
+				if (offset == 0) {
+					sink.write(body.data(), half);
+					return true;
+				}
+				auto started = std::chrono::steady_clock::now();
+				while (elements_seen == 0 && elapsed_ms(started) < 10000) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+				first_half_decoded = elements_seen > 0;
+				sink.write(body.data() + half, body.size() - half);
+				sink.done();
+				return true;
+			});
+		});
+	};
+	serve("identity", "", plain);
+	serve("zstd", "zstd", "not really zstd");
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+	std::string gzip = zlib_encode(plain, 31);
+	serve("gzip", "gzip", gzip);
+	serve("deflate", "deflate", zlib_encode(plain, 15));
+	serve("truncated", "gzip", gzip.substr(0, gzip.size() / 2));
+#endif
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+	serve("br", "br", brotli_encode(plain));
+#endif
+	/* Compressed by the server itself, from the Accept-Encoding we send */
+	server.svr.Get("/api/fixtures/negotiated", [&plain, &accepted](const httplib::Request &req, httplib::Response &res) {
+		accepted = req.get_header_value("Accept-Encoding");
+		res.set_content(plain, "application/json");
+	});
+	server.start();
+
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = server.url();
+	bot.request_retries = 0;
+	bot.rest_compression = true;
+
+	std::vector<std::string> encodings = { "identity" };
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+	encodings.push_back("gzip");
+	encodings.push_back("deflate");
+#endif
+#ifdef CPPHTTPLIB_BROTLI_SUPPORT
+	encodings.push_back("br");
+#endif
+	uint64_t wire = 0, decoded = 0;
+	for (auto & e : encodings) {
+		reply r = get(bot, e);
+		printf("%-9s status=%u wire=%llu decoded=%llu\n", e.c_str(), r.http.status, (unsigned long long)r.http.wire_size, (unsigned long long)r.http.body_size);
+		CHECK(r.http.error == dpp::h_success);
+		CHECK(r.http.status == 200);
+		CHECK(r.elements == 100);
+		CHECK(r.http.body_size == plain.size());
+		CHECK(e == "identity" ? r.http.wire_size == plain.size() : r.http.wire_size < plain.size() / 3);
+		wire += r.http.wire_size;
+		decoded += r.http.body_size;
+	}
+
+	reply negotiated = get(bot, "negotiated");
+	CHECK(negotiated.elements == 100);
+#if defined(CPPHTTPLIB_ZLIB_SUPPORT) || defined(CPPHTTPLIB_BROTLI_SUPPORT)
+	CHECK(!accepted.empty());
+	CHECK(negotiated.http.wire_size < plain.size());
+#endif
+	wire += negotiated.http.wire_size;
+	decoded += negotiated.http.body_size;
+
+	/* A body we can't decode fails with h_compression rather than being parsed as it is */
+	reply zstd = get(bot, "zstd");
+	CHECK(zstd.http.error == dpp::h_compression);
+	CHECK(zstd.elements == 0);
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+	reply truncated = get(bot, "truncated");
+	CHECK(truncated.http.error == dpp::h_compression);
+	CHECK(truncated.elements == 0);
+	wire += truncated.http.wire_size;
+	decoded += truncated.http.body_size;
+#endif
+	wire += zstd.http.wire_size;
+	decoded += zstd.http.body_size;
+
+	/* Streamed arrays are decoded as they arrive, a part at a time */
+	for (auto & e : encodings) {
+		first_half_decoded = false;
+		reply r = get_array(bot, e);
+		CHECK(r.http.error == dpp::h_success);
+		CHECK(r.http.status == 200);
+		CHECK(r.elements == 100);
+		CHECK(first_half_decoded);
+		CHECK(r.http.body_size == plain.size());
+		CHECK(e == "identity" ? r.http.wire_size == plain.size() : r.http.wire_size < plain.size() / 3);
+		wire += r.http.wire_size;
+		decoded += r.http.body_size;
+	}
+#ifdef CPPHTTPLIB_ZLIB_SUPPORT
+	/* One cut short hands over what it can, then fails */
+	reply streamed_truncated = get_array(bot, "truncated");
+	CHECK(streamed_truncated.http.error == dpp::h_compression);
+	CHECK(streamed_truncated.elements < 100);
+	wire += streamed_truncated.http.wire_size;
+	decoded += streamed_truncated.http.body_size;
+#endif
+
+	dpp::rest_stats stats = bot.get_rest_stats();
+	CHECK(stats.bytes_received == wire);
+	CHECK(stats.bytes_decoded == decoded);
+
+	/* Without rest_compression, nothing is asked for and nothing is compressed */
+	bot.rest_compression = false;
+	reply off = get(bot, "negotiated");
+	CHECK(accepted.empty());
+	CHECK(off.http.wire_size == plain.size());
+
+	return test_result();
+}
@@ -0,0 +1,138 @@
+#include "test.h"
+#include <dpp/coordinator.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Two cluster processes coordinating under the same name: this one and a forked child. Both
+ * publish their counts, which each must see, and requests from both must together stay within
+ * the one global REST limit.
+ */
+static const double per_second = 50;
+static const double seconds = 2;
+
+/** Take tokens from the global bucket for the given time, returning how many were taken */
+static int hammer(dpp::cluster_coordinator &c) {
+	int taken = 0;
+	auto started = std::chrono::steady_clock::now();
+	while (elapsed_ms(started) < seconds * 1000) {
+		double wait = c.acquire_global(per_second, 0);
+		if (wait == 0) {
+			taken++;
+		} else {
+			std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+		}
+	}
+	return taken;
+}
+
+/** Wait until a coordinator sees the counts of the given number of clusters */
+static bool wait_for_clusters(dpp::cluster_coordinator &c, size_t clusters) {
+	auto started = std::chrono::steady_clock::now();
+	while (c.get_counts().size() != clusters && elapsed_ms(started) < 5000) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return c.get_counts().size() == clusters;
+}
+
+/** The child: cluster 1 with three shards. Reports how many tokens it took through the pipe. */
+static int child(const std::string &name, int go, int report) {
+	int taken = -1;
+	try {
+		dpp::cluster_coordinator b(name, 1);
+		b.publish([]() {
+			dpp::cache_counts c;
+			c.shards = 3;
+			c.guilds = 30;
+			return c;
+		});
+		char start;
+		if (read(go, &start, 1) == 1) {
+			taken = hammer(b);
+		}
+	}
+	catch (const std::exception &e) {
+		fprintf(stderr, "child: %s\n", e.what());
+	}
+	return write(report, &taken, sizeof(taken)) == sizeof(taken) && taken >= 0 ? 0 : 1;
+}
+
+int main() {
+	std::string name = "test-" + std::to_string(getpid());
+	dpp::cluster_coordinator::remove(name);
+
+	/* Fork before this process starts any threads of its own */
+	int go[2], report[2];
+	if (pipe(go) != 0 || pipe(report) != 0) {
+		perror("pipe");
+		return 1;
+	}
+	pid_t pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		close(go[1]);
+		close(report[0]);
+		_exit(child(name, go[0], report[1]));
+	}
+	close(go[0]);
+	close(report[1]);
+
+	{
+		dpp::cluster_coordinator a(name, 0);
+		a.publish([]() {
+			dpp::cache_counts c;
+			c.shards = 2;
+			c.guilds = 20;
+			return c;
+		});
+
+		/* Each process's counts are visible to the other, and add up */
+		CHECK(wait_for_clusters(a, 2));
+		bool child_seen = false;
+		for (auto & c : a.get_counts()) {
+			if (c.cluster_id == 1) {
+				child_seen = true;
+				CHECK(c.pid == pid);
+				CHECK(c.shards == 3);
+			} else {
+				CHECK(c.pid == getpid());
+			}
+		}
+		CHECK(child_seen);
+		dpp::cache_counts totals = a.get_totals();
+		CHECK(totals.shards == 5);
+		CHECK(totals.guilds == 50);
+
+		/* Both processes take from the global bucket at once */
+		CHECK(write(go[1], "g", 1) == 1);
+		int taken = hammer(a);
+		int child_taken = -1;
+		CHECK(read(report[0], &child_taken, sizeof(child_taken)) == sizeof(child_taken));
+		int status = 0;
+		CHECK(waitpid(pid, &status, 0) == pid);
+		CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+		/* A full bucket's burst, then the refill rate, with a token of slack for timing */
+		int combined = taken + child_taken;
+		printf("%d + %d requests in %.0fs from two processes, limit %.0f/s\n", taken, child_taken, seconds, per_second);
+		CHECK(child_taken > 0);
+		CHECK(combined <= per_second + per_second * seconds + 1);
+		CHECK(combined >= per_second * seconds);
+
+		/* The child marked itself gone as it exited, leaving only this process in the totals */
+		CHECK(a.get_counts().size() == 1);
+		CHECK(a.get_totals().shards == 2);
+
+		/* Tokens kept back for higher priorities aren't handed out to lower ones */
+		while (a.acquire_global(per_second, 0) == 0) {
+		}
+		CHECK(a.acquire_global(per_second, 2) > a.acquire_global(per_second, 0));
+	}
+	close(go[1]);
+	close(report[0]);
+	dpp::cluster_coordinator::remove(name);
+	return test_result();
+}
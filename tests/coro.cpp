@@ -0,0 +1,64 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <future>
+
+/* co_await on the cluster's REST methods, chained in a dpp::job. Each step must get its own
+ * result, and the coroutine resumes on the REST completion thread. Built as C++20; without
+ * coroutine support there is nothing to test.
+ */
+#ifdef DPP_CORO
+static std::thread::id main_thread;
+
+static dpp::job read_channel(dpp::cluster &bot, std::promise<std::vector<std::string>> &done) {
+	std::vector<std::string> seen;
+	dpp::confirmation_callback_t got = co_await bot.co_message_get(7, 1);
+	seen.push_back(got.http_info.status == 200 ? std::get<dpp::message>(got.value).content : "failed");
+	seen.push_back(std::this_thread::get_id() == main_thread ? "main thread" : "completion thread");
+	for (int page = 0; page < 3; ++page) {
+		dpp::confirmation_callback_t history = co_await bot.co_messages_get(1, 0, 100 - page * 10, 0, 10, dpp::rp_low);
+		seen.push_back(std::to_string(std::get<dpp::message_map>(history.value).size()));
+	}
+	std::vector<dpp::snowflake> ids = { 101, 102 };
+	dpp::confirmation_callback_t users = co_await bot.co_users_get(ids);
+	seen.push_back(std::to_string(std::get<dpp::user_map>(users.value).size()));
+	done.set_value(seen);
+}
+#endif
+
+int main() {
+#ifdef DPP_CORO
+	test_server server;
+	server.svr.Get("/api/channels/1/messages/7", [](const httplib::Request&, httplib::Response &res) {
+		res.set_content(R"({"id":"7","channel_id":"1","content":"seven"})", "application/json");
+	});
+	server.svr.Get("/api/channels/1/messages", [](const httplib::Request &req, httplib::Response &res) {
+		uint64_t before = std::stoull(req.get_param_value("before"));
+		std::string body = "[";
+		for (uint64_t id = before - 1; id + 10 >= before; --id) {
+			body += (body.size() > 1 ? "," : "") + std::string(R"({"id":")") + std::to_string(id) + R"(","channel_id":"1"})";
+		}
+		res.set_content(body + "]", "application/json");
+	});
+	server.svr.Get(R"(/api/users/(\d+))", [](const httplib::Request &req, httplib::Response &res) {
+		std::string id = req.matches[1];
+		res.set_content(R"({"id":")" + id + R"(","username":"user)" + id + R"(","discriminator":"0001"})", "application/json");
+	});
+	server.start();
+
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = server.url();
+	main_thread = std::this_thread::get_id();
+	std::promise<std::vector<std::string>> done;
+	read_channel(bot, done);
+	auto f = done.get_future();
+	if (f.wait_for(std::chrono::seconds(10)) != std::future_status::ready) {
+		CHECK(!"coroutine never finished");
+		return test_result();
+	}
+	std::vector<std::string> seen = f.get();
+	CHECK(seen == std::vector<std::string>({ "seven", "completion thread", "10", "10", "10", "2" }));
+#else
+	printf("built without coroutine support, skipped\n");
+#endif
+	return test_result();
+}
@@ -0,0 +1,61 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <atomic>
+#include <future>
+
+/* A request with a short deadline, queued behind a bucket which is used up for some seconds,
+ * must time out at its deadline rather than when the bucket resets, without being sent. The
+ * deadline is a small fraction of the reset time, so that a slow machine doesn't blur the two.
+ */
+static const double reset_after = 3;
+
+int main() {
+	std::atomic<int> served(0);
+	test_server server;
+	server.svr.Post("/api/channels/1/messages", [&served](const httplib::Request &, httplib::Response &res) {
+		served++;
+		res.set_header("X-RateLimit-Bucket", "messages");
+		res.set_header("X-RateLimit-Limit", "1");
+		res.set_header("X-RateLimit-Remaining", "0");
+		res.set_header("X-RateLimit-Reset-After", std::to_string(reset_after));
+		res.set_content("{}", "application/json");
+	});
+	server.start();
+
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = server.url();
+
+	/* The first request uses the bucket up */
+	std::promise<int> first;
+	bot.post_rest("/api/channels", "1/messages", dpp::m_post, "{}", [&first](json&, const dpp::http_request_completion_t &http) {
+		first.set_value(http.status);
+	});
+	auto f = first.get_future();
+	CHECK(f.wait_for(std::chrono::seconds(10)) == std::future_status::ready && f.get() == 200);
+
+	std::promise<void> expired_done, last_done;
+	int expired_status = 0;
+	double expired_after = 0;
+	auto queued = std::chrono::steady_clock::now();
+	bot.post_rest("/api/channels", "1/messages", dpp::m_post, "{}", [&](json&, const dpp::http_request_completion_t &http) {
+		expired_status = http.status;
+		expired_after = elapsed_ms(queued);
+		expired_done.set_value();
+	}, dpp::rp_normal, 0.2);
+	int last_status = 0;
+	bot.post_rest("/api/channels", "1/messages", dpp::m_post, "{}", [&](json&, const dpp::http_request_completion_t &http) {
+		last_status = http.status;
+		last_done.set_value();
+	});
+
+	auto wait = std::chrono::seconds((int)reset_after + 10);
+	CHECK(expired_done.get_future().wait_for(wait) == std::future_status::ready);
+	CHECK(last_done.get_future().wait_for(wait) == std::future_status::ready);
+	CHECK(expired_status == 408);
+	CHECK(expired_after < reset_after * 1000);
+	CHECK(last_status == 200);
+	CHECK(served == 2);
+	CHECK(bot.get_rest_stats().expired[dpp::rp_normal] == 1);
+
+	return test_result();
+}
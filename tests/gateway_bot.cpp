@@ -0,0 +1,68 @@
+#include "test.h"
+#include <dpp/dpp.h>
+
+/* cluster::start() with a shard count of 0 asks /gateway/bot for one. Whatever the reply, start()
+ * must come back with a usable shard count. Nothing listens for the gateway connections, so the
+ * first shard fails to connect, and start() throws once the reply has been handled.
+ */
+static bool start_throws(dpp::cluster &bot) {
+	try {
+		bot.start();
+	}
+	catch (const std::runtime_error &e) {
+		return std::string(e.what()).find("Shard 0 could not connect") == 0;
+	}
+	return false;
+}
+
+static uint32_t start_with(const std::string &url, double &ms) {
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = url;
+	bot.request_retries = 0;
+	auto started = std::chrono::steady_clock::now();
+	CHECK(start_throws(bot));
+	ms = elapsed_ms(started);
+	CHECK(bot.shards.empty());
+	return bot.numshards;
+}
+
+int main() {
+	test_server server;
+	server.svr.Get("/api/gateway/bot", [](const httplib::Request &req, httplib::Response &res) {
+		CHECK(req.get_header_value("Authorization") == "Bot token");
+		res.set_content(R"({"url":"wss://127.0.0.1","shards":3,"session_start_limit":{"total":1000,"remaining":999,"reset_after":0,"max_concurrency":2}})", "application/json");
+	});
+	server.start();
+
+	test_server broken;
+	broken.svr.Get("/api/gateway/bot", [](const httplib::Request&, httplib::Response &res) {
+		res.set_content("{\"url\": \"wss://", "application/json");
+	});
+	broken.start();
+
+	test_server failing;
+	failing.svr.Get("/api/gateway/bot", [](const httplib::Request&, httplib::Response &res) {
+		res.status = 500;
+	});
+	failing.start();
+
+	double ms;
+	{
+		dpp::cluster bot("token", 0, 0);
+		bot.rest_url = server.url();
+		CHECK(start_throws(bot));
+		CHECK(bot.numshards == 3);
+		CHECK(bot.max_concurrency == 2);
+		CHECK(bot.gateway_host == "127.0.0.1");
+	}
+	/* A malformed reply or an error falls back on one shard, without waiting for the timeout */
+	CHECK(start_with(broken.url(), ms) == 1);
+	CHECK(ms < 5000);
+	CHECK(start_with(failing.url(), ms) == 1);
+	CHECK(ms < 5000);
+	/* So does a server that isn't there */
+	CHECK(start_with("http://127.0.0.1:1", ms) == 1);
+	CHECK(ms < 5000);
+
+	return test_result();
+}
@@ -0,0 +1,396 @@
+#pragma once
+
+/* A local stand-in for discord's websocket gateway, for the tests of a shard's connection handling.
+ * It speaks TLS with a throwaway self-signed certificate, on a free local port, and runs a script
+ * for each connection on a thread of its own. The script plays discord's side of the conversation:
+ * it sends HELLO, reads what the shard sends, and closes the connection with whatever close code the
+ * test needs. Point a cluster at it with gateway_host = "127.0.0.1" and gateway_port = port_str().
+ */
+#include <nlohmann/json.hpp>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class gateway_server;
+
+/** One shard's connection, as the script sees it */
+class gateway_connection {
+	friend class gateway_server;
+	gateway_server* server;
+	int fd;
+	SSL* ssl;
+	std::string inbuf;
+	bool open = true;
+
+	/* Read more from the shard. Returns false if nothing arrived before the deadline, or the connection is gone. */
+	bool fill(std::chrono::steady_clock::time_point deadline);
+	/* Take one complete frame from inbuf, unmasking it. Returns false if there isn't one yet. */
+	bool next_frame(int &opcode, std::string &payload);
+	void write_frame(int opcode, const std::string &payload);
+public:
+	/** Connection number, counting from 1 */
+	int number = 0;
+
+	/** Answer each heartbeat (op 1) with an ACK (op 11) as it is received */
+	bool ack_heartbeats = true;
+
+	/** Send a gateway payload */
+	void send(const nlohmann::json &j) {
+		write_frame(0x1, j.dump());
+	}
+
+	/** Send HELLO (op 10) with a heartbeat interval, in milliseconds */
+	void hello(uint32_t heartbeat_interval = 45000) {
+		send({{"op", 10}, {"d", {{"heartbeat_interval", heartbeat_interval}}}});
+	}
+
+	/** Send READY for a session, so that the shard resumes it on reconnecting */
+	void ready(const std::string &session_id, uint64_t seq = 1) {
+		send({{"op", 0}, {"t", "READY"}, {"s", seq}, {"d", {{"session_id", session_id}, {"resume_gateway_url", "wss://127.0.0.1"}}}});
+	}
+
+	/** Returns the next payload from the shard, or null if none came within timeout_ms or it disconnected */
+	nlohmann::json receive(int timeout_ms);
+
+	/** Returns the next payload from the shard with the given opcode, skipping any others, or null as for receive() */
+	nlohmann::json expect(uint32_t op, int timeout_ms) {
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+		while (std::chrono::steady_clock::now() < deadline) {
+			nlohmann::json j = receive((int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count() + 1);
+			if (j.is_null() || (j.find("op") != j.end() && j["op"] == op)) {
+				return j;
+			}
+		}
+		return nlohmann::json();
+	}
+
+	/** Wait up to timeout_ms for the shard to drop the connection. Returns true if it did. */
+	bool wait_disconnect(int timeout_ms) {
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+		while (open && std::chrono::steady_clock::now() < deadline) {
+			receive((int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count() + 1);
+		}
+		return !open;
+	}
+
+	/** Close the connection with a websocket close code */
+	void close(uint16_t code) {
+		std::string payload;
+		payload.push_back((char)(code >> 8));
+		payload.push_back((char)(code & 0xff));
+		write_frame(0x8, payload);
+		open = false;
+	}
+
+	/** False once the connection has been closed by either side */
+	bool is_open() const {
+		return open;
+	}
+};
+
+class gateway_server {
+	friend class gateway_connection;
+	int listen_fd = -1;
+	SSL_CTX* ctx = nullptr;
+	std::atomic<bool> stopping{false};
+	std::thread acceptor;
+	std::mutex threads_mutex;
+	std::vector<std::thread> threads;
+	std::mutex times_mutex;
+	std::vector<std::pair<std::chrono::steady_clock::time_point, std::chrono::steady_clock::time_point>> times;
+
+	/* A certificate for this run only. The shard doesn't verify it, any more than it does discord's. */
+	void make_certificate() {
+		EVP_PKEY* key = nullptr;
+		EVP_PKEY_CTX* kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+		EVP_PKEY_keygen_init(kctx);
+		EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1);
+		EVP_PKEY_keygen(kctx, &key);
+		EVP_PKEY_CTX_free(kctx);
+		X509* cert = X509_new();
+		X509_set_version(cert, 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+		X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+		X509_gmtime_adj(X509_getm_notAfter(cert), 86400);
+		X509_set_pubkey(cert, key);
+		X509_NAME* name = X509_get_subject_name(cert);
+		X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"127.0.0.1", -1, -1, 0);
+		X509_set_issuer_name(cert, name);
+		X509_sign(cert, key, EVP_sha256());
+		SSL_CTX_use_certificate(ctx, cert);
+		SSL_CTX_use_PrivateKey(ctx, key);
+		X509_free(cert);
+		EVP_PKEY_free(key);
+	}
+
+	void serve(int fd, int number) {
+		/* A shard which goes away mid-write mustn't kill the test */
+		sigset_t sigpipe;
+		sigemptyset(&sigpipe);
+		sigaddset(&sigpipe, SIGPIPE);
+		pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+		/* A client which never finishes its handshake mustn't hold up the server's destructor */
+		struct timeval tv = { 5, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		gateway_connection c;
+		c.server = this;
+		c.fd = fd;
+		c.number = number;
+		c.ssl = SSL_new(ctx);
+		SSL_set_fd(c.ssl, fd);
+		if (SSL_accept(c.ssl) == 1) {
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+			/* The websocket upgrade request, and its reply */
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+			while (c.inbuf.find("\r\n\r\n") == std::string::npos && c.fill(deadline));
+			size_t end = c.inbuf.find("\r\n\r\n");
+			if (end != std::string::npos && c.inbuf.compare(0, 4, "GET ") == 0) {
+				c.inbuf.erase(0, end + 4);
+				std::string reply = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n\r\n";
+				c.write_frame(-1, reply);
+				if (script) {
+					script(c);
+				}
+			}
+			SSL_shutdown(c.ssl);
+		}
+		SSL_free(c.ssl);
+		::close(fd);
+		std::lock_guard<std::mutex> lock(times_mutex);
+		times[number - 1].second = std::chrono::steady_clock::now();
+	}
+public:
+	/** Run on the connection's thread for each connection, once the websocket upgrade is done.
+	 * When it returns the connection is closed, if it is still open.
+	 */
+	std::function<void(gateway_connection &c)> script;
+
+	/** Connections accepted */
+	std::atomic<int> connections{0};
+
+	int port = 0;
+
+	void start() {
+		ctx = SSL_CTX_new(TLS_server_method());
+		make_certificate();
+		listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+		socklen_t len = sizeof(addr);
+		getsockname(listen_fd, (struct sockaddr*)&addr, &len);
+		port = ntohs(addr.sin_port);
+		listen(listen_fd, 16);
+		acceptor = std::thread([this]() {
+			while (!stopping) {
+				struct pollfd p = { listen_fd, POLLIN, 0 };
+				if (poll(&p, 1, 50) <= 0) {
+					continue;
+				}
+				int fd = accept(listen_fd, nullptr, nullptr);
+				if (fd < 0) {
+					continue;
+				}
+				int one = 1;
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				{
+					std::lock_guard<std::mutex> lock(times_mutex);
+					times.emplace_back(std::chrono::steady_clock::now(), std::chrono::steady_clock::time_point());
+				}
+				int number = ++connections;
+				std::lock_guard<std::mutex> lock(threads_mutex);
+				threads.emplace_back(&gateway_server::serve, this, fd, number);
+			}
+		});
+	}
+
+	std::string port_str() const {
+		return std::to_string(port);
+	}
+
+	/** When a connection, numbered from 1, was accepted */
+	std::chrono::steady_clock::time_point opened(int number) {
+		std::lock_guard<std::mutex> lock(times_mutex);
+		return number > 0 && (size_t)number <= times.size() ? times[number - 1].first : std::chrono::steady_clock::time_point();
+	}
+
+	/** When a connection, numbered from 1, was closed, or the epoch if it is still open */
+	std::chrono::steady_clock::time_point closed(int number) {
+		std::lock_guard<std::mutex> lock(times_mutex);
+		return number > 0 && (size_t)number <= times.size() ? times[number - 1].second : std::chrono::steady_clock::time_point();
+	}
+
+	/** Wait up to timeout_ms for at least count connections to have been accepted */
+	bool wait_connections(int count, int timeout_ms) {
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+		while (connections < count && std::chrono::steady_clock::now() < deadline) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		return connections >= count;
+	}
+
+	~gateway_server() {
+		stopping = true;
+		if (acceptor.joinable()) {
+			acceptor.join();
+		}
+		for (auto & t : threads) {
+			t.join();
+		}
+		if (listen_fd >= 0) {
+			::close(listen_fd);
+		}
+		SSL_CTX_free(ctx);
+	}
+};
+
+inline bool gateway_connection::fill(std::chrono::steady_clock::time_point deadline) {
+	char buf[16384];
+	while (open && !server->stopping) {
+		int n = SSL_read(ssl, buf, sizeof(buf));
+		if (n > 0) {
+			inbuf.append(buf, n);
+			return true;
+		}
+		int e = SSL_get_error(ssl, n);
+		if (e != SSL_ERROR_WANT_READ && e != SSL_ERROR_WANT_WRITE) {
+			open = false;
+			return false;
+		}
+		auto now = std::chrono::steady_clock::now();
+		if (now >= deadline) {
+			return false;
+		}
+		struct pollfd p = { fd, (short)(e == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT), 0 };
+		int wait = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+		/* Wake now and then to notice stopping */
+		poll(&p, 1, std::min(wait, 50));
+	}
+	return false;
+}
+
+inline bool gateway_connection::next_frame(int &opcode, std::string &payload) {
+	if (inbuf.length() < 2) {
+		return false;
+	}
+	const unsigned char* b = (const unsigned char*)inbuf.data();
+	opcode = b[0] & 0x0f;
+	bool masked = b[1] & 0x80;
+	uint64_t len = b[1] & 0x7f;
+	size_t pos = 2;
+	if (len == 126) {
+		if (inbuf.length() < 4) {
+			return false;
+		}
+		len = (b[2] << 8) | b[3];
+		pos = 4;
+	} else if (len == 127) {
+		if (inbuf.length() < 10) {
+			return false;
+		}
+		len = 0;
+		for (int i = 2; i < 10; ++i) {
+			len = (len << 8) | b[i];
+		}
+		pos = 10;
+	}
+	unsigned char mask[4] = { 0, 0, 0, 0 };
+	if (masked) {
+		if (inbuf.length() < pos + 4) {
+			return false;
+		}
+		memcpy(mask, b + pos, 4);
+		pos += 4;
+	}
+	if (inbuf.length() < pos + len) {
+		return false;
+	}
+	payload = inbuf.substr(pos, len);
+	for (size_t i = 0; i < payload.length(); ++i) {
+		payload[i] ^= mask[i % 4];
+	}
+	inbuf.erase(0, pos + len);
+	return true;
+}
+
+/* Frames to the shard are never masked. An opcode of -1 writes the data as it is, for the upgrade reply. */
+inline void gateway_connection::write_frame(int opcode, const std::string &payload) {
+	if (!open) {
+		return;
+	}
+	std::string out;
+	if (opcode >= 0) {
+		out.push_back((char)(0x80 | opcode));
+		if (payload.length() <= 125) {
+			out.push_back((char)payload.length());
+		} else if (payload.length() <= 65535) {
+			out.push_back((char)126);
+			out.push_back((char)(payload.length() >> 8));
+			out.push_back((char)(payload.length() & 0xff));
+		} else {
+			out.push_back((char)127);
+			for (int i = 7; i >= 0; --i) {
+				out.push_back((char)(((uint64_t)payload.length() >> (i * 8)) & 0xff));
+			}
+		}
+	}
+	out += payload;
+	size_t done = 0;
+	while (done < out.length()) {
+		int n = SSL_write(ssl, out.data() + done, out.length() - done);
+		if (n > 0) {
+			done += n;
+			continue;
+		}
+		int e = SSL_get_error(ssl, n);
+		if (e != SSL_ERROR_WANT_READ && e != SSL_ERROR_WANT_WRITE) {
+			open = false;
+			return;
+		}
+		struct pollfd p = { fd, (short)(e == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT), 0 };
+		poll(&p, 1, 50);
+	}
+}
+
+inline nlohmann::json gateway_connection::receive(int timeout_ms) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	while (true) {
+		int opcode;
+		std::string payload;
+		while (next_frame(opcode, payload)) {
+			if (opcode != 0x1) {
+				continue;
+			}
+			nlohmann::json j = nlohmann::json::parse(payload, nullptr, false);
+			if (ack_heartbeats && j.is_object() && j["op"] == 1) {
+				send({{"op", 11}});
+			}
+			return j;
+		}
+		if (!fill(deadline)) {
+			return nlohmann::json();
+		}
+	}
+}
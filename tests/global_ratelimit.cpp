@@ -0,0 +1,78 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <vector>
+
+/* A global 429 holds back every bucket until its Retry-After has passed, not only the bucket of
+ * the request which got it. Two channels, which have buckets of their own, are queued together
+ * behind a request the server holds up, so that both are in the same pass of the queue. The
+ * first channel request served gets a global 429; nothing may be served after it until
+ * Retry-After has passed, and both then complete.
+ */
+static const double retry_after = 2;
+
+int main() {
+	std::mutex log_mutex;
+	std::vector<double> served_at;
+	std::promise<void> both_queued;
+	std::shared_future<void> release = both_queued.get_future().share();
+	auto start = std::chrono::steady_clock::now();
+	test_server server;
+	server.svr.Get("/api/blocker", [&](const httplib::Request &, httplib::Response &res) {
+		release.wait_for(std::chrono::seconds(10));
+		res.set_content("{}", "application/json");
+	});
+	server.svr.Get(R"(/api/channels/(\d+))", [&](const httplib::Request &, httplib::Response &res) {
+		std::lock_guard<std::mutex> lock(log_mutex);
+		served_at.push_back(elapsed_ms(start));
+		if (served_at.size() == 1) {
+			res.status = 429;
+			res.set_header("X-RateLimit-Global", "true");
+			res.set_header("Retry-After", std::to_string(retry_after));
+			res.set_content("{\"message\": \"You are being rate limited.\", \"retry_after\": " + std::to_string(retry_after) + ", \"global\": true}", "application/json");
+			return;
+		}
+		res.set_content("{}", "application/json");
+	});
+	server.start();
+
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = server.url();
+
+	std::promise<void> blocker_done;
+	bot.post_rest("/api/blocker", "", dpp::m_get, "", [&](json&, const dpp::http_request_completion_t &) {
+		blocker_done.set_value();
+	});
+	/* Wait until the blocker is in flight, so that the channels are queued behind it */
+	while (bot.get_rest_stats().requests_sent == 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	std::atomic<int> finished(0), ok(0);
+	std::promise<void> all_done;
+	for (const char* channel : {"1", "2"}) {
+		bot.post_rest("/api/channels", channel, dpp::m_get, "", [&](json&, const dpp::http_request_completion_t &http) {
+			ok += http.status == 200 ? 1 : 0;
+			if (++finished == 2) {
+				all_done.set_value();
+			}
+		});
+	}
+	both_queued.set_value();
+
+	auto wait = std::chrono::seconds((int)retry_after + 10);
+	CHECK(blocker_done.get_future().wait_for(wait) == std::future_status::ready);
+	CHECK(all_done.get_future().wait_for(wait) == std::future_status::ready);
+	CHECK(ok == 2);
+
+	std::lock_guard<std::mutex> lock(log_mutex);
+	/* The 429, the other channel and the retry */
+	CHECK(served_at.size() == 3);
+	for (size_t i = 1; i < served_at.size(); ++i) {
+		CHECK(served_at[i] - served_at[0] >= retry_after * 1000 - 50);
+	}
+
+	return test_result();
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+/* A local stand-in for discord's REST API over HTTP/2, for the tests of cluster::rest_http2.
+ * It speaks h2c with prior knowledge, on a free local port, and serves each connection on a
+ * thread of its own. Replies may be held back for a while, without holding up others on the
+ * same connection, so that multiplexed requests overlap as they would against discord.
+ */
+#ifdef DPP_HTTP2
+#include <nghttp2/nghttp2.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** A request as the server saw it */
+struct h2_request {
+	std::string method;
+	std::string path;
+	/** Header names are in lower case */
+	std::map<std::string, std::string> headers;
+	std::string body;
+	/** Connection it arrived on, numbered from 1 */
+	int connection = 0;
+};
+
+/** A reply from the handler */
+struct h2_response {
+	int status = 200;
+	/** Header names must be in lower case */
+	std::vector<std::pair<std::string, std::string>> headers;
+	std::string body;
+	/** Milliseconds to hold the reply back for */
+	int delay_ms = 0;
+};
+
+class h2_server {
+	/** One stream on a connection */
+	struct stream {
+		h2_request req;
+		h2_response res;
+		size_t sent = 0;
+		std::chrono::steady_clock::time_point due;
+		bool answered = false;
+	};
+
+	/** One connection */
+	struct connection {
+		h2_server* server;
+		int fd;
+		int number;
+		nghttp2_session* session = nullptr;
+		std::map<int32_t, stream> streams;
+		int requests = 0;
+	};
+
+	int listen_fd = -1;
+	std::atomic<bool> stopping{false};
+	std::thread acceptor;
+	std::mutex threads_mutex;
+	std::vector<std::thread> threads;
+	std::atomic<int> in_progress{0};
+
+	static ssize_t send_cb(nghttp2_session*, const uint8_t* data, size_t length, int, void* user_data) {
+		connection* c = (connection*)user_data;
+		size_t done = 0;
+		while (done < length) {
+			ssize_t n = ::send(c->fd, data + done, length - done, MSG_NOSIGNAL);
+			if (n <= 0) {
+				return NGHTTP2_ERR_CALLBACK_FAILURE;
+			}
+			done += n;
+		}
+		return (ssize_t)length;
+	}
+
+	static int begin_headers_cb(nghttp2_session*, const nghttp2_frame* frame, void* user_data) {
+		connection* c = (connection*)user_data;
+		if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+			c->streams[frame->hd.stream_id].req.connection = c->number;
+		}
+		return 0;
+	}
+
+	static int header_cb(nghttp2_session*, const nghttp2_frame* frame, const uint8_t* name, size_t namelen, const uint8_t* value, size_t valuelen, uint8_t, void* user_data) {
+		connection* c = (connection*)user_data;
+		auto s = c->streams.find(frame->hd.stream_id);
+		if (s == c->streams.end()) {
+			return 0;
+		}
+		std::string n((const char*)name, namelen), v((const char*)value, valuelen);
+		if (n == ":method") {
+			s->second.req.method = v;
+		} else if (n == ":path") {
+			s->second.req.path = v;
+		} else if (n[0] != ':') {
+			s->second.req.headers[n] = v;
+		}
+		return 0;
+	}
+
+	static int data_cb(nghttp2_session*, uint8_t, int32_t stream_id, const uint8_t* data, size_t len, void* user_data) {
+		connection* c = (connection*)user_data;
+		auto s = c->streams.find(stream_id);
+		if (s != c->streams.end()) {
+			s->second.req.body.append((const char*)data, len);
+		}
+		return 0;
+	}
+
+	static int frame_recv_cb(nghttp2_session* session, const nghttp2_frame* frame, void* user_data) {
+		connection* c = (connection*)user_data;
+		if ((frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA) || !(frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) {
+			return 0;
+		}
+		auto s = c->streams.find(frame->hd.stream_id);
+		if (s == c->streams.end()) {
+			return 0;
+		}
+		h2_server* server = c->server;
+		int now_in_progress = ++server->in_progress;
+		int peak = server->peak_in_progress;
+		while (now_in_progress > peak && !server->peak_in_progress.compare_exchange_weak(peak, now_in_progress));
+		server->requests++;
+		if (server->handler) {
+			server->handler(s->second.req, s->second.res);
+		}
+		s->second.due = std::chrono::steady_clock::now() + std::chrono::milliseconds(s->second.res.delay_ms);
+		if (server->requests_per_connection && ++c->requests == server->requests_per_connection) {
+			/* Streams after this one are refused, and the client must retry them on a new connection */
+			nghttp2_submit_goaway(session, NGHTTP2_FLAG_NONE, frame->hd.stream_id, NGHTTP2_NO_ERROR, nullptr, 0);
+		}
+		return 0;
+	}
+
+	static int stream_close_cb(nghttp2_session*, int32_t stream_id, uint32_t, void* user_data) {
+		connection* c = (connection*)user_data;
+		auto s = c->streams.find(stream_id);
+		if (s != c->streams.end()) {
+			if (s->second.answered) {
+				c->server->in_progress--;
+			}
+			c->streams.erase(s);
+		}
+		return 0;
+	}
+
+	static ssize_t read_cb(nghttp2_session*, int32_t, uint8_t* buf, size_t length, uint32_t* data_flags, nghttp2_data_source* source, void*) {
+		stream* s = (stream*)source->ptr;
+		size_t n = std::min(length, s->res.body.length() - s->sent);
+		memcpy(buf, s->res.body.data() + s->sent, n);
+		s->sent += n;
+		if (s->sent == s->res.body.length()) {
+			*data_flags |= NGHTTP2_DATA_FLAG_EOF;
+		}
+		return (ssize_t)n;
+	}
+
+	/* Submit the replies which are due, and return the milliseconds until the next one is, or -1 */
+	static int answer(connection &c) {
+		auto now = std::chrono::steady_clock::now();
+		int wait = -1;
+		for (auto & entry : c.streams) {
+			stream &s = entry.second;
+			if (s.answered || s.req.method.empty() || s.due == std::chrono::steady_clock::time_point()) {
+				continue;
+			}
+			if (s.due > now) {
+				int ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(s.due - now).count() + 1;
+				wait = wait < 0 ? ms : std::min(wait, ms);
+				continue;
+			}
+			s.answered = true;
+			std::string status = std::to_string(s.res.status);
+			std::vector<nghttp2_nv> nva;
+			auto nv = [](const std::string &n, const std::string &v) {
+				return nghttp2_nv{ (uint8_t*)n.c_str(), (uint8_t*)v.c_str(), n.length(), v.length(), NGHTTP2_NV_FLAG_NONE };
+			};
+			static const std::string status_name = ":status";
+			nva.push_back(nv(status_name, status));
+			for (auto & h : s.res.headers) {
+				nva.push_back(nv(h.first, h.second));
+			}
+			nghttp2_data_provider body;
+			body.source.ptr = &s;
+			body.read_callback = read_cb;
+			nghttp2_submit_response(c.session, entry.first, nva.data(), nva.size(), &body);
+		}
+		return wait;
+	}
+
+	void serve(int fd, int number) {
+		connection c;
+		c.server = this;
+		c.fd = fd;
+		c.number = number;
+		nghttp2_session_callbacks* callbacks;
+		nghttp2_session_callbacks_new(&callbacks);
+		nghttp2_session_callbacks_set_send_callback(callbacks, send_cb);
+		nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, begin_headers_cb);
+		nghttp2_session_callbacks_set_on_header_callback(callbacks, header_cb);
+		nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, data_cb);
+		nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, frame_recv_cb);
+		nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, stream_close_cb);
+		nghttp2_session_server_new(&c.session, callbacks, &c);
+		nghttp2_session_callbacks_del(callbacks);
+		nghttp2_settings_entry settings[] = { { NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 100 } };
+		nghttp2_submit_settings(c.session, NGHTTP2_FLAG_NONE, settings, 1);
+		char buffer[16384];
+		while (!stopping) {
+			int wait = answer(c);
+			if (nghttp2_session_send(c.session) != 0) {
+				break;
+			}
+			if (!nghttp2_session_want_read(c.session) && !nghttp2_session_want_write(c.session)) {
+				break;
+			}
+			struct pollfd p = { fd, POLLIN, 0 };
+			/* Wake now and then to notice stopping */
+			int r = poll(&p, 1, wait < 0 ? 50 : std::min(wait, 50));
+			if (r > 0) {
+				ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+				if (n <= 0 || nghttp2_session_mem_recv(c.session, (const uint8_t*)buffer, n) < 0) {
+					break;
+				}
+			}
+		}
+		for (auto & s : c.streams) {
+			if (s.second.answered) {
+				in_progress--;
+			}
+		}
+		nghttp2_session_del(c.session);
+		::close(fd);
+	}
+public:
+	/** Called on the connection's thread for each request. It may set res.delay_ms to answer later. */
+	std::function<void(const h2_request &req, h2_response &res)> handler;
+	/** If not 0, each connection is sent GOAWAY once it has taken this many requests */
+	int requests_per_connection = 0;
+	/** Connections accepted */
+	std::atomic<int> connections{0};
+	/** Requests received */
+	std::atomic<int> requests{0};
+	/** Most requests received and not yet answered in full at once */
+	std::atomic<int> peak_in_progress{0};
+	int port = 0;
+
+	void start() {
+		listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+		socklen_t len = sizeof(addr);
+		getsockname(listen_fd, (struct sockaddr*)&addr, &len);
+		port = ntohs(addr.sin_port);
+		listen(listen_fd, 16);
+		acceptor = std::thread([this]() {
+			while (!stopping) {
+				struct pollfd p = { listen_fd, POLLIN, 0 };
+				if (poll(&p, 1, 50) <= 0) {
+					continue;
+				}
+				int fd = accept(listen_fd, nullptr, nullptr);
+				if (fd < 0) {
+					continue;
+				}
+				int one = 1;
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				int number = ++connections;
+				std::lock_guard<std::mutex> lock(threads_mutex);
+				threads.emplace_back(&h2_server::serve, this, fd, number);
+			}
+		});
+	}
+
+	std::string url() const {
+		return "http://127.0.0.1:" + std::to_string(port);
+	}
+
+	~h2_server() {
+		stopping = true;
+		if (acceptor.joinable()) {
+			acceptor.join();
+		}
+		for (auto & t : threads) {
+			t.join();
+		}
+		::close(listen_fd);
+	}
+};
+#endif
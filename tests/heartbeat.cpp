@@ -0,0 +1,81 @@
+#include "test.h"
+#include "gateway_server.h"
+#include <dpp/dpp.h>
+#include <dpp/discordclient.h>
+
+/* Heartbeats against a local gateway. A heartbeat which is still unacknowledged when the next
+ * one is due means the connection is a zombie: rather than send another, the shard drops it and
+ * reconnects. Acknowledged heartbeats go into the shard's round trip times.
+ */
+int main() {
+	const int interval = 200;
+	gateway_server server;
+	std::atomic<int> heartbeats_before_drop(0);
+	std::atomic<double> drop_ms(-1);
+	std::atomic<bool> acked_connection_kept(false);
+	server.script = [&](gateway_connection &c) {
+		c.hello(interval);
+		if (c.number == 1) {
+			/* Never ACK: the shard must drop the connection when its next heartbeat is due */
+			c.ack_heartbeats = false;
+			c.expect(2, 2000);
+			if (c.expect(1, interval * 2).is_null()) {
+				return;
+			}
+			heartbeats_before_drop++;
+			auto first = std::chrono::steady_clock::now();
+			while (c.is_open()) {
+				json j = c.receive(interval * 5);
+				if (j.is_null()) {
+					break;
+				}
+				if (j["op"] == 1) {
+					heartbeats_before_drop++;
+				}
+			}
+			if (!c.is_open()) {
+				drop_ms = elapsed_ms(first);
+			}
+		} else if (c.number == 2) {
+			/* ACKed: the connection is kept through several heartbeats */
+			c.expect(2, 2000);
+			int heartbeats = 0;
+			while (heartbeats < 4 && !c.expect(1, interval * 2).is_null()) {
+				heartbeats++;
+			}
+			acked_connection_kept = heartbeats == 4 && c.is_open();
+			c.close(4004);
+		} else {
+			c.close(4004);
+		}
+	};
+	server.start();
+
+	dpp::cluster bot("token", 0, 1);
+	bot.gateway_host = "127.0.0.1";
+	bot.gateway_port = server.port_str();
+	DiscordClient* shard = new DiscordClient(&bot, 0, 1, "token");
+	shard->Run();
+	CHECK(server.wait_connections(2, 5000));
+	/* The second connection is closed with 4004 after four heartbeats, which stops the shard */
+	auto started = std::chrono::steady_clock::now();
+	while (server.closed(2) == std::chrono::steady_clock::time_point() && elapsed_ms(started) < 5000) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	/* Let the shard read what was sent before the close */
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	dpp::shard_stats stats = shard->get_stats();
+	delete shard;
+
+	CHECK(heartbeats_before_drop == 1);
+	CHECK(drop_ms >= interval * 0.9 && drop_ms < interval * 3);
+	CHECK(acked_connection_kept);
+	CHECK(server.connections == 2);
+	CHECK(stats.missed_acks == 1);
+	CHECK(stats.reconnects == 1);
+	CHECK(stats.heartbeats_sent >= 5);
+	CHECK(stats.heartbeat_acks == 4);
+	CHECK(stats.rtt.count == 4);
+	CHECK(stats.last_rtt > 0 && stats.rtt.max < 1000);
+	return test_result();
+}
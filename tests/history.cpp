@@ -0,0 +1,90 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <dpp/history.h>
+#include <atomic>
+#include <future>
+
+/* message_history reads a channel newest first, a page at a time, fetching ahead of the
+ * caller. Every message must arrive once and in order, whatever the window. The server counts
+ * the pages asked for: after the caller has taken a page, the cursor must go on to fetch the
+ * window's worth of pages after it without being asked, and never more than that.
+ */
+static const uint64_t total_messages = 450;
+static const uint64_t page_size = 50;
+/* Nine full pages, then an empty one which ends the history */
+static const uint64_t total_pages = total_messages / page_size + 1;
+
+/* Pages requested from the server, and pages the caller has asked for with next() */
+static std::atomic<uint64_t> requested(0), asked(0);
+static std::atomic<uint32_t> current_window(1);
+
+static void read_all(const std::string &url, uint32_t window, uint64_t &seen, bool &in_order, bool &fetched_ahead) {
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = url;
+	requested = 0;
+	asked = 0;
+	current_window = window;
+	auto history = bot.messages_history(1, 0, page_size, window);
+	uint64_t expect = total_messages;
+	seen = 0;
+	in_order = true;
+	fetched_ahead = true;
+	while (true) {
+		std::promise<dpp::history_page> p;
+		asked++;
+		history->next([&p](const dpp::history_page &page) {
+			p.set_value(page);
+		});
+		auto f = p.get_future();
+		if (f.wait_for(std::chrono::seconds(10)) != std::future_status::ready) {
+			CHECK(!"next() never called back");
+			break;
+		}
+		dpp::history_page page = f.get();
+		CHECK(page.http_info.status == 200);
+		for (auto & m : page.messages) {
+			in_order = in_order && m.id == expect--;
+			seen++;
+		}
+		/* While the caller works on this page the cursor fetches the next window's worth */
+		uint64_t ahead = std::min(asked + window, total_pages);
+		auto started = std::chrono::steady_clock::now();
+		while (requested < ahead && elapsed_ms(started) < 10000) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		fetched_ahead = fetched_ahead && requested == ahead;
+		if (page.end) {
+			break;
+		}
+	}
+	CHECK(history->done());
+	CHECK(requested == total_pages);
+}
+
+int main() {
+	test_server server;
+	server.svr.Get("/api/channels/1/messages", [](const httplib::Request &req, httplib::Response &res) {
+		/* A page is only fetched once there is room for it in the window */
+		CHECK(++requested <= asked + current_window);
+		uint64_t before = req.has_param("before") ? std::stoull(req.get_param_value("before")) : total_messages + 1;
+		uint64_t limit = std::stoull(req.get_param_value("limit"));
+		std::string body = "[";
+		for (uint64_t id = before - 1; id > 0 && id + limit >= before; --id) {
+			body += (body.size() > 1 ? "," : "") + std::string(R"({"id":")") + std::to_string(id) + R"(","channel_id":"1","content":"message )" + std::to_string(id) + "\"}";
+		}
+		body += "]";
+		res.set_content(body, "application/json");
+	});
+	server.start();
+
+	for (uint32_t window : { 1, 4 }) {
+		uint64_t seen;
+		bool in_order, fetched_ahead;
+		read_all(server.url(), window, seen, in_order, fetched_ahead);
+		CHECK(seen == total_messages);
+		CHECK(in_order);
+		CHECK(fetched_ahead);
+	}
+
+	return test_result();
+}
@@ -0,0 +1,163 @@
+#include "test.h"
+#include "h2_server.h"
+#include <dpp/dpp.h>
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <vector>
+
+/* With cluster::rest_http2 set, requests for different buckets are in flight on one connection
+ * at once, while each bucket's requests are still sent one at a time and complete in order. A
+ * server which sends GOAWAY part way through must not make requests fail, only open another
+ * connection, and rate limit headers must be read from HTTP/2 replies as from HTTP/1.1 ones.
+ */
+#ifdef DPP_HTTP2
+static const int delay_ms = 300;
+
+/* Send GETs to channels 1 to count at once, and wait for all of them. Returns the number which succeeded. */
+static int get_channels(dpp::cluster &bot, int count) {
+	std::atomic<int> ok(0), finished(0);
+	std::promise<void> all_done;
+	for (int i = 1; i <= count; ++i) {
+		bot.post_rest("/api/channels", std::to_string(i), dpp::m_get, "", [&, i](json &j, const dpp::http_request_completion_t &http) {
+			ok += (http.error == dpp::h_success && http.status == 200 && j.is_object() && j["id"] == std::to_string(i)) ? 1 : 0;
+			if (++finished == count) {
+				all_done.set_value();
+			}
+		});
+	}
+	if (all_done.get_future().wait_for(std::chrono::seconds(20)) != std::future_status::ready) {
+		return -1;
+	}
+	return ok;
+}
+
+int main() {
+	auto channel = [](const h2_request &req, h2_response &res) {
+		res.headers.emplace_back("content-type", "application/json");
+		res.body = "{\"id\":\"" + req.path.substr(req.path.rfind('/') + 1) + "\"}";
+		res.delay_ms = delay_ms;
+	};
+
+	/* Ten buckets, each reply held back: they overlap on one connection */
+	{
+		h2_server server;
+		std::mutex headers_mutex;
+		std::string authorization;
+		server.handler = [&](const h2_request &req, h2_response &res) {
+			{
+				std::lock_guard<std::mutex> lock(headers_mutex);
+				authorization = req.headers.count("authorization") ? req.headers.at("authorization") : "";
+			}
+			channel(req, res);
+		};
+		server.start();
+		dpp::cluster bot("token", 0, 0);
+		bot.rest_url = server.url();
+		bot.rest_http2 = true;
+		const int count = 10;
+		auto start = std::chrono::steady_clock::now();
+		CHECK(get_channels(bot, count) == count);
+		/* One after another they would take count * delay_ms */
+		CHECK(elapsed_ms(start) < count * delay_ms / 2);
+		dpp::rest_stats stats = bot.get_rest_stats();
+		CHECK(stats.requests_sent == count);
+		CHECK(stats.http2_requests == count);
+		CHECK(stats.connections_opened == 1);
+		CHECK(stats.http2_peak_streams > 1);
+		CHECK(server.connections == 1);
+		CHECK(server.peak_in_progress > 1);
+		std::lock_guard<std::mutex> lock(headers_mutex);
+		CHECK(authorization == "Bot token");
+	}
+
+	/* One bucket: its POSTs go one at a time, with their bodies, and complete in order */
+	{
+		h2_server server;
+		std::mutex order_mutex;
+		std::vector<std::string> served, completed;
+		server.handler = [&](const h2_request &req, h2_response &res) {
+			{
+				std::lock_guard<std::mutex> lock(order_mutex);
+				served.push_back(req.body);
+			}
+			res.headers.emplace_back("content-type", "application/json");
+			res.body = req.body;
+			res.delay_ms = 20;
+		};
+		server.start();
+		dpp::cluster bot("token", 0, 0);
+		bot.rest_url = server.url();
+		bot.rest_http2 = true;
+		const int count = 5;
+		std::promise<void> all_done;
+		for (int i = 0; i < count; ++i) {
+			bot.post_rest("/api/channels", "1/messages", dpp::m_post, "{\"n\":" + std::to_string(i) + "}", [&](json &j, const dpp::http_request_completion_t &http) {
+				std::lock_guard<std::mutex> lock(order_mutex);
+				completed.push_back(http.status == 200 ? j.dump() : "failed");
+				if (completed.size() == count) {
+					all_done.set_value();
+				}
+			});
+		}
+		CHECK(all_done.get_future().wait_for(std::chrono::seconds(20)) == std::future_status::ready);
+		CHECK(server.peak_in_progress == 1);
+		std::lock_guard<std::mutex> lock(order_mutex);
+		CHECK(served.size() == count && completed.size() == count);
+		for (size_t i = 0; i < served.size() && i < completed.size(); ++i) {
+			std::string expected = "{\"n\":" + std::to_string(i) + "}";
+			CHECK(served[i] == expected);
+			CHECK(completed[i] == expected);
+		}
+	}
+
+	/* GOAWAY after every three requests: the refused ones are sent again on a new connection */
+	{
+		h2_server server;
+		server.handler = channel;
+		server.requests_per_connection = 3;
+		server.start();
+		dpp::cluster bot("token", 0, 0);
+		bot.rest_url = server.url();
+		bot.rest_http2 = true;
+		const int count = 8;
+		CHECK(get_channels(bot, count) == count);
+		CHECK(server.connections >= 3);
+		CHECK(bot.get_rest_stats().connections_opened == (uint64_t)server.connections);
+	}
+
+	/* A 429's rate limit headers are read from an HTTP/2 reply, and the request retried */
+	{
+		h2_server server;
+		std::atomic<int> hits(0);
+		server.handler = [&](const h2_request &req, h2_response &res) {
+			if (hits++ == 0) {
+				res.status = 429;
+				res.headers.emplace_back("x-ratelimit-limit", "1");
+				res.headers.emplace_back("x-ratelimit-remaining", "0");
+				res.headers.emplace_back("x-ratelimit-reset-after", "0.2");
+				res.headers.emplace_back("retry-after", "0.2");
+				res.headers.emplace_back("content-type", "application/json");
+				res.body = "{\"message\": \"You are being rate limited.\", \"retry_after\": 0.2, \"global\": false}";
+				return;
+			}
+			res.headers.emplace_back("content-type", "application/json");
+			res.body = "{\"id\":\"1\"}";
+		};
+		server.start();
+		dpp::cluster bot("token", 0, 0);
+		bot.rest_url = server.url();
+		bot.rest_http2 = true;
+		CHECK(get_channels(bot, 1) == 1);
+		CHECK(hits == 2);
+		CHECK(bot.get_rest_stats().retries_ratelimited == 1);
+	}
+
+	return test_result();
+}
+#else
+int main() {
+	printf("Built without nghttp2, so there is no HTTP/2 transport to test\n");
+	return 0;
+}
+#endif
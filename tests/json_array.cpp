@@ -0,0 +1,242 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <dpp/jsonscan.h>
+#include <atomic>
+#include <cstdlib>
+#include <future>
+#include <new>
+#include <random>
+
+/* json_parse_array must hand over exactly the elements of the array, in order, with either
+ * backend; return false for a document which isn't an array; and throw parse_error for a
+ * malformed array, as parsing it whole would. json_array_parser must do the same however the
+ * text is split into parts. A REST reply which is an array is parsed as it arrives, so the
+ * memory used while receiving one stays well below the size of its body.
+ */
+static std::mt19937 rng(48);
+
+/* Live and peak heap use. Each allocation records its size in front of the block. */
+static std::atomic<size_t> live(0), peak(0);
+
+void* operator new(size_t size) {
+	char* p = (char*)malloc(size + 16);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	*(size_t*)p = size;
+	size_t now = live += size;
+	size_t was = peak;
+	while (now > was && !peak.compare_exchange_weak(was, now)) {
+	}
+	return p + 16;
+}
+
+void operator delete(void* p) noexcept {
+	if (p) {
+		char* block = (char*)p - 16;
+		live -= *(size_t*)block;
+		free(block);
+	}
+}
+
+void operator delete(void* p, size_t) noexcept {
+	operator delete(p);
+}
+
+static json random_value(int depth) {
+	switch (rng() % (depth > 3 ? 4 : 6)) {
+		case 0: return (int64_t)rng() - 0x7fffffff;
+		case 1: return "s,]}\"[" + std::to_string(rng());
+		case 2: return nullptr;
+		case 3: return rng() % 2 == 0;
+		case 4: {
+			json a = json::array();
+			for (int n = rng() % 4; n > 0; --n) {
+				a.push_back(random_value(depth + 1));
+			}
+			return a;
+		}
+		default: {
+			json o = json::object();
+			for (int n = rng() % 4; n > 0; --n) {
+				o["k" + std::to_string(rng() % 10)] = random_value(depth + 1);
+			}
+			return o;
+		}
+	}
+}
+
+/* Compare json_parse_array with parsing the whole document. Text which doesn't start with
+ * '[' isn't looked at any further, whether or not it is well formed.
+ */
+static bool matches(const std::string &doc, dpp::json_backend backend) {
+	size_t start = doc.find_first_not_of(" \t\r\n");
+	if (start == std::string::npos || doc[start] != '[') {
+		try {
+			bool called = false;
+			return !dpp::json_parse_array(doc, [&called](json&) { called = true; }, backend) && !called;
+		}
+		catch (const json::parse_error&) {
+			return false;
+		}
+	}
+	json whole;
+	bool valid = true;
+	try {
+		whole = json::parse(doc);
+	}
+	catch (const json::parse_error&) {
+		valid = false;
+	}
+	/* Once whole, and once in parts of random sizes, including empty ones */
+	for (bool split : { false, true }) {
+		std::vector<json> elements;
+		bool is_array;
+		try {
+			auto element = [&elements](json &j) {
+				elements.push_back(std::move(j));
+			};
+			if (split) {
+				dpp::json_array_parser parser(element, backend);
+				for (size_t p = 0, n; p < doc.length(); p += n) {
+					n = std::min<size_t>(rng() % 8, doc.length() - p);
+					parser.feed(doc.data() + p, n);
+				}
+				is_array = parser.finish();
+			} else {
+				is_array = dpp::json_parse_array(doc, element, backend);
+			}
+		}
+		catch (const json::parse_error&) {
+			if (valid) {
+				return false;
+			}
+			continue;
+		}
+		if (!valid || is_array != whole.is_array()) {
+			return false;
+		}
+		if (is_array ? elements != std::vector<json>(whole.begin(), whole.end()) : !elements.empty()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Fetch a large array from a local server, which makes it up as it sends it, through the REST
+ * queue. Returns the number of elements handed over, and the peak heap use while fetching it.
+ */
+static size_t fetch_array(size_t elements, size_t &body_size, size_t &peak_use) {
+	const std::string padding(200, 'x');
+	body_size = 0;
+	test_server server;
+	server.svr.Get("/api/items", [&](const httplib::Request &, httplib::Response &res) {
+		res.set_chunked_content_provider("application/json", [&, sent = (size_t)0](size_t, httplib::DataSink &sink) mutable {
+			std::string part = sent == 0 ? "[" : "";
+			for (size_t n = 0; n < 100 && sent < elements; ++n, ++sent) {
+				part += (sent ? "," : "") + std::string(R"({"id":")") + std::to_string(sent + 1) + R"(","content":")" + padding + "\"}";
+			}
+			if (sent == elements) {
+				part += "]";
+			}
+			body_size += part.length();
+			sink.write(part.data(), part.length());
+			if (sent == elements) {
+				sink.done();
+			}
+			return true;
+		});
+	});
+	server.start();
+
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = server.url();
+	size_t received = 0;
+	bool in_order = true;
+	std::promise<dpp::http_request_completion_t> done;
+	size_t base = live;
+	peak = base;
+	bot.post_rest_array("/api/items", "", dpp::m_get, "", [&](json &j) {
+		in_order = in_order && j["id"] == std::to_string(received + 1);
+		received++;
+	}, [&done](const dpp::http_request_completion_t &http) {
+		done.set_value(http);
+	});
+	auto f = done.get_future();
+	if (f.wait_for(std::chrono::seconds(30)) != std::future_status::ready) {
+		CHECK(!"post_rest_array never completed");
+		return 0;
+	}
+	peak_use = peak - base;
+	auto http = f.get();
+	CHECK(http.error == dpp::h_success);
+	CHECK(http.status == 200);
+	CHECK(http.body.empty());
+	CHECK(in_order);
+	return received;
+}
+
+/* A malformed reply is reported to the completion handler, with the elements before the fault
+ * handed over, rather than thrown on the completion thread.
+ */
+static void fetch_malformed() {
+	test_server server;
+	server.svr.Get("/api/items", [](const httplib::Request &, httplib::Response &res) {
+		res.set_content("[1,2,}", "application/json");
+	});
+	server.start();
+
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = server.url();
+	size_t received = 0;
+	std::promise<dpp::http_request_completion_t> done;
+	bot.post_rest_array("/api/items", "", dpp::m_get, "", [&received](json &) {
+		received++;
+	}, [&done](const dpp::http_request_completion_t &http) {
+		done.set_value(http);
+	});
+	auto f = done.get_future();
+	if (f.wait_for(std::chrono::seconds(10)) != std::future_status::ready) {
+		CHECK(!"post_rest_array never completed");
+		return;
+	}
+	auto http = f.get();
+	CHECK(http.error == dpp::h_unknown);
+	CHECK(!http.body.empty());
+	CHECK(received == 2);
+}
+
+int main() {
+	for (auto backend : { dpp::jb_nlohmann, dpp::jb_simd }) {
+		for (const char* doc : { "[]", " [ ] ", "[1]", "[1,2,3]", R"([{"a":"x,]}"},[1,[2]],"s"])", R"({"a":1})", "\"[1]\"", "[1,]", "[1,2", "[1}", "", "  ", "{\"a\":", "[1] x", "[,1]", "[{\"a\":[1,2]}, {\"b\":{}}]\n" }) {
+			if (!matches(doc, backend)) {
+				printf("differs: %s\n", doc);
+				CHECK(!"json_parse_array differs from parsing the whole document");
+			}
+		}
+		int diffs = 0;
+		for (int i = 0; i < 5000; ++i) {
+			json a = json::array();
+			for (int n = rng() % 20; n > 0; --n) {
+				a.push_back(random_value(0));
+			}
+			std::string doc = a.dump(i % 2 ? -1 : 1);
+			/* Sometimes cut it short, so it is malformed */
+			if (i % 5 == 0 && doc.size() > 2) {
+				doc.resize(rng() % doc.size());
+			}
+			diffs += !matches(doc, backend);
+		}
+		CHECK(diffs == 0);
+	}
+
+	/* The body is never held whole: the most the fetch has in use at once is a small fraction of it */
+	size_t body_size = 0, peak_use = 0;
+	CHECK(fetch_array(20000, body_size, peak_use) == 20000);
+	printf("peak heap use %zu bytes while fetching a %zu byte array\n", peak_use, body_size);
+	CHECK(body_size > 4000000);
+	CHECK(peak_use < body_size / 4);
+
+	fetch_malformed();
+	return test_result();
+}
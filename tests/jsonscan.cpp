@@ -0,0 +1,144 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <dpp/jsonscan.h>
+#include <random>
+
+/* The jb_simd backend must accept and reject exactly what jb_nlohmann does, and build the
+ * same document. Random documents, random bytes inside strings (control characters and
+ * invalid UTF-8) and hand-picked edge cases are parsed with both and compared.
+ */
+static std::mt19937 rng(7);
+
+/* The structural characters of s found the slow way, one character at a time. As in the
+ * scanner, a backslash escapes the next character even outside a string, where it can only
+ * stop a quote from counting; a document like that is malformed anyway.
+ */
+static bool reference_index(const std::string &s, std::vector<uint32_t> &out) {
+	out.clear();
+	bool in_string = false, escaped = false;
+	for (size_t i = 0; i < s.size(); ++i) {
+		char c = s[i];
+		if (escaped) {
+			escaped = false;
+			if (!in_string && c && strchr("{}[]:,", c)) {
+				out.push_back((uint32_t)i);
+			}
+			continue;
+		}
+		if (c == '\\') {
+			escaped = true;
+			continue;
+		}
+		if (c == '"') {
+			in_string = !in_string;
+			out.push_back((uint32_t)i);
+		} else if (!in_string && c && strchr("{}[]:,", c)) {
+			out.push_back((uint32_t)i);
+		}
+	}
+	return !in_string;
+}
+
+static json random_value(int depth) {
+	switch (rng() % (depth > 4 ? 5 : 7)) {
+		case 0: return (int64_t)(rng() % 2000000) - 1000000;
+		case 1: return std::to_string(rng()) + "\"\\\n\xc3\xa9 x";
+		case 2: return rng() % 2 == 0;
+		case 3: return nullptr;
+		case 4: return (double)rng() / 7.0;
+		case 5: {
+			json a = json::array();
+			for (int n = rng() % 5; n > 0; --n) {
+				a.push_back(random_value(depth + 1));
+			}
+			return a;
+		}
+		default: {
+			json o = json::object();
+			for (int n = rng() % 5; n > 0; --n) {
+				o["k" + std::to_string(rng() % 100)] = random_value(depth + 1);
+			}
+			return o;
+		}
+	}
+}
+
+/* 0 if rejected, 1 if accepted (with the document dumped into out), 2 for any other exception */
+static int verdict(const std::string &doc, dpp::json_backend backend, std::string &out) {
+	try {
+		out = dpp::json_parse(doc, backend).dump();
+		return 1;
+	}
+	catch (const json::parse_error&) {
+		return 0;
+	}
+	catch (const std::exception&) {
+		return 2;
+	}
+}
+
+static bool same(const std::string &doc) {
+	std::string a, b;
+	int va = verdict(doc, dpp::jb_nlohmann, a);
+	int vb = verdict(doc, dpp::jb_simd, b);
+	return va == vb && a == b;
+}
+
+int main() {
+	printf("scanner: %s\n", dpp::json_scanner_name());
+
+	/* Structural index, over strings made mostly of the characters that matter to it */
+	const char alphabet[] = "\"\\{}[]:, a1";
+	for (int i = 0; i < 100000; ++i) {
+		std::string s;
+		for (size_t n = rng() % 300; n > 0; --n) {
+			s += alphabet[rng() % (sizeof(alphabet) - 1)];
+		}
+		std::vector<uint32_t> expected, index;
+		bool ok = reference_index(s, expected);
+		CHECK(dpp::json_structural_index(s.data(), s.size(), index) == ok);
+		CHECK(!ok || index == expected);
+	}
+
+	/* Round trips of random documents, compact and pretty printed */
+	int diffs = 0;
+	for (int i = 0; i < 20000; ++i) {
+		json v = random_value(0);
+		std::string s = v.dump(i % 3 ? -1 : 2);
+		diffs += dpp::json_parse(s, dpp::jb_simd) != v;
+	}
+	CHECK(diffs == 0);
+
+	/* Random bytes in strings: control characters, escapes, and valid and invalid UTF-8 */
+	diffs = 0;
+	for (int i = 0; i < 100000; ++i) {
+		std::string s = "{\"k\":\"";
+		for (size_t n = rng() % 24; n > 0; --n) {
+			int r = rng() % 10;
+			if (r < 4) {
+				s += (char)('a' + rng() % 26);
+			} else if (r < 5) {
+				s += (char)(rng() % 0x20);
+			} else if (r < 6) {
+				s += "\\n";
+			} else {
+				s += (char)(0x80 + rng() % 0x80);
+			}
+		}
+		s += "\",\"x\":[1,\"" + std::string(rng() % 2 ? "\xc3\xa9" : "\xed\xa0\x80") + "\"]}";
+		diffs += !same(s);
+	}
+	CHECK(diffs == 0);
+
+	for (const char* doc : {
+		R"({"a":1,"b":[true,false,null,-5,1.5e3,18446744073709551615,184467440737095516150],"c":{"d":"x\"y\\z\u00e9\ud83d\ude00"},"e":""})",
+		"[]", "{}", " 1 ", "\"s\"", "[1,2,]", "{\"a\" 1}", "{\"a\":1 2}", "[01]", "[1.]", "{\"a\":}", "tru",
+		"[\"\\x\"]", "[1] x", " [ { } , [ ] , \"\\/\" ] ", "[\"\t\"]", "[\"\xc0\xaf\"]", "[\"\xf4\x90\x80\x80\"]", "[\"\xe2\x82\"]" }) {
+		if (!same(doc)) {
+			printf("differs: %s\n", doc);
+			CHECK(!"backends differ");
+		}
+	}
+
+	return test_result();
+}
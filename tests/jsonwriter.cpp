@@ -0,0 +1,92 @@
+#include "test.h"
+#include "message_json.h"
+#include <dpp/jsonwriter.h>
+#include <random>
+
+/* json_writer must produce the same document as building an nlohmann::json and dumping it.
+ * Random messages, with every ASCII character and some UTF-8 in their text, are written
+ * both ways and the parsed results compared.
+ */
+static std::mt19937 rng(29);
+
+static std::string random_text() {
+	std::string s;
+	for (size_t n = rng() % 40; n > 0; --n) {
+		if (rng() % 8 == 0) {
+			s += "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80";
+		} else {
+			s += (char)(1 + rng() % 0x7f);
+		}
+	}
+	return s;
+}
+
+int main() {
+	dpp::message sample = sample_message();
+	CHECK(json::parse(sample.build_json()) == json::parse(dom_build_json(sample)));
+	CHECK(json::parse(sample.build_json(true)) == json::parse(dom_build_json(sample, true)));
+
+	int diffs = 0;
+	for (int i = 0; i < 20000; ++i) {
+		dpp::message m;
+		m.channel_id = rng();
+		m.id = rng() * (uint64_t)rng();
+		m.content = random_text();
+		m.nonce = random_text();
+		m.tts = rng() % 2;
+		if (rng() % 2) {
+			dpp::embed e;
+			e.set_title(random_text()).set_description(random_text()).set_color(rng() % 0x1000000);
+			if (rng() % 2) {
+				e.set_author(random_text(), random_text(), random_text());
+			}
+			for (size_t n = rng() % 5; n > 0; --n) {
+				e.add_field(random_text(), random_text(), rng() % 2);
+			}
+			m.embeds.push_back(e);
+		}
+		bool with_id = rng() % 2;
+		diffs += json::parse(m.build_json(with_id)) != json::parse(dom_build_json(m, with_id));
+	}
+	CHECK(diffs == 0);
+
+	dpp::json_writer w;
+	w.begin_object().field("min", INT64_MIN).field("max", INT64_MAX).field("umax", UINT64_MAX).field("zero", 0).key("id").snowflake(UINT64_MAX).key("none").null();
+	w.key("list").begin_array().value(true).value("a").begin_array().end_array().begin_object().end_object().end_array().end_object();
+	json j = json::parse(w.str());
+	CHECK(j["min"] == INT64_MIN);
+	CHECK(j["max"] == INT64_MAX);
+	CHECK(j["umax"] == UINT64_MAX);
+	CHECK(j["zero"] == 0);
+	CHECK(j["id"] == "18446744073709551615");
+	CHECK(j["none"].is_null());
+	CHECK(j["list"].dump() == R"([true,"a",[],{}])");
+
+	/* Strings which aren't valid UTF-8 throw the same type_error as dumping them, and valid
+	 * ones at the edges of the ranges are written as they are
+	 */
+	for (const char* text : { "\xff", "a\xc3", "\xc0\xaf", "\xe0\x80\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80", "ok\xe2\x82", "\x80" "abc" }) {
+		std::string dumped, written;
+		try {
+			json(text).dump();
+		}
+		catch (const json::type_error &e) {
+			dumped = e.what();
+		}
+		try {
+			dpp::json_writer().value(text);
+		}
+		catch (const json::type_error &e) {
+			written = e.what();
+		}
+		CHECK(!dumped.empty());
+		CHECK(written == dumped);
+	}
+	for (const char* text : { "\xc2\x80", "\xdf\xbf", "\xe0\xa0\x80", "\xed\x9f\xbf", "\xee\x80\x80", "\xef\xbf\xbf", "\xf0\x90\x80\x80", "\xf4\x8f\xbf\xbf" }) {
+		dpp::json_writer v;
+		v.value(text);
+		CHECK(json::parse(v.str()) == json(text));
+	}
+
+	return test_result();
+}
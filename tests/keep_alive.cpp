@@ -0,0 +1,56 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <future>
+
+/* With cluster::rest_keep_alive set, the request thread reuses one connection for every
+ * request; without it, each request opens its own. A server which closes the connection
+ * after every reply must not make requests fail, only open more connections.
+ */
+static dpp::rest_stats run(const std::string &url, bool keep_alive, int requests, int &failed) {
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = url;
+	bot.rest_keep_alive = keep_alive;
+	bot.request_retries = 0;
+	failed = 0;
+	for (int i = 0; i < requests; ++i) {
+		std::promise<bool> done;
+		bot.user_get(1, [&done](const dpp::confirmation_callback_t &cc) {
+			done.set_value(cc.http_info.error == dpp::h_success && cc.http_info.status == 200);
+		});
+		failed += !done.get_future().get();
+	}
+	return bot.get_rest_stats();
+}
+
+int main() {
+	auto user = [](const httplib::Request&, httplib::Response &res) {
+		res.set_content(R"({"id":"1","username":"one","discriminator":"0001"})", "application/json");
+	};
+	test_server server;
+	/* httplib's server closes a connection after 5 requests by default */
+	server.svr.set_keep_alive_max_count(1000);
+	server.svr.Get("/api/users/1", user);
+	server.start();
+	test_server closing;
+	closing.svr.set_keep_alive_max_count(1);
+	closing.svr.Get("/api/users/1", user);
+	closing.start();
+
+	const int requests = 20;
+	int failed;
+	dpp::rest_stats kept = run(server.url(), true, requests, failed);
+	CHECK(failed == 0);
+	CHECK(kept.requests_sent == requests);
+	CHECK(kept.connections_opened == 1);
+
+	dpp::rest_stats fresh = run(server.url(), false, requests, failed);
+	CHECK(failed == 0);
+	CHECK(fresh.connections_opened == requests);
+
+	dpp::rest_stats closed = run(closing.url(), true, requests, failed);
+	CHECK(failed == 0);
+	CHECK(closed.requests_sent == requests);
+	CHECK(closed.connections_opened == requests);
+
+	return test_result();
+}
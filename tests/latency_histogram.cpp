@@ -0,0 +1,98 @@
+#include "test.h"
+#include <dpp/stats.h>
+
+/* dpp::latency_histogram against known inputs: which bucket a value lands in, the percentiles
+ * estimated from the buckets, and merging, which must give the same histogram as recording
+ * every value into one.
+ */
+static bool same(const dpp::latency_histogram &a, const dpp::latency_histogram &b) {
+	return a.buckets == b.buckets && a.count == b.count && a.total == b.total && a.min == b.min && a.max == b.max;
+}
+
+int main() {
+	/* Bucket i ends at 2^i ms */
+	CHECK(dpp::latency_histogram::bucket_limit(0) == 1);
+	CHECK(dpp::latency_histogram::bucket_limit(1) == 2);
+	CHECK(dpp::latency_histogram::bucket_limit(10) == 1024);
+	CHECK(dpp::latency_histogram::bucket_limit(dpp::latency_histogram::bucket_count - 1) == 32768);
+
+	/* A bucket takes values up to but not including its limit, and the last takes the rest */
+	{
+		dpp::latency_histogram h;
+		for (double ms : { 0.0, 0.5, 1.0, 1.5, 3.0, 4.0, 32767.0, 32768.0, 1e6 }) {
+			h.record(ms);
+		}
+		CHECK(h.buckets[0] == 2);
+		CHECK(h.buckets[1] == 2);
+		CHECK(h.buckets[2] == 1);
+		CHECK(h.buckets[3] == 1);
+		CHECK(h.buckets[dpp::latency_histogram::bucket_count - 1] == 3);
+		CHECK(h.count == 9);
+		CHECK(h.min == 0);
+		CHECK(h.max == 1e6);
+		CHECK(h.total == 0.5 + 1 + 1.5 + 3 + 4 + 32767 + 32768 + 1e6);
+	}
+
+	/* An empty histogram */
+	{
+		dpp::latency_histogram h;
+		CHECK(h.mean() == 0);
+		CHECK(h.percentile(50) == 0);
+		CHECK(h.percentile(100) == 0);
+	}
+
+	/* 1 to 100 ms: the buckets end at 2, 4, 8, 16, 32, 64 and 128 ms, holding 1, 2, 4, 8, 16, 32 and 37 values */
+	dpp::latency_histogram all;
+	for (int ms = 1; ms <= 100; ++ms) {
+		all.record(ms);
+	}
+	CHECK(all.count == 100);
+	CHECK(all.mean() == 50.5);
+	CHECK(all.percentile(0) == 1);
+	CHECK(all.percentile(1) == 2);
+	CHECK(all.percentile(10) == 16);
+	CHECK(all.percentile(50) == 64);
+	CHECK(all.percentile(63) == 64);
+	CHECK(all.percentile(64) == 100);
+	/* Never above the largest value recorded, though its bucket goes on to 128 ms */
+	CHECK(all.percentile(99) == 100);
+	CHECK(all.percentile(100) == 100);
+	/* Out of range percentiles are clamped */
+	CHECK(all.percentile(-5) == 1);
+	CHECK(all.percentile(150) == 100);
+
+	/* A value past the last bucket's limit is the largest, so the top percentile is exact */
+	{
+		dpp::latency_histogram h = all;
+		h.record(50000);
+		CHECK(h.percentile(100) == 50000);
+		CHECK(h.percentile(50) == 64);
+	}
+
+	/* Merging two halves gives the same as recording them all into one */
+	{
+		dpp::latency_histogram low, high;
+		for (int ms = 1; ms <= 50; ++ms) {
+			low.record(ms);
+		}
+		for (int ms = 51; ms <= 100; ++ms) {
+			high.record(ms);
+		}
+		CHECK(low.percentile(100) == 50);
+		CHECK(high.percentile(0) == 51);
+		dpp::latency_histogram merged = high;
+		merged.merge(low);
+		CHECK(same(merged, all));
+		CHECK(merged.percentile(50) == 64);
+		CHECK(merged.percentile(99) == 100);
+
+		/* Into an empty histogram, and an empty one into a full one */
+		dpp::latency_histogram empty, copy;
+		copy.merge(all);
+		CHECK(same(copy, all));
+		copy.merge(empty);
+		CHECK(same(copy, all));
+	}
+
+	return test_result();
+}
@@ -0,0 +1,156 @@
+#include "test.h"
+#include "gateway_server.h"
+#include <dpp/dpp.h>
+#include <dpp/discordclient.h>
+#include <map>
+#include <mutex>
+#include <set>
+
+/* Member chunk requests against a local gateway. Queued guilds are asked for in batches of
+ * cluster::chunk_batch_size, prioritised ones first, each batch with a nonce of its own. Only
+ * chunks with the right nonce count towards a guild, and guild_members_loaded fires once all of
+ * its chunks have arrived, or with timed_out set once cluster::chunk_timeout passes without one.
+ */
+
+/** A GUILD_MEMBERS_CHUNK event with the given number of (empty) members */
+static json chunk(const std::string &guild_id, const std::string &nonce, int index, int count, int members) {
+	json list = json::array();
+	for (int i = 0; i < members; ++i) {
+		list.push_back({{"user", {{"id", std::to_string(1000 + i)}}}});
+	}
+	return {{"op", 0}, {"t", "GUILD_MEMBERS_CHUNK"}, {"s", 2}, {"d", {{"guild_id", guild_id}, {"nonce", nonce}, {"chunk_index", index}, {"chunk_count", count}, {"members", list}}}};
+}
+
+int main() {
+	std::mutex requests_mutex;
+	std::vector<json> requests;
+	gateway_server server;
+	server.script = [&](gateway_connection &c) {
+		c.hello();
+		if (c.number > 1) {
+			c.close(4004);
+			return;
+		}
+		c.expect(2, 2000);
+		c.ready("abc");
+		/* Answer each request as it comes. Guild 8 has two chunks, with one for another
+		 * request's nonce in between; guild 6 only ever gets the first of its two.
+		 */
+		for (int r = 0; r < 3; ++r) {
+			json req = c.expect(8, 5000);
+			if (req.is_null()) {
+				break;
+			}
+			{
+				std::lock_guard<std::mutex> lock(requests_mutex);
+				requests.push_back(req);
+			}
+			std::string nonce = req["d"]["nonce"];
+			json ids = req["d"]["guild_id"];
+			if (!ids.is_array()) {
+				ids = json::array({ ids });
+			}
+			for (auto & id : ids) {
+				if (id == "8") {
+					c.send(chunk("8", nonce, 0, 2, 2));
+					c.send(chunk("8", "not-ours", 1, 2, 7));
+					c.send(chunk("8", nonce, 1, 2, 1));
+				} else if (id == "6") {
+					c.send(chunk("6", nonce, 0, 2, 4));
+				} else {
+					c.send(chunk(id, nonce, 0, 1, 5));
+				}
+			}
+		}
+		/* Stay connected until guild 6 has timed out */
+		c.receive(6000);
+		c.close(4004);
+	};
+	server.start();
+
+	dpp::cluster bot("token", dpp::GUILD_MEMBERS, 1);
+	bot.gateway_host = "127.0.0.1";
+	bot.gateway_port = server.port_str();
+	bot.chunk_batch_size = 3;
+	bot.chunk_timeout = 2;
+	std::mutex loaded_mutex;
+	std::vector<dpp::guild_members_loaded_t> loaded;
+	bot.on_guild_members_loaded([&](const dpp::guild_members_loaded_t &l) {
+		std::lock_guard<std::mutex> lock(loaded_mutex);
+		loaded.push_back(l);
+	});
+
+	DiscordClient* shard = new DiscordClient(&bot, 0, 1, "token", dpp::GUILD_MEMBERS);
+	/* Queued before the shard runs, so that the first request takes the front of the queue */
+	for (uint64_t id = 1; id <= 7; ++id) {
+		shard->add_chunk_queue(id);
+	}
+	/* Already queued, and queued twice: neither adds it again */
+	shard->add_chunk_queue(3);
+	shard->add_chunk_queue(3);
+	shard->prioritise_chunk(7);
+	shard->add_chunk_queue(8, true);
+	CHECK(shard->get_stats().chunk_guilds_queued == 8);
+	shard->Run();
+
+	auto started = std::chrono::steady_clock::now();
+	while (elapsed_ms(started) < 10000) {
+		{
+			std::lock_guard<std::mutex> lock(loaded_mutex);
+			if (loaded.size() == 8) {
+				break;
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	dpp::shard_stats stats = shard->get_stats();
+	CHECK(server.wait_connections(2, 10000));
+	delete shard;
+
+	/* Three requests: the prioritised guilds first, then the rest in the order they were queued */
+	{
+		std::lock_guard<std::mutex> lock(requests_mutex);
+		CHECK(requests.size() == 3);
+		if (requests.size() == 3) {
+			CHECK(requests[0]["d"]["guild_id"] == json::array({ "8", "7", "1" }));
+			CHECK(requests[1]["d"]["guild_id"] == json::array({ "2", "3", "4" }));
+			CHECK(requests[2]["d"]["guild_id"] == json::array({ "5", "6" }));
+			std::set<std::string> nonces;
+			for (auto & r : requests) {
+				std::string nonce = r["d"]["nonce"];
+				CHECK(nonce.length() <= 32);
+				nonces.insert(nonce);
+			}
+			CHECK(nonces.size() == 3);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(loaded_mutex);
+	CHECK(loaded.size() == 8);
+	std::map<uint64_t, dpp::guild_members_loaded_t> by_guild;
+	for (auto & l : loaded) {
+		by_guild[l.guild_id] = l;
+	}
+	CHECK(by_guild.size() == 8);
+	/* The chunk with another nonce isn't counted */
+	CHECK(by_guild[8].member_count == 3);
+	CHECK(!by_guild[8].timed_out);
+	for (uint64_t id : { 1, 2, 3, 4, 5, 7 }) {
+		CHECK(by_guild[id].member_count == 5);
+		CHECK(!by_guild[id].timed_out);
+		CHECK(by_guild[id].shard_id == 0);
+	}
+	/* Guild 6 is given up on, with the members it did get, and is the last */
+	CHECK(by_guild[6].timed_out);
+	CHECK(by_guild[6].member_count == 4);
+	if (!loaded.empty()) {
+		CHECK(loaded.back().guild_id == 6);
+		CHECK(loaded.back().guilds_pending == 0);
+	}
+	CHECK(stats.chunk_guilds_loaded == 7);
+	CHECK(stats.chunk_members_loaded == 3 + 6 * 5);
+	CHECK(stats.chunk_guilds_queued == 0);
+	CHECK(stats.chunk_guilds_loading == 0);
+
+	return test_result();
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <dpp/dpp.h>
+
+/* message::build_json() as it was written before json_writer, building an nlohmann::json
+ * document and dumping it. Kept as the reference the writer is compared and timed against.
+ */
+inline std::string dom_build_json(const dpp::message &m, bool with_id = false) {
+	json j({
+		{"content", m.content},
+		{"channel_id", m.channel_id},
+		{"tts", m.tts},
+		{"nonce", m.nonce}
+	});
+	if (with_id) {
+		j["id"] = std::to_string(m.id);
+	}
+	if (m.embeds.size()) {
+		const dpp::embed &embed = m.embeds[0];
+		json e;
+		if (!embed.description.empty())
+			e["description"] = embed.description;
+		if (!embed.title.empty())
+			e["title"] = embed.title;
+		if (!embed.url.empty())
+			e["url"] = embed.url;
+		e["color"] = embed.color;
+		if (embed.footer.has_value()) {
+			e["footer"]["text"] = embed.footer->text;
+			e["footer"]["icon_url"] = embed.footer->icon_url;
+		}
+		if (embed.image.has_value()) {
+			e["image"]["url"] = embed.image->url;
+		}
+		if (embed.thumbnail.has_value()) {
+			e["thumbnail"]["url"] = embed.thumbnail->url;
+		}
+		if (embed.author.has_value()) {
+			e["author"]["name"] = embed.author->name;
+			e["author"]["url"] = embed.author->url;
+			e["author"]["icon_url"] = embed.author->icon_url;
+		}
+		if (embed.fields.size()) {
+			e["fields"] = json();
+			for (auto& field : embed.fields) {
+				json f({ {"name", field.name}, {"value", field.value}, {"inline", field.is_inline} });
+				e["fields"].push_back(f);
+			}
+		}
+		j["embed"] = e;
+	}
+	return j.dump();
+}
+
+/* A message with an embed of ten fields, with text that needs escaping */
+inline dpp::message sample_message() {
+	dpp::message m;
+	m.channel_id = 825411104208977952ULL;
+	m.id = 825411104208977953ULL;
+	m.content = "Hello \"world\" this is a message with some text\n and a newline, repeated. ";
+	dpp::embed e;
+	e.set_title("Title").set_description("An embed description that is moderately long for testing purposes").set_url("https://example.com/").set_color(0xff0000);
+	e.set_author("a", "https://example.com", "https://example.com/x.png");
+	e.set_image("https://example.com/i.png");
+	dpp::embed_footer footer;
+	footer.text = "footer";
+	footer.icon_url = "https://example.com/f.png";
+	e.footer = footer;
+	for (int i = 0; i < 10; ++i) {
+		e.add_field("Field " + std::to_string(i), "Some value text \\ with escapes\t" + std::to_string(i), i & 1);
+	}
+	m.embeds.push_back(e);
+	return m;
+}
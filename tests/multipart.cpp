@@ -0,0 +1,125 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+/* Files attached to a message are streamed from disk to the socket a chunk at a time, so
+ * uploading a large file must not raise the process's peak memory by anything like its
+ * size. The test server reads the upload a chunk at a time too, and checksums each part.
+ */
+static const size_t file_size = 48 * 1024 * 1024;
+
+static long peak_rss_mb() {
+#ifndef _WIN32
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024;
+#else
+	return 0;
+#endif
+}
+
+struct part {
+	std::string filename;
+	std::string content_type;
+	size_t size = 0;
+	uint64_t checksum = 14695981039346656037ULL;
+	std::string head;
+};
+
+static void checksum(uint64_t &hash, const char* data, size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		hash = (hash ^ (uint8_t)data[i]) * 1099511628211ULL;
+	}
+}
+
+int main() {
+	std::string path = (std::filesystem::temp_directory_path() / "dpp_multipart_test.bin").string();
+	uint64_t expected = 14695981039346656037ULL;
+	{
+		std::ofstream f(path, std::ios::binary);
+		std::string block(1024 * 1024, 0);
+		for (size_t written = 0; written < file_size; written += block.size()) {
+			for (size_t i = 0; i < block.size(); ++i) {
+				block[i] = (char)((written + i) * 131 >> 7);
+			}
+			checksum(expected, block.data(), block.size());
+			f.write(block.data(), block.size());
+		}
+	}
+
+	std::map<std::string, part> parts;
+	test_server server;
+	server.svr.Post("/api/channels/1/messages", [&parts](const httplib::Request &req, httplib::Response &res, const httplib::ContentReader &reader) {
+		std::string current;
+		reader([&](const httplib::MultipartFormData &f) {
+			current = f.name;
+			parts[current].filename = f.filename;
+			parts[current].content_type = f.content_type;
+			return true;
+		}, [&](const char* data, size_t len) {
+			part &p = parts[current];
+			p.size += len;
+			checksum(p.checksum, data, len);
+			if (p.head.size() < 256) {
+				p.head.append(data, std::min(len, 256 - p.head.size()));
+			}
+			return true;
+		});
+		res.set_content(R"({"id":"5","channel_id":"1","content":"files"})", "application/json");
+	});
+	server.start();
+
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = server.url();
+	dpp::message m;
+	m.channel_id = 1;
+	m.content = "files";
+	dpp::message_file big;
+	big.name = "big.bin";
+	big.path = path;
+	m.files.push_back(big);
+	static const char note[] = "hello";
+	dpp::message_file small;
+	small.name = "note.txt";
+	small.data = note;
+	small.size = 5;
+	small.content_type = "text/plain";
+	m.files.push_back(small);
+
+	long before = peak_rss_mb();
+	auto started = std::chrono::steady_clock::now();
+	std::promise<dpp::confirmation_callback_t> done;
+	bot.message_create(m, [&done](const dpp::confirmation_callback_t &cc) {
+		done.set_value(cc);
+	});
+	auto f = done.get_future();
+	CHECK(f.wait_for(std::chrono::seconds(60)) == std::future_status::ready);
+	dpp::confirmation_callback_t cc = f.get();
+	long after = peak_rss_mb();
+	printf("%zu MB uploaded in %.0f ms, peak RSS %ld MB -> %ld MB\n", file_size >> 20, elapsed_ms(started), before, after);
+	std::remove(path.c_str());
+
+	CHECK(cc.http_info.status == 200);
+	CHECK(std::get<dpp::message>(cc.value).id == 5);
+	CHECK(parts.size() == 3);
+	CHECK(parts["payload_json"].content_type == "application/json");
+	CHECK(json::parse(parts["payload_json"].head)["content"] == "files");
+	CHECK(parts["files[0]"].filename == "big.bin");
+	CHECK(parts["files[0]"].content_type == "application/octet-stream");
+	CHECK(parts["files[0]"].size == file_size);
+	CHECK(parts["files[0]"].checksum == expected);
+	CHECK(parts["files[1]"].filename == "note.txt");
+	CHECK(parts["files[1]"].content_type == "text/plain");
+	CHECK(parts["files[1]"].head == "hello");
+#ifndef _WIN32
+	/* Buffering the upload would need the whole file in memory at least once */
+	CHECK(after - before < 16);
+#endif
+	return test_result();
+}
@@ -0,0 +1,94 @@
+#include "test.h"
+#include <dpp/ratelimit.h>
+#include <atomic>
+
+/* dpp::rate_limiter, as the gateway uses it: 120 commands a minute with 5 kept back from each
+ * priority below rp_critical. A burst is shared out lowest priority first, each leaving its
+ * reserve for those above, and heartbeats get through however busy the member chunk requests
+ * are. wait_time() says when each priority may go again, and reset() refills the limiter.
+ */
+int main() {
+	/* A burst: rp_low may not touch the last 10 tokens, rp_normal the last 5 */
+	{
+		dpp::rate_limiter limiter(120, 60, 5);
+		int low = 0, normal = 0, critical = 0;
+		while (limiter.try_acquire(dpp::rp_low)) {
+			low++;
+		}
+		while (limiter.try_acquire(dpp::rp_normal)) {
+			normal++;
+		}
+		while (limiter.try_acquire(dpp::rp_critical)) {
+			critical++;
+		}
+		CHECK(low == 110);
+		CHECK(normal == 5);
+		CHECK(critical == 5);
+		CHECK(limiter.get_acquired(dpp::rp_low) == 110);
+		CHECK(limiter.get_acquired(dpp::rp_normal) == 5);
+		CHECK(limiter.get_acquired(dpp::rp_critical) == 5);
+		CHECK(limiter.get_refused(dpp::rp_low) == 1);
+		CHECK(limiter.get_refused(dpp::rp_normal) == 1);
+		CHECK(limiter.get_refused(dpp::rp_critical) == 1);
+	}
+
+	/* rp_low tried 200 times a second for 3 seconds, and a heartbeat every half second */
+	{
+		dpp::rate_limiter limiter(120, 60, 5);
+		std::atomic<bool> stop(false);
+		std::thread flood([&]() {
+			while (!stop) {
+				limiter.try_acquire(dpp::rp_low);
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			}
+		});
+		int heartbeats = 0;
+		for (int i = 0; i < 6; ++i) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(500));
+			heartbeats += limiter.try_acquire(dpp::rp_critical) ? 1 : 0;
+		}
+		stop = true;
+		flood.join();
+		CHECK(heartbeats == 6);
+		CHECK(limiter.get_refused(dpp::rp_low) > 0);
+		CHECK(limiter.get_refused(dpp::rp_critical) == 0);
+	}
+
+	/* wait_time(): 10 tokens a second, 2 kept back from each priority. rp_low leaves 4, so
+	 * needs one more token, a tenth of a second, while the others may go now.
+	 */
+	{
+		dpp::rate_limiter limiter(10, 1, 2);
+		CHECK(limiter.wait_time(dpp::rp_low) == 0);
+		while (limiter.try_acquire(dpp::rp_low));
+		double low_wait = limiter.wait_time(dpp::rp_low);
+		CHECK(low_wait > 0 && low_wait <= 0.1);
+		CHECK(limiter.wait_time(dpp::rp_normal) == 0);
+		CHECK(limiter.wait_time(dpp::rp_critical) == 0);
+		std::this_thread::sleep_for(std::chrono::duration<double>(low_wait + 0.005));
+		CHECK(limiter.try_acquire(dpp::rp_low));
+
+		/* Empty it, and rp_critical waits for a token of its own, the others longer */
+		while (limiter.try_acquire(dpp::rp_critical));
+		double critical_wait = limiter.wait_time(dpp::rp_critical);
+		CHECK(critical_wait > 0 && critical_wait <= 0.1);
+		CHECK(limiter.wait_time(dpp::rp_normal) > critical_wait);
+		CHECK(limiter.wait_time(dpp::rp_low) > limiter.wait_time(dpp::rp_normal));
+	}
+
+	/* reset() refills it, e.g. for a new gateway connection */
+	{
+		dpp::rate_limiter limiter(120, 60, 5);
+		while (limiter.try_acquire(dpp::rp_critical));
+		CHECK(limiter.wait_time(dpp::rp_critical) > 0);
+		limiter.reset();
+		CHECK(limiter.wait_time(dpp::rp_low) == 0);
+		int low = 0;
+		while (limiter.try_acquire(dpp::rp_low)) {
+			low++;
+		}
+		CHECK(low == 110);
+	}
+
+	return test_result();
+}
@@ -0,0 +1,124 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+/* A simulated discord REST API with per-route, per-channel rate limit buckets. Message create
+ * and edit share a bucket, as they do on discord, and reactions have their own. Each bucket
+ * allows LIMIT requests per WINDOW seconds, and anything over gets a 429. The server logs the
+ * order requests are served in, so that the checks don't depend on how fast the machine is;
+ * bench_ratelimit measures the time taken.
+ */
+const int LIMIT = 5;
+const double WINDOW = 0.5;
+
+struct sim_bucket {
+	int remaining = LIMIT;
+	std::chrono::steady_clock::time_point reset;
+};
+
+std::mutex sim_mutex;
+std::map<std::string, sim_bucket> sim_buckets;
+std::atomic<int> served(0), limited(0);
+
+/* Bucket of each request served successfully, in order */
+std::vector<std::string> served_log;
+
+static void serve(const std::string &family, const std::string &channel, httplib::Response &res) {
+	std::lock_guard<std::mutex> lock(sim_mutex);
+	served++;
+	sim_bucket &b = sim_buckets[family + "/" + channel];
+	auto now = std::chrono::steady_clock::now();
+	if (now >= b.reset) {
+		b.remaining = LIMIT;
+		b.reset = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(WINDOW));
+	}
+	double reset_after = std::chrono::duration<double>(b.reset - now).count();
+	res.set_header("X-RateLimit-Bucket", family);
+	res.set_header("X-RateLimit-Limit", std::to_string(LIMIT));
+	res.set_header("X-RateLimit-Reset-After", std::to_string(reset_after));
+	if (b.remaining == 0) {
+		limited++;
+		res.status = 429;
+		res.set_header("X-RateLimit-Remaining", "0");
+		res.set_header("Retry-After", std::to_string(reset_after));
+		res.set_content("{\"message\": \"You are being rate limited.\", \"retry_after\": " + std::to_string(reset_after) + ", \"global\": false}", "application/json");
+		return;
+	}
+	b.remaining--;
+	served_log.push_back(family + "/" + channel);
+	res.set_header("X-RateLimit-Remaining", std::to_string(b.remaining));
+	res.set_content("{}", "application/json");
+}
+
+int main() {
+	test_server server;
+	server.svr.Post(R"(/api/channels/(\d+)/messages)", [](const httplib::Request &req, httplib::Response &res) {
+		serve("messages", req.matches[1], res);
+	});
+	server.svr.Patch(R"(/api/channels/(\d+)/messages/\d+)", [](const httplib::Request &req, httplib::Response &res) {
+		serve("messages", req.matches[1], res);
+	});
+	server.svr.Put(R"(/api/channels/(\d+)/messages/\d+/reactions/[^/]+/@me)", [](const httplib::Request &req, httplib::Response &res) {
+		serve("reactions", req.matches[1], res);
+	});
+	server.start();
+
+	dpp::cluster bot("token");
+	bot.rest_url = server.url();
+
+	/* One busy channel, which uses its bucket up many times over, and nine quiet ones which
+	 * each fit in one window. The quiet channels must not wait behind the busy one.
+	 */
+	const int busy = 40, quiet = 9, per_quiet = 4;
+	const int total = busy + quiet * per_quiet * 2;
+	std::atomic<int> done(0), failed(0);
+	auto callback = [&](json&, const dpp::http_request_completion_t &http) {
+		if (http.status != 200) {
+			failed++;
+		}
+		done++;
+	};
+	for (int i = 0; i < busy; ++i) {
+		bot.post_rest("/api/channels", i % 2 ? "1000/messages" : "1000/messages/" + std::to_string(5000 + i), i % 2 ? dpp::m_post : dpp::m_patch, "{}", callback);
+	}
+	for (int c = 1; c <= quiet; ++c) {
+		std::string channel = std::to_string(1000 + c);
+		for (int i = 0; i < per_quiet; ++i) {
+			bot.post_rest("/api/channels", channel + "/messages", dpp::m_post, "{}", callback);
+			bot.post_rest("/api/channels", channel + "/messages/" + std::to_string(6000 + i) + "/reactions/%F0%9F%91%8D/@me", dpp::m_put, "", callback);
+		}
+	}
+	auto started = std::chrono::steady_clock::now();
+	while (done < total && elapsed_ms(started) < 30000) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	printf("requests=%d sent=%d 429s=%d\n", total, served.load(), limited.load());
+
+	CHECK(done == total);
+	CHECK(failed == 0);
+	/* Buckets are counted down before replies arrive, so only a route's first requests, before
+	 * its shared bucket hash is known, can overrun it.
+	 */
+	CHECK(limited * 20 <= served);
+
+	/* The quiet channels were all served while the busy one was still on the first half of its
+	 * requests, rather than after them: they only waited on their own buckets.
+	 */
+	std::lock_guard<std::mutex> lock(sim_mutex);
+	CHECK(served_log.size() == (size_t)total);
+	int busy_served = 0, busy_before_quiet_done = 0;
+	for (auto & bucket : served_log) {
+		if (bucket == "messages/1000") {
+			busy_served++;
+		} else {
+			busy_before_quiet_done = busy_served;
+		}
+	}
+	printf("busy channel requests served before the quiet channels were done: %d of %d\n", busy_before_quiet_done, busy);
+	CHECK(busy_served == busy);
+	CHECK(busy_before_quiet_done < busy / 2);
+	return test_result();
+}
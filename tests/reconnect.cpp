@@ -0,0 +1,265 @@
+#include "test.h"
+#include "gateway_server.h"
+#include <dpp/dpp.h>
+#include <dpp/discordclient.h>
+#include <future>
+#include <memory>
+#include <random>
+
+/* A shard's reconnects, against a local gateway. Close codes which would only fail again stop it
+ * reconnecting, and those which end the session make it identify afresh rather than resume. Failed
+ * attempts back off exponentially until a heartbeat is acknowledged. An invalid session (op 9) is
+ * waited out by Tick(), while the shard carries on reading. Gateway host lookups are cached, and
+ * dropped when none of their addresses could be connected to.
+ */
+
+/** A shard connected to a gateway of its own, which runs the given script for each connection.
+ * The script must end the shard's last connection with a fatal close code, so that the shard
+ * stops and can be deleted. The shards share a cluster, and each keeps the port it was made with.
+ */
+struct shard_test {
+	gateway_server server;
+	DiscordClient* shard;
+
+	shard_test(dpp::cluster &bot, std::function<void(gateway_connection &c)> script) {
+		server.script = script;
+		server.start();
+		bot.gateway_host = "127.0.0.1";
+		bot.gateway_port = server.port_str();
+		shard = new DiscordClient(&bot, 0, 1, "token");
+		shard->Run();
+	}
+
+	~shard_test() {
+		delete shard;
+	}
+};
+
+/** Milliseconds between two time points */
+static double between(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+	return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+/** Returns the next IDENTIFY (op 2) or RESUME (op 6) from the shard, or null */
+static json next_session(gateway_connection &c, int timeout_ms) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	while (std::chrono::steady_clock::now() < deadline) {
+		json j = c.receive((int)between(std::chrono::steady_clock::now(), deadline) + 1);
+		if (j.is_null() || j["op"] == 2 || j["op"] == 6) {
+			return j;
+		}
+	}
+	return json();
+}
+
+int main() {
+	dpp::cluster bot("token", 0, 1);
+
+	/* Close codes after which reconnecting can't succeed end the shard's connection for good */
+	{
+		std::vector<uint16_t> fatal = { 4004, 4010, 4011, 4012, 4013, 4014 };
+		std::vector<std::unique_ptr<shard_test>> tests;
+		for (uint16_t code : fatal) {
+			tests.emplace_back(new shard_test(bot, [code](gateway_connection &c) {
+				c.hello();
+				c.expect(2, 2000);
+				c.close(c.number == 1 ? code : 4004);
+			}));
+		}
+		/* Any other code is followed by a reconnect, within a second as it is the first */
+		shard_test control(bot, [](gateway_connection &c) {
+			c.hello();
+			c.expect(2, 2000);
+			c.close(c.number == 1 ? 4000 : 4004);
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+		for (size_t i = 0; i < fatal.size(); ++i) {
+			CHECK(tests[i]->server.connections == 1);
+			CHECK(tests[i]->shard->get_stats().reconnects == 0);
+		}
+		CHECK(control.server.connections == 2);
+		CHECK(control.shard->get_stats().reconnects == 1);
+	}
+
+	/* After 4007 (invalid seq) or 4009 (session timed out) the shard identifies again; after
+	 * other codes it resumes the session READY gave it.
+	 */
+	{
+		std::vector<uint16_t> codes = { 4007, 4009, 4000 };
+		std::vector<std::shared_ptr<std::promise<json>>> sessions;
+		std::vector<std::unique_ptr<shard_test>> tests;
+		for (uint16_t code : codes) {
+			auto session = std::make_shared<std::promise<json>>();
+			sessions.push_back(session);
+			tests.emplace_back(new shard_test(bot, [code, session](gateway_connection &c) {
+				c.hello();
+				if (c.number == 1) {
+					c.expect(2, 2000);
+					c.ready("abc");
+					c.close(code);
+				} else {
+					if (c.number == 2) {
+						session->set_value(next_session(c, 3000));
+					}
+					c.close(4004);
+				}
+			}));
+		}
+		for (size_t i = 0; i < codes.size(); ++i) {
+			auto f = sessions[i]->get_future();
+			CHECK(f.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+			json j = f.get();
+			if (codes[i] == 4000) {
+				CHECK(j["op"] == 6);
+				CHECK(j["d"]["session_id"] == "abc");
+				CHECK(j["d"]["seq"] == 1);
+			} else {
+				CHECK(j["op"] == 2);
+			}
+		}
+	}
+
+	/* The backoff: up to a second for the first attempt, unless discord asked for the reconnect,
+	 * then between half and all of 2^attempts seconds, up to a minute.
+	 */
+	{
+		std::mt19937 rng(1);
+		CHECK(DiscordClient::ReconnectDelay(0, true, rng) == 0);
+		for (uint32_t attempts : { 0U, 1U, 2U, 3U, 4U, 5U, 6U, 7U, 16U, 17U, 1000U, 0xffffffffU }) {
+			double cap = attempts == 0 ? 1 : std::min(60.0, (double)(1ULL << std::min(attempts, 16U)));
+			double low = 1e9, high = 0;
+			for (int i = 0; i < 1000; ++i) {
+				double d = DiscordClient::ReconnectDelay(attempts, false, rng);
+				low = std::min(low, d);
+				high = std::max(high, d);
+			}
+			CHECK(low >= (attempts == 0 ? 0 : cap / 2));
+			CHECK(high <= cap);
+			/* Spread over the range, not bunched together */
+			CHECK(high - low > cap * 0.4);
+		}
+	}
+
+	/* Failed connections back off, and an acknowledged heartbeat resets it. Two connections
+	 * closed without a heartbeat put the third reconnect at 1 to 2 seconds; one which heartbeats
+	 * takes the next back to under a second, where without the ACK it would be 2 to 4.
+	 */
+	{
+		shard_test test(bot, [](gateway_connection &c) {
+			if (c.number < 3) {
+				c.hello();
+				c.expect(2, 2000);
+				c.close(4000);
+			} else if (c.number == 3) {
+				c.hello(100);
+				c.expect(2, 2000);
+				c.expect(1, 1000);
+				/* Give the ACK time to be read */
+				c.receive(200);
+				c.close(4000);
+			} else {
+				c.close(4004);
+			}
+		});
+		CHECK(test.server.wait_connections(4, 10000));
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		double first = between(test.server.closed(1), test.server.opened(2));
+		double second = between(test.server.closed(2), test.server.opened(3));
+		double after_ack = between(test.server.closed(3), test.server.opened(4));
+		CHECK(first < 1500);
+		CHECK(second >= 950 && second < 2500);
+		CHECK(after_ack < 1900);
+		dpp::shard_stats stats = test.shard->get_stats();
+		CHECK(stats.reconnects == 3);
+		CHECK(stats.heartbeat_acks >= 1);
+	}
+
+	/* op 9: the shard waits 1 to 5 seconds before starting a session again, reading all the
+	 * while, so that a heartbeat request (op 1) is answered straight away. It identifies again if
+	 * the session is gone, and resumes it if discord says it may.
+	 */
+	{
+		std::vector<bool> resumable = { false, true };
+		std::vector<std::shared_ptr<std::promise<std::pair<double, double>>>> waits;
+		std::vector<std::shared_ptr<std::promise<json>>> sessions;
+		std::vector<std::unique_ptr<shard_test>> tests;
+		for (bool resume : resumable) {
+			auto wait = std::make_shared<std::promise<std::pair<double, double>>>();
+			auto session = std::make_shared<std::promise<json>>();
+			waits.push_back(wait);
+			sessions.push_back(session);
+			tests.emplace_back(new shard_test(bot, [resume, wait, session](gateway_connection &c) {
+				if (c.number == 1) {
+					c.hello();
+					c.expect(2, 2000);
+					c.ready("abc");
+					auto invalid = std::chrono::steady_clock::now();
+					c.send({{"op", 9}, {"d", resume}});
+					c.send({{"op", 1}, {"d", nullptr}});
+					json heartbeat = c.expect(1, 1000);
+					double heartbeat_ms = heartbeat.is_null() ? -1 : elapsed_ms(invalid);
+					json j = next_session(c, 7000);
+					wait->set_value({ heartbeat_ms, j.is_null() ? -1 : elapsed_ms(invalid) });
+					session->set_value(j);
+				}
+				c.close(4004);
+			}));
+		}
+		for (size_t i = 0; i < resumable.size(); ++i) {
+			auto w = waits[i]->get_future();
+			auto s = sessions[i]->get_future();
+			CHECK(w.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+			auto ms = w.get();
+			json j = s.get();
+			CHECK(ms.first >= 0 && ms.first < 500);
+			CHECK(ms.second >= 950 && ms.second < 5500);
+			CHECK(j["op"] == (resumable[i] ? 6 : 2));
+		}
+	}
+
+	/* Host lookups are cached per host and port, and a host none of whose addresses could be
+	 * connected to is looked up again next time.
+	 */
+	{
+		gateway_server server;
+		server.start();
+		uint64_t before = SSLClient::DNSLookups();
+		{
+			SSLClient first("localhost", server.port_str());
+		}
+		{
+			SSLClient second("localhost", server.port_str());
+		}
+		CHECK(SSLClient::DNSLookups() == before + 1);
+
+		/* A port nothing listens on */
+		int s = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		bind(s, (struct sockaddr*)&addr, sizeof(addr));
+		socklen_t len = sizeof(addr);
+		getsockname(s, (struct sockaddr*)&addr, &len);
+		std::string closed_port = std::to_string(ntohs(addr.sin_port));
+		::close(s);
+		for (int i = 0; i < 2; ++i) {
+			bool thrown = false;
+			try {
+				SSLClient refused("localhost", closed_port);
+			}
+			catch (const std::runtime_error &) {
+				thrown = true;
+			}
+			CHECK(thrown);
+		}
+		CHECK(SSLClient::DNSLookups() == before + 3);
+
+		/* The port which was connected to is still cached */
+		{
+			SSLClient third("localhost", server.port_str());
+		}
+		CHECK(SSLClient::DNSLookups() == before + 3);
+	}
+
+	return test_result();
+}
@@ -0,0 +1,99 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+/* dpp::small_function holds callables of up to its capacity inline, so wrapping the lambdas
+ * REST methods pass to post_rest() doesn't allocate. Larger ones go on the heap, and either
+ * kind must copy, move and destroy its callable exactly as std::function would.
+ */
+static std::atomic<size_t> allocations(0);
+
+void* operator new(size_t size) {
+	allocations++;
+	void* p = malloc(size ? size : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+int main() {
+	json j;
+	dpp::http_request_completion_t http;
+	http.status = 204;
+
+	/* A lambda like the ones cluster methods build: the caller's callback and an id */
+	uint64_t got = 0;
+	dpp::command_completion_event_t callback = [&got](const dpp::confirmation_callback_t &cc) {
+		got = cc.http_info.status;
+	};
+	dpp::snowflake channel_id = 825411104208977952;
+	size_t before = allocations;
+	dpp::json_encode_t f = [channel_id, callback](json &, const dpp::http_request_completion_t &h) {
+		callback(dpp::confirmation_callback_t("confirmation", dpp::confirmation(), h));
+	};
+	dpp::json_encode_t moved = std::move(f);
+	CHECK(allocations == before);
+	CHECK(!f);
+	CHECK(moved);
+	moved(j, http);
+	CHECK(got == 204);
+
+	/* Copies share nothing with the original */
+	auto count = std::make_shared<int>(0);
+	dpp::json_encode_t counter = [count](json &, const dpp::http_request_completion_t &) { ++*count; };
+	dpp::json_encode_t copy = counter;
+	CHECK(count.use_count() == 3);
+	counter(j, http);
+	copy(j, http);
+	CHECK(*count == 2);
+	counter = nullptr;
+	CHECK(!counter);
+	CHECK(count.use_count() == 2);
+
+	/* Too large to hold inline: allocated, but still copied and moved correctly */
+	char big[128] = "large";
+	std::string seen;
+	dpp::json_encode_t large = [big, &seen](json &, const dpp::http_request_completion_t &) { seen = big; };
+	dpp::json_encode_t large_copy = large;
+	dpp::json_encode_t large_moved = std::move(large);
+	large_copy(j, http);
+	CHECK(seen == "large");
+	seen.clear();
+	large_moved(j, http);
+	CHECK(seen == "large");
+	large_moved = large_copy;
+	seen.clear();
+	large_moved(j, http);
+	CHECK(seen == "large");
+
+	/* Empty std::functions and null function pointers give an empty function */
+	CHECK(!dpp::json_encode_t(std::function<void(json&, const dpp::http_request_completion_t&)>()));
+	CHECK(!dpp::json_encode_t((void(*)(json&, const dpp::http_request_completion_t&))nullptr));
+	CHECK(!dpp::json_encode_t());
+
+	/* Every callable has been destroyed along with the functions holding it */
+	{
+		auto owned = std::make_shared<int>(0);
+		{
+			dpp::json_encode_t a = [owned](json &, const dpp::http_request_completion_t &) {};
+			dpp::json_encode_t b = a;
+			dpp::json_encode_t c = std::move(b);
+			CHECK(owned.use_count() == 3);
+		}
+		CHECK(owned.use_count() == 1);
+	}
+
+	return test_result();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+/* Shared by the tests: a check macro which counts failures, and a local stand-in for discord's
+ * REST API. httplib is configured as it is in the library, which includes the same header.
+ */
+#define CPPHTTPLIB_OPENSSL_SUPPORT
+#include <dpp/httplib.h>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <chrono>
+
+static int failures = 0;
+
+/** Report a failed check, and carry on so that one run reports every failure */
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		++failures; \
+	} \
+} while (0)
+
+/** Exit status for main(), 0 if every check passed */
+inline int test_result() {
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed\n", failures);
+	}
+	return failures ? 1 : 0;
+}
+
+/** A plain HTTP server on a free local port, run on its own thread. Add handlers to svr, then
+ * call start(), and point a cluster at it with cluster::rest_url = url().
+ */
+class test_server {
+	std::thread runner;
+public:
+	httplib::Server svr;
+	int port = 0;
+
+	void start() {
+		/* Without this, replies written in two parts wait on a delayed ACK */
+		svr.set_tcp_nodelay(true);
+		port = svr.bind_to_any_port("127.0.0.1");
+		runner = std::thread([this]() { svr.listen_after_bind(); });
+		while (!svr.is_running()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	std::string url() const {
+		return "http://127.0.0.1:" + std::to_string(port);
+	}
+
+	~test_server() {
+		svr.stop();
+		if (runner.joinable()) {
+			runner.join();
+		}
+	}
+};
+
+/** Returns milliseconds elapsed since a steady clock time point */
+inline double elapsed_ms(std::chrono::steady_clock::time_point since) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
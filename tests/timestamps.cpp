@@ -0,0 +1,55 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <dpp/discordevents.h>
+#include <random>
+#include <ctime>
+#ifdef _WIN32
+#define timegm _mkgmtime
+#endif
+
+/* SnowflakeNotNull and TimestampNotNull parse in place. Their results are compared with
+ * std::stoull and with timegm() on random values, whatever the local timezone.
+ */
+int main() {
+	std::mt19937_64 rng(27);
+
+	for (int i = 0; i < 100000; ++i) {
+		uint64_t id = rng() >> (rng() % 64);
+		json j = { { "id", std::to_string(id) } };
+		CHECK(SnowflakeNotNull(&j, "id") == id);
+	}
+	json odd = { { "number", 5 }, { "null", nullptr }, { "empty", "" }, { "text", "abc" } };
+	for (const char* key : { "number", "null", "empty", "text", "missing" }) {
+		CHECK(SnowflakeNotNull(&odd, key) == 0);
+	}
+
+	char text[64];
+	for (int i = 0; i < 100000; ++i) {
+		tm t = {};
+		t.tm_year = 70 + rng() % 130;
+		t.tm_mon = rng() % 12;
+		t.tm_mday = 1 + rng() % 28;
+		t.tm_hour = rng() % 24;
+		t.tm_min = rng() % 60;
+		t.tm_sec = rng() % 60;
+		int offset_minutes = (int)(rng() % (14 * 60 * 2 + 1)) - 14 * 60;
+		int offset = std::abs(offset_minutes);
+		snprintf(text, sizeof(text), "%04d-%02d-%02dT%02d:%02d:%02d.%06d%c%02d:%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec,
+			(int)(rng() % 1000000), offset_minutes < 0 ? '-' : '+', offset / 60, offset % 60);
+		json j = { { "timestamp", text } };
+		time_t expected = timegm(&t) - offset_minutes * 60;
+		if (TimestampNotNull(&j, "timestamp") != expected) {
+			printf("%s: got %lld, expected %lld\n", text, (long long)TimestampNotNull(&j, "timestamp"), (long long)expected);
+			CHECK(!"timestamp differs");
+			break;
+		}
+	}
+	json known = { { "a", "2021-04-16T14:21:07.123000+00:00" }, { "b", "2021-04-16T14:21:07+02:00" }, { "c", "2021-04-16T14:21:07" }, { "d", "yesterday" }, { "e", nullptr } };
+	CHECK(TimestampNotNull(&known, "a") == 1618582867);
+	CHECK(TimestampNotNull(&known, "b") == 1618582867 - 7200);
+	CHECK(TimestampNotNull(&known, "c") == 1618582867);
+	CHECK(TimestampNotNull(&known, "d") == 0);
+	CHECK(TimestampNotNull(&known, "e") == 0);
+
+	return test_result();
+}
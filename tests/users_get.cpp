@@ -0,0 +1,69 @@
+#include "test.h"
+#include <dpp/dpp.h>
+#include <future>
+
+/* cluster::users_get() fetches the users it doesn't have as a batch, and reports the first
+ * failure among them, including a request which never got a reply at all. When every user is
+ * cached, it completes at once with status 200.
+ */
+static dpp::confirmation_callback_t users_get(const std::string &url, const std::vector<dpp::snowflake> &ids) {
+	dpp::cluster bot("token", 0, 0);
+	bot.rest_url = url;
+	bot.request_retries = 0;
+	std::promise<dpp::confirmation_callback_t> done;
+	bot.users_get(ids, [&done](const dpp::confirmation_callback_t &cc) {
+		done.set_value(cc);
+	});
+	auto f = done.get_future();
+	if (f.wait_for(std::chrono::seconds(10)) != std::future_status::ready) {
+		CHECK(!"users_get never called back");
+		return dpp::confirmation_callback_t();
+	}
+	return f.get();
+}
+
+int main() {
+	test_server server;
+	server.svr.Get(R"(/api/users/(\d+))", [](const httplib::Request &req, httplib::Response &res) {
+		std::string id = req.matches[1];
+		if (id == "404") {
+			res.status = 404;
+			res.set_content(R"({"message":"Unknown User","code":10013})", "application/json");
+			return;
+		}
+		res.set_content(R"({"id":")" + id + R"(","username":"user)" + id + R"(","discriminator":"0001"})", "application/json");
+	});
+	server.start();
+
+	auto ok = users_get(server.url(), { 101, 102, 101 });
+	CHECK(ok.http_info.error == dpp::h_success);
+	CHECK(ok.http_info.status == 200);
+	const dpp::user_map &users = std::get<dpp::user_map>(ok.value);
+	CHECK(users.size() == 2);
+	CHECK(users.count(101) && users.at(101).username == "user101");
+
+	/* One missing user is reported, and the others are still returned */
+	auto missing = users_get(server.url(), { 103, 404, 104 });
+	CHECK(missing.http_info.status == 404);
+	CHECK(std::get<dpp::user_map>(missing.value).size() == 2);
+
+	/* Every user cached: nothing is fetched, and the result is still a success */
+	for (dpp::snowflake id : { 106, 107 }) {
+		dpp::user* u = new dpp::user();
+		u->id = id;
+		u->username = "cached" + std::to_string(id);
+		dpp::get_user_cache()->store(u);
+	}
+	auto cached = users_get("http://127.0.0.1:1", { 106, 107 });
+	CHECK(cached.http_info.error == dpp::h_success);
+	CHECK(cached.http_info.status == 200);
+	CHECK(std::get<dpp::user_map>(cached.value).size() == 2);
+	CHECK(std::get<dpp::user_map>(cached.value).at(107).username == "cached107");
+
+	/* Nothing listening: no reply, so status 0 with the error set, never success */
+	auto unreachable = users_get("http://127.0.0.1:1", { 105 });
+	CHECK(unreachable.http_info.error != dpp::h_success);
+	CHECK(std::get<dpp::user_map>(unreachable.value).empty());
+
+	return test_result();
+}